@@ -1,424 +1,13 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdint.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
-#include <pthread.h>
 
-// ============================================================================
-// OS/2 API Type Definitions
-// ============================================================================
-
-typedef uint32_t APIRET;
-typedef uint32_t HFILE;
-typedef uint32_t ULONG;
-typedef uint16_t USHORT;
-typedef uint8_t  UCHAR;
-typedef char*    PSZ;
-typedef const char* PCSZ;
-typedef void*    PVOID;
-typedef HFILE*   PHFILE;
-typedef ULONG*   PULONG;
-typedef USHORT*  PUSHORT;
-typedef int32_t  LONG;
-
-#define APIENTRY
-
-// OS/2 Error Codes
-#define NO_ERROR                0
-#define ERROR_INVALID_FUNCTION  1
-#define ERROR_FILE_NOT_FOUND    2
-#define ERROR_PATH_NOT_FOUND    3
-#define ERROR_TOO_MANY_OPEN_FILES 4
-#define ERROR_ACCESS_DENIED     5
-#define ERROR_INVALID_HANDLE    6
-#define ERROR_NOT_ENOUGH_MEMORY 8
-#define ERROR_INVALID_PARAMETER 87
-#define ERROR_NEGATIVE_SEEK     131
-
-// DosOpen flags
-#define OPEN_ACTION_FAIL_IF_EXISTS     0x0000
-#define OPEN_ACTION_OPEN_IF_EXISTS     0x0001
-#define OPEN_ACTION_REPLACE_IF_EXISTS  0x0002
-#define OPEN_ACTION_FAIL_IF_NEW        0x0000
-#define OPEN_ACTION_CREATE_IF_NEW      0x0010
-
-#define OPEN_FLAGS_NOINHERIT           0x0080
-#define OPEN_FLAGS_FAIL_ON_ERROR       0x2000
-#define OPEN_FLAGS_WRITE_THROUGH       0x4000
-
-#define OPEN_SHARE_DENYREADWRITE       0x0010
-#define OPEN_SHARE_DENYWRITE           0x0020
-#define OPEN_SHARE_DENYREAD            0x0030
-#define OPEN_SHARE_DENYNONE            0x0040
-
-#define OPEN_ACCESS_READONLY           0x0000
-#define OPEN_ACCESS_WRITEONLY          0x0001
-#define OPEN_ACCESS_READWRITE          0x0002
-
-// File attributes
-#define FILE_NORMAL    0x0000
-#define FILE_READONLY  0x0001
-#define FILE_HIDDEN    0x0002
-#define FILE_SYSTEM    0x0004
-#define FILE_DIRECTORY 0x0010
-#define FILE_ARCHIVED  0x0020
-
-// DosOpen actions
-#define FILE_EXISTED   1
-#define FILE_CREATED   2
-#define FILE_TRUNCATED 3
-
-// Seek origins
-#define FILE_BEGIN   0
-#define FILE_CURRENT 1
-#define FILE_END     2
-
-// ============================================================================
-// Handle Management
-// ============================================================================
-
-#define MAX_HANDLES 256
-
-typedef struct {
-int linux_fd;      // Linux file descriptor
-int in_use;        // Is this handle slot in use?
-char path[256];    // File path for debugging
-} handle_entry_t;
-
-static handle_entry_t handle_table[MAX_HANDLES];
-static int handle_table_initialized = 0;
-
-void init_handle_table() {
-if (handle_table_initialized) return;
-
-for (int i = 0; i < MAX_HANDLES; i++) {
-    handle_table[i].linux_fd = -1;
-    handle_table[i].in_use = 0;
-    handle_table[i].path[0] = '\0';
-}
-
-// Reserve standard handles
-handle_table[0].linux_fd = 0; // stdin
-handle_table[0].in_use = 1;
-handle_table[1].linux_fd = 1; // stdout
-handle_table[1].in_use = 1;
-handle_table[2].linux_fd = 2; // stderr
-handle_table[2].in_use = 1;
-
-handle_table_initialized = 1;
-
-}
-
-HFILE allocate_handle(int linux_fd, const char *path) {
-for (int i = 3; i < MAX_HANDLES; i++) {
-if (!handle_table[i].in_use) {
-handle_table[i].linux_fd = linux_fd;
-handle_table[i].in_use = 1;
-strncpy(handle_table[i].path, path ? path : "", sizeof(handle_table[i].path) - 1);
-return i;
-}
-}
-return (HFILE)-1;
-}
-
-int get_linux_fd(HFILE handle) {
-if (handle >= MAX_HANDLES || !handle_table[handle].in_use) {
-return -1;
-}
-return handle_table[handle].linux_fd;
-}
-
-void free_handle(HFILE handle) {
-if (handle < MAX_HANDLES && handle_table[handle].in_use) {
-handle_table[handle].in_use = 0;
-handle_table[handle].linux_fd = -1;
-handle_table[handle].path[0] = '\0';
-}
-}
-
-// ============================================================================
-// Error Code Translation
-// ============================================================================
-
-APIRET errno_to_os2(int err) {
-switch (err) {
-case 0: return NO_ERROR;
-case ENOENT: return ERROR_FILE_NOT_FOUND;
-case EACCES: return ERROR_ACCESS_DENIED;
-case EINVAL: return ERROR_INVALID_PARAMETER;
-case EMFILE: return ERROR_TOO_MANY_OPEN_FILES;
-case ENOMEM: return ERROR_NOT_ENOUGH_MEMORY;
-case EBADF: return ERROR_INVALID_HANDLE;
-default: return ERROR_INVALID_FUNCTION;
-}
-}
-
-// ============================================================================
-// OS/2 API Implementations
-// ============================================================================
-
-/**
-
-- DosOpen - Open or create a file
-  */
-  APIRET APIENTRY DosOpen(
-  PCSZ    pszFileName,    // File path name
-  PHFILE  pHandle,        // Handle returned
-  PULONG  pulAction,      // Action taken
-  ULONG   ulFileSize,     // File size if created
-  ULONG   ulAttribute,    // File attributes
-  ULONG   ulOpenFlags,    // Open flags
-  ULONG   ulOpenMode,     // Open mode
-  PVOID   peaop2          // Extended attributes (unused)
-  ) {
-  init_handle_table();
-  
-  printf("[DosOpen] Opening: %s\n", pszFileName);
-  
-  // Translate open flags
-  int flags = 0;
-  int mode = 0644;
-  
-  // Determine access mode
-  int access = ulOpenMode & 0x0003;
-  if (access == OPEN_ACCESS_READONLY) {
-  flags = O_RDONLY;
-  } else if (access == OPEN_ACCESS_WRITEONLY) {
-  flags = O_WRONLY;
-  } else if (access == OPEN_ACCESS_READWRITE) {
-  flags = O_RDWR;
-  }
-  
-  // Determine creation flags
-  int open_action = ulOpenFlags & 0x00FF;
-  
-  if (open_action & OPEN_ACTION_CREATE_IF_NEW) {
-  flags |= O_CREAT;
-  if (!(open_action & OPEN_ACTION_OPEN_IF_EXISTS)) {
-  flags |= O_EXCL;
-  }
-  }
-  
-  if (open_action & OPEN_ACTION_REPLACE_IF_EXISTS) {
-  flags |= O_TRUNC;
-  }
-  
-  // Open the file
-  int fd = open(pszFileName, flags, mode);
-  
-  if (fd < 0) {
-  printf("[DosOpen] Failed: %s\n", strerror(errno));
-  return errno_to_os2(errno);
-  }
-  
-  // Allocate OS/2 handle
-  HFILE os2_handle = allocate_handle(fd, pszFileName);
-  if (os2_handle == (HFILE)-1) {
-  close(fd);
-  return ERROR_TOO_MANY_OPEN_FILES;
-  }
-  
-  *pHandle = os2_handle;
-  
-  // Determine action taken
-  struct stat st;
-  if (fstat(fd, &st) == 0) {
-  if (flags & O_CREAT) {
-  *pulAction = (flags & O_EXCL) ? FILE_CREATED : FILE_EXISTED;
-  } else {
-  *pulAction = (flags & O_TRUNC) ? FILE_TRUNCATED : FILE_EXISTED;
-  }
-  }
-  
-  printf("[DosOpen] Success: handle=%d, fd=%d, action=%d\n",
-  os2_handle, fd, *pulAction);
-  
-  return NO_ERROR;
-  }
-
-/**
-
-- DosRead - Read from a file
-  */
-  APIRET APIENTRY DosRead(
-  HFILE   hFile,          // File handle
-  PVOID   pBuffer,        // Buffer
-  ULONG   ulLength,       // Bytes to read
-  PULONG  pulBytesRead    // Bytes actually read
-  ) {
-  int fd = get_linux_fd(hFile);
-  if (fd < 0) {
-  return ERROR_INVALID_HANDLE;
-  }
-  
-  ssize_t bytes = read(fd, pBuffer, ulLength);
-  
-  if (bytes < 0) {
-  printf("[DosRead] Failed: %s\n", strerror(errno));
-  *pulBytesRead = 0;
-  return errno_to_os2(errno);
-  }
-  
-  *pulBytesRead = bytes;
-  printf("[DosRead] Read %ld bytes from handle %d\n", bytes, hFile);
-  
-  return NO_ERROR;
-  }
-
-/**
-
-- DosWrite - Write to a file
-  */
-  APIRET APIENTRY DosWrite(
-  HFILE   hFile,          // File handle
-  PVOID   pBuffer,        // Buffer
-  ULONG   ulLength,       // Bytes to write
-  PULONG  pulBytesWritten // Bytes actually written
-  ) {
-  int fd = get_linux_fd(hFile);
-  if (fd < 0) {
-  return ERROR_INVALID_HANDLE;
-  }
-  
-  ssize_t bytes = write(fd, pBuffer, ulLength);
-  
-  if (bytes < 0) {
-  printf("[DosWrite] Failed: %s\n", strerror(errno));
-  *pulBytesWritten = 0;
-  return errno_to_os2(errno);
-  }
-  
-  *pulBytesWritten = bytes;
-  printf("[DosWrite] Wrote %ld bytes to handle %d\n", bytes, hFile);
-  
-  return NO_ERROR;
-  }
-
-/**
-
-- DosClose - Close a file
-  */
-  APIRET APIENTRY DosClose(HFILE hFile) {
-  int fd = get_linux_fd(hFile);
-  if (fd < 0) {
-  return ERROR_INVALID_HANDLE;
-  }
-  
-  if (close(fd) < 0) {
-  return errno_to_os2(errno);
-  }
-  
-  free_handle(hFile);
-  printf("[DosClose] Closed handle %d\n", hFile);
-  
-  return NO_ERROR;
-  }
-
-/**
-
-- DosSetFilePtr - Seek in a file
-  */
-  APIRET APIENTRY DosSetFilePtr(
-  HFILE   hFile,          // File handle
-  LONG    lOffset,        // Offset
-  ULONG   ulOrigin,       // Origin (FILE_BEGIN, FILE_CURRENT, FILE_END)
-  PULONG  pulNewPtr       // New file pointer
-  ) {
-  int fd = get_linux_fd(hFile);
-  if (fd < 0) {
-  return ERROR_INVALID_HANDLE;
-  }
-  
-  int whence;
-  switch (ulOrigin) {
-  case FILE_BEGIN:   whence = SEEK_SET; break;
-  case FILE_CURRENT: whence = SEEK_CUR; break;
-  case FILE_END:     whence = SEEK_END; break;
-  default: return ERROR_INVALID_PARAMETER;
-  }
-  
-  off_t new_pos = lseek(fd, lOffset, whence);
-  
-  if (new_pos < 0) {
-  return errno_to_os2(errno);
-  }
-  
-  if (pulNewPtr) {
-  *pulNewPtr = new_pos;
-  }
-  
-  printf("[DosSetFilePtr] Seek: handle=%d, offset=%ld, new_pos=%ld\n",
-  hFile, lOffset, new_pos);
-  
-  return NO_ERROR;
-  }
-
-/**
-
-- DosDelete - Delete a file
-  */
-  APIRET APIENTRY DosDelete(PCSZ pszFileName) {
-  printf("[DosDelete] Deleting: %s\n", pszFileName);
-  
-  if (unlink(pszFileName) < 0) {
-  return errno_to_os2(errno);
-  }
-  
-  return NO_ERROR;
-  }
-
-/**
-
-- DosExit - Exit the process
-  */
-  void APIENTRY DosExit(ULONG ulAction, ULONG ulResult) {
-  printf("[DosExit] Exiting with code %d\n", ulResult);
-  exit(ulResult);
-  }
-
-/**
-
-- DosSleep - Sleep for specified milliseconds
-  */
-  APIRET APIENTRY DosSleep(ULONG ulMilliseconds) {
-  printf("[DosSleep] Sleeping for %d ms\n", ulMilliseconds);
-  usleep(ulMilliseconds * 1000);
-  return NO_ERROR;
-  }
-
-/**
-
-- DosAllocMem - Allocate memory
-  */
-  APIRET APIENTRY DosAllocMem(
-  PVOID*  ppBaseAddress,  // Base address returned
-  ULONG   ulSize,         // Size to allocate
-  ULONG   ulFlags         // Allocation flags
-  ) {
-  void *mem = malloc(ulSize);
-  if (!mem) {
-  return ERROR_NOT_ENOUGH_MEMORY;
-  }
-  
-  *ppBaseAddress = mem;
-  printf("[DosAllocMem] Allocated %d bytes at %p\n", ulSize, mem);
-  
-  return NO_ERROR;
-  }
-
-/**
-
-- DosFreeMem - Free memory
-  */
-  APIRET APIENTRY DosFreeMem(PVOID pBaseAddress) {
-  printf("[DosFreeMem] Freeing memory at %p\n", pBaseAddress);
-  free(pBaseAddress);
-  return NO_ERROR;
-  }
+#include "os2_runtime.h"
 
 // ============================================================================
 // API Export Table
@@ -437,6 +26,10 @@ static api_export_t api_exports[] = {
 { "DosClose",       DosClose },
 { "DosSetFilePtr",  DosSetFilePtr },
 { "DosDelete",      DosDelete },
+{ "DosDupHandle",   DosDupHandle },
+{ "DosCreatePipe",  DosCreatePipe },
+{ "DosCopy",        DosCopy },
+{ "DosResetBuffer", DosResetBuffer },
 
 // Process
 { "DosExit",        DosExit },
@@ -445,6 +38,46 @@ static api_export_t api_exports[] = {
 // Memory
 { "DosAllocMem",    DosAllocMem },
 { "DosFreeMem",     DosFreeMem },
+{ "DosSetMem",      DosSetMem },
+{ "DosQueryMem",    DosQueryMem },
+{ "DosSubSetMem",   DosSubSetMem },
+{ "DosSubAllocMem", DosSubAllocMem },
+{ "DosSubFreeMem",  DosSubFreeMem },
+{ "DosSubUnsetMem", DosSubUnsetMem },
+
+// Threads
+{ "DosCreateThread",  DosCreateThread },
+{ "DosResumeThread",  DosResumeThread },
+{ "DosWaitThread",    DosWaitThread },
+{ "DosGetInfoBlocks", DosGetInfoBlocks },
+{ "DosSetPriority",   DosSetPriority },
+{ "DosAllocThreadLocalMemory", DosAllocThreadLocalMemory },
+{ "DosFreeThreadLocalMemory",  DosFreeThreadLocalMemory },
+
+// Semaphores
+{ "DosCreateEventSem",   DosCreateEventSem },
+{ "DosOpenEventSem",     DosOpenEventSem },
+{ "DosCloseEventSem",    DosCloseEventSem },
+{ "DosPostEventSem",     DosPostEventSem },
+{ "DosWaitEventSem",     DosWaitEventSem },
+{ "DosResetEventSem",    DosResetEventSem },
+{ "DosCreateMutexSem",   DosCreateMutexSem },
+{ "DosOpenMutexSem",     DosOpenMutexSem },
+{ "DosCloseMutexSem",    DosCloseMutexSem },
+{ "DosRequestMutexSem",  DosRequestMutexSem },
+{ "DosReleaseMutexSem",  DosReleaseMutexSem },
+{ "DosCreateMuxWaitSem", DosCreateMuxWaitSem },
+{ "DosCloseMuxWaitSem",  DosCloseMuxWaitSem },
+{ "DosWaitMuxWaitSem",   DosWaitMuxWaitSem },
+
+// Queues
+{ "DosCreateQueue", DosCreateQueue },
+{ "DosOpenQueue",   DosOpenQueue },
+{ "DosCloseQueue",  DosCloseQueue },
+{ "DosWriteQueue",  DosWriteQueue },
+{ "DosReadQueue",   DosReadQueue },
+{ "DosPurgeQueue",  DosPurgeQueue },
+{ "DosQueryQueue",  DosQueryQueue },
 
 { NULL, NULL }
 
@@ -455,14 +88,15 @@ static api_export_t api_exports[] = {
 - Resolve an OS/2 API function by name
   */
   void* resolve_os2_api(const char *name) {
+  TRACE_ENTER(TRACE_RESOLVE, name);
   for (int i = 0; api_exports[i].name != NULL; i++) {
   if (strcmp(api_exports[i].name, name) == 0) {
-  printf("[API] Resolved: %s -> %p\n", name, api_exports[i].function);
+  TRACE_POINT(NO_ERROR, (uintptr_t)api_exports[i].function, 0, 0);
   return api_exports[i].function;
   }
   }
   
-  printf("[API] Warning: Unresolved function: %s\n", name);
+  TRACE_POINT(ERROR_INVALID_FUNCTION, 0, 0, 0);
   return NULL;
   }
 
@@ -472,10 +106,30 @@ static api_export_t api_exports[] = {
 
 #ifdef TEST_API
 
+static TID test_thread_tids[4];
+static uint32_t test_tls_word;
+
+// Records its TID, and stores it in its own copy of thread 1's TLS word
+static void APIENTRY test_thread(ULONG index) {
+PTIB tib;
+DosGetInfoBlocks(&tib, NULL);
+test_thread_tids[index] = tib->tib_ptib2->tib2_ultid;
+tls_area[test_thread_tids[index]][test_tls_word] = test_thread_tids[index];
+}
+
+// Posts event 'hev' once the test is waiting on it
+static void APIENTRY test_post(ULONG hev) {
+usleep(10000);
+DosPostEventSem(hev);
+}
+
 int main() {
 printf("OS/2 API Emulation Layer Test\n");
 printf("==============================\n\n");
 
+snprintf(g_trace_path, sizeof(g_trace_path), "%s", "os2_emulator.trace");
+trace_init(getenv("OS2_TRACE"));
+if (g_trace_mask) atexit(trace_flush);
 init_handle_table();
 
 // Test file operations
@@ -511,7 +165,7 @@ if (rc == NO_ERROR) {
 
 printf("Test 3: Memory allocation\n");
 void *mem;
-rc = DosAllocMem(&mem, 1024, 0);
+rc = DosAllocMem(&mem, 1024, PAG_COMMIT | PAG_READ | PAG_WRITE);
 if (rc == NO_ERROR) {
     strcpy(mem, "Memory test");
     printf("Memory content: %s\n", (char*)mem);
@@ -519,6 +173,206 @@ if (rc == NO_ERROR) {
     printf("Success!\n\n");
 }
 
+printf("Test 4: Handle table growth\n");
+static HFILE handles[1000];
+int ok = 1;
+for (int i = 0; i < 1000; i++) {
+    handles[i] = allocate_handle(1000 + i, "test.txt");
+    ok &= handles[i] != (HFILE)-1 && get_linux_fd(handles[i]) == 1000 + i;
+}
+HFILE closed = handles[500];
+ok &= free_handle(closed) == 1500 && get_linux_fd(closed) < 0;
+handles[500] = allocate_handle(2000, "test.txt");
+ok &= handles[500] == closed && get_linux_fd(closed) == 2000;
+for (int i = 0; i < 1000; i++) free_handle(handles[i]);
+ok &= DosClose(closed) == ERROR_INVALID_HANDLE && get_linux_fd(1) == 1;
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 5: Reserve and commit memory\n");
+char *reserved;
+ULONG size = 0, flags;
+ok = DosAllocMem((PVOID*)&reserved, 0x20000, PAG_READ | PAG_WRITE) == NO_ERROR;
+ok = ok && DosQueryMem(reserved, &size, &flags) == NO_ERROR &&
+     size == 0x20000 && flags == (PAG_READ | PAG_WRITE | PAG_BASE);
+ok = ok && DosSetMem(reserved + 0x1000, 0x1000, PAG_COMMIT | PAG_DEFAULT) == NO_ERROR;
+if (ok) {
+    strcpy(reserved + 0x1000, "Committed");
+    size = 0;
+    DosQueryMem(reserved + 0x1000, &size, &flags);
+    ok = size == 0x1000 && flags == (PAG_READ | PAG_WRITE | PAG_COMMIT) &&
+         DosSetMem(reserved + 0x1000, 0x1000, PAG_COMMIT | PAG_DEFAULT) == ERROR_ACCESS_DENIED &&
+         DosSetMem(reserved + 0x1000, 0x1000, PAG_DECOMMIT) == NO_ERROR &&
+         DosFreeMem(reserved + 0x1000) == ERROR_INVALID_ADDRESS &&
+         DosFreeMem(reserved) == NO_ERROR;
+}
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 6: Sub-allocation\n");
+char *heap, *small, *large;
+ok = DosAllocMem((PVOID*)&heap, 0x10000, PAG_COMMIT | PAG_READ | PAG_WRITE) == NO_ERROR &&
+     DosSubSetMem(heap, DOSSUB_INIT, 0x10000) == NO_ERROR &&
+     DosSubAllocMem(heap, (PVOID*)&small, 20) == NO_ERROR &&
+     DosSubAllocMem(heap, (PVOID*)&large, 4000) == NO_ERROR;
+if (ok) {
+    strcpy(small, "Sub-allocated");
+    ok = large >= small + 24 && DosSubFreeMem(heap, small, 20) == NO_ERROR &&
+         DosSubAllocMem(heap, (PVOID*)&small, 17) == NO_ERROR && large >= small + 24 &&
+         DosSubFreeMem(heap, heap, 8) == ERROR_DOSSUB_OVERLAP &&
+         DosSubUnsetMem(heap) == NO_ERROR && DosFreeMem(heap) == NO_ERROR;
+}
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 7: Threads\n");
+PTIB tib;
+PULONG tls;
+TID tids[4];
+ok = DosGetInfoBlocks(&tib, NULL) == NO_ERROR && tib->tib_ptib2->tib2_ultid == 1 &&
+     DosAllocThreadLocalMemory(1, &tls) == NO_ERROR;
+test_tls_word = ok ? tls - tls_area[1] : 0;
+for (int i = 0; ok && i < 4; i++) {
+    ok = DosCreateThread(&tids[i], test_thread, i, CREATE_READY, 8192) == NO_ERROR;
+}
+for (int i = 0; ok && i < 4; i++) {
+    ok = DosWaitThread(&tids[i], DCWW_WAIT) == NO_ERROR && test_thread_tids[i] == tids[i] &&
+         tls_area[tids[i]][test_tls_word] == tids[i];
+}
+if (!ok || DosFreeThreadLocalMemory(tls) != NO_ERROR) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 8: Semaphores\n");
+HEV hev;
+HMTX hmtx;
+HMUX hmux;
+ULONG posts = 0, user = 0;
+SEMRECORD rec[1];
+ok = DosCreateEventSem(NULL, &hev, 0, FALSE) == NO_ERROR &&
+     DosCreateMutexSem(NULL, &hmtx, 0, FALSE) == NO_ERROR;
+rec[0].hsemCur = hev;
+rec[0].ulUser = 7;
+ok = ok && DosCreateMuxWaitSem(NULL, &hmux, 1, rec, DCMW_WAIT_ANY) == NO_ERROR &&
+     DosWaitMuxWaitSem(hmux, SEM_IMMEDIATE_RETURN, &user) == ERROR_TIMEOUT;
+ok = ok && DosCreateThread(&tids[0], test_post, hev, CREATE_READY, 8192) == NO_ERROR &&
+     DosWaitMuxWaitSem(hmux, SEM_INDEFINITE_WAIT, &user) == NO_ERROR && user == 7 &&
+     DosWaitThread(&tids[0], DCWW_WAIT) == NO_ERROR;
+ok = ok && DosWaitEventSem(hev, SEM_IMMEDIATE_RETURN) == NO_ERROR &&
+     DosResetEventSem(hev, &posts) == NO_ERROR && posts == 1 &&
+     DosRequestMutexSem(hmtx, SEM_INDEFINITE_WAIT) == NO_ERROR &&
+     DosReleaseMutexSem(hmtx) == NO_ERROR && DosReleaseMutexSem(hmtx) == ERROR_NOT_OWNER;
+ok = ok && DosCloseEventSem(hev) == ERROR_SEM_BUSY && DosCloseMuxWaitSem(hmux) == NO_ERROR &&
+     DosCloseEventSem(hev) == NO_ERROR && DosCloseMutexSem(hmtx) == NO_ERROR;
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 9: Queues\n");
+HQUEUE hq;
+REQUESTDATA req;
+ULONG cb, count = 0;
+PVOID data;
+BYTE priority;
+char qname[64];
+snprintf(qname, sizeof(qname), "\\QUEUES\\OS2EMU\\%d", (int)getpid());
+ok = DosCreateQueue(&hq, QUE_PRIORITY, qname) == NO_ERROR &&
+     DosWriteQueue(hq, 1, 5, "first", 0) == NO_ERROR &&
+     DosWriteQueue(hq, 2, 6, "second", 15) == NO_ERROR &&
+     DosQueryQueue(hq, &count) == NO_ERROR && count == 2;
+ok = ok && DosReadQueue(hq, &req, &cb, &data, 0, DCWW_WAIT, &priority, 0) == NO_ERROR &&
+     req.ulData == 2 && cb == 6 && priority == 15 && strcmp(data, "second") == 0 &&
+     DosReadQueue(hq, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == NO_ERROR && req.ulData == 1 &&
+     DosReadQueue(hq, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == ERROR_QUE_EMPTY;
+ok = ok && DosCloseQueue(hq) == NO_ERROR && DosCloseQueue(hq) == ERROR_QUE_INVALID_HANDLE;
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 10: Pipes\n");
+HFILE rd, wr, dupped = 0xFFFFFFFF;
+ok = DosCreatePipe(&rd, &wr, 0) == NO_ERROR && DosDupHandle(wr, &dupped) == NO_ERROR &&
+     DosClose(wr) == NO_ERROR && DosWrite(dupped, "pipe", 4, &bytesWritten) == NO_ERROR &&
+     bytesWritten == 4 && DosClose(dupped) == NO_ERROR;
+ok = ok && DosRead(rd, buffer, sizeof(buffer), &bytesRead) == NO_ERROR && bytesRead == 4 &&
+     memcmp(buffer, "pipe", 4) == 0 && DosRead(rd, buffer, sizeof(buffer), &bytesRead) == NO_ERROR &&
+     bytesRead == 0 && DosClose(rd) == NO_ERROR;
+ok = ok && DosCopy("test.txt", "test_copy.txt", DCPY_EXISTING) == NO_ERROR &&
+     DosCopy("test.txt", "test_copy.txt", 0) == ERROR_ACCESS_DENIED && DosDelete("test_copy.txt") == NO_ERROR;
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 11: Asynchronous file I/O\n");
+io_wanted = 1;
+ULONG pos = 0;
+ok = DosOpen("test_ring.txt", &hFile, &action, 0, FILE_NORMAL,
+             OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS, OPEN_ACCESS_READWRITE, NULL) == NO_ERROR;
+for (int i = 0; ok && i < 20000; i++) {
+    ok = DosWrite(hFile, "0123456789", 10, &bytesWritten) == NO_ERROR && bytesWritten == 10;
+}
+ok = ok && DosSetFilePtr(hFile, 0, FILE_END, &pos) == NO_ERROR && pos == 200000 &&
+     DosSetFilePtr(hFile, 99995, FILE_BEGIN, &pos) == NO_ERROR &&
+     DosRead(hFile, buffer, 10, &bytesRead) == NO_ERROR && bytesRead == 10 &&
+     memcmp(buffer, "5678901234", 10) == 0 && DosClose(hFile) == NO_ERROR &&
+     DosDelete("test_ring.txt") == NO_ERROR;
+io_wanted = 0;
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 12: Write-behind buffers\n");
+struct stat st;
+ok = DosOpen("test_wb.txt", &hFile, &action, 0, FILE_NORMAL,
+             OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS, OPEN_ACCESS_WRITEONLY, NULL) == NO_ERROR &&
+     DosWrite(hFile, "line\n", 5, &bytesWritten) == NO_ERROR && stat("test_wb.txt", &st) == 0 && st.st_size == 0 &&
+     DosResetBuffer(hFile) == NO_ERROR && stat("test_wb.txt", &st) == 0 && st.st_size == 5 &&
+     DosClose(hFile) == NO_ERROR;
+ok = ok && DosOpen("test_wb.txt", &hFile, &action, 0, FILE_NORMAL, OPEN_ACTION_REPLACE_IF_EXISTS,
+                   OPEN_ACCESS_WRITEONLY | OPEN_FLAGS_WRITE_THROUGH, NULL) == NO_ERROR &&
+     DosWrite(hFile, "line\n", 5, &bytesWritten) == NO_ERROR && stat("test_wb.txt", &st) == 0 && st.st_size == 5 &&
+     DosClose(hFile) == NO_ERROR && DosDelete("test_wb.txt") == NO_ERROR;
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
+printf("Test 13: OS/2 file names\n");
+char cwd[PATH_MAX], name[PATH_MAX + 16];
+int fd = open("Test_Case.Txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+if (fd >= 0) close(fd);
+ok = fd >= 0 && DosOpen(".\\TEST_CASE.TXT", &hFile, &action, 0, FILE_NORMAL, OPEN_ACTION_OPEN_IF_EXISTS,
+                        OPEN_ACCESS_READONLY, NULL) == NO_ERROR && DosClose(hFile) == NO_ERROR;
+ok = ok && getcwd(cwd, sizeof(cwd)) && DosCopy("test_case.txt", "TEST_CASE.TXT", 0) == ERROR_ACCESS_DENIED;
+snprintf(name, sizeof(name), "C:%s\\test_case.TXT", cwd);
+ok = ok && DosDelete(name) == NO_ERROR && access("Test_Case.Txt", F_OK) < 0 &&
+     DosDelete("Q:\\TEST_CASE.TXT") == ERROR_INVALID_DRIVE;
+if (!ok) {
+    printf("Failed!\n");
+    return 1;
+}
+printf("Success!\n\n");
+
 printf("All tests passed!\n");
 return 0;
 
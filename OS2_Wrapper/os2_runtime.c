@@ -0,0 +1,3803 @@
+// OS/2 API runtime: everything the DOSCALLS entry points need, built into
+// os2run, os2bench and os2_emulator alike. See os2_runtime.h.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#if defined(__x86_64__)
+#include <asm/prctl.h>
+#endif
+
+#include "os2_runtime.h"
+
+// ============================================================================
+// Handle Management
+// ============================================================================
+//
+// OS/2 handles index a two-level table: a fixed directory of chunk
+// pointers, with chunks allocated as handles run out and never moved or
+// freed, so a lookup is two loads and needs no lock. Free handles are
+// chained through their entries (LIFO), making allocate and free O(1)
+// under a short spinlock. Paths are only kept when OS2_TRACE_HANDLES is set.
+
+handle_entry_t *handle_chunks[HANDLE_CHUNKS];
+static uint32_t handle_limit = 0;           // Handles covered by chunks
+static uint32_t handle_free = HANDLE_NONE;  // Head of the free-list
+static int handle_lock = 0;
+static int handle_trace = 0;
+static int handle_table_initialized = 0;
+
+static void handle_table_lock(void) {
+while (__atomic_exchange_n(&handle_lock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&handle_lock, __ATOMIC_RELAXED)) { }
+}
+}
+
+static void handle_table_unlock(void) {
+__atomic_store_n(&handle_lock, 0, __ATOMIC_RELEASE);
+}
+
+// Add one chunk of free handles. Called with the lock held and the
+// free-list empty; the new handles are chained lowest first.
+static int grow_handle_table(void) {
+uint32_t index = handle_limit >> HANDLE_CHUNK_BITS;
+if (index >= HANDLE_CHUNKS) return -1;
+
+handle_entry_t *chunk = calloc(HANDLE_CHUNK, sizeof(handle_entry_t));
+if (!chunk) return -1;
+
+for (uint32_t i = 0; i < HANDLE_CHUNK; i++) {
+    chunk[i].linux_fd = -1;
+    chunk[i].next_free = i + 1 < HANDLE_CHUNK ? handle_limit + i + 1 : HANDLE_NONE;
+}
+
+__atomic_store_n(&handle_chunks[index], chunk, __ATOMIC_RELEASE);
+handle_free = handle_limit;
+handle_limit += HANDLE_CHUNK;
+return 0;
+}
+
+static void wb_init(void);
+
+void init_handle_table() {
+if (__atomic_load_n(&handle_table_initialized, __ATOMIC_ACQUIRE)) return;
+
+int first = 0;
+handle_table_lock();
+if (!handle_table_initialized) {
+    first = 1;
+    const char *trace = getenv("OS2_TRACE_HANDLES");
+    handle_trace = trace && *trace && strcmp(trace, "0") != 0;
+
+    if (grow_handle_table() == 0) {
+        for (int i = 0; i < HANDLE_STD; i++) {
+            handle_chunks[0][i].linux_fd = i;
+        }
+        handle_free = HANDLE_STD;
+    }
+    __atomic_store_n(&handle_table_initialized, 1, __ATOMIC_RELEASE);
+}
+handle_table_unlock();
+if (first) wb_init();
+}
+
+HFILE allocate_handle(int linux_fd, const char *path) {
+init_handle_table();
+char *copy = handle_trace && path ? strdup(path) : NULL;
+
+handle_table_lock();
+if (handle_free == HANDLE_NONE && grow_handle_table() < 0) {
+    handle_table_unlock();
+    free(copy);
+    return (HFILE)-1;
+}
+
+HFILE handle = handle_free;
+handle_entry_t *entry = handle_entry(handle);
+handle_free = entry->next_free;
+entry->path = copy;
+__atomic_store_n(&entry->linux_fd, linux_fd, __ATOMIC_RELEASE);
+handle_table_unlock();
+
+if (handle_trace) {
+    printf("[Handle] %u -> fd %d (%s)\n", handle, linux_fd, path ? path : "");
+}
+return handle;
+}
+
+// Put 'linux_fd' in 'handle', which must not be open: DosDupHandle onto a
+// given handle. Returns -1 if it is open or out of range. Finding the
+// handle on the free-list is a walk, but only this needs it.
+int claim_handle(HFILE handle, int linux_fd, const char *path) {
+init_handle_table();
+char *copy = handle_trace && path ? strdup(path) : NULL;
+
+handle_table_lock();
+while (handle >= handle_limit) {
+    // New chunks go in front of the handles already free
+    uint32_t head = handle_free;
+    handle_free = HANDLE_NONE;
+    if (grow_handle_table() < 0) {
+        handle_free = head;
+        break;
+    }
+    handle_entry(handle_limit - 1)->next_free = head;
+}
+handle_entry_t *entry = handle_entry(handle);
+if (!entry || entry->linux_fd >= 0) {
+    handle_table_unlock();
+    free(copy);
+    return -1;
+}
+if (handle >= HANDLE_STD) {
+    uint32_t *link = &handle_free;
+    while (*link != handle) link = &handle_entry(*link)->next_free;
+    *link = entry->next_free;
+}
+entry->path = copy;
+__atomic_store_n(&entry->linux_fd, linux_fd, __ATOMIC_RELEASE);
+handle_table_unlock();
+
+if (handle_trace) {
+    printf("[Handle] %u -> fd %d (%s)\n", handle, linux_fd, path ? path : "");
+}
+return 0;
+}
+
+int get_linux_fd(HFILE handle) {
+handle_entry_t *entry = handle_entry(handle);
+return entry ? __atomic_load_n(&entry->linux_fd, __ATOMIC_ACQUIRE) : -1;
+}
+
+// Release a handle and return the fd it held, or -1 if it was not open.
+// Only one of several racing closers gets the fd.
+int free_handle(HFILE handle) {
+handle_table_lock();
+handle_entry_t *entry = handle_entry(handle);
+int fd = entry ? entry->linux_fd : -1;
+char *path = NULL;
+
+if (fd >= 0) {
+    path = entry->path;
+    entry->path = NULL;
+    __atomic_store_n(&entry->linux_fd, -1, __ATOMIC_RELEASE);
+    if (handle >= HANDLE_STD) {
+        entry->next_free = handle_free;
+        handle_free = handle;
+    }
+}
+handle_table_unlock();
+
+if (handle_trace && fd >= 0) {
+    printf("[Handle] %u closed (%s)\n", handle, path ? path : "");
+}
+free(path);
+return fd;
+}
+
+APIRET errno_to_os2(int err) {
+switch (err) {
+case 0: return NO_ERROR;
+case ENOENT: return ERROR_FILE_NOT_FOUND;
+case EACCES: return ERROR_ACCESS_DENIED;
+case EINVAL: return ERROR_INVALID_PARAMETER;
+case EMFILE: return ERROR_TOO_MANY_OPEN_FILES;
+case ENOMEM: return ERROR_NOT_ENOUGH_MEMORY;
+case EBADF: return ERROR_INVALID_HANDLE;
+case EPIPE: return ERROR_BROKEN_PIPE;
+default: return ERROR_INVALID_FUNCTION;
+}
+}
+
+// ============================================================================
+// Asynchronous File I/O
+// ============================================================================
+//
+// With OS2_IO_URING set, regular files DosOpen opens keep their file
+// pointer in user space and are read and written by position through an
+// io_uring ring, set up with the raw system calls. DosWrites smaller than
+// IO_BLOCK are gathered into a block that goes to the kernel when full
+// (or on a seek elsewhere, a read or DosClose) while the other one fills;
+// an error in writing it behind is returned by the next call on the
+// handle. Small DosReads are served from a block, and reading on from
+// where the last block ended reads the block after it ahead. Without the
+// ring, and for pipes, devices and duplicated handles (which share their
+// pointer), DosRead and DosWrite make one read or write each, taking no
+// lock. A handle on the ring has a lock of its own, so its calls follow
+// one another; the ring itself has a short one, never held in a system
+// call that waits. One thread at a time sleeps in io_uring_enter for
+// completions and reaps them; the others wait for it to.
+
+#define IO_BLOCK        (64u << 10)         // Write-behind and read-ahead unit
+#define IO_RING_ENTRIES 64
+
+enum { IO_IDLE, IO_QUEUED, IO_DONE };       // io_block_t.state
+
+typedef struct {
+uint8_t *data;
+uint64_t offset;        // File offset of data[0]
+uint32_t len;           // Bytes gathered (write) or read (read)
+int write;
+int state;              // IO_DONE: completed, result not yet looked at
+int result;             // Bytes or -errno
+struct iovec iov;
+} io_block_t;
+
+struct io_file {
+pthread_mutex_t lock;   // Held by the call on the handle
+uint64_t pos;           // The file pointer
+int mode;               // O_RDONLY, O_WRONLY or O_RDWR
+int error;              // errno of a failed write behind
+int filling;            // write[filling] gathers, the other may be in flight
+int current;            // read[current] is read from, the other read ahead
+io_block_t write[2];
+io_block_t read[2];
+};
+
+static struct {
+int fd;
+uint32_t entries;
+uint32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+uint32_t *cq_head, *cq_tail, *cq_mask;
+struct io_uring_sqe *sqes;
+struct io_uring_cqe *cqes;
+uint32_t unsubmitted;   // Queued since the last io_uring_enter
+uint32_t inflight;      // Queued and not yet reaped
+int waiting;            // A thread is asleep in io_uring_enter
+} io_ring = { .fd = -1 };
+
+static pthread_mutex_t io_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_ring_reaped = PTHREAD_COND_INITIALIZER;
+static pthread_once_t io_once = PTHREAD_ONCE_INIT;
+int io_wanted = -1;                         // OS2_IO_URING, read on first DosOpen
+static int io_ready = 0;                    // 1 once the ring is up, -1 if it cannot be
+static int io_files = 0;                    // Handles with an io_file_t
+
+static int io_ring_setup(void) {
+struct io_uring_params p;
+memset(&p, 0, sizeof(p));
+int fd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &p);
+if (fd < 0) return -1;
+
+size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+if (single && cq_size > sq_size) sq_size = cq_size;
+
+uint8_t *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+uint8_t *cq = single ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 fd, IORING_OFF_CQ_RING);
+void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    if (sq != MAP_FAILED) munmap(sq, sq_size);
+    if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_size);
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    close(fd);
+    return -1;
+}
+
+io_ring.fd = fd;
+io_ring.entries = p.sq_entries;
+io_ring.sq_head = (uint32_t *)(sq + p.sq_off.head);
+io_ring.sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+io_ring.sq_mask = (uint32_t *)(sq + p.sq_off.ring_mask);
+io_ring.sq_array = (uint32_t *)(sq + p.sq_off.array);
+io_ring.cq_head = (uint32_t *)(cq + p.cq_off.head);
+io_ring.cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+io_ring.cq_mask = (uint32_t *)(cq + p.cq_off.ring_mask);
+io_ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+io_ring.sqes = sqes;
+return 0;
+}
+
+// The ring functions below run under io_ring_lock. Only the thread that
+// sleeps in the kernel reaps while it is asleep: another one taking the
+// completion it waits for would leave it asleep.
+static int io_reap(void) {
+uint32_t head = *io_ring.cq_head;
+uint32_t tail = __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE);
+int reaped = tail - head;
+for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &io_ring.cqes[head & *io_ring.cq_mask];
+    io_block_t *b = (io_block_t *)(uintptr_t)cqe->user_data;
+    b->result = cqe->res;
+    __atomic_store_n(&b->state, IO_DONE, __ATOMIC_RELEASE);
+    io_ring.inflight--;
+}
+__atomic_store_n(io_ring.cq_head, head, __ATOMIC_RELEASE);
+return reaped;
+}
+
+// Hand what is queued to the kernel, without waiting for any of it
+static void io_submit(void) {
+while (io_ring.unsubmitted) {
+    int n = syscall(__NR_io_uring_enter, io_ring.fd, io_ring.unsubmitted, 0, 0, NULL, 0);
+    if (n >= 0) {
+        io_ring.unsubmitted -= n;
+        return;
+    }
+    if (errno != EINTR) return;             // EAGAIN, EBUSY: the next io_sleep submits
+}
+}
+
+// Reap what has completed or, if nothing has, wait until something does:
+// asleep in the kernel with io_ring_lock released, or for the thread that
+// is. The caller looks again at what it waits for. Returns an errno.
+static int io_sleep(void) {
+if (io_ring.waiting) {
+    pthread_cond_wait(&io_ring_reaped, &io_ring_lock);
+    return 0;
+}
+if (io_reap()) return 0;
+
+io_ring.waiting = 1;
+uint32_t submit = io_ring.unsubmitted;
+pthread_mutex_unlock(&io_ring_lock);
+int n = syscall(__NR_io_uring_enter, io_ring.fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+int err = n < 0 ? errno : 0;
+if (err == EAGAIN || err == EBUSY) sched_yield();
+pthread_mutex_lock(&io_ring_lock);
+if (n > 0) io_ring.unsubmitted -= n;
+io_ring.waiting = 0;
+io_reap();
+pthread_cond_broadcast(&io_ring_reaped);
+return err == EINTR || err == EAGAIN || err == EBUSY ? 0 : err;
+}
+
+// Queue b for reading or writing at b->offset, and with 'submit' hand it
+// to the kernel. The completion ring holds twice the submission ring, so
+// waiting here for a free entry keeps it from overflowing.
+static void io_queue(io_block_t *b, int fd, int submit) {
+pthread_mutex_lock(&io_ring_lock);
+while (io_ring.inflight == io_ring.entries) io_sleep();
+
+uint32_t tail = *io_ring.sq_tail;
+uint32_t index = tail & *io_ring.sq_mask;
+struct io_uring_sqe *sqe = &io_ring.sqes[index];
+memset(sqe, 0, sizeof(*sqe));
+b->iov.iov_base = b->data;
+b->iov.iov_len = b->write ? b->len : IO_BLOCK;
+sqe->opcode = b->write ? IORING_OP_WRITEV : IORING_OP_READV;
+sqe->fd = fd;
+sqe->off = b->offset;
+sqe->addr = (uintptr_t)&b->iov;
+sqe->len = 1;
+sqe->user_data = (uintptr_t)b;
+io_ring.sq_array[index] = index;
+b->state = IO_QUEUED;
+__atomic_store_n(io_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+io_ring.unsubmitted++;
+io_ring.inflight++;
+if (submit) io_submit();
+pthread_mutex_unlock(&io_ring_lock);
+}
+
+// Wait for b and take its result: a read block gets its length, a write
+// block is emptied, finishing a short write with pwrite. Returns an errno.
+static int io_wait(io_block_t *b, int fd) {
+if (__atomic_load_n(&b->state, __ATOMIC_ACQUIRE) == IO_QUEUED) {
+    int err = 0;
+    pthread_mutex_lock(&io_ring_lock);
+    io_submit();
+    while (!err && __atomic_load_n(&b->state, __ATOMIC_ACQUIRE) == IO_QUEUED) err = io_sleep();
+    pthread_mutex_unlock(&io_ring_lock);
+    if (err) return err;
+}
+if (b->state == IO_IDLE) return 0;
+b->state = IO_IDLE;
+
+if (!b->write) {
+    b->len = b->result > 0 ? b->result : 0;
+    return b->result < 0 ? -b->result : 0;
+}
+int64_t done = b->result;
+while (done >= 0 && done < b->len) {
+    ssize_t n = pwrite(fd, b->data + done, b->len - done, b->offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    done = n > 0 ? done + n : n < 0 ? -errno : -ENOSPC;
+}
+b->len = 0;
+return done < 0 ? (int)-done : 0;
+}
+
+static int io_alloc(io_block_t pair[2], int write) {
+if (pair[0].data) return 0;
+uint8_t *data = malloc(2 * IO_BLOCK);
+if (!data) return -1;
+for (int i = 0; i < 2; i++) {
+    pair[i].data = data + i * IO_BLOCK;
+    pair[i].write = write;
+}
+return 0;
+}
+
+// Hand the block being filled to the kernel and start on the other. The
+// other may still be on its way; it is waited for before it is filled.
+static void io_write_behind(io_file_t *f, int fd) {
+io_block_t *b = &f->write[f->filling];
+if (!b->len || b->state != IO_IDLE) return;
+io_queue(b, fd, 1);
+f->filling ^= 1;
+}
+
+// Write out everything gathered and wait for it; errors land in f->error
+static void io_flush(io_file_t *f, int fd) {
+io_write_behind(f, fd);
+for (int i = 0; i < 2; i++) {
+    int err = io_wait(&f->write[i], fd);
+    if (err && !f->error) f->error = err;
+}
+}
+
+static int io_take_error(io_file_t *f) {
+int err = f->error;
+f->error = 0;
+return err;
+}
+
+// Forget what has been read, once the read ahead is back
+static void io_drop_reads(io_file_t *f, int fd) {
+for (int i = 0; i < 2; i++) {
+    io_wait(&f->read[i], fd);
+    f->read[i].len = 0;
+}
+}
+
+static ssize_t io_file_read(io_file_t *f, int fd, uint8_t *buf, size_t n) {
+if (f->mode == O_WRONLY) {
+    errno = EBADF;
+    return -1;
+}
+io_flush(f, fd);
+int err = io_take_error(f);
+if (!err && io_alloc(f->read, 0) < 0) err = ENOMEM;
+if (err) {
+    errno = err;
+    return -1;
+}
+
+size_t done = 0;
+while (done < n) {
+    io_block_t *cur = &f->read[f->current];
+    io_block_t *next = &f->read[f->current ^ 1];
+    if (f->pos >= cur->offset && f->pos < cur->offset + cur->len) {
+        size_t c = cur->offset + cur->len - f->pos;
+        if (c > n - done) c = n - done;
+        memcpy(buf + done, cur->data + (f->pos - cur->offset), c);
+        done += c;
+        f->pos += c;
+        continue;
+    }
+
+    // Carrying on from the last block: the next may have been read ahead
+    int sequential = f->pos == cur->offset + cur->len;
+    if (next->state != IO_IDLE || next->len) {
+        if (io_wait(next, fd) == 0 && f->pos >= next->offset && f->pos < next->offset + next->len) {
+            f->current ^= 1;
+            if (next->len == IO_BLOCK) {
+                cur->offset = next->offset + IO_BLOCK;
+                cur->len = 0;
+                io_queue(cur, fd, 1);
+            }
+            continue;
+        }
+        next->len = 0;
+    }
+
+    // Large reads go straight to the caller's buffer
+    if (n - done >= IO_BLOCK) {
+        ssize_t r = pread(fd, buf + done, n - done, f->pos);
+        if (r < 0 && !done) return -1;
+        if (r > 0) {
+            done += r;
+            f->pos += r;
+        }
+        break;
+    }
+
+    // Read this block, and the one after it ahead in the same system call
+    cur->offset = f->pos;
+    cur->len = 0;
+    io_queue(cur, fd, 0);
+    if (sequential) {
+        next->offset = f->pos + IO_BLOCK;
+        io_queue(next, fd, 0);
+    }
+    err = io_wait(cur, fd);
+    if (err) {
+        if (done) break;
+        errno = err;
+        return -1;
+    }
+    if (!cur->len) break;                   // End of file
+}
+return done;
+}
+
+static ssize_t io_file_write(io_file_t *f, int fd, const uint8_t *buf, size_t n) {
+int err = f->mode == O_RDONLY ? EBADF : io_take_error(f);
+if (!err && n < IO_BLOCK && io_alloc(f->write, 1) < 0) err = ENOMEM;
+if (err) {
+    errno = err;
+    return -1;
+}
+if (f->read[0].len || f->read[1].len || f->read[0].state || f->read[1].state) io_drop_reads(f, fd);
+
+io_block_t *b = &f->write[f->filling];
+if (b->len && b->state == IO_IDLE && f->pos != b->offset + b->len) io_write_behind(f, fd);
+
+if (n >= IO_BLOCK) {
+    io_flush(f, fd);
+    if ((err = io_take_error(f))) {
+        errno = err;
+        return -1;
+    }
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = pwrite(fd, buf + done, n - done, f->pos);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            if (!done) return -1;
+            break;
+        }
+        done += w;
+        f->pos += w;
+    }
+    return done;
+}
+
+for (size_t done = 0; done < n; ) {
+    b = &f->write[f->filling];
+    err = io_wait(b, fd);
+    if (err && !f->error) f->error = err;
+    if (!b->len) b->offset = f->pos;
+    size_t c = IO_BLOCK - b->len;
+    if (c > n - done) c = n - done;
+    memcpy(b->data + b->len, buf + done, c);
+    b->len += c;
+    done += c;
+    f->pos += c;
+    if (b->len == IO_BLOCK) io_write_behind(f, fd);
+}
+return n;
+}
+
+static io_file_t *io_get(HFILE hFile) {
+handle_entry_t *entry = handle_entry(hFile);
+return entry ? __atomic_load_n(&entry->io, __ATOMIC_ACQUIRE) : NULL;
+}
+
+static void io_sync_all(void) {
+for (HFILE h = 0; h < handle_limit && __atomic_load_n(&io_files, __ATOMIC_RELAXED); h++) {
+    io_file_t *f = io_get(h);
+    if (!f) continue;
+    pthread_mutex_lock(&f->lock);
+    io_flush(f, get_linux_fd(h));
+    pthread_mutex_unlock(&f->lock);
+}
+}
+
+static void io_init(void) {
+io_ready = io_ring_setup() == 0 ? 1 : -1;
+if (io_ready > 0) atexit(io_sync_all);
+}
+
+static void io_attach(HFILE hFile, int fd) {
+if (io_wanted < 0) {
+    const char *uring = getenv("OS2_IO_URING");
+    io_wanted = uring && *uring && strcmp(uring, "0") != 0;
+}
+struct stat st;
+if (!io_wanted || io_ready < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) return;
+
+pthread_once(&io_once, io_init);
+handle_entry_t *entry = handle_entry(hFile);
+io_file_t *f = io_ready > 0 && entry ? calloc(1, sizeof(io_file_t)) : NULL;
+if (!f) return;
+pthread_mutex_init(&f->lock, NULL);
+f->mode = fcntl(fd, F_GETFL) & O_ACCMODE;
+__atomic_fetch_add(&io_files, 1, __ATOMIC_RELAXED);
+__atomic_store_n(&entry->io, f, __ATOMIC_RELEASE);
+}
+
+// Take hFile off the ring before DosClose or DosDupHandle: what was
+// written goes out and Linux's file pointer is set to ours. Returns the
+// errno of a write behind that failed, or 0.
+static int io_detach(HFILE hFile) {
+handle_entry_t *entry = handle_entry(hFile);
+io_file_t *f = entry ? __atomic_exchange_n(&entry->io, NULL, __ATOMIC_ACQ_REL) : NULL;
+if (!f) return 0;
+int fd = entry->linux_fd;
+pthread_mutex_lock(&f->lock);
+io_flush(f, fd);
+io_drop_reads(f, fd);
+int err = io_take_error(f);
+lseek(fd, f->pos, SEEK_SET);
+pthread_mutex_unlock(&f->lock);
+__atomic_fetch_sub(&io_files, 1, __ATOMIC_RELAXED);
+pthread_mutex_destroy(&f->lock);
+free(f->write[0].data);
+free(f->read[0].data);
+free(f);
+return err;
+}
+
+// Write out and wait for what hFile has gathered (DosResetBuffer).
+// Returns the errno of a write behind that failed, or 0.
+static int io_sync(HFILE hFile) {
+io_file_t *f = io_get(hFile);
+if (!f) return 0;
+pthread_mutex_lock(&f->lock);
+io_flush(f, get_linux_fd(hFile));
+int err = io_take_error(f);
+pthread_mutex_unlock(&f->lock);
+return err;
+}
+
+// DosRead, DosWrite and DosSetFilePtr on a handle that may be on the ring
+static ssize_t io_read(HFILE hFile, int fd, void *buf, size_t n) {
+io_file_t *f = io_get(hFile);
+if (!f) return read(fd, buf, n);
+pthread_mutex_lock(&f->lock);
+ssize_t r = io_file_read(f, fd, buf, n);
+int err = errno;
+pthread_mutex_unlock(&f->lock);
+errno = err;
+return r;
+}
+
+static ssize_t io_write(HFILE hFile, int fd, const void *buf, size_t n) {
+io_file_t *f = io_get(hFile);
+if (!f) return write(fd, buf, n);
+pthread_mutex_lock(&f->lock);
+ssize_t r = io_file_write(f, fd, buf, n);
+int err = errno;
+pthread_mutex_unlock(&f->lock);
+errno = err;
+return r;
+}
+
+static off_t io_seek(HFILE hFile, int fd, off_t offset, int whence) {
+io_file_t *f = io_get(hFile);
+if (!f) return lseek(fd, offset, whence);
+
+pthread_mutex_lock(&f->lock);
+off_t base = whence == SEEK_CUR ? (off_t)f->pos : 0;
+int err = 0;
+if (whence == SEEK_END) {
+    struct stat st;
+    io_flush(f, fd);
+    if (!(err = io_take_error(f))) err = fstat(fd, &st) < 0 ? errno : 0;
+    base = err ? 0 : st.st_size;
+}
+if (!err && base + offset < 0) err = EINVAL;
+if (!err) f->pos = base + offset;
+pthread_mutex_unlock(&f->lock);
+errno = err;
+return err ? -1 : base + offset;
+}
+
+// ============================================================================
+// Write-Behind Buffers
+// ============================================================================
+//
+// Programs hand DosWrite and DosPutMessage a line or less at a time, and
+// each call used to be a write(). Handles on a terminal or a regular file
+// now gather it in a buffer of their own: a terminal's goes out at the
+// end of each line, a file's once WB_SIZE bytes have built up. Anything
+// else done with the handle (reading, seeking, duplicating, closing,
+// DosResetBuffer), DosCopy and exit write it out first, and DosRead and
+// DosSleep write out the console's, so a prompt shows before the program
+// waits. A failed write of buffered data is returned by the next DosWrite
+// or DosClose. Pipes stay unbuffered, as the other end may be waiting for
+// what was just written; so do files opened with OPEN_FLAGS_WRITE_THROUGH,
+// files on the io_uring ring, which gathers writes itself, and duplicated
+// handles, which share a file pointer. OS2_WRITE_BEHIND=0 turns it off.
+
+int wb_wanted = 1;
+
+write_buffer_t *wb_get(HFILE hFile) {
+handle_entry_t *entry = handle_entry(hFile);
+return entry ? __atomic_load_n(&entry->wb, __ATOMIC_ACQUIRE) : NULL;
+}
+
+// Under wb->lock. What cannot be written is dropped, so one bad write
+// is reported once.
+static int wb_write_out(write_buffer_t *wb, int fd) {
+for (uint32_t done = 0; done < wb->len; ) {
+    ssize_t n = write(fd, wb->data + done, wb->len - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+        if (!wb->error) wb->error = n < 0 ? errno : EIO;
+        break;
+    }
+    done += n;
+}
+wb->len = 0;
+return wb->error ? -1 : 0;
+}
+
+// Write out hFile's buffer; with 'take', return and clear its error
+static int wb_flush(HFILE hFile, int take) {
+write_buffer_t *wb = wb_get(hFile);
+if (!wb) return 0;
+pthread_mutex_lock(&wb->lock);
+if (wb->len) wb_write_out(wb, get_linux_fd(hFile));
+int err = take ? wb->error : 0;
+if (take) wb->error = 0;
+pthread_mutex_unlock(&wb->lock);
+return err;
+}
+
+static void wb_flush_console(void) {
+for (HFILE h = 1; h < HANDLE_STD; h++) {
+    write_buffer_t *wb = wb_get(h);
+    if (wb && wb->tty && __atomic_load_n(&wb->len, __ATOMIC_RELAXED)) wb_flush(h, 0);
+}
+}
+
+void wb_flush_all(void) {
+for (HFILE h = 0; h < handle_limit; h++) {
+    if (wb_get(h)) wb_flush(h, 0);
+}
+}
+
+static ssize_t wb_write(write_buffer_t *wb, int fd, const char *buf, size_t n) {
+pthread_mutex_lock(&wb->lock);
+ssize_t r = n;
+if (!wb->error && wb->len + n > WB_SIZE) wb_write_out(wb, fd);
+if (!wb->error && n >= WB_SIZE) {
+    // Large writes go straight through, short or not
+    r = write(fd, buf, n);
+    if (r < 0) wb->error = errno;
+} else if (!wb->error) {
+    memcpy(wb->data + wb->len, buf, n);
+    wb->len += n;
+    if (wb->len == WB_SIZE || (wb->tty && memchr(buf, '\n', n))) wb_write_out(wb, fd);
+}
+int err = wb->error;
+wb->error = 0;
+pthread_mutex_unlock(&wb->lock);
+errno = err;
+return err ? -1 : r;
+}
+
+// Give hFile a buffer if it is open for writing on a terminal or a
+// regular file, without O_DSYNC and not on the io_uring ring
+void wb_attach(HFILE hFile, int fd) {
+handle_entry_t *entry = handle_entry(hFile);
+struct stat st;
+int flags = fcntl(fd, F_GETFL);
+if (!wb_wanted || !entry || entry->io || entry->wb || flags < 0 || (flags & O_ACCMODE) == O_RDONLY ||
+    (flags & O_DSYNC) || fstat(fd, &st) < 0) {
+    return;
+}
+int tty = isatty(fd);
+if (!tty && !S_ISREG(st.st_mode)) return;
+
+write_buffer_t *wb = malloc(sizeof(write_buffer_t));
+if (!wb) return;
+pthread_mutex_init(&wb->lock, NULL);
+wb->tty = tty;
+wb->error = 0;
+wb->len = 0;
+__atomic_store_n(&entry->wb, wb, __ATOMIC_RELEASE);
+}
+
+// Write out and drop hFile's buffer. Returns its error, or 0.
+int wb_detach(HFILE hFile) {
+handle_entry_t *entry = handle_entry(hFile);
+write_buffer_t *wb = entry ? __atomic_exchange_n(&entry->wb, NULL, __ATOMIC_ACQ_REL) : NULL;
+if (!wb) return 0;
+pthread_mutex_lock(&wb->lock);
+if (wb->len) wb_write_out(wb, entry->linux_fd);
+int err = wb->error;
+pthread_mutex_unlock(&wb->lock);
+pthread_mutex_destroy(&wb->lock);
+free(wb);
+return err;
+}
+
+// Buffer stdout and stderr, and write out every buffer at exit
+static void wb_init(void) {
+const char *behind = getenv("OS2_WRITE_BEHIND");
+wb_wanted = !behind || strcmp(behind, "0") != 0;
+if (!wb_wanted) return;
+for (HFILE h = 1; h < HANDLE_STD; h++) wb_attach(h, h);
+atexit(wb_flush_all);
+}
+
+// ============================================================================
+// Path Translation
+// ============================================================================
+//
+// OS/2 programs name files C:\DIR\NAME.EXT, in whatever case they like.
+// DosOpen, DosDelete and DosCopy turn a drive letter into the directory
+// it stands for (OS2_DRIVE_C=/srv/os2 and so on; C: is / unless set), a
+// leading \ into the root of C:, backslashes into slashes and . and ..
+// into the directory they name, then look each component up regardless
+// of case. The lookups go through an index of the directories on the
+// way, a hash table of names per directory, read from disk the first
+// time a path goes through it and kept current with inotify. Changes are
+// applied before each lookup, so a file made or renamed by anyone is
+// found by its new name at once, and a repeated open costs a hash lookup
+// per component and one read of the inotify queue. A name spelt the same
+// on disk wins over other spellings; a name not there (a file about to be
+// created) is used as given, as is everything below a directory that
+// cannot be read or watched. OS2_FOLD_CASE=0 keeps the translation but
+// uses every name as given.
+
+#define PATH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct path_dir path_dir_t;
+
+typedef struct path_entry {
+struct path_entry *next;
+uint32_t hash;              // Of the name in lower case
+path_dir_t *dir;            // Its index, once a path has gone through it
+char name[];                // As on disk
+} path_entry_t;
+
+// A directory's names; buckets is NULL until it is read
+struct path_dir {
+int wd;                     // inotify watch
+uint32_t count;
+uint32_t mask;              // Buckets - 1
+path_entry_t **buckets;
+};
+
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
+static int path_ready;
+static int path_fold = 1;
+static int path_inotify = -1;
+static char *path_drives[26];           // Without the trailing /, so / is ""
+static path_dir_t path_root = { -1, 0, 0, NULL };
+static path_dir_t **path_watches;       // By watch descriptor
+static int path_watch_count;
+
+static uint32_t path_hash(const char *name, size_t len) {
+uint32_t h = 2166136261u;
+for (size_t i = 0; i < len; i++) {
+    uint8_t c = name[i];
+    h = (h ^ (c >= 'A' && c <= 'Z' ? c + 32 : c)) * 16777619u;
+}
+return h;
+}
+
+static void path_forget(path_dir_t *dir);
+
+static void path_free(path_entry_t *e) {
+if (e->dir) {
+    path_forget(e->dir);
+    free(e->dir);
+}
+free(e);
+}
+
+// Drop dir's names and the indexes below it; the next path through it
+// reads it again
+static void path_forget(path_dir_t *dir) {
+if (dir->wd >= 0) {
+    inotify_rm_watch(path_inotify, dir->wd);
+    path_watches[dir->wd] = NULL;
+    dir->wd = -1;
+}
+if (!dir->buckets) return;
+for (uint32_t i = 0; i <= dir->mask; i++) {
+    for (path_entry_t *e = dir->buckets[i], *next; e; e = next) {
+        next = e->next;
+        path_free(e);
+    }
+}
+free(dir->buckets);
+dir->buckets = NULL;
+dir->count = 0;
+}
+
+// The entry spelt like name if there is one, else one that differs in case
+static path_entry_t *path_lookup(path_dir_t *dir, const char *name, size_t len) {
+uint32_t hash = path_hash(name, len);
+path_entry_t *match = NULL;
+for (path_entry_t *e = dir->buckets[hash & dir->mask]; e; e = e->next) {
+    if (e->hash != hash || strncasecmp(e->name, name, len) != 0 || e->name[len]) continue;
+    if (memcmp(e->name, name, len) == 0) return e;
+    if (!match) match = e;
+}
+return match;
+}
+
+static void path_insert(path_dir_t *dir, const char *name) {
+size_t len = strlen(name);
+path_entry_t *e = path_lookup(dir, name, len);
+if (e && memcmp(e->name, name, len) == 0) return;
+
+if (dir->count >= 2 * (dir->mask + 1)) {
+    uint32_t mask = dir->mask * 2 + 1;
+    path_entry_t **buckets = calloc(mask + 1, sizeof(path_entry_t *));
+    if (buckets) {
+        for (uint32_t i = 0; i <= dir->mask; i++) {
+            for (path_entry_t *next; (e = dir->buckets[i]); dir->buckets[i] = next) {
+                next = e->next;
+                e->next = buckets[e->hash & mask];
+                buckets[e->hash & mask] = e;
+            }
+        }
+        free(dir->buckets);
+        dir->buckets = buckets;
+        dir->mask = mask;
+    }
+}
+
+// A name that cannot be added would make the index wrong
+e = malloc(sizeof(path_entry_t) + len + 1);
+if (!e) {
+    path_forget(dir);
+    return;
+}
+e->hash = path_hash(name, len);
+e->dir = NULL;
+memcpy(e->name, name, len + 1);
+e->next = dir->buckets[e->hash & dir->mask];
+dir->buckets[e->hash & dir->mask] = e;
+dir->count++;
+}
+
+static void path_remove(path_dir_t *dir, const char *name) {
+uint32_t hash = path_hash(name, strlen(name));
+for (path_entry_t **p = &dir->buckets[hash & dir->mask]; *p; p = &(*p)->next) {
+    if (strcmp((*p)->name, name) == 0) {
+        path_entry_t *e = *p;
+        *p = e->next;
+        dir->count--;
+        path_free(e);
+        return;
+    }
+}
+}
+
+// Read the directory at 'path' into dir, watching it first so that
+// nothing done to it in between is missed
+static int path_index(path_dir_t *dir, const char *path) {
+int wd = path_inotify < 0 ? -1 : inotify_add_watch(path_inotify, path, PATH_EVENTS | IN_ONLYDIR);
+if (wd < 0) return -1;
+// A directory reached by two paths has one watch, which the first keeps
+if (wd < path_watch_count && path_watches[wd]) return -1;
+if (wd >= path_watch_count) {
+    int count = path_watch_count ? path_watch_count : 64;
+    while (count <= wd) count *= 2;
+    path_dir_t **watches = realloc(path_watches, count * sizeof(path_dir_t *));
+    if (!watches) {
+        inotify_rm_watch(path_inotify, wd);
+        return -1;
+    }
+    memset(watches + path_watch_count, 0, (count - path_watch_count) * sizeof(path_dir_t *));
+    path_watches = watches;
+    path_watch_count = count;
+}
+
+DIR *d = opendir(path);
+dir->buckets = d ? calloc(16, sizeof(path_entry_t *)) : NULL;
+if (!dir->buckets) {
+    if (d) closedir(d);
+    inotify_rm_watch(path_inotify, wd);
+    return -1;
+}
+dir->mask = 15;
+dir->count = 0;
+dir->wd = wd;
+path_watches[wd] = dir;
+for (struct dirent *de; dir->buckets && (de = readdir(d)); ) {
+    if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) path_insert(dir, de->d_name);
+}
+closedir(d);
+return dir->buckets ? 0 : -1;
+}
+
+// Apply what has been done to the indexed directories since the last lookup
+static void path_drain(void) {
+char buffer[2048] __attribute__((aligned(__alignof__(struct inotify_event))));
+ssize_t n;
+while ((n = read(path_inotify, buffer, sizeof(buffer))) > 0) {
+    for (char *p = buffer; p < buffer + n; ) {
+        struct inotify_event *ev = (struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + ev->len;
+        if (ev->mask & IN_Q_OVERFLOW) {
+            path_forget(&path_root);
+            continue;
+        }
+        path_dir_t *dir = ev->wd >= 0 && ev->wd < path_watch_count ? path_watches[ev->wd] : NULL;
+        if (!dir || !dir->buckets) continue;
+        if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) path_forget(dir);
+        else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) path_insert(dir, ev->name);
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) path_remove(dir, ev->name);
+    }
+}
+}
+
+static void path_init(void) {
+const char *fold = getenv("OS2_FOLD_CASE");
+path_fold = !fold || strcmp(fold, "0") != 0;
+if (path_fold) path_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+char var[] = "OS2_DRIVE_A", real[PATH_MAX];
+for (int i = 0; i < 26; i++) {
+    var[sizeof(var) - 2] = 'A' + i;
+    const char *root = getenv(var);
+    if (!root && i == 'C' - 'A') root = "/";
+    if (!root || !realpath(root, real)) continue;
+    path_drives[i] = strndup(real, strcmp(real, "/") == 0 ? 0 : strlen(real));
+}
+path_ready = 1;
+}
+
+// name made absolute, with . and .. taken out, in 'path' (PATH_MAX bytes).
+// .. stops at the root of a drive.
+static APIRET path_absolute(const char *name, char *path) {
+const char *root = NULL;
+size_t len = 0;
+if (((name[0] | 32) >= 'a' && (name[0] | 32) <= 'z') && name[1] == ':') {
+    root = path_drives[(name[0] | 32) - 'a'];
+    if (!root) return ERROR_INVALID_DRIVE;
+    name += 2;
+} else if (name[0] == '\\') {
+    root = path_drives['C' - 'A'];
+    if (!root) return ERROR_INVALID_DRIVE;
+} else if (name[0] != '/') {
+    if (!getcwd(path, PATH_MAX)) return errno_to_os2(errno);
+    len = strcmp(path, "/") == 0 ? 0 : strlen(path);
+}
+if (root) {
+    len = strlen(root);
+    memcpy(path, root, len);
+}
+
+size_t base = root ? len : 0;
+for (const char *c = name; *c; ) {
+    if (*c == '/' || *c == '\\') {
+        c++;
+        continue;
+    }
+    const char *end = c;
+    while (*end && *end != '/' && *end != '\\') end++;
+    size_t n = end - c;
+    if (n == 2 && c[0] == '.' && c[1] == '.') {
+        while (len > base && path[--len] != '/') {}
+    } else if (n != 1 || c[0] != '.') {
+        if (len + 1 + n >= PATH_MAX) return ERROR_FILENAME_EXCED_RANGE;
+        path[len++] = '/';
+        memcpy(path + len, c, n);
+        len += n;
+    }
+    c = end;
+}
+path[len] = 0;
+return NO_ERROR;
+}
+
+// Look each component of the absolute 'path' up in turn, writing the
+// names found on disk to 'out'. Spellings differ only in case, so 'out'
+// is as long as 'path'.
+static void path_resolve(const char *path, char *out) {
+path_dir_t *dir = &path_root;
+size_t len = 0;
+out[0] = 0;
+for (const char *c = path; *c; ) {
+    const char *end = strchrnul(++c, '/');
+    size_t n = end - c;
+    if (dir && !dir->buckets && path_index(dir, len ? out : "/") < 0) dir = NULL;
+    path_entry_t *e = dir ? path_lookup(dir, c, n) : NULL;
+    out[len++] = '/';
+    memcpy(out + len, e ? e->name : c, n);
+    len += n;
+    out[len] = 0;
+
+    dir = NULL;
+    if (e && *end) {
+        if (!e->dir && (e->dir = calloc(1, sizeof(path_dir_t)))) e->dir->wd = -1;
+        dir = e->dir;
+    }
+    c = end;
+}
+if (!len) strcpy(out, "/");
+}
+
+// The Linux name of the OS/2 file 'name', in 'out' (PATH_MAX bytes)
+APIRET path_translate(const char *name, char *out) {
+char path[PATH_MAX];
+pthread_mutex_lock(&path_lock);
+if (!path_ready) path_init();
+APIRET rc = path_absolute(name, path);
+if (rc == NO_ERROR && path_fold && path_inotify >= 0) {
+    path_drain();
+    path_resolve(path, out);
+} else if (rc == NO_ERROR) {
+    strcpy(out, *path ? path : "/");
+}
+pthread_mutex_unlock(&path_lock);
+return rc;
+}
+
+// ============================================================================
+// API Tracing
+// ============================================================================
+//
+// API calls are recorded as fixed-size binary events in a ring per thread
+// rather than printed. OS2_TRACE selects the calls (a comma-separated list
+// of trace_apis names, or "all"); at exit the rings are written to
+// OS2_TRACE_FILE (default "os2run.trace") for 'os2run --trace' to
+// print as a timeline. A call that is not selected costs one load and
+// branch; building with -DOS2_NO_TRACE removes the hooks altogether.
+
+static const char *const trace_apis[TRACE_API_COUNT] = {
+"open", "read", "write", "close", "seek", "delete", "exit", "sleep",
+"alloc", "free", "getmessage", "putmessage", "resolve", "setmem", "querymem",
+"subset", "suballoc", "subfree", "subunset", "createthread", "resumethread",
+"waitthread", "infoblocks", "setpriority", "tlsalloc", "tlsfree", "createevent",
+"openevent", "closeevent", "post", "waitevent", "reset", "createmutex",
+"openmutex", "closemutex", "request", "release", "createmuxwait",
+"closemuxwait", "waitmuxwait", "createqueue", "openqueue", "closequeue",
+"writequeue", "readqueue", "purgequeue", "queryqueue", "createpipe", "duphandle",
+"copy", "resetbuffer"
+};
+
+uint64_t g_trace_mask = 0;           // 1 << TRACE_* per selected call
+static uint64_t g_trace_epoch = 0;          // trace_clock() at trace_init
+static uint64_t g_trace_epoch_ns = 0;
+static trace_ring_t *g_trace_rings = NULL;
+
+#ifndef OS2_NO_TRACE
+static uint16_t g_trace_threads = 0;
+static __thread trace_ring_t *t_trace_ring = NULL;
+
+static trace_ring_t *trace_new_ring(void) {
+trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+if (!ring) return NULL;
+ring->thread = __atomic_fetch_add(&g_trace_threads, 1, __ATOMIC_RELAXED);
+ring->next = __atomic_load_n(&g_trace_rings, __ATOMIC_RELAXED);
+while (!__atomic_compare_exchange_n(&g_trace_rings, &ring->next, ring, 1,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) { }
+t_trace_ring = ring;
+return ring;
+}
+
+void trace_record(const trace_call_t *call, uint32_t rc,
+                         uint64_t a0, uint64_t a1, uint64_t a2) {
+uint64_t end = trace_clock();
+trace_ring_t *ring = t_trace_ring ? t_trace_ring : trace_new_ring();
+if (!ring) return;
+
+trace_event_t *e = &ring->events[ring->head & (TRACE_RING_EVENTS - 1)];
+e->start = call->start - g_trace_epoch;
+e->duration = end - call->start;
+e->args[0] = a0;
+e->args[1] = a1;
+e->args[2] = a2;
+e->rc = rc;
+e->api = call->api;
+e->flags = 0;
+e->thread = ring->thread;
+e->text[0] = '\0';
+if (call->text) {
+    size_t len = strlen(call->text);
+    const char *from = call->text;
+    if (len >= sizeof(e->text)) {
+        from += len - (sizeof(e->text) - 1);
+        e->flags = TRACE_TEXT_TAIL;
+    }
+    memcpy(e->text, from, strlen(from) + 1);
+}
+__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+static int trace_write_all(int fd, const void *buf, size_t len) {
+const uint8_t *p = buf;
+while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+}
+return 0;
+}
+
+// Write every ring, oldest event first, to 'path'. Returns the number of
+// events written or -1. Only plain system calls, so a crash handler can
+// save the trace too.
+long trace_write(const char *path) {
+trace_file_header_t hdr = { "OS2TRACE", TRACE_FORMAT, sizeof(trace_event_t), 0, 0, 1.0 };
+uint64_t ticks = trace_clock() - g_trace_epoch;
+if (ticks) hdr.ns_per_tick = (double)(now_ns() - g_trace_epoch_ns) / ticks;
+for (trace_ring_t *r = __atomic_load_n(&g_trace_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    hdr.event_count += head < TRACE_RING_EVENTS ? head : TRACE_RING_EVENTS;
+    hdr.dropped += head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+}
+
+int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+if (fd < 0) return -1;
+int failed = trace_write_all(fd, &hdr, sizeof(hdr));
+for (trace_ring_t *r = __atomic_load_n(&g_trace_rings, __ATOMIC_ACQUIRE); r && !failed; r = r->next) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    uint32_t from = first & (TRACE_RING_EVENTS - 1), count = head - first;
+
+    // Oldest part at the ring's end, then the wrapped part at its start
+    uint32_t tail = count < TRACE_RING_EVENTS - from ? count : TRACE_RING_EVENTS - from;
+    failed = trace_write_all(fd, &r->events[from], tail * sizeof(trace_event_t)) < 0 ||
+             trace_write_all(fd, r->events, (count - tail) * sizeof(trace_event_t)) < 0;
+}
+if (close(fd) < 0 || failed) return -1;
+return hdr.event_count;
+}
+
+char g_trace_path[PATH_MAX] = "os2run.trace";   // OS2_TRACE_FILE
+
+void trace_flush(void) {
+if (!g_trace_rings) return;
+long count = trace_write(g_trace_path);
+if (count < 0) {
+    fprintf(stderr, "[Trace] Cannot write %s: %s\n", g_trace_path, strerror(errno));
+} else {
+    printf("[Trace] %ld events written to %s\n", count, g_trace_path);
+}
+}
+
+// From a crash: no stdio
+void trace_flush_fatal(void) {
+if (g_trace_rings && trace_write(g_trace_path) >= 0) {
+    static const char msg[] = "[Trace] Saved after a crash\n";
+    trace_write_all(STDERR_FILENO, msg, sizeof(msg) - 1);
+}
+}
+
+// Select the traced calls from an OS2_TRACE value (replacing any earlier
+// selection) and start the clock
+void trace_init(const char *spec) {
+uint64_t mask = 0;
+if (!spec || !*spec || strcmp(spec, "0") == 0) {
+    // Nothing traced
+} else if (strcmp(spec, "all") == 0 || strcmp(spec, "1") == 0) {
+    mask = UINT64_MAX >> (64 - TRACE_API_COUNT);
+} else {
+    char list[256];
+    snprintf(list, sizeof(list), "%s", spec);
+    for (char *save = NULL, *name = strtok_r(list, ",", &save); name;
+         name = strtok_r(NULL, ",", &save)) {
+        int api = 0;
+        while (api < TRACE_API_COUNT && strcasecmp(trace_apis[api], name) != 0) api++;
+        if (api == TRACE_API_COUNT) {
+            fprintf(stderr, "[Trace] Unknown call '%s' in OS2_TRACE\n", name);
+        } else {
+            mask |= 1ull << api;
+        }
+    }
+}
+
+const char *path = getenv("OS2_TRACE_FILE");
+if (path && *path) snprintf(g_trace_path, sizeof(g_trace_path), "%s", path);
+g_trace_epoch_ns = now_ns();
+g_trace_epoch = trace_clock();
+g_trace_mask = mask;
+}
+
+// -------- Decoder --------
+
+const char *const trace_calls[TRACE_API_COUNT] = {
+"DosOpen", "DosRead", "DosWrite", "DosClose", "DosSetFilePtr", "DosDelete",
+"DosExit", "DosSleep", "DosAllocMem", "DosFreeMem", "DosGetMessage",
+"DosPutMessage", "(resolve)", "DosSetMem", "DosQueryMem", "DosSubSetMem",
+"DosSubAllocMem", "DosSubFreeMem", "DosSubUnsetMem", "DosCreateThread",
+"DosResumeThread", "DosWaitThread", "DosGetInfoBlocks", "DosSetPriority",
+"DosAllocThreadLocalMemory", "DosFreeThreadLocalMemory", "DosCreateEventSem",
+"DosOpenEventSem", "DosCloseEventSem", "DosPostEventSem", "DosWaitEventSem",
+"DosResetEventSem", "DosCreateMutexSem", "DosOpenMutexSem", "DosCloseMutexSem",
+"DosRequestMutexSem", "DosReleaseMutexSem", "DosCreateMuxWaitSem",
+"DosCloseMuxWaitSem", "DosWaitMuxWaitSem", "DosCreateQueue", "DosOpenQueue",
+"DosCloseQueue", "DosWriteQueue", "DosReadQueue", "DosPurgeQueue", "DosQueryQueue",
+"DosCreatePipe", "DosDupHandle", "DosCopy", "DosResetBuffer"
+};
+
+static void trace_print_event(const trace_event_t *e, double ns_per_tick) {
+unsigned long long a0 = e->args[0], a1 = e->args[1], a2 = e->args[2];
+char text[sizeof(e->text) + 3];
+snprintf(text, sizeof(text), "%s%.*s", e->flags & TRACE_TEXT_TAIL ? "..." : "",
+         (int)sizeof(e->text) - 1, e->text);
+
+printf("%12.3f %3u  %-14s %10.3f %5u  ", e->start * ns_per_tick / 1000.0, e->thread,
+       e->api < TRACE_API_COUNT ? trace_calls[e->api] : "?",
+       e->duration * ns_per_tick / 1000.0, e->rc);
+switch (e->api) {
+    case TRACE_OPEN:
+        printf("\"%s\" mode 0x%llx -> handle %llu, action %llu", text, a2, a0, a1);
+        break;
+    case TRACE_READ:
+    case TRACE_WRITE:
+        printf("handle %llu, %llu of %llu bytes", a0, a2, a1);
+        break;
+    case TRACE_CLOSE:
+        printf("handle %llu", a0);
+        break;
+    case TRACE_SEEK:
+        printf("handle %llu, offset %lld -> %llu", a0, (long long)a1, a2);
+        break;
+    case TRACE_DELETE:
+        printf("\"%s\"", text);
+        break;
+    case TRACE_EXIT:
+        printf("result %llu, action %llu", a0, a1);
+        break;
+    case TRACE_SLEEP:
+        printf("%llu ms", a0);
+        break;
+    case TRACE_ALLOC:
+        printf("%llu bytes, flags 0x%llx -> 0x%llx", a0, a1, a2);
+        break;
+    case TRACE_FREE:
+        printf("0x%llx", a0);
+        break;
+    case TRACE_SETMEM:
+        printf("0x%llx, %llu bytes, flags 0x%llx", a0, a1, a2);
+        break;
+    case TRACE_QUERYMEM:
+        printf("0x%llx -> %llu bytes, flags 0x%llx", a0, a1, a2);
+        break;
+    case TRACE_SUBSETMEM:
+        printf("heap 0x%llx, flags 0x%llx, %llu bytes", a0, a1, a2);
+        break;
+    case TRACE_SUBALLOCMEM:
+        printf("heap 0x%llx, %llu bytes -> 0x%llx", a0, a1, a2);
+        break;
+    case TRACE_SUBFREEMEM:
+        printf("heap 0x%llx, 0x%llx, %llu bytes", a0, a1, a2);
+        break;
+    case TRACE_SUBUNSETMEM:
+        printf("heap 0x%llx", a0);
+        break;
+    case TRACE_CREATETHREAD:
+        printf("flags 0x%llx, %llu byte stack -> tid %llu", a1, a2, a0);
+        break;
+    case TRACE_RESUMETHREAD:
+        printf("tid %llu", a0);
+        break;
+    case TRACE_WAITTHREAD:
+        printf("tid %llu, option %llu -> tid %llu", a0, a1, a2);
+        break;
+    case TRACE_GETINFOBLOCKS:
+        printf("-> tib 0x%llx, pib 0x%llx", a0, a1);
+        break;
+    case TRACE_SETPRIORITY:
+        printf("scope %llu, class %llu, delta %lld, id %llu", a0 >> 8, a0 & 0xFF, (long long)a1, a2);
+        break;
+    case TRACE_ALLOCTLS:
+        printf("%llu words -> 0x%llx", a0, a1);
+        break;
+    case TRACE_FREETLS:
+        printf("0x%llx", a0);
+        break;
+    case TRACE_CREATEEVENTSEM:
+    case TRACE_CREATEMUTEXSEM:
+        printf("\"%s\" -> handle %llu, state %llu", text, a0, a1);
+        break;
+    case TRACE_OPENEVENTSEM:
+    case TRACE_OPENMUTEXSEM:
+        printf("\"%s\" -> handle %llu", text, a0);
+        break;
+    case TRACE_CLOSEEVENTSEM:
+    case TRACE_CLOSEMUTEXSEM:
+    case TRACE_CLOSEMUXWAITSEM:
+    case TRACE_RELEASEMUTEXSEM:
+        printf("handle %llu", a0);
+        break;
+    case TRACE_POSTEVENTSEM:
+    case TRACE_RESETEVENTSEM:
+        printf("handle %llu, %llu posts", a0, a1);
+        break;
+    case TRACE_WAITEVENTSEM:
+        printf("handle %llu, timeout %lld ms", a0, (long long)(int32_t)a1);
+        break;
+    case TRACE_REQUESTMUTEXSEM:
+        printf("handle %llu, timeout %lld ms -> %llu requests", a0, (long long)(int32_t)a1, a2);
+        break;
+    case TRACE_CREATEMUXWAITSEM:
+        printf("%llu records, flags 0x%llx -> handle %llu", a1, a2, a0);
+        break;
+    case TRACE_WAITMUXWAITSEM:
+        printf("handle %llu, timeout %lld ms -> user %llu", a0, (long long)(int32_t)a1, a2);
+        break;
+    case TRACE_CREATEQUEUE:
+        printf("\"%s\" -> handle %llu, order %llu", text, a0, a1);
+        break;
+    case TRACE_OPENQUEUE:
+        printf("\"%s\" -> handle %llu, owner %llu", text, a0, a1);
+        break;
+    case TRACE_CLOSEQUEUE:
+        printf("handle %llu", a0);
+        break;
+    case TRACE_WRITEQUEUE:
+    case TRACE_READQUEUE:
+        printf("handle %llu, request %llu, %llu bytes", a0, a1, a2);
+        break;
+    case TRACE_PURGEQUEUE:
+        printf("handle %llu, %llu purged", a0, a1);
+        break;
+    case TRACE_QUERYQUEUE:
+        printf("handle %llu -> %llu elements", a0, a1);
+        break;
+    case TRACE_CREATEPIPE:
+        printf("-> read %llu, write %llu, %llu-byte buffer", a0, a1, a2);
+        break;
+    case TRACE_DUPHANDLE:
+        printf("handle %llu -> %llu", a0, a1);
+        break;
+    case TRACE_RESETBUFFER:
+        printf("handle %llu", a0);
+        break;
+    case TRACE_COPY:
+        printf("\"%s\" options 0x%llx -> %llu bytes", text, a1, a0);
+        break;
+    case TRACE_GETMESSAGE:
+        printf("message %llu, %llu bytes", a0, a1);
+        break;
+    case TRACE_PUTMESSAGE:
+        printf("handle %llu, %llu bytes", a0, a1);
+        break;
+    case TRACE_RESOLVE:
+        if (a0) printf("%s -> 0x%llx", text, a0);
+        else printf("%s unresolved", text);
+        break;
+}
+putchar('\n');
+}
+
+static int trace_event_order(const void *a, const void *b) {
+const trace_event_t *x = a, *y = b;
+if (x->start != y->start) return x->start < y->start ? -1 : 1;
+return x->thread - y->thread;
+}
+
+// Print a trace file as one timeline across all threads, then a summary
+// per call. Returns the number of events or -1.
+long trace_decode(const char *path) {
+FILE *f = fopen(path, "rb");
+if (!f) {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+}
+
+trace_file_header_t hdr;
+trace_event_t *events = NULL;
+if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, "OS2TRACE", 8) != 0 ||
+    hdr.format != TRACE_FORMAT || hdr.event_size != sizeof(trace_event_t) ||
+    hdr.event_count > (1u << 26) ||
+    !(events = malloc(hdr.event_count ? hdr.event_count * sizeof(trace_event_t) : 1)) ||
+    fread(events, sizeof(trace_event_t), hdr.event_count, f) != hdr.event_count) {
+    fprintf(stderr, "%s: not a trace file, or truncated\n", path);
+    free(events);
+    fclose(f);
+    return -1;
+}
+fclose(f);
+
+qsort(events, hdr.event_count, sizeof(trace_event_t), trace_event_order);
+
+uint64_t calls[TRACE_API_COUNT] = { 0 }, total[TRACE_API_COUNT] = { 0 };
+uint64_t longest[TRACE_API_COUNT] = { 0 };
+printf("%12s %3s  %-14s %10s %5s  %s\n", "start us", "thr", "call", "took us", "rc", "details");
+for (uint64_t i = 0; i < hdr.event_count; i++) {
+    const trace_event_t *e = &events[i];
+    trace_print_event(e, hdr.ns_per_tick);
+    if (e->api >= TRACE_API_COUNT) continue;
+    calls[e->api]++;
+    total[e->api] += e->duration;
+    if (e->duration > longest[e->api]) longest[e->api] = e->duration;
+}
+
+printf("\n%-14s %8s %12s %10s\n", "call", "count", "total us", "max us");
+for (int api = 0; api < TRACE_API_COUNT; api++) {
+    if (!calls[api]) continue;
+    printf("%-14s %8llu %12.3f %10.3f\n", trace_calls[api], (unsigned long long)calls[api],
+           total[api] * hdr.ns_per_tick / 1000.0, longest[api] * hdr.ns_per_tick / 1000.0);
+}
+if (hdr.dropped) {
+    printf("\n%llu earlier events were overwritten (ring of %d per thread)\n",
+           (unsigned long long)hdr.dropped, TRACE_RING_EVENTS);
+}
+
+free(events);
+return hdr.event_count;
+}
+
+// ============================================================================
+// Virtual Memory
+// ============================================================================
+//
+// DosAllocMem reserves address space: PROT_NONE, no swap reserved, below
+// 2 GB where 32-bit code can reach it, on OS/2's 64 KB boundaries. Pages
+// are committed by PAG_COMMIT at allocation or later by DosSetMem
+// (mprotect), and decommitted by DosSetMem (MADV_DONTNEED, then
+// PROT_NONE), which hands the memory back. Allocations are kept sorted by
+// address, so DosQueryMem and DosSetMem find theirs by binary search.
+
+typedef struct {
+uintptr_t base;
+size_t size;            // Whole pages
+uint32_t flags;         // Access requested at allocation (PAG_DEFAULT)
+uint8_t *pages;         // Per page: PAG_ACCESS | PAG_GUARD | PAG_COMMIT
+} vm_region_t;
+
+static vm_region_t *vm_regions = NULL;     // Sorted by base
+static uint32_t vm_region_count = 0;
+static uint32_t vm_region_capacity = 0;
+static int vm_lock_word = 0;
+
+static void vm_lock(void) {
+while (__atomic_exchange_n(&vm_lock_word, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&vm_lock_word, __ATOMIC_RELAXED)) { }
+}
+}
+
+static void vm_unlock(void) {
+__atomic_store_n(&vm_lock_word, 0, __ATOMIC_RELEASE);
+}
+
+// Index of the first region ending above 'addr': the one holding it, if any
+static uint32_t vm_search(uintptr_t addr) {
+uint32_t lo = 0, hi = vm_region_count;
+while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (vm_regions[mid].base + vm_regions[mid].size <= addr) lo = mid + 1;
+    else hi = mid;
+}
+return lo;
+}
+
+static vm_region_t *vm_find(uintptr_t addr) {
+uint32_t i = vm_search(addr);
+return i < vm_region_count && vm_regions[i].base <= addr ? &vm_regions[i] : NULL;
+}
+
+// Write and execute imply read, as on OS/2
+static inline int vm_prot(uint32_t flags) {
+return (flags & PAG_READ ? PROT_READ : 0) |
+       (flags & PAG_WRITE ? PROT_READ | PROT_WRITE : 0) |
+       (flags & PAG_EXECUTE ? PROT_READ | PROT_EXEC : 0);
+}
+
+// 'size' bytes of inaccessible address space on a VM_ALIGN boundary
+static uint8_t *vm_reserve(size_t size) {
+size_t span = size + VM_ALIGN - VM_PAGE;
+int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+uint8_t *mem = mmap(NULL, span, PROT_NONE, flags | MAP_32BIT, -1, 0);
+if (mem == MAP_FAILED) mem = mmap(NULL, span, PROT_NONE, flags, -1, 0);
+if (mem == MAP_FAILED) return NULL;
+
+uint8_t *base = (uint8_t*)(((uintptr_t)mem + VM_ALIGN - 1) & ~(uintptr_t)(VM_ALIGN - 1));
+if (base > mem) munmap(mem, base - mem);
+if (mem + span > base + size) munmap(base + size, mem + span - (base + size));
+return base;
+}
+
+static int vm_insert(const vm_region_t *region) {
+if (vm_region_count == vm_region_capacity) {
+    uint32_t capacity = vm_region_capacity ? vm_region_capacity * 2 : 64;
+    vm_region_t *grown = realloc(vm_regions, capacity * sizeof(vm_region_t));
+    if (!grown) return -1;
+    vm_regions = grown;
+    vm_region_capacity = capacity;
+}
+uint32_t i = vm_search(region->base);
+memmove(&vm_regions[i + 1], &vm_regions[i], (vm_region_count - i) * sizeof(vm_region_t));
+vm_regions[i] = *region;
+vm_region_count++;
+return 0;
+}
+
+// ============================================================================
+// Threads
+// ============================================================================
+//
+// OS/2 threads are detached pthreads. TIDs index a table of them (TID 1 is
+// the thread that starts the program); a thread that has ended keeps its
+// TID until DosWaitThread collects it or the TIDs run out. Each thread has
+// a TIB/TIB2 and a row of thread-local memory. OS/2 code finds its TIB
+// through FS, which glibc owns on Linux, so on x86-64 every thread's GS
+// base points at its TIB instead. The emulator reaches the current thread
+// through an initial-exec __thread pointer: one FS-relative load.
+
+enum { THREAD_FREE, THREAD_RUNNING, THREAD_ENDED };
+
+static os2_thread_t *thread_table[THREAD_MAX];
+static uint8_t thread_state[THREAD_MAX];
+static uint32_t thread_next = 1;            // Next TID to try
+static uint32_t thread_running = 0;
+static uint32_t thread_ended = 0;
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_changed = PTHREAD_COND_INITIALIZER;    // Ended or resumed
+static pthread_key_t thread_key;            // Ends the thread when its pthread does
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+
+static __thread os2_thread_t *t_thread __attribute__((tls_model("initial-exec")));
+
+// Row TID of thread-local memory; words are allocated for all rows at once
+ULONG tls_area[THREAD_MAX][TLS_WORDS] __attribute__((aligned(64)));
+static uint32_t tls_used = 0;               // Bit per allocated word
+static uint8_t tls_length[TLS_WORDS];       // Words of the block starting here
+
+static PIB process_info;
+
+// Apply a thread's OS/2 priority to its Linux thread. Idle time is
+// SCHED_IDLE and time critical SCHED_RR; the other classes (and time
+// critical without CAP_SYS_NICE) are nice values, more negative for higher
+// classes and levels, falling back to 0 where raising is not allowed.
+static void thread_apply_priority(const os2_thread_t *t) {
+ULONG cls = t->tib2.tib2_ulpri >> 8, level = t->tib2.tib2_ulpri & 0xFF;
+struct sched_param param = { 0 };
+if (!t->linux_tid) return;
+
+if (cls == PRTYC_IDLETIME) {
+    sched_setscheduler(t->linux_tid, SCHED_IDLE, &param);
+    return;
+}
+if (cls == PRTYC_TIMECRITICAL) {
+    param.sched_priority = 1 + level;
+    if (sched_setscheduler(t->linux_tid, SCHED_RR, &param) == 0) return;
+    param.sched_priority = 0;
+}
+sched_setscheduler(t->linux_tid, SCHED_OTHER, &param);
+
+int nice = -(int)level / 8;
+if (cls == PRTYC_FOREGROUNDSERVER) nice -= 4;
+else if (cls == PRTYC_TIMECRITICAL) nice -= 8;
+if (setpriority(PRIO_PROCESS, t->linux_tid, nice) < 0) setpriority(PRIO_PROCESS, t->linux_tid, 0);
+}
+
+// Called with thread_lock held. Prefers TIDs never used or collected, in
+// rotation, then reuses those of ended threads nobody waited for.
+static TID thread_new_tid(void) {
+for (int reuse = 0; reuse < 2; reuse++) {
+    for (uint32_t n = 0; n < THREAD_MAX - 1; n++) {
+        TID tid = 1 + (thread_next - 1 + n) % (THREAD_MAX - 1);
+        if (thread_state[tid] == THREAD_FREE || (reuse && thread_state[tid] == THREAD_ENDED)) {
+            if (thread_state[tid] == THREAD_ENDED) thread_ended--;
+            thread_next = tid % (THREAD_MAX - 1) + 1;
+            return tid;
+        }
+    }
+}
+return 0;
+}
+
+// Called with thread_lock held
+static void thread_register(os2_thread_t *t, TID tid) {
+t->tib.tib_ptib2 = &t->tib2;
+t->tib.tib_version = 20;
+t->tib.tib_ordinal = tid;
+t->tib2.tib2_ultid = tid;
+t->tib2.tib2_ulpri = PRTYC_REGULAR << 8;
+t->tib2.tib2_version = 20;
+memset(tls_area[tid], 0, sizeof(tls_area[tid]));
+thread_table[tid] = t;
+thread_state[tid] = THREAD_RUNNING;
+thread_running++;
+}
+
+// pthread key destructor: the thread has returned or called DosExit
+static void thread_end(void *arg) {
+os2_thread_t *t = arg;
+TID tid = t->tib2.tib2_ultid;
+pthread_mutex_lock(&thread_lock);
+thread_table[tid] = NULL;
+thread_state[tid] = THREAD_ENDED;
+thread_running--;
+thread_ended++;
+pthread_cond_broadcast(&thread_changed);
+pthread_mutex_unlock(&thread_lock);
+t_thread = NULL;
+free(t);
+}
+
+static void thread_init(void) {
+pthread_key_create(&thread_key, thread_end);
+}
+
+// Runs on the thread itself
+static void thread_attach(os2_thread_t *t) {
+t_thread = t;
+pthread_setspecific(thread_key, t);
+
+pthread_attr_t attr;
+void *stack;
+size_t size;
+if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    if (pthread_attr_getstack(&attr, &stack, &size) == 0) {
+        t->tib.tib_pstack = stack;
+        t->tib.tib_pstacklimit = (uint8_t*)stack + size;
+    }
+    pthread_attr_destroy(&attr);
+}
+#if defined(__x86_64__)
+syscall(SYS_arch_prctl, ARCH_SET_GS, (unsigned long)&t->tib);
+#endif
+
+pthread_mutex_lock(&thread_lock);
+t->linux_tid = syscall(SYS_gettid);
+if (t->tib2.tib2_ulpri != PRTYC_REGULAR << 8) thread_apply_priority(t);
+pthread_mutex_unlock(&thread_lock);
+}
+
+// The calling thread; threads the emulator did not create (thread 1
+// included) get a TID on first use. NULL if all TIDs are taken.
+os2_thread_t *thread_current(void) {
+if (__builtin_expect(t_thread != NULL, 1)) return t_thread;
+
+pthread_once(&thread_once, thread_init);
+os2_thread_t *t = calloc(1, sizeof(*t));
+if (!t) return NULL;
+pthread_mutex_lock(&thread_lock);
+TID tid = thread_new_tid();
+if (tid) thread_register(t, tid);
+pthread_mutex_unlock(&thread_lock);
+if (!tid) {
+    free(t);
+    return NULL;
+}
+thread_attach(t);
+return t;
+}
+
+static void *thread_start(void *arg) {
+os2_thread_t *t = arg;
+thread_attach(t);
+if (t->suspended) {
+    pthread_mutex_lock(&thread_lock);
+    while (t->suspended) pthread_cond_wait(&thread_changed, &thread_lock);
+    pthread_mutex_unlock(&thread_lock);
+}
+t->fn(t->arg);
+return NULL;
+}
+
+APIRET APIENTRY DosCreateThread(PTID ptid, PFNTHREAD pfn, ULONG param, ULONG flag, ULONG cbStack) {
+TRACE_ENTER(TRACE_CREATETHREAD, NULL);
+if (!ptid || !pfn || (flag & ~(CREATE_SUSPENDED | STACK_COMMITTED))) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, flag, cbStack);
+}
+// The creator gets its TID first, so the program's own thread is 1
+if (!thread_current()) TRACE_RETURN(ERROR_MAX_THRDS_REACHED, 0, flag, cbStack);
+
+os2_thread_t *t = calloc(1, sizeof(*t));
+if (!t) TRACE_RETURN(ERROR_NOT_ENOUGH_MEMORY, 0, flag, cbStack);
+t->fn = pfn;
+t->arg = param;
+t->suspended = flag & CREATE_SUSPENDED;
+
+pthread_mutex_lock(&thread_lock);
+TID tid = thread_new_tid();
+if (tid) thread_register(t, tid);
+pthread_mutex_unlock(&thread_lock);
+if (!tid) {
+    free(t);
+    TRACE_RETURN(ERROR_MAX_THRDS_REACHED, 0, flag, cbStack);
+}
+
+size_t stack = ((size_t)cbStack + VM_PAGE - 1) & ~(size_t)(VM_PAGE - 1);
+pthread_attr_t attr;
+pthread_t thread;
+pthread_attr_init(&attr);
+pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+pthread_attr_setstacksize(&attr, stack < THREAD_STACK_MIN ? THREAD_STACK_MIN : stack);
+int err = pthread_create(&thread, &attr, thread_start, t);
+pthread_attr_destroy(&attr);
+if (err) {
+    pthread_mutex_lock(&thread_lock);
+    thread_table[tid] = NULL;
+    thread_state[tid] = THREAD_FREE;
+    thread_running--;
+    pthread_mutex_unlock(&thread_lock);
+    free(t);
+    TRACE_RETURN(ERROR_NOT_ENOUGH_MEMORY, 0, flag, cbStack);
+}
+
+*ptid = tid;
+TRACE_RETURN(NO_ERROR, tid, flag, cbStack);
+}
+
+APIRET APIENTRY DosResumeThread(TID tid) {
+TRACE_ENTER(TRACE_RESUMETHREAD, NULL);
+APIRET rc = NO_ERROR;
+pthread_mutex_lock(&thread_lock);
+if (tid == 0 || tid >= THREAD_MAX || thread_state[tid] != THREAD_RUNNING) {
+    rc = ERROR_INVALID_THREADID;
+} else if (!thread_table[tid]->suspended) {
+    rc = ERROR_NOT_FROZEN;
+} else {
+    thread_table[tid]->suspended = 0;
+    pthread_cond_broadcast(&thread_changed);
+}
+pthread_mutex_unlock(&thread_lock);
+TRACE_RETURN(rc, tid, 0, 0);
+}
+
+// Wait for thread *ptid to end, or for any other thread if *ptid is 0,
+// and release its TID
+APIRET APIENTRY DosWaitThread(PTID ptid, ULONG option) {
+TRACE_ENTER(TRACE_WAITTHREAD, NULL);
+TID want = *ptid;
+if (option != DCWW_WAIT && option != DCWW_NOWAIT) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, want, option, 0);
+}
+os2_thread_t *self = thread_current();
+TID me = self ? self->tib2.tib2_ultid : 0;
+
+APIRET rc;
+pthread_mutex_lock(&thread_lock);
+for (;;) {
+    if (want) {
+        if (want >= THREAD_MAX || want == me || thread_state[want] == THREAD_FREE) {
+            rc = ERROR_INVALID_THREADID;
+            break;
+        }
+        if (thread_state[want] == THREAD_ENDED) {
+            thread_state[want] = THREAD_FREE;
+            thread_ended--;
+            rc = NO_ERROR;
+            break;
+        }
+    } else if (thread_ended) {
+        TID tid = 1;
+        while (thread_state[tid] != THREAD_ENDED) tid++;
+        thread_state[tid] = THREAD_FREE;
+        thread_ended--;
+        *ptid = tid;
+        rc = NO_ERROR;
+        break;
+    } else if (thread_running <= (me ? 1u : 0u)) {
+        rc = ERROR_INVALID_THREADID;
+        break;
+    }
+    if (option == DCWW_NOWAIT) {
+        rc = ERROR_THREAD_NOT_TERMINATED;
+        break;
+    }
+    pthread_cond_wait(&thread_changed, &thread_lock);
+}
+pthread_mutex_unlock(&thread_lock);
+TRACE_RETURN(rc, want, option, *ptid);
+}
+
+// Command line and environment in OS/2 form, built on first use
+static void process_info_init(void) {
+process_info.pib_ulpid = getpid();
+process_info.pib_ulppid = getppid();
+process_info.pib_ultype = 2;                // Windowed text mode
+
+char cmd[4096];
+size_t len = 0;
+int fd = open("/proc/self/cmdline", O_RDONLY);
+if (fd >= 0) {
+    ssize_t n = read(fd, cmd, sizeof(cmd) - 2);
+    len = n > 0 ? n : 0;
+    close(fd);
+}
+// "prog\0arg1\0arg2\0" becomes "prog\0arg1 arg2\0\0"
+char *first = memchr(cmd, '\0', len);
+for (char *c = first ? first + 1 : cmd + len; c + 1 < cmd + len; c++) {
+    if (*c == '\0') *c = ' ';
+}
+cmd[len] = cmd[len + 1] = '\0';
+if ((process_info.pib_pchcmd = malloc(len + 2))) memcpy(process_info.pib_pchcmd, cmd, len + 2);
+
+extern char **environ;
+size_t env = 1;
+for (char **e = environ; *e; e++) env += strlen(*e) + 1;
+char *block = malloc(env);
+if (block) {
+    char *p = block;
+    for (char **e = environ; *e; e++) p = stpcpy(p, *e) + 1;
+    *p = '\0';
+}
+process_info.pib_pchenv = block;
+}
+
+APIRET APIENTRY DosGetInfoBlocks(PTIB *pptib, PPIB *pppib) {
+TRACE_ENTER(TRACE_GETINFOBLOCKS, NULL);
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+if (pptib) {
+    os2_thread_t *t = thread_current();
+    if (!t) TRACE_RETURN(ERROR_MAX_THRDS_REACHED, 0, 0, 0);
+    *pptib = &t->tib;
+}
+if (pppib) {
+    pthread_once(&once, process_info_init);
+    *pppib = &process_info;
+}
+TRACE_RETURN(NO_ERROR, pptib ? (uintptr_t)*pptib : 0, pppib ? (uintptr_t)*pppib : 0, 0);
+}
+
+// Called with thread_lock held
+static void thread_set_priority(os2_thread_t *t, ULONG cls, LONG delta) {
+ULONG old = t->tib2.tib2_ulpri >> 8;
+LONG level = cls == PRTYC_NOCHANGE || cls == old ? (LONG)(t->tib2.tib2_ulpri & 0xFF) : 0;
+level += delta;
+if (level < 0) level = 0;
+if (level > PRTYD_MAXIMUM) level = PRTYD_MAXIMUM;
+t->tib2.tib2_ulpri = (cls == PRTYC_NOCHANGE ? old : cls) << 8 | level;
+thread_apply_priority(t);
+}
+
+APIRET APIENTRY DosSetPriority(ULONG scope, ULONG ulClass, LONG delta, ULONG id) {
+TRACE_ENTER(TRACE_SETPRIORITY, NULL);
+if (scope > PRTYS_THREAD) TRACE_RETURN(ERROR_INVALID_SCOPE, scope, ulClass, id);
+if (ulClass > PRTYC_FOREGROUNDSERVER) TRACE_RETURN(ERROR_INVALID_PCLASS, scope, ulClass, id);
+if (delta < -PRTYD_MAXIMUM || delta > PRTYD_MAXIMUM) {
+    TRACE_RETURN(ERROR_INVALID_PDELTA, scope, ulClass, id);
+}
+if (scope != PRTYS_THREAD && id != 0 && id != (ULONG)getpid()) {
+    TRACE_RETURN(ERROR_INVALID_PROCID, scope, ulClass, id);
+}
+os2_thread_t *self = thread_current();
+
+APIRET rc = NO_ERROR;
+pthread_mutex_lock(&thread_lock);
+if (scope != PRTYS_THREAD) {
+    for (TID tid = 1; tid < THREAD_MAX; tid++) {
+        if (thread_state[tid] == THREAD_RUNNING) thread_set_priority(thread_table[tid], ulClass, delta);
+    }
+} else if (id == 0 && self) {
+    thread_set_priority(self, ulClass, delta);
+} else if (id > 0 && id < THREAD_MAX && thread_state[id] == THREAD_RUNNING) {
+    thread_set_priority(thread_table[id], ulClass, delta);
+} else {
+    rc = ERROR_INVALID_THREADID;
+}
+pthread_mutex_unlock(&thread_lock);
+TRACE_RETURN(rc, scope << 8 | ulClass, delta, id);
+}
+
+// cb words of thread-local memory. The pointer addresses the calling
+// thread's copy: unlike OS/2, other threads see their copy at a different
+// address (their TIB's row), since threads here share one address space.
+APIRET APIENTRY DosAllocThreadLocalMemory(ULONG cb, PULONG *p) {
+TRACE_ENTER(TRACE_ALLOCTLS, NULL);
+os2_thread_t *self = thread_current();
+if (cb == 0 || cb > TLS_WORDS) TRACE_RETURN(ERROR_INVALID_PARAMETER, cb, 0, 0);
+if (!self) TRACE_RETURN(ERROR_MAX_THRDS_REACHED, cb, 0, 0);
+
+uint32_t mask = cb == 32 ? UINT32_MAX : (1u << cb) - 1;
+pthread_mutex_lock(&thread_lock);
+uint32_t word = 0;
+while (word + cb <= TLS_WORDS && (tls_used & mask << word)) word++;
+if (word + cb > TLS_WORDS) {
+    pthread_mutex_unlock(&thread_lock);
+    TRACE_RETURN(ERROR_NOT_ENOUGH_MEMORY, cb, 0, 0);
+}
+tls_used |= mask << word;
+tls_length[word] = cb;
+for (TID tid = 1; tid < THREAD_MAX; tid++) {
+    if (thread_state[tid] == THREAD_RUNNING) memset(&tls_area[tid][word], 0, cb * sizeof(ULONG));
+}
+pthread_mutex_unlock(&thread_lock);
+
+*p = &tls_area[self->tib2.tib2_ultid][word];
+TRACE_RETURN(NO_ERROR, cb, (uintptr_t)*p, 0);
+}
+
+APIRET APIENTRY DosFreeThreadLocalMemory(PULONG p) {
+TRACE_ENTER(TRACE_FREETLS, NULL);
+uintptr_t offset = (uintptr_t)p - (uintptr_t)tls_area;
+if (offset >= sizeof(tls_area) || offset % sizeof(ULONG)) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, (uintptr_t)p, 0, 0);
+}
+uint32_t word = offset / sizeof(ULONG) % TLS_WORDS;
+
+APIRET rc = NO_ERROR;
+pthread_mutex_lock(&thread_lock);
+uint32_t cb = tls_length[word];
+if (!cb) {
+    rc = ERROR_INVALID_PARAMETER;
+} else {
+    tls_used &= ~((cb == 32 ? UINT32_MAX : (1u << cb) - 1) << word);
+    tls_length[word] = 0;
+}
+pthread_mutex_unlock(&thread_lock);
+TRACE_RETURN(rc, (uintptr_t)p, 0, 0);
+}
+
+// ============================================================================
+// Semaphores
+// ============================================================================
+//
+// Event and mutex semaphores are a futex word each, so posting, waiting on
+// a posted event and requesting or releasing a free mutex are one atomic
+// operation; the kernel is entered only to sleep, or to wake a thread known
+// to be asleep. An event's word is its post count in the low 16 bits and a
+// reset count above them, so a post and reset between a waiter's checks
+// still releases it. A mutex's word is 0 free, 1 owned, 2 owned with
+// sleepers. Named semaphores (\SEM32\...) keep their state in a POSIX
+// shared memory object that other processes open, and use shared futexes;
+// unnamed ones are private to the process, DC_SEM_SHARED or not.
+//
+// A muxwait semaphore sleeps on a word of its own that every post and
+// release of a member in this process bumps; members that other processes
+// can post are waited on alongside it in the same futex_waitv call.
+// Handles index a table of chunks that are never freed, so a post racing
+// a muxwait's close bumps a dead word at worst.
+
+static os2_sem_t *sem_chunks[SEM_MAX / SEM_CHUNK];
+static uint32_t sem_next = 1;               // Next handle to try
+static pthread_mutex_t sem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sem_futex_waitv = 1;             // Cleared if the kernel has no futex_waitv
+
+// Sleep while *word is val, until 'deadline' (CLOCK_MONOTONIC, NULL for
+// none). -1 if it passed.
+static int sem_sleep(uint32_t *word, uint32_t val, int shared, const struct timespec *deadline) {
+long rc = syscall(SYS_futex, word, FUTEX_WAIT_BITSET | (shared ? 0 : FUTEX_PRIVATE_FLAG), val,
+                  deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+return rc < 0 && errno == ETIMEDOUT ? -1 : 0;
+}
+
+static void sem_wake(uint32_t *word, int count, int shared) {
+syscall(SYS_futex, word, FUTEX_WAKE | (shared ? 0 : FUTEX_PRIVATE_FLAG), count, NULL, NULL, 0);
+}
+
+static struct timespec *sem_deadline(ULONG ms, struct timespec *ts) {
+if (ms == SEM_INDEFINITE_WAIT) return NULL;
+clock_gettime(CLOCK_MONOTONIC, ts);
+ts->tv_sec += ms / 1000;
+ts->tv_nsec += (long)(ms % 1000) * 1000000;
+if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+}
+return ts;
+}
+
+// Mutex owner ID of the calling thread: its Linux TID, which no thread of
+// another process has either
+static inline uint32_t sem_self(void) {
+os2_thread_t *t = thread_current();
+return t ? (uint32_t)t->linux_tid : (uint32_t)syscall(SYS_gettid);
+}
+
+static inline os2_sem_t *sem_entry(ULONG h) {
+return &sem_chunks[h / SEM_CHUNK][h % SEM_CHUNK];
+}
+
+os2_sem_t *sem_get(ULONG h, uint32_t type) {
+if (h == 0 || h >= SEM_MAX) return NULL;
+os2_sem_t *chunk = __atomic_load_n(&sem_chunks[h / SEM_CHUNK], __ATOMIC_ACQUIRE);
+if (!chunk) return NULL;
+os2_sem_t *s = &chunk[h % SEM_CHUNK];
+return __atomic_load_n(&s->type, __ATOMIC_ACQUIRE) == type ? s : NULL;
+}
+
+// A free handle, or 0. Called with sem_lock held; the caller fills the
+// entry in and publishes it by setting its type.
+static ULONG sem_alloc(void) {
+for (uint32_t n = 0; n < SEM_MAX - 1; n++) {
+    ULONG h = 1 + (sem_next - 1 + n) % (SEM_MAX - 1);
+    os2_sem_t *chunk = sem_chunks[h / SEM_CHUNK];
+    if (!chunk) {
+        chunk = calloc(SEM_CHUNK, sizeof(os2_sem_t));
+        if (!chunk) return 0;
+        __atomic_store_n(&sem_chunks[h / SEM_CHUNK], chunk, __ATOMIC_RELEASE);
+    }
+    os2_sem_t *s = &chunk[h % SEM_CHUNK];
+    if (s->type == SEM_FREE) {
+        sem_next = h % (SEM_MAX - 1) + 1;
+        memset(&s->local, 0, sizeof(s->local));
+        s->state = &s->local;
+        s->shared = 0;
+        s->name = NULL;
+        s->opens = 1;
+        return h;
+    }
+}
+return 0;
+}
+
+// Shared memory object name for \SEM32\name: case does not matter on OS/2
+static int sem_path(PCSZ name, char *path, size_t size) {
+if (strncasecmp(name, "\\SEM32\\", 7) != 0 || !name[7] || strlen(name) + 2 > size) return -1;
+size_t n = snprintf(path, size, "/os2sem");
+for (const char *p = name + 6; *p; p++) {
+    char c = *p >= 'a' && *p <= 'z' ? *p - 'a' + 'A' : *p;
+    path[n++] = c == '\\' || c == '/' ? '.' : c;
+}
+path[n] = '\0';
+return 0;
+}
+
+// Give entry s the named semaphore at 'path', creating it or opening an
+// existing one of 'type'. Called with sem_lock held.
+static APIRET sem_map(os2_sem_t *s, const char *path, uint32_t type, int create) {
+int fd = shm_open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0600);
+if (fd < 0) {
+    if (errno == EEXIST) return ERROR_DUPLICATE_NAME;
+    return errno == ENOENT ? ERROR_SEM_NOT_FOUND : ERROR_TOO_MANY_SEMAPHORES;
+}
+struct stat st;
+sem_state_t *state = MAP_FAILED;
+if (create ? ftruncate(fd, sizeof(sem_state_t)) == 0
+           : fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(sem_state_t)) {
+    state = mmap(NULL, sizeof(sem_state_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+}
+close(fd);
+
+APIRET rc = NO_ERROR;
+if (state == MAP_FAILED) {
+    rc = create ? ERROR_TOO_MANY_SEMAPHORES : ERROR_SEM_NOT_FOUND;
+} else if (!create && __atomic_load_n(&state->type, __ATOMIC_ACQUIRE) != type) {
+    rc = ERROR_SEM_NOT_FOUND;               // Another kind, or not created yet
+} else if (!(s->name = strdup(path))) {
+    rc = ERROR_NOT_ENOUGH_MEMORY;
+}
+if (rc != NO_ERROR) {
+    if (state != MAP_FAILED) munmap(state, sizeof(sem_state_t));
+    if (create) shm_unlink(path);
+    return rc;
+}
+__atomic_fetch_add(&state->opens, 1, __ATOMIC_RELAXED);
+s->state = state;
+s->shared = 1;
+return NO_ERROR;
+}
+
+// A new event or mutex whose word is 'word', owned by 'owner' (0: none)
+static APIRET sem_create(PCSZ name, uint32_t type, uint32_t word, uint32_t owner, ULONG *ph) {
+char path[NAME_MAX + 1];
+if (name && sem_path(name, path, sizeof(path)) < 0) return ERROR_INVALID_NAME;
+
+pthread_mutex_lock(&sem_lock);
+ULONG h = sem_alloc();
+APIRET rc = h ? NO_ERROR : ERROR_TOO_MANY_SEMAPHORES;
+if (h && name) rc = sem_map(sem_entry(h), path, type, 1);
+if (rc == NO_ERROR) {
+    os2_sem_t *s = sem_entry(h);
+    s->state->word = word;
+    s->state->owner = owner;
+    s->state->requests = owner ? 1 : 0;
+    __atomic_store_n(&s->state->type, type, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->type, type, __ATOMIC_RELEASE);
+    *ph = h;
+}
+pthread_mutex_unlock(&sem_lock);
+return rc;
+}
+
+// Open a named semaphore, or another reference to *ph if 'name' is NULL.
+// A name this process has open already gives the same handle.
+static APIRET sem_open(PCSZ name, uint32_t type, ULONG *ph) {
+char path[NAME_MAX + 1];
+if (name && sem_path(name, path, sizeof(path)) < 0) return ERROR_INVALID_NAME;
+
+APIRET rc = NO_ERROR;
+pthread_mutex_lock(&sem_lock);
+if (!name) {
+    os2_sem_t *s = sem_get(*ph, type);
+    if (s) s->opens++;
+    else rc = ERROR_INVALID_HANDLE;
+} else {
+    ULONG h = 0;
+    for (uint32_t c = 0; c < SEM_MAX / SEM_CHUNK && !h; c++) {
+        for (uint32_t i = 0; sem_chunks[c] && i < SEM_CHUNK && !h; i++) {
+            os2_sem_t *s = &sem_chunks[c][i];
+            if (s->type == type && s->name && strcmp(s->name, path) == 0) h = c * SEM_CHUNK + i;
+        }
+    }
+    if (h) {
+        sem_entry(h)->opens++;
+    } else if (!(h = sem_alloc())) {
+        rc = ERROR_TOO_MANY_SEMAPHORES;
+    } else if ((rc = sem_map(sem_entry(h), path, type, 0)) == NO_ERROR) {
+        __atomic_store_n(&sem_entry(h)->type, type, __ATOMIC_RELEASE);
+    }
+    if (rc == NO_ERROR) *ph = h;
+}
+pthread_mutex_unlock(&sem_lock);
+return rc;
+}
+
+// In use here: slept on, owned, or in a muxwait
+static int sem_busy(const os2_sem_t *s) {
+const sem_state_t *st = s->state;
+if (s->muxes) return 1;
+if (s->type == SEM_MUX) return __atomic_load_n(&s->sleepers, __ATOMIC_RELAXED) != 0;
+if (s->type == SEM_EVENT) return !s->shared && __atomic_load_n(&st->waiters, __ATOMIC_RELAXED) != 0;
+if (s->shared) return __atomic_load_n(&st->owner, __ATOMIC_RELAXED) == sem_self();
+return __atomic_load_n(&st->word, __ATOMIC_RELAXED) != 0;
+}
+
+// Drop one reference; the last one frees the handle, and the last in any
+// process removes a named semaphore
+static APIRET sem_close(ULONG h, uint32_t type) {
+APIRET rc = NO_ERROR;
+pthread_mutex_lock(&sem_lock);
+os2_sem_t *s = sem_get(h, type);
+if (!s) {
+    rc = ERROR_INVALID_HANDLE;
+} else if (s->opens > 1) {
+    s->opens--;
+} else if (sem_busy(s)) {
+    rc = ERROR_SEM_BUSY;
+} else {
+    for (uint32_t i = 0; type == SEM_MUX && i < s->count; i++) {
+        os2_sem_t *member = sem_entry(s->records[i].hsemCur);
+        int slot = 0;
+        while (member->mux[slot] != h) slot++;
+        __atomic_store_n(&member->mux[slot], 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&member->muxes, member->muxes - 1, __ATOMIC_SEQ_CST);
+    }
+    if (type == SEM_MUX) {
+        free(s->records);
+        s->records = NULL;
+        s->count = 0;
+    }
+    if (s->shared) {
+        if (__atomic_sub_fetch(&s->state->opens, 1, __ATOMIC_ACQ_REL) == 0) shm_unlink(s->name);
+        munmap(s->state, sizeof(sem_state_t));
+        free(s->name);
+        s->name = NULL;
+        s->state = &s->local;
+    }
+    __atomic_store_n(&s->type, SEM_FREE, __ATOMIC_RELEASE);
+}
+pthread_mutex_unlock(&sem_lock);
+return rc;
+}
+
+// A member of muxwaits was posted or released: wake their sleepers
+static void sem_notify(os2_sem_t *s) {
+for (int i = 0; i < SEM_MUXES; i++) {
+    uint32_t h = __atomic_load_n(&s->mux[i], __ATOMIC_SEQ_CST);
+    if (!h) continue;
+    os2_sem_t *m = sem_entry(h);
+    __atomic_fetch_add(&m->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m->sleepers, __ATOMIC_SEQ_CST)) sem_wake(&m->seq, INT_MAX, 0);
+}
+}
+
+static inline int mutex_try(sem_state_t *st, uint32_t self) {
+if (__atomic_load_n(&st->owner, __ATOMIC_RELAXED) == self) {
+    if (st->requests >= SEM_MAX_REQUESTS) return 0;
+    st->requests++;
+    return 1;
+}
+uint32_t free_word = 0;
+if (!__atomic_compare_exchange_n(&st->word, &free_word, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return 0;
+}
+__atomic_store_n(&st->owner, self, __ATOMIC_RELAXED);
+st->requests = 1;
+return 1;
+}
+
+// Release one request of the calling thread, which owns s. Shared mutexes
+// wake every sleeper, as muxwaits of other processes sleep on the word too.
+static void mutex_release(os2_sem_t *s) {
+sem_state_t *st = s->state;
+if (--st->requests) return;
+__atomic_store_n(&st->owner, 0, __ATOMIC_RELAXED);
+if (__atomic_exchange_n(&st->word, 0, __ATOMIC_SEQ_CST) == 2) {
+    sem_wake(&st->word, s->shared ? INT_MAX : 1, s->shared);
+}
+if (__atomic_load_n(&s->muxes, __ATOMIC_SEQ_CST)) sem_notify(s);
+}
+
+APIRET APIENTRY DosCreateEventSem(PCSZ pszName, PHEV phev, ULONG flAttr, BOOL32 fState) {
+TRACE_ENTER(TRACE_CREATEEVENTSEM, pszName);
+if (!phev || (flAttr & ~DC_SEM_SHARED)) TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, fState, 0);
+APIRET rc = sem_create(pszName, SEM_EVENT, fState ? 1 : 0, 0, phev);
+TRACE_RETURN(rc, rc == NO_ERROR ? *phev : 0, fState, 0);
+}
+
+APIRET APIENTRY DosOpenEventSem(PCSZ pszName, PHEV phev) {
+TRACE_ENTER(TRACE_OPENEVENTSEM, pszName);
+if (!phev) TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, 0, 0);
+APIRET rc = sem_open(pszName, SEM_EVENT, phev);
+TRACE_RETURN(rc, *phev, 0, 0);
+}
+
+APIRET APIENTRY DosCloseEventSem(HEV hev) {
+TRACE_ENTER(TRACE_CLOSEEVENTSEM, NULL);
+TRACE_RETURN(sem_close(hev, SEM_EVENT), hev, 0, 0);
+}
+
+APIRET APIENTRY DosPostEventSem(HEV hev) {
+TRACE_ENTER(TRACE_POSTEVENTSEM, NULL);
+os2_sem_t *s = sem_get(hev, SEM_EVENT);
+if (!s) TRACE_RETURN(ERROR_INVALID_HANDLE, hev, 0, 0);
+sem_state_t *st = s->state;
+uint32_t word = __atomic_load_n(&st->word, __ATOMIC_RELAXED);
+do {
+    if ((word & SEM_POSTS) == SEM_POSTS) TRACE_RETURN(ERROR_TOO_MANY_POSTS, hev, SEM_POSTS, 0);
+} while (!__atomic_compare_exchange_n(&st->word, &word, word + 1, 1, __ATOMIC_SEQ_CST,
+                                      __ATOMIC_RELAXED));
+uint32_t posts = (word & SEM_POSTS) + 1;
+if (posts > 1) TRACE_RETURN(ERROR_ALREADY_POSTED, hev, posts, 0);
+if (__atomic_load_n(&st->waiters, __ATOMIC_SEQ_CST)) sem_wake(&st->word, INT_MAX, s->shared);
+if (__atomic_load_n(&s->muxes, __ATOMIC_SEQ_CST)) sem_notify(s);
+TRACE_RETURN(NO_ERROR, hev, posts, 0);
+}
+
+APIRET APIENTRY DosWaitEventSem(HEV hev, ULONG ulTimeout) {
+TRACE_ENTER(TRACE_WAITEVENTSEM, NULL);
+os2_sem_t *s = sem_get(hev, SEM_EVENT);
+if (!s) TRACE_RETURN(ERROR_INVALID_HANDLE, hev, ulTimeout, 0);
+sem_state_t *st = s->state;
+uint32_t word = __atomic_load_n(&st->word, __ATOMIC_ACQUIRE);
+if (word & SEM_POSTS) TRACE_RETURN(NO_ERROR, hev, ulTimeout, 0);
+if (ulTimeout == SEM_IMMEDIATE_RETURN) TRACE_RETURN(ERROR_TIMEOUT, hev, ulTimeout, 0);
+
+// Any change of the word is a post, or a reset that followed one
+struct timespec ts, *deadline = sem_deadline(ulTimeout, &ts);
+APIRET rc = NO_ERROR;
+__atomic_fetch_add(&st->waiters, 1, __ATOMIC_SEQ_CST);
+while (__atomic_load_n(&st->word, __ATOMIC_SEQ_CST) == word) {
+    if (sem_sleep(&st->word, word, s->shared, deadline) < 0) {
+        rc = ERROR_TIMEOUT;
+        break;
+    }
+}
+__atomic_fetch_sub(&st->waiters, 1, __ATOMIC_RELAXED);
+TRACE_RETURN(rc, hev, ulTimeout, 0);
+}
+
+APIRET APIENTRY DosResetEventSem(HEV hev, PULONG pulPostCt) {
+TRACE_ENTER(TRACE_RESETEVENTSEM, NULL);
+os2_sem_t *s = sem_get(hev, SEM_EVENT);
+if (!s || !pulPostCt) TRACE_RETURN(s ? ERROR_INVALID_PARAMETER : ERROR_INVALID_HANDLE, hev, 0, 0);
+sem_state_t *st = s->state;
+uint32_t word = __atomic_load_n(&st->word, __ATOMIC_RELAXED);
+do {
+    *pulPostCt = word & SEM_POSTS;
+    if (!*pulPostCt) TRACE_RETURN(ERROR_ALREADY_RESET, hev, 0, 0);
+} while (!__atomic_compare_exchange_n(&st->word, &word, (word | SEM_POSTS) + 1, 1, __ATOMIC_SEQ_CST,
+                                      __ATOMIC_RELAXED));
+TRACE_RETURN(NO_ERROR, hev, *pulPostCt, 0);
+}
+
+APIRET APIENTRY DosCreateMutexSem(PCSZ pszName, PHMTX phmtx, ULONG flAttr, BOOL32 fState) {
+TRACE_ENTER(TRACE_CREATEMUTEXSEM, pszName);
+if (!phmtx || (flAttr & ~DC_SEM_SHARED)) TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, fState, 0);
+APIRET rc = sem_create(pszName, SEM_MUTEX, fState ? 1 : 0, fState ? sem_self() : 0, phmtx);
+TRACE_RETURN(rc, rc == NO_ERROR ? *phmtx : 0, fState, 0);
+}
+
+APIRET APIENTRY DosOpenMutexSem(PCSZ pszName, PHMTX phmtx) {
+TRACE_ENTER(TRACE_OPENMUTEXSEM, pszName);
+if (!phmtx) TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, 0, 0);
+APIRET rc = sem_open(pszName, SEM_MUTEX, phmtx);
+TRACE_RETURN(rc, *phmtx, 0, 0);
+}
+
+APIRET APIENTRY DosCloseMutexSem(HMTX hmtx) {
+TRACE_ENTER(TRACE_CLOSEMUTEXSEM, NULL);
+TRACE_RETURN(sem_close(hmtx, SEM_MUTEX), hmtx, 0, 0);
+}
+
+APIRET APIENTRY DosRequestMutexSem(HMTX hmtx, ULONG ulTimeout) {
+TRACE_ENTER(TRACE_REQUESTMUTEXSEM, NULL);
+os2_sem_t *s = sem_get(hmtx, SEM_MUTEX);
+if (!s) TRACE_RETURN(ERROR_INVALID_HANDLE, hmtx, ulTimeout, 0);
+sem_state_t *st = s->state;
+uint32_t self = sem_self();
+if (mutex_try(st, self)) TRACE_RETURN(NO_ERROR, hmtx, ulTimeout, st->requests);
+if (__atomic_load_n(&st->owner, __ATOMIC_RELAXED) == self) {
+    TRACE_RETURN(ERROR_TOO_MANY_SEM_REQUESTS, hmtx, ulTimeout, st->requests);
+}
+if (ulTimeout == SEM_IMMEDIATE_RETURN) TRACE_RETURN(ERROR_TIMEOUT, hmtx, ulTimeout, 0);
+
+struct timespec ts, *deadline = sem_deadline(ulTimeout, &ts);
+while (__atomic_exchange_n(&st->word, 2, __ATOMIC_SEQ_CST) != 0) {
+    if (sem_sleep(&st->word, 2, s->shared, deadline) < 0) {
+        TRACE_RETURN(ERROR_TIMEOUT, hmtx, ulTimeout, 0);
+    }
+}
+__atomic_store_n(&st->owner, self, __ATOMIC_RELAXED);
+st->requests = 1;
+TRACE_RETURN(NO_ERROR, hmtx, ulTimeout, 1);
+}
+
+APIRET APIENTRY DosReleaseMutexSem(HMTX hmtx) {
+TRACE_ENTER(TRACE_RELEASEMUTEXSEM, NULL);
+os2_sem_t *s = sem_get(hmtx, SEM_MUTEX);
+if (!s) TRACE_RETURN(ERROR_INVALID_HANDLE, hmtx, 0, 0);
+if (__atomic_load_n(&s->state->owner, __ATOMIC_RELAXED) != sem_self()) {
+    TRACE_RETURN(ERROR_NOT_OWNER, hmtx, 0, 0);
+}
+mutex_release(s);
+TRACE_RETURN(NO_ERROR, hmtx, 0, 0);
+}
+
+// Muxwait semaphores are private to the process: a name is refused
+APIRET APIENTRY DosCreateMuxWaitSem(PCSZ pszName, PHMUX phmux, ULONG cSemRec, PSEMRECORD pSemRec,
+                                    ULONG flAttr) {
+TRACE_ENTER(TRACE_CREATEMUXWAITSEM, pszName);
+ULONG wait = flAttr & (DCMW_WAIT_ANY | DCMW_WAIT_ALL);
+if (!phmux || (cSemRec && !pSemRec) || (wait != DCMW_WAIT_ANY && wait != DCMW_WAIT_ALL) ||
+    (flAttr & ~(DC_SEM_SHARED | DCMW_WAIT_ANY | DCMW_WAIT_ALL))) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, cSemRec, flAttr);
+}
+if (pszName) TRACE_RETURN(ERROR_INVALID_NAME, 0, cSemRec, flAttr);
+if (cSemRec > SEM_MUX_RECORDS) TRACE_RETURN(ERROR_TOO_MANY_SEMAPHORES, 0, cSemRec, flAttr);
+SEMRECORD *records = NULL;
+if (cSemRec && !(records = malloc(cSemRec * sizeof(SEMRECORD)))) {
+    TRACE_RETURN(ERROR_NOT_ENOUGH_MEMORY, 0, cSemRec, flAttr);
+}
+if (cSemRec) memcpy(records, pSemRec, cSemRec * sizeof(SEMRECORD));
+
+APIRET rc = NO_ERROR;
+uint32_t members = 0;
+pthread_mutex_lock(&sem_lock);
+for (ULONG i = 0; i < cSemRec && rc == NO_ERROR; i++) {
+    os2_sem_t *s = sem_get(records[i].hsemCur, SEM_EVENT);
+    if (!s) s = sem_get(records[i].hsemCur, SEM_MUTEX);
+    if (!s) {
+        rc = ERROR_INVALID_HANDLE;
+    } else if (members && s->type != members) {
+        rc = ERROR_WRONG_TYPE;
+    } else if (s->muxes == SEM_MUXES) {
+        rc = ERROR_TOO_MANY_HANDLES;
+    }
+    for (ULONG j = 0; j < i && rc == NO_ERROR; j++) {
+        if (records[j].hsemCur == records[i].hsemCur) rc = ERROR_INVALID_PARAMETER;
+    }
+    if (s) members = s->type;
+}
+ULONG h = rc == NO_ERROR ? sem_alloc() : 0;
+if (rc == NO_ERROR && !h) rc = ERROR_TOO_MANY_SEMAPHORES;
+if (rc == NO_ERROR) {
+    os2_sem_t *m = sem_entry(h);
+    m->flags = wait;
+    m->members = members;
+    m->count = cSemRec;
+    m->records = records;
+    m->sleepers = 0;
+    for (ULONG i = 0; i < cSemRec; i++) {
+        os2_sem_t *s = sem_entry(records[i].hsemCur);
+        int slot = 0;
+        while (s->mux[slot]) slot++;
+        __atomic_store_n(&s->mux[slot], h, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&s->muxes, s->muxes + 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&m->type, SEM_MUX, __ATOMIC_RELEASE);
+    *phmux = h;
+}
+pthread_mutex_unlock(&sem_lock);
+if (rc != NO_ERROR) free(records);
+TRACE_RETURN(rc, h, cSemRec, flAttr);
+}
+
+APIRET APIENTRY DosCloseMuxWaitSem(HMUX hmux) {
+TRACE_ENTER(TRACE_CLOSEMUXWAITSEM, NULL);
+TRACE_RETURN(sem_close(hmux, SEM_MUX), hmux, 0, 0);
+}
+
+// One look at a muxwait's members: 1 if the wait is satisfied. With 'take'
+// mutexes are requested too, all or none of them for DCMW_WAIT_ALL.
+static int mux_scan(os2_sem_t *m, os2_sem_t **member, uint32_t self, int take, PULONG pulUser) {
+int any = m->flags & DCMW_WAIT_ANY;
+for (uint32_t i = 0; i < m->count; i++) {
+    sem_state_t *st = member[i]->state;
+    int ready;
+    if (m->members == SEM_EVENT) {
+        ready = (__atomic_load_n(&st->word, __ATOMIC_SEQ_CST) & SEM_POSTS) != 0;
+    } else if (take) {
+        ready = mutex_try(st, self);
+    } else {
+        ready = __atomic_load_n(&st->word, __ATOMIC_SEQ_CST) == 0 ||
+                __atomic_load_n(&st->owner, __ATOMIC_RELAXED) == self;
+    }
+    if (any && ready) {
+        *pulUser = m->records[i].ulUser;
+        return 1;
+    }
+    if (!any && !ready) {
+        while (take && m->members == SEM_MUTEX && i-- > 0) mutex_release(member[i]);
+        return 0;
+    }
+}
+return !any;
+}
+
+// Sleep until a member may have changed, or 'deadline'; -1 if it passed.
+// Members other processes can post or release are slept on too, marked as
+// slept on like any waiter would mark them.
+static int mux_sleep(os2_sem_t *m, os2_sem_t **member, uint32_t self, uint32_t seq,
+                     const struct timespec *deadline) {
+struct futex_waitv wait[1 + SEM_MUX_RECORDS];
+sem_state_t *marked[SEM_MUX_RECORDS];
+uint32_t n = 0, shared = 0;
+memset(wait, 0, sizeof(wait[0]));
+wait[0].val = seq;
+wait[0].uaddr = (uintptr_t)&m->seq;
+wait[0].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+for (uint32_t i = 0; i < m->count; i++) {
+    sem_state_t *st = member[i]->state;
+    if (!member[i]->shared) continue;
+    shared++;
+    if (!sem_futex_waitv) continue;
+    if (m->members == SEM_EVENT) {
+        __atomic_fetch_add(&st->waiters, 1, __ATOMIC_SEQ_CST);
+    } else {
+        uint32_t owned = 1;
+        __atomic_compare_exchange_n(&st->word, &owned, 2, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+    marked[n++] = st;
+    memset(&wait[n], 0, sizeof(wait[n]));
+    wait[n].val = __atomic_load_n(&st->word, __ATOMIC_SEQ_CST);
+    wait[n].uaddr = (uintptr_t)&st->word;
+    wait[n].flags = FUTEX_32;
+}
+
+int rc = 0;
+ULONG user;
+struct timespec poll;
+if (mux_scan(m, member, self, 0, &user)) {
+    // Changed while the marks went in
+} else if (n) {
+    if (syscall(SYS_futex_waitv, wait, n + 1, 0, deadline, CLOCK_MONOTONIC) < 0) {
+        if (errno == ENOSYS) sem_futex_waitv = 0;
+        rc = errno == ETIMEDOUT ? -1 : 0;
+    }
+} else if (shared) {
+    // No futex_waitv (Linux before 5.16): look at shared members every 10 ms
+    sem_deadline(10, &poll);
+    int last = deadline && (deadline->tv_sec < poll.tv_sec ||
+                            (deadline->tv_sec == poll.tv_sec && deadline->tv_nsec <= poll.tv_nsec));
+    rc = sem_sleep(&m->seq, seq, 0, last ? deadline : &poll);
+    if (!last) rc = 0;
+} else {
+    rc = sem_sleep(&m->seq, seq, 0, deadline);
+}
+for (uint32_t i = 0; i < n && m->members == SEM_EVENT; i++) {
+    __atomic_fetch_sub(&marked[i]->waiters, 1, __ATOMIC_RELAXED);
+}
+return rc;
+}
+
+APIRET APIENTRY DosWaitMuxWaitSem(HMUX hmux, ULONG ulTimeout, PULONG pulUser) {
+TRACE_ENTER(TRACE_WAITMUXWAITSEM, NULL);
+os2_sem_t *m = sem_get(hmux, SEM_MUX);
+if (!m) TRACE_RETURN(ERROR_INVALID_HANDLE, hmux, ulTimeout, 0);
+if (!m->count) TRACE_RETURN(ERROR_EMPTY_MUXWAIT, hmux, ulTimeout, 0);
+os2_sem_t *member[SEM_MUX_RECORDS];
+for (uint32_t i = 0; i < m->count; i++) member[i] = sem_entry(m->records[i].hsemCur);
+uint32_t self = m->members == SEM_MUTEX ? sem_self() : 0;
+
+struct timespec ts, *deadline = NULL;
+APIRET rc = NO_ERROR;
+ULONG user = 0;
+for (int pass = 0; !mux_scan(m, member, self, 1, &user); pass++) {
+    if (ulTimeout == SEM_IMMEDIATE_RETURN) {
+        rc = ERROR_TIMEOUT;
+        break;
+    }
+    if (pass == 0) deadline = sem_deadline(ulTimeout, &ts);
+    __atomic_fetch_add(&m->sleepers, 1, __ATOMIC_SEQ_CST);
+    int expired = mux_sleep(m, member, self, __atomic_load_n(&m->seq, __ATOMIC_SEQ_CST), deadline) < 0;
+    __atomic_fetch_sub(&m->sleepers, 1, __ATOMIC_RELAXED);
+    if (expired) {
+        rc = ERROR_TIMEOUT;
+        break;
+    }
+}
+if (rc == NO_ERROR && pulUser) *pulUser = user;
+TRACE_RETURN(rc, hmux, ulTimeout, user);
+}
+
+// ============================================================================
+// Queues
+// ============================================================================
+//
+// Every OS/2 queue has a name other processes can open to write to it, so
+// each lives in a POSIX shared memory object, as named semaphores do. FIFO
+// and priority queues are bounded lock-free MPMC rings, one per priority
+// (0-15, 15 read first) with a bitmap of the non-empty ones; LIFO queues
+// are a tagged lock-free stack over a pool of the same slots. Writers bump
+// a futex word the owner's readers sleep on, and post the event semaphore
+// a DCWW_NOWAIT read left behind. Elements carry the writer's address of
+// the data, as on OS/2: the data itself is not copied. Only the creating
+// process reads; DosPeekQueue and reading a given element are not provided.
+
+// Ring slots keep their sequence number less their index, so a zeroed
+// ring is an empty one
+typedef struct {
+uint32_t seq;
+uint32_t next;          // LIFO: index + 1 of the node below, 0 at the bottom
+PID pid;
+ULONG request;
+ULONG cb;
+uint32_t priority;
+uint64_t data;          // The writer's pbData
+} queue_slot_t;
+
+typedef struct {
+uint32_t tail __attribute__((aligned(64)));     // Next position written
+uint32_t head __attribute__((aligned(64)));     // Next position read
+} queue_ring_t;
+
+typedef struct {
+uint32_t order;         // QUE_FIFO, QUE_LIFO or QUE_PRIORITY
+PID owner;
+uint32_t closed;        // The owner closed it
+uint32_t levels;        // Bit per priority with elements
+uint32_t count;         // For DosQueryQueue
+uint32_t seq;           // Futex: bumped by every write
+uint32_t sleepers;      // Set by a reader going to sleep on seq, cleared by the write that wakes it
+uint32_t lifo_used;     // LIFO: pool slots ever handed out
+uint64_t lifo;          // LIFO: tag << 32 | index + 1 of the top node
+uint64_t lifo_free;     // LIFO: the same for unused nodes
+HEV notify_hev;         // Posted on write, in the owner process
+uint32_t notify_gen;    // Bumped when notify_hev changes
+char notify[NAME_MAX + 1];  // Its name for other processes, "" if unnamed
+queue_ring_t rings[QUEUE_LEVELS];
+queue_slot_t slots[QUEUE_LEVELS][QUEUE_SLOTS];
+} queue_shared_t;
+
+typedef struct {
+queue_shared_t *q;      // NULL: handle free
+uint32_t opens;
+char *path;             // Shared memory object
+HEV notify_hev;         // Writers here: our handle for q->notify
+uint32_t notify_gen;
+} queue_t;
+
+static queue_t queue_table[QUEUE_MAX];
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static PID queue_pid;                       // getpid() is a system call; set by create and open
+
+static queue_t *queue_get(HQUEUE hq) {
+if (hq == 0 || hq >= QUEUE_MAX) return NULL;
+return __atomic_load_n(&queue_table[hq].q, __ATOMIC_ACQUIRE) ? &queue_table[hq] : NULL;
+}
+
+static int queue_owned(const queue_t *h) {
+return h->q->owner == queue_pid;
+}
+
+static int queue_push(queue_shared_t *q, uint32_t level, const queue_slot_t *e) {
+queue_ring_t *r = &q->rings[level];
+uint32_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+for (;;) {
+    queue_slot_t *s = &q->slots[level][pos & (QUEUE_SLOTS - 1)];
+    uint32_t lap = pos & ~(uint32_t)(QUEUE_SLOTS - 1);
+    int32_t diff = (int32_t)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - lap);
+    if (diff == 0) {
+        if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            s->pid = e->pid;
+            s->request = e->request;
+            s->cb = e->cb;
+            s->priority = e->priority;
+            s->data = e->data;
+            __atomic_store_n(&s->seq, lap + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+    } else if (diff < 0) {
+        return -1;                          // Full
+    } else {
+        pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    }
+}
+}
+
+static int queue_pop(queue_shared_t *q, uint32_t level, queue_slot_t *e) {
+queue_ring_t *r = &q->rings[level];
+uint32_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+for (;;) {
+    queue_slot_t *s = &q->slots[level][pos & (QUEUE_SLOTS - 1)];
+    uint32_t lap = pos & ~(uint32_t)(QUEUE_SLOTS - 1);
+    int32_t diff = (int32_t)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - (lap + 1));
+    if (diff == 0) {
+        if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *e = *s;
+            __atomic_store_n(&s->seq, lap + QUEUE_SLOTS, __ATOMIC_RELEASE);
+            return 0;
+        }
+    } else if (diff < 0) {
+        return -1;                          // Empty
+    } else {
+        pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    }
+}
+}
+
+// Tagged stack of pool slots (slots[0]); the tag defeats ABA
+static void queue_stack_push(queue_shared_t *q, uint64_t *top, uint32_t i) {
+uint64_t old = __atomic_load_n(top, __ATOMIC_RELAXED), new;
+do {
+    __atomic_store_n(&q->slots[0][i].next, (uint32_t)old, __ATOMIC_RELAXED);
+    new = ((old >> 32) + 1) << 32 | (i + 1);
+} while (!__atomic_compare_exchange_n(top, &old, new, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static int queue_stack_pop(queue_shared_t *q, uint64_t *top) {
+uint64_t old = __atomic_load_n(top, __ATOMIC_ACQUIRE), new;
+do {
+    if (!(uint32_t)old) return -1;
+    uint32_t next = __atomic_load_n(&q->slots[0][(uint32_t)old - 1].next, __ATOMIC_RELAXED);
+    new = ((old >> 32) + 1) << 32 | next;
+} while (!__atomic_compare_exchange_n(top, &old, new, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+return (uint32_t)old - 1;
+}
+
+static int queue_put(queue_shared_t *q, const queue_slot_t *e) {
+if (q->order != QUE_LIFO) {
+    if (queue_push(q, e->priority, e) < 0) return -1;
+    if (q->order == QUE_PRIORITY) __atomic_fetch_or(&q->levels, 1u << e->priority, __ATOMIC_SEQ_CST);
+    return 0;
+}
+int i = queue_stack_pop(q, &q->lifo_free);
+if (i < 0) {
+    i = __atomic_fetch_add(&q->lifo_used, 1, __ATOMIC_RELAXED);
+    if (i >= QUEUE_SLOTS) return -1;
+}
+queue_slot_t *s = &q->slots[0][i];
+s->pid = e->pid;
+s->request = e->request;
+s->cb = e->cb;
+s->priority = 0;
+s->data = e->data;
+queue_stack_push(q, &q->lifo, i);
+return 0;
+}
+
+// The next element in the queue's order, or -1 if it is empty
+static int queue_take(queue_shared_t *q, queue_slot_t *e) {
+if (q->order == QUE_FIFO) return queue_pop(q, 0, e);
+if (q->order == QUE_LIFO) {
+    int i = queue_stack_pop(q, &q->lifo);
+    if (i < 0) return -1;
+    *e = q->slots[0][i];
+    queue_stack_push(q, &q->lifo_free, i);
+    return 0;
+}
+// A writer sets a priority's bit after adding to it, so one cleared here
+// is set again if the ring turns out not to be empty
+uint32_t levels = __atomic_load_n(&q->levels, __ATOMIC_SEQ_CST);
+while (levels) {
+    uint32_t level = 31 - __builtin_clz(levels);
+    if (queue_pop(q, level, e) == 0) return 0;
+    __atomic_fetch_and(&q->levels, ~(1u << level), __ATOMIC_SEQ_CST);
+    queue_ring_t *r = &q->rings[level];
+    if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) != __atomic_load_n(&r->head, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_or(&q->levels, 1u << level, __ATOMIC_SEQ_CST);
+    }
+    levels = __atomic_load_n(&q->levels, __ATOMIC_SEQ_CST) & ((1u << level) - 1);
+}
+return -1;
+}
+
+// Shared memory object name for \QUEUES\name
+static int queue_path(PCSZ name, char *path, size_t size) {
+if (!name || strncasecmp(name, "\\QUEUES\\", 8) != 0 || !name[8] || strlen(name) + 2 > size) return -1;
+size_t n = snprintf(path, size, "/os2queue");
+for (const char *p = name + 7; *p; p++) {
+    char c = *p >= 'a' && *p <= 'z' ? *p - 'a' + 'A' : *p;
+    path[n++] = c == '\\' || c == '/' ? '.' : c;
+}
+path[n] = '\0';
+return 0;
+}
+
+// A handle for the queue at 'path', created or opened. Called with
+// queue_lock held.
+static APIRET queue_map(const char *path, int create, ULONG order, HQUEUE *phq) {
+HQUEUE hq = 1;
+while (hq < QUEUE_MAX && queue_table[hq].q) hq++;
+if (hq == QUEUE_MAX) return ERROR_QUE_NO_MEMORY;
+
+int fd = shm_open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0600);
+if (fd < 0) {
+    if (errno == EEXIST) return ERROR_QUE_DUPLICATE;
+    return errno == ENOENT ? ERROR_QUE_NAME_NOT_EXIST : ERROR_QUE_NO_MEMORY;
+}
+struct stat st;
+queue_shared_t *q = MAP_FAILED;
+if (create ? ftruncate(fd, sizeof(queue_shared_t)) == 0
+           : fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(queue_shared_t)) {
+    q = mmap(NULL, sizeof(queue_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+}
+close(fd);
+char *copy = q != MAP_FAILED ? strdup(path) : NULL;
+if (!copy || (!create && !__atomic_load_n(&q->owner, __ATOMIC_ACQUIRE))) {
+    if (q != MAP_FAILED) munmap(q, sizeof(queue_shared_t));
+    if (create) shm_unlink(path);
+    free(copy);
+    return create || q == MAP_FAILED ? ERROR_QUE_NO_MEMORY : ERROR_QUE_NAME_NOT_EXIST;
+}
+
+if (create) {
+    q->order = order;
+    __atomic_store_n(&q->owner, queue_pid, __ATOMIC_RELEASE);
+}
+queue_t *h = &queue_table[hq];
+h->opens = 1;
+h->path = copy;
+h->notify_hev = 0;
+h->notify_gen = 0;
+__atomic_store_n(&h->q, q, __ATOMIC_RELEASE);
+*phq = hq;
+return NO_ERROR;
+}
+
+// Post the event semaphore a reader left with DosReadQueue. Writers in
+// other processes open it by name, so there it has to be a named one.
+static void queue_notify(queue_t *h) {
+queue_shared_t *q = h->q;
+if (queue_owned(h)) {
+    DosPostEventSem(__atomic_load_n(&q->notify_hev, __ATOMIC_RELAXED));
+    return;
+}
+pthread_mutex_lock(&queue_lock);
+uint32_t gen = __atomic_load_n(&q->notify_gen, __ATOMIC_ACQUIRE);
+if (h->notify_gen != gen) {
+    if (h->notify_hev) DosCloseEventSem(h->notify_hev);
+    h->notify_hev = 0;
+    h->notify_gen = gen;
+    char name[sizeof(q->notify)];
+    memcpy(name, q->notify, sizeof(name));
+    name[sizeof(name) - 1] = '\0';
+    if (name[0]) DosOpenEventSem(name, &h->notify_hev);
+}
+HEV hev = h->notify_hev;
+pthread_mutex_unlock(&queue_lock);
+if (hev) DosPostEventSem(hev);
+}
+
+APIRET APIENTRY DosCreateQueue(PHQUEUE phq, ULONG priority, PCSZ pszName) {
+TRACE_ENTER(TRACE_CREATEQUEUE, pszName);
+char path[NAME_MAX + 1];
+ULONG order = priority & ~QUE_CONVERT_ADDRESS;
+if (!phq || order > QUE_PRIORITY) TRACE_RETURN(ERROR_QUE_INVALID_PRIORITY, 0, priority, 0);
+if (queue_path(pszName, path, sizeof(path)) < 0) TRACE_RETURN(ERROR_QUE_INVALID_NAME, 0, priority, 0);
+
+pthread_mutex_lock(&queue_lock);
+queue_pid = getpid();
+APIRET rc = queue_map(path, 1, order, phq);
+pthread_mutex_unlock(&queue_lock);
+TRACE_RETURN(rc, rc == NO_ERROR ? *phq : 0, priority, 0);
+}
+
+// A queue this process has open already gives the same handle
+APIRET APIENTRY DosOpenQueue(PPID ppid, PHQUEUE phq, PCSZ pszName) {
+TRACE_ENTER(TRACE_OPENQUEUE, pszName);
+char path[NAME_MAX + 1];
+if (!ppid || !phq) TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, 0, 0);
+if (queue_path(pszName, path, sizeof(path)) < 0) TRACE_RETURN(ERROR_QUE_INVALID_NAME, 0, 0, 0);
+
+APIRET rc = ERROR_QUE_NAME_NOT_EXIST;
+pthread_mutex_lock(&queue_lock);
+queue_pid = getpid();
+for (HQUEUE hq = 1; hq < QUEUE_MAX; hq++) {
+    if (queue_table[hq].q && strcmp(queue_table[hq].path, path) == 0) {
+        queue_table[hq].opens++;
+        *phq = hq;
+        rc = NO_ERROR;
+        break;
+    }
+}
+if (rc != NO_ERROR) rc = queue_map(path, 0, 0, phq);
+if (rc == NO_ERROR) *ppid = queue_table[*phq].q->owner;
+pthread_mutex_unlock(&queue_lock);
+TRACE_RETURN(rc, rc == NO_ERROR ? *phq : 0, rc == NO_ERROR ? *ppid : 0, 0);
+}
+
+// The owner's last close removes the queue; writers elsewhere then get
+// ERROR_QUE_INVALID_HANDLE
+APIRET APIENTRY DosCloseQueue(HQUEUE hq) {
+TRACE_ENTER(TRACE_CLOSEQUEUE, NULL);
+APIRET rc = NO_ERROR;
+pthread_mutex_lock(&queue_lock);
+queue_t *h = queue_get(hq);
+if (!h) {
+    rc = ERROR_QUE_INVALID_HANDLE;
+} else if (--h->opens == 0) {
+    queue_shared_t *q = h->q;
+    if (queue_owned(h)) {
+        __atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+        shm_unlink(h->path);
+    }
+    if (h->notify_hev) DosCloseEventSem(h->notify_hev);
+    __atomic_store_n(&h->q, NULL, __ATOMIC_RELEASE);
+    munmap(q, sizeof(queue_shared_t));
+    free(h->path);
+    h->path = NULL;
+}
+pthread_mutex_unlock(&queue_lock);
+TRACE_RETURN(rc, hq, 0, 0);
+}
+
+APIRET APIENTRY DosWriteQueue(HQUEUE hq, ULONG request, ULONG cbData, PVOID pbData, ULONG priority) {
+TRACE_ENTER(TRACE_WRITEQUEUE, NULL);
+queue_t *h = queue_get(hq);
+queue_shared_t *q = h ? h->q : NULL;
+if (!q || __atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) {
+    TRACE_RETURN(ERROR_QUE_INVALID_HANDLE, hq, request, cbData);
+}
+queue_slot_t e;
+e.pid = queue_pid;
+e.request = request;
+e.cb = cbData;
+e.priority = q->order == QUE_PRIORITY ? (priority < QUEUE_LEVELS ? priority : QUEUE_LEVELS - 1) : 0;
+e.data = (uintptr_t)pbData;
+// Counted before it can be read, so a reader's decrement never comes first
+__atomic_fetch_add(&q->count, 1, __ATOMIC_RELAXED);
+if (queue_put(q, &e) < 0) {
+    __atomic_fetch_sub(&q->count, 1, __ATOMIC_RELAXED);
+    TRACE_RETURN(ERROR_QUE_NO_MEMORY, hq, request, cbData);
+}
+
+__atomic_fetch_add(&q->seq, 1, __ATOMIC_SEQ_CST);
+if (__atomic_load_n(&q->sleepers, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&q->sleepers, 0, __ATOMIC_SEQ_CST)) {
+    sem_wake(&q->seq, INT_MAX, 1);
+}
+if (__atomic_load_n(&q->notify_hev, __ATOMIC_RELAXED)) queue_notify(h);
+TRACE_RETURN(NO_ERROR, hq, request, cbData);
+}
+
+// With DCWW_NOWAIT and hsem, hsem is posted by every later write
+APIRET APIENTRY DosReadQueue(HQUEUE hq, PREQUESTDATA pRequest, PULONG pcbData, PPVOID ppbuf,
+                             ULONG element, BOOL32 wait, PBYTE ppriority, HEV hsem) {
+TRACE_ENTER(TRACE_READQUEUE, NULL);
+queue_t *h = queue_get(hq);
+if (!h) TRACE_RETURN(ERROR_QUE_INVALID_HANDLE, hq, 0, 0);
+if (!queue_owned(h)) TRACE_RETURN(ERROR_QUE_PROC_NOT_OWNED, hq, 0, 0);
+if (!pRequest || !pcbData || !ppbuf || !ppriority || wait > DCWW_NOWAIT) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, hq, 0, 0);
+}
+if (element != 0) TRACE_RETURN(ERROR_QUE_ELEMENT_NOT_EXIST, hq, 0, 0);
+queue_shared_t *q = h->q;
+
+if (wait == DCWW_NOWAIT && hsem && hsem != __atomic_load_n(&q->notify_hev, __ATOMIC_RELAXED)) {
+    os2_sem_t *s = sem_get(hsem, SEM_EVENT);
+    if (!s) TRACE_RETURN(ERROR_INVALID_HANDLE, hq, 0, 0);
+    pthread_mutex_lock(&queue_lock);
+    q->notify[0] = '\0';
+    if (s->name) snprintf(q->notify, sizeof(q->notify), "\\SEM32%s", s->name + strlen("/os2sem"));
+    for (char *p = q->notify + 6; *p; p++) {
+        if (*p == '.') *p = '\\';
+    }
+    __atomic_store_n(&q->notify_hev, hsem, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->notify_gen, q->notify_gen + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// An empty queue is given a few chances to fill before sleeping: a reader
+// woken for every element would make each a pair of context switches.
+// Elements counted but not reachable mean a writer was preempted between
+// counting its element and filling its slot, and is the one to run.
+queue_slot_t e;
+int yields = 0;
+while (queue_take(q, &e) < 0) {
+    if (wait == DCWW_NOWAIT) TRACE_RETURN(ERROR_QUE_EMPTY, hq, 0, 0);
+    if (yields < QUEUE_YIELDS || __atomic_load_n(&q->count, __ATOMIC_RELAXED)) {
+        yields++;
+        sched_yield();
+        continue;
+    }
+    yields = 0;
+    __atomic_store_n(&q->sleepers, 1, __ATOMIC_SEQ_CST);
+    uint32_t seq = __atomic_load_n(&q->seq, __ATOMIC_SEQ_CST);
+    if (queue_take(q, &e) == 0) break;
+    sem_sleep(&q->seq, seq, 1, NULL);
+}
+__atomic_fetch_sub(&q->count, 1, __ATOMIC_RELAXED);
+
+pRequest->pid = e.pid;
+pRequest->ulData = e.request;
+*pcbData = e.cb;
+*ppbuf = (PVOID)(uintptr_t)e.data;
+*ppriority = e.priority;
+TRACE_RETURN(NO_ERROR, hq, e.request, e.cb);
+}
+
+APIRET APIENTRY DosPurgeQueue(HQUEUE hq) {
+TRACE_ENTER(TRACE_PURGEQUEUE, NULL);
+queue_t *h = queue_get(hq);
+if (!h) TRACE_RETURN(ERROR_QUE_INVALID_HANDLE, hq, 0, 0);
+if (!queue_owned(h)) TRACE_RETURN(ERROR_QUE_PROC_NOT_OWNED, hq, 0, 0);
+queue_slot_t e;
+uint32_t purged = 0;
+while (queue_take(h->q, &e) == 0) purged++;
+__atomic_fetch_sub(&h->q->count, purged, __ATOMIC_RELAXED);
+TRACE_RETURN(NO_ERROR, hq, purged, 0);
+}
+
+APIRET APIENTRY DosQueryQueue(HQUEUE hq, PULONG pcbEntries) {
+TRACE_ENTER(TRACE_QUERYQUEUE, NULL);
+queue_t *h = queue_get(hq);
+if (!h) TRACE_RETURN(ERROR_QUE_INVALID_HANDLE, hq, 0, 0);
+if (!pcbEntries) TRACE_RETURN(ERROR_INVALID_PARAMETER, hq, 0, 0);
+*pcbEntries = __atomic_load_n(&h->q->count, __ATOMIC_RELAXED);
+TRACE_RETURN(NO_ERROR, hq, *pcbEntries, 0);
+}
+
+// ============================================================================
+// OS/2 API Implementations
+// ============================================================================
+
+// Makes sure [addr, addr + len) is loaded before a system call reads or
+// writes it; os2run's loader, which loads pages on first touch, supplies
+// the real one
+__attribute__((weak)) void loader_prefault(const void *addr, size_t len) {
+(void)addr;
+(void)len;
+}
+
+APIRET APIENTRY DosOpen(PCSZ pszFileName, PHFILE pHandle, PULONG pulAction,
+ULONG ulFileSize, ULONG ulAttribute, ULONG ulOpenFlags,
+ULONG ulOpenMode, PVOID peaop2) {
+init_handle_table();
+loader_prefault(pszFileName, strlen(pszFileName) + 1);
+TRACE_ENTER(TRACE_OPEN, pszFileName);
+
+int flags = 0;
+int mode = 0644;
+int access = ulOpenMode & 0x0003;
+
+if (access == OPEN_ACCESS_READONLY) flags = O_RDONLY;
+else if (access == OPEN_ACCESS_WRITEONLY) flags = O_WRONLY;
+else if (access == OPEN_ACCESS_READWRITE) flags = O_RDWR;
+if (ulOpenMode & OPEN_FLAGS_WRITE_THROUGH) flags |= O_DSYNC;
+
+int open_action = ulOpenFlags & 0x00FF;
+if (open_action & OPEN_ACTION_CREATE_IF_NEW) {
+    flags |= O_CREAT;
+    if (!(open_action & (OPEN_ACTION_OPEN_IF_EXISTS | OPEN_ACTION_REPLACE_IF_EXISTS))) {
+        flags |= O_EXCL;
+    }
+}
+if (open_action & OPEN_ACTION_REPLACE_IF_EXISTS) {
+    flags |= O_TRUNC;
+}
+
+char path[PATH_MAX];
+APIRET rc = path_translate(pszFileName, path);
+if (rc != NO_ERROR) TRACE_RETURN(rc, 0, 0, ulOpenMode);
+int fd = open(path, flags, mode);
+if (fd < 0) TRACE_RETURN(errno_to_os2(errno), 0, 0, ulOpenMode);
+
+HFILE os2_handle = allocate_handle(fd, path);
+if (os2_handle == (HFILE)-1) {
+    close(fd);
+    TRACE_RETURN(ERROR_TOO_MANY_OPEN_FILES, 0, 0, ulOpenMode);
+}
+if (!(flags & O_DSYNC)) io_attach(os2_handle, fd);
+wb_attach(os2_handle, fd);
+
+*pHandle = os2_handle;
+*pulAction = (flags & O_CREAT) ? FILE_CREATED : FILE_EXISTED;
+
+TRACE_RETURN(NO_ERROR, os2_handle, *pulAction, ulOpenMode);
+}
+
+APIRET APIENTRY DosRead(HFILE hFile, PVOID pBuffer, ULONG ulLength, PULONG pulBytesRead) {
+TRACE_ENTER(TRACE_READ, NULL);
+int fd = get_linux_fd(hFile);
+if (fd < 0) TRACE_RETURN(ERROR_INVALID_HANDLE, hFile, ulLength, 0);
+
+loader_prefault(pBuffer, ulLength);
+wb_flush_console();
+wb_flush(hFile, 0);
+ssize_t bytes = __atomic_load_n(&io_files, __ATOMIC_RELAXED) ? io_read(hFile, fd, pBuffer, ulLength)
+                                                             : read(fd, pBuffer, ulLength);
+if (bytes < 0) {
+    *pulBytesRead = 0;
+    TRACE_RETURN(errno_to_os2(errno), hFile, ulLength, 0);
+}
+
+*pulBytesRead = bytes;
+TRACE_RETURN(NO_ERROR, hFile, ulLength, bytes);
+}
+
+APIRET APIENTRY DosWrite(HFILE hFile, PVOID pBuffer, ULONG ulLength, PULONG pulBytesWritten) {
+TRACE_ENTER(TRACE_WRITE, NULL);
+int fd = get_linux_fd(hFile);
+if (fd < 0) TRACE_RETURN(ERROR_INVALID_HANDLE, hFile, ulLength, 0);
+
+loader_prefault(pBuffer, ulLength);
+write_buffer_t *wb = wb_get(hFile);
+ssize_t bytes = wb ? wb_write(wb, fd, pBuffer, ulLength)
+              : __atomic_load_n(&io_files, __ATOMIC_RELAXED) ? io_write(hFile, fd, pBuffer, ulLength)
+              : write(fd, pBuffer, ulLength);
+if (bytes < 0) {
+    *pulBytesWritten = 0;
+    TRACE_RETURN(errno_to_os2(errno), hFile, ulLength, 0);
+}
+
+*pulBytesWritten = bytes;
+TRACE_RETURN(NO_ERROR, hFile, ulLength, bytes);
+}
+
+APIRET APIENTRY DosClose(HFILE hFile) {
+TRACE_ENTER(TRACE_CLOSE, NULL);
+int err = wb_detach(hFile);
+int ring_err = __atomic_load_n(&io_files, __ATOMIC_RELAXED) ? io_detach(hFile) : 0;
+if (!err) err = ring_err;
+int fd = free_handle(hFile);
+if (fd < 0) TRACE_RETURN(ERROR_INVALID_HANDLE, hFile, 0, 0);
+
+// The handle is gone either way; Linux releases the fd even on error
+if (close(fd) < 0) TRACE_RETURN(errno_to_os2(errno), hFile, 0, 0);
+if (err) TRACE_RETURN(errno_to_os2(err), hFile, 0, 0);
+TRACE_RETURN(NO_ERROR, hFile, 0, 0);
+}
+
+// A new handle for hFile's open file, or with *phfNew other than
+// 0xFFFFFFFF that handle, closing what it had open. Handles 0-2 keep
+// their Linux descriptors, so redirecting stdout redirects printf too.
+APIRET APIENTRY DosDupHandle(HFILE hFile, PHFILE phfNew) {
+TRACE_ENTER(TRACE_DUPHANDLE, NULL);
+int fd = get_linux_fd(hFile);
+if (fd < 0) TRACE_RETURN(ERROR_INVALID_HANDLE, hFile, 0, 0);
+if (!phfNew) TRACE_RETURN(ERROR_INVALID_PARAMETER, hFile, 0, 0);
+
+HFILE target = *phfNew;
+// Duplicates share the file pointer, so neither is buffered any more
+wb_detach(hFile);
+if (target != HANDLE_NONE) wb_detach(target);
+if (__atomic_load_n(&io_files, __ATOMIC_RELAXED)) {
+    io_detach(hFile);
+    if (target != HANDLE_NONE) io_detach(target);
+}
+if (target == HANDLE_NONE) {
+    int copy = dup(fd);
+    if (copy < 0) TRACE_RETURN(errno_to_os2(errno), hFile, 0, 0);
+    target = allocate_handle(copy, NULL);
+    if (target == (HFILE)-1) {
+        close(copy);
+        TRACE_RETURN(ERROR_TOO_MANY_OPEN_FILES, hFile, 0, 0);
+    }
+} else if (target != hFile) {
+    int old = get_linux_fd(target);
+    if (old >= 0) {
+        if (dup2(fd, old) < 0) TRACE_RETURN(errno_to_os2(errno), hFile, target, 0);
+    } else {
+        int copy = target < HANDLE_STD ? dup2(fd, target) : dup(fd);
+        if (copy < 0) TRACE_RETURN(errno_to_os2(errno), hFile, target, 0);
+        if (claim_handle(target, copy, NULL) < 0) {
+            close(copy);
+            TRACE_RETURN(ERROR_INVALID_TARGET_HANDLE, hFile, target, 0);
+        }
+    }
+}
+*phfNew = target;
+TRACE_RETURN(NO_ERROR, hFile, target, 0);
+}
+
+APIRET APIENTRY DosSetFilePtr(HFILE hFile, LONG lOffset, ULONG ulOrigin, PULONG pulNewPtr) {
+TRACE_ENTER(TRACE_SEEK, NULL);
+int fd = get_linux_fd(hFile);
+if (fd < 0) TRACE_RETURN(ERROR_INVALID_HANDLE, hFile, (int64_t)lOffset, 0);
+
+int whence;
+switch (ulOrigin) {
+    case FILE_BEGIN:   whence = SEEK_SET; break;
+    case FILE_CURRENT: whence = SEEK_CUR; break;
+    case FILE_END:     whence = SEEK_END; break;
+    default: TRACE_RETURN(ERROR_INVALID_PARAMETER, hFile, (int64_t)lOffset, 0);
+}
+
+wb_flush(hFile, 0);
+off_t new_pos = __atomic_load_n(&io_files, __ATOMIC_RELAXED) ? io_seek(hFile, fd, lOffset, whence)
+                                                             : lseek(fd, lOffset, whence);
+if (new_pos < 0) TRACE_RETURN(errno_to_os2(errno), hFile, (int64_t)lOffset, 0);
+
+if (pulNewPtr) *pulNewPtr = new_pos;
+TRACE_RETURN(NO_ERROR, hFile, (int64_t)lOffset, new_pos);
+}
+
+// What hFile has buffered, ours and the kernel's, goes to the file
+static int reset_buffer(HFILE hFile) {
+int fd = get_linux_fd(hFile);
+int err = wb_flush(hFile, 1);
+int ring_err = __atomic_load_n(&io_files, __ATOMIC_RELAXED) ? io_sync(hFile) : 0;
+if (!err) err = ring_err;
+struct stat st;
+if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && fsync(fd) < 0 && !err) err = errno;
+return err;
+}
+
+// hFile 0xFFFF resets every open handle
+APIRET APIENTRY DosResetBuffer(HFILE hFile) {
+TRACE_ENTER(TRACE_RESETBUFFER, NULL);
+int err = 0;
+if (hFile == 0xFFFF) {
+    for (HFILE h = 0; h < handle_limit; h++) {
+        int e = get_linux_fd(h) >= 0 ? reset_buffer(h) : 0;
+        if (!err) err = e;
+    }
+} else {
+    if (get_linux_fd(hFile) < 0) TRACE_RETURN(ERROR_INVALID_HANDLE, hFile, 0, 0);
+    err = reset_buffer(hFile);
+}
+TRACE_RETURN(errno_to_os2(err), hFile, 0, 0);
+}
+
+APIRET APIENTRY DosDelete(PCSZ pszFileName) {
+loader_prefault(pszFileName, strlen(pszFileName) + 1);
+TRACE_ENTER(TRACE_DELETE, pszFileName);
+char path[PATH_MAX];
+APIRET rc = path_translate(pszFileName, path);
+if (rc != NO_ERROR) TRACE_RETURN(rc, 0, 0, 0);
+if (unlink(path) < 0) TRACE_RETURN(errno_to_os2(errno), 0, 0, 0);
+TRACE_RETURN(NO_ERROR, 0, 0, 0);
+}
+
+// cb is a minimum: pipes get at least PIPE_BUFFER_MIN, so a program
+// streaming output through one is not woken for every 64 KB. Writing to
+// a pipe nobody can read fails with ERROR_BROKEN_PIPE instead of raising
+// SIGPIPE.
+APIRET APIENTRY DosCreatePipe(PHFILE phfRead, PHFILE phfWrite, ULONG cb) {
+TRACE_ENTER(TRACE_CREATEPIPE, NULL);
+if (!phfRead || !phfWrite) TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, 0, cb);
+int fds[2];
+if (pipe(fds) < 0) TRACE_RETURN(errno_to_os2(errno), 0, 0, cb);
+signal(SIGPIPE, SIG_IGN);
+
+// Over the per-user limit F_SETPIPE_SZ fails; settle for less
+size_t size = cb > PIPE_BUFFER_MIN ? cb : PIPE_BUFFER_MIN;
+if (size > PIPE_BUFFER_MAX) size = PIPE_BUFFER_MAX;
+while (size > PIPE_BUFFER_DEFAULT && fcntl(fds[1], F_SETPIPE_SZ, (int)size) < 0) size /= 2;
+
+HFILE read_end = allocate_handle(fds[0], "(pipe)");
+HFILE write_end = read_end != (HFILE)-1 ? allocate_handle(fds[1], "(pipe)") : (HFILE)-1;
+if (write_end == (HFILE)-1) {
+    if (read_end != (HFILE)-1) free_handle(read_end);
+    close(fds[0]);
+    close(fds[1]);
+    TRACE_RETURN(ERROR_TOO_MANY_OPEN_FILES, 0, 0, cb);
+}
+*phfRead = read_end;
+*phfWrite = write_end;
+TRACE_RETURN(NO_ERROR, read_end, write_end, fcntl(fds[1], F_GETPIPE_SZ));
+}
+
+// Move what is left of fd 'in' to fd 'out' without passing it through a
+// buffer of ours: copy_file_range between files (a reflink where the file
+// system can), splice when either is a pipe. Where the kernel refuses,
+// read and write. Returns the bytes moved, or -1 with errno set.
+int64_t fd_transfer(int in, int out) {
+enum { MOVE_RANGE, MOVE_SPLICE, MOVE_COPY } how = MOVE_RANGE;
+struct stat si, so;
+if (fstat(in, &si) < 0 || fstat(out, &so) < 0) return -1;
+if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode)) how = MOVE_SPLICE;
+
+const size_t chunk = 1u << 30;
+char *buffer = NULL;
+int64_t total = 0;
+for (;;) {
+    ssize_t n;
+    if (how == MOVE_RANGE) n = copy_file_range(in, NULL, out, NULL, chunk, 0);
+    else if (how == MOVE_SPLICE) n = splice(in, NULL, out, NULL, chunk, SPLICE_F_MOVE);
+    else {
+        n = read(in, buffer, PIPE_BUFFER_DEFAULT);
+        for (ssize_t done = 0, w; n > 0 && done < n; done += w) {
+            w = write(out, buffer + done, n - done);
+            if (w < 0) n = -1;
+        }
+    }
+    if (n < 0 && how != MOVE_COPY &&
+        (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP)) {
+        how = MOVE_COPY;
+        if (!(buffer = malloc(PIPE_BUFFER_DEFAULT))) return -1;
+        continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+        free(buffer);
+        return n < 0 ? -1 : total;
+    }
+    total += n;
+}
+}
+
+// Copies one file, which may be a FIFO; directories are not copied.
+// Without DCPY_EXISTING or DCPY_APPEND an existing target is refused.
+APIRET APIENTRY DosCopy(PCSZ pszOld, PCSZ pszNew, ULONG ulOptions) {
+loader_prefault(pszOld, strlen(pszOld) + 1);
+loader_prefault(pszNew, strlen(pszNew) + 1);
+TRACE_ENTER(TRACE_COPY, pszOld);
+if (ulOptions & ~(DCPY_EXISTING | DCPY_APPEND | DCPY_FAILEAS)) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, 0, ulOptions, 0);
+}
+char old_path[PATH_MAX], new_path[PATH_MAX];
+APIRET rc = path_translate(pszOld, old_path);
+if (rc == NO_ERROR) rc = path_translate(pszNew, new_path);
+if (rc != NO_ERROR) TRACE_RETURN(rc, 0, ulOptions, 0);
+// Files being written may still have data to write behind
+wb_flush_all();
+if (__atomic_load_n(&io_files, __ATOMIC_RELAXED)) io_sync_all();
+struct stat si, so;
+int in = open(old_path, O_RDONLY);
+if (in < 0) TRACE_RETURN(errno_to_os2(errno), 0, ulOptions, 0);
+if (fstat(in, &si) < 0 || S_ISDIR(si.st_mode)) {
+    close(in);
+    TRACE_RETURN(ERROR_ACCESS_DENIED, 0, ulOptions, 0);
+}
+
+// Truncate only once the target is known not to be the source
+int replace = ulOptions & (DCPY_EXISTING | DCPY_APPEND);
+int out = open(new_path, O_WRONLY | O_CREAT | (replace ? 0 : O_EXCL), si.st_mode & 0777);
+if (out < 0) {
+    rc = errno == EEXIST ? ERROR_ACCESS_DENIED : errno_to_os2(errno);
+} else if (fstat(out, &so) < 0 || (so.st_dev == si.st_dev && so.st_ino == si.st_ino)) {
+    rc = ERROR_ACCESS_DENIED;
+} else if ((ulOptions & DCPY_APPEND ? lseek(out, 0, SEEK_END) : ftruncate(out, 0)) < 0) {
+    rc = errno_to_os2(errno);
+}
+int64_t moved = rc == NO_ERROR ? fd_transfer(in, out) : 0;
+if (moved < 0) rc = errno_to_os2(errno);
+close(in);
+if (out >= 0) close(out);
+TRACE_RETURN(rc, moved > 0 ? moved : 0, ulOptions, 0);
+}
+
+void APIENTRY DosExit(ULONG ulAction, ULONG ulResult) {
+TRACE_ENTER(TRACE_EXIT, NULL);
+TRACE_POINT(NO_ERROR, ulResult, ulAction, 0);
+// Any thread but thread 1 can end alone; thread 1 ending ends the process
+if (ulAction == EXIT_THREAD && t_thread && t_thread->tib2.tib2_ultid != 1) pthread_exit(NULL);
+exit(ulResult);
+}
+
+APIRET APIENTRY DosSleep(ULONG ulMilliseconds) {
+TRACE_ENTER(TRACE_SLEEP, NULL);
+wb_flush_console();
+usleep(ulMilliseconds * 1000);
+TRACE_RETURN(NO_ERROR, ulMilliseconds, 0, 0);
+}
+
+APIRET APIENTRY DosAllocMem(PVOID* ppBaseAddress, ULONG ulSize, ULONG ulFlags) {
+TRACE_ENTER(TRACE_ALLOC, NULL);
+if (ulSize == 0 || !(ulFlags & PAG_ACCESS) ||
+    (ulFlags & ~(PAG_ACCESS | PAG_GUARD | PAG_COMMIT | OBJ_TILE | OBJ_ANY))) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, ulSize, ulFlags, 0);
+}
+
+size_t size = ((size_t)ulSize + VM_PAGE - 1) & ~(size_t)(VM_PAGE - 1);
+vm_region_t region = { 0, size, ulFlags & PAG_ACCESS, malloc(size / VM_PAGE) };
+uint8_t *mem = region.pages ? vm_reserve(size) : NULL;
+if (!mem) {
+    free(region.pages);
+    TRACE_RETURN(ERROR_NOT_ENOUGH_MEMORY, ulSize, ulFlags, 0);
+}
+region.base = (uintptr_t)mem;
+memset(region.pages, ulFlags & (PAG_ACCESS | PAG_GUARD | PAG_COMMIT), size / VM_PAGE);
+
+int failed = (ulFlags & PAG_COMMIT) && mprotect(mem, size, vm_prot(ulFlags)) < 0;
+if (!failed) {
+    vm_lock();
+    failed = vm_insert(&region) < 0;
+    vm_unlock();
+}
+if (failed) {
+    munmap(mem, size);
+    free(region.pages);
+    TRACE_RETURN(ERROR_NOT_ENOUGH_MEMORY, ulSize, ulFlags, 0);
+}
+
+*ppBaseAddress = mem;
+TRACE_RETURN(NO_ERROR, ulSize, ulFlags, (uintptr_t)mem);
+}
+
+APIRET APIENTRY DosFreeMem(PVOID pBaseAddress) {
+TRACE_ENTER(TRACE_FREE, NULL);
+vm_lock();
+vm_region_t *r = vm_find((uintptr_t)pBaseAddress);
+if (!r || r->base != (uintptr_t)pBaseAddress) {
+    vm_unlock();
+    TRACE_RETURN(ERROR_INVALID_ADDRESS, (uintptr_t)pBaseAddress, 0, 0);
+}
+vm_region_t region = *r;
+uint32_t i = r - vm_regions;
+memmove(&vm_regions[i], &vm_regions[i + 1], (vm_region_count - i - 1) * sizeof(vm_region_t));
+vm_region_count--;
+vm_unlock();
+
+munmap((void*)region.base, region.size);
+free(region.pages);
+TRACE_RETURN(NO_ERROR, region.base, region.size, 0);
+}
+
+// Commit (PAG_COMMIT), decommit (PAG_DECOMMIT) or change the access of
+// the pages covering [pb, pb + cb), all inside one allocation. Committing
+// needs every page uncommitted, the others every page committed.
+APIRET APIENTRY DosSetMem(PVOID pb, ULONG cb, ULONG flag) {
+TRACE_ENTER(TRACE_SETMEM, NULL);
+uintptr_t start = (uintptr_t)pb & ~(uintptr_t)(VM_PAGE - 1);
+uintptr_t end = ((uintptr_t)pb + cb + VM_PAGE - 1) & ~(uintptr_t)(VM_PAGE - 1);
+uint32_t access = flag & PAG_ACCESS;
+int decommit = (flag & PAG_DECOMMIT) != 0;
+
+if (cb == 0 || (flag & ~(PAG_ACCESS | PAG_GUARD | PAG_COMMIT | PAG_DECOMMIT | PAG_DEFAULT)) ||
+    ((flag & PAG_COMMIT) && decommit) || ((flag & PAG_DEFAULT) && access) ||
+    (!decommit && !access && !(flag & PAG_DEFAULT))) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, (uintptr_t)pb, cb, flag);
+}
+
+vm_lock();
+vm_region_t *r = vm_find(start);
+if (!r || end > r->base + r->size) {
+    vm_unlock();
+    TRACE_RETURN(ERROR_INVALID_ADDRESS, (uintptr_t)pb, cb, flag);
+}
+
+uint8_t *pages = r->pages + (start - r->base) / VM_PAGE;
+size_t count = (end - start) / VM_PAGE;
+uint8_t committed = (flag & PAG_COMMIT) ? 0 : PAG_COMMIT;
+for (size_t i = 0; i < count; i++) {
+    if ((pages[i] & PAG_COMMIT) != committed) {
+        vm_unlock();
+        TRACE_RETURN(ERROR_ACCESS_DENIED, (uintptr_t)pb, cb, flag);
+    }
+}
+
+APIRET rc = NO_ERROR;
+if (decommit) {
+    // Zero-fill (and free) the pages, then make them inaccessible again
+    if (madvise((void*)start, end - start, MADV_DONTNEED) < 0 ||
+        mprotect((void*)start, end - start, PROT_NONE) < 0) {
+        rc = errno_to_os2(errno);
+    } else {
+        memset(pages, r->flags, count);
+    }
+} else {
+    uint8_t state = (flag & PAG_DEFAULT ? r->flags : access) | (flag & PAG_GUARD) | PAG_COMMIT;
+    if (mprotect((void*)start, end - start, vm_prot(state)) < 0) {
+        rc = errno_to_os2(errno);
+    } else {
+        memset(pages, state, count);
+    }
+}
+vm_unlock();
+TRACE_RETURN(rc, (uintptr_t)pb, cb, flag);
+}
+
+// Attributes of the pages from pb on: *pcb bytes at most (0: to the end
+// of the allocation) sharing the first page's state. Unallocated space is
+// PAG_FREE up to the next allocation.
+APIRET APIENTRY DosQueryMem(PVOID pb, PULONG pcb, PULONG pFlag) {
+TRACE_ENTER(TRACE_QUERYMEM, NULL);
+if (!pcb || !pFlag) TRACE_RETURN(ERROR_INVALID_PARAMETER, (uintptr_t)pb, 0, 0);
+uintptr_t addr = (uintptr_t)pb & ~(uintptr_t)(VM_PAGE - 1);
+size_t limit = *pcb ? ((uintptr_t)pb + *pcb + VM_PAGE - 1 - addr) /
+                      VM_PAGE * VM_PAGE : SIZE_MAX;
+size_t size;
+ULONG flags;
+
+vm_lock();
+uint32_t i = vm_search(addr);
+if (i == vm_region_count || vm_regions[i].base > addr) {
+    uintptr_t next = i < vm_region_count ? vm_regions[i].base : UINT32_MAX + (uintptr_t)1;
+    size = next > addr ? next - addr : VM_PAGE;
+    flags = PAG_FREE;
+} else {
+    const vm_region_t *r = &vm_regions[i];
+    size_t first = (addr - r->base) / VM_PAGE, total = r->size / VM_PAGE;
+    size_t n = 1;
+    while (first + n < total && n * VM_PAGE < limit && r->pages[first + n] == r->pages[first]) {
+        n++;
+    }
+    size = n * VM_PAGE;
+    flags = r->pages[first] | (addr == r->base ? PAG_BASE : 0);
+}
+vm_unlock();
+
+if (size > limit) size = limit;
+*pcb = size > UINT32_MAX ? UINT32_MAX : size;
+*pFlag = flags;
+TRACE_RETURN(NO_ERROR, (uintptr_t)pb, *pcb, flags);
+}
+
+APIRET APIENTRY DosGetMessage(PCHAR *ppStrings, ULONG ulStrings, PCHAR pBuffer,
+ULONG ulBufferLength, ULONG ulMsgNumber,
+PCSZ pszMsgFile, PULONG pulMsgLength) {
+TRACE_ENTER(TRACE_GETMESSAGE, NULL);
+// Simplified: just return empty message
+if (pulMsgLength) *pulMsgLength = 0;
+TRACE_RETURN(NO_ERROR, ulMsgNumber, 0, 0);
+}
+
+APIRET APIENTRY DosPutMessage(HFILE hFile, ULONG ulLength, PCHAR pBuffer) {
+TRACE_ENTER(TRACE_PUTMESSAGE, NULL);
+ULONG written;
+TRACE_RETURN(DosWrite(hFile, pBuffer, ulLength, &written), hFile, ulLength, 0);
+}
+
+// ============================================================================
+// Sub-allocated Heaps
+// ============================================================================
+//
+// DosSubSetMem turns a block (normally from DosAllocMem) into a heap whose
+// state lives entirely in the block: a control header at the start, then
+// the heap. Like OS/2, DosSubFreeMem is told the size, so allocations carry
+// no header of their own. Free chunks hold their size and the offset of
+// the next chunk; chunks of up to SUB_SMALL bytes sit on one LIFO list per
+// 8-byte size class, with a bitmap of non-empty classes, so allocating and
+// freeing them is O(1). Space never handed out is taken from 'top'.
+// Adjacent free chunks are only merged when an allocation would otherwise
+// fail, keeping the common path free of neighbour lookups.
+
+typedef struct {
+uint32_t next;          // Offset of the next free chunk; 0: end
+uint32_t size;
+} sub_chunk_t;
+
+#define SUB_CHUNK(h, off)   ((sub_chunk_t*)((uint8_t*)(h) + (off)))
+
+static void sub_lock(sub_heap_t *h) {
+if (!(h->flags & DOSSUB_SERIALIZE)) return;
+while (__atomic_exchange_n(&h->lock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&h->lock, __ATOMIC_RELAXED)) { }
+}
+}
+
+static void sub_unlock(sub_heap_t *h) {
+if (h->flags & DOSSUB_SERIALIZE) __atomic_store_n(&h->lock, 0, __ATOMIC_RELEASE);
+}
+
+static void sub_push(sub_heap_t *h, uint32_t off, uint32_t size) {
+sub_chunk_t *c = SUB_CHUNK(h, off);
+c->size = size;
+if (size <= SUB_SMALL) {
+    uint32_t cls = size / SUB_GRAIN - 1;
+    c->next = h->classes[cls];
+    h->classes[cls] = off;
+    h->nonempty |= 1ull << cls;
+} else {
+    c->next = h->large;
+    h->large = off;
+}
+}
+
+static uint32_t sub_pop(sub_heap_t *h, uint32_t cls) {
+uint32_t off = h->classes[cls];
+h->classes[cls] = SUB_CHUNK(h, off)->next;
+if (!h->classes[cls]) h->nonempty &= ~(1ull << cls);
+return off;
+}
+
+// Hand out the first 'size' bytes of a free chunk, returning the rest
+static uint32_t sub_split(sub_heap_t *h, uint32_t off, uint32_t chunk, uint32_t size) {
+if (chunk > size) sub_push(h, off + size, chunk - size);
+return off;
+}
+
+// Commit the pages of a sparse heap from *committed up to 'end'
+static int sub_commit(uint8_t *heap, uint32_t *committed, uint32_t end) {
+uintptr_t page = (uintptr_t)(heap + *committed) & ~(uintptr_t)(VM_PAGE - 1);
+uintptr_t limit = (uintptr_t)(heap + end);
+while (page < limit) {
+    ULONG cb = limit - page, flags;
+    if (DosQueryMem((PVOID)page, &cb, &flags) != NO_ERROR || (flags & PAG_FREE)) return -1;
+    if (!(flags & PAG_COMMIT) && DosSetMem((PVOID)page, cb, PAG_COMMIT | PAG_DEFAULT) != NO_ERROR) {
+        return -1;
+    }
+    page += cb;
+}
+*committed = page - (uintptr_t)heap;
+return 0;
+}
+
+// Sort a chunk list by offset (merge sort on the list itself)
+static uint32_t sub_sort(sub_heap_t *h, uint32_t list) {
+if (!list || !SUB_CHUNK(h, list)->next) return list;
+
+uint32_t slow = list, fast = SUB_CHUNK(h, list)->next;
+while (fast && SUB_CHUNK(h, fast)->next) {
+    slow = SUB_CHUNK(h, slow)->next;
+    fast = SUB_CHUNK(h, SUB_CHUNK(h, fast)->next)->next;
+}
+uint32_t a = SUB_CHUNK(h, slow)->next;
+SUB_CHUNK(h, slow)->next = 0;
+uint32_t b = sub_sort(h, list);
+a = sub_sort(h, a);
+
+uint32_t head = 0, *tail = &head;
+while (a && b) {
+    uint32_t *first = a < b ? &a : &b;
+    *tail = *first;
+    tail = &SUB_CHUNK(h, *first)->next;
+    *first = *tail;
+}
+*tail = a ? a : b;
+return head;
+}
+
+// Merge adjacent free chunks, and those ending at 'top' into it. Returns
+// -1 if chunks overlap (a block freed twice or with the wrong size). Such
+// a heap's lists may loop, so chunks are marked (size bit 0) as gathered.
+static int sub_coalesce(sub_heap_t *h) {
+uint32_t all = 0;
+for (uint32_t cls = 0; cls <= SUB_CLASSES; cls++) {
+    uint32_t *list = cls < SUB_CLASSES ? &h->classes[cls] : &h->large;
+    uint32_t off = *list;
+    while (off) {
+        if (SUB_CHUNK(h, off)->size & 1) return -1;
+        SUB_CHUNK(h, off)->size |= 1;
+        uint32_t next = SUB_CHUNK(h, off)->next;
+        SUB_CHUNK(h, off)->next = all;
+        all = off;
+        off = next;
+    }
+    *list = 0;
+}
+h->nonempty = 0;
+
+all = sub_sort(h, all);
+int rc = 0;
+uint32_t run = 0, run_size = 0;
+while (all) {
+    sub_chunk_t *c = SUB_CHUNK(h, all);
+    uint32_t next = c->next, size = c->size & ~1u;
+    if (run && run + run_size > all) rc = -1;
+    if (run && run + run_size >= all) {
+        if (all + size > run + run_size) run_size = all + size - run;
+    } else {
+        if (run) sub_push(h, run, run_size);
+        run = all;
+        run_size = size;
+    }
+    all = next;
+}
+if (run && run + run_size >= h->top) h->top = run;
+else if (run) sub_push(h, run, run_size);
+return rc;
+}
+
+// Offset of a free 'size' bytes in *off, or 0 if there is no room
+static APIRET sub_alloc(sub_heap_t *h, uint32_t size, uint32_t *off) {
+for (int pass = 0; pass < 2; pass++) {
+    if (size <= SUB_SMALL) {
+        uint32_t cls = size / SUB_GRAIN - 1;
+        if (h->classes[cls]) {
+            *off = sub_pop(h, cls);
+            return NO_ERROR;
+        }
+        uint64_t larger = cls + 1 < SUB_CLASSES ? h->nonempty >> (cls + 1) << (cls + 1) : 0;
+        if (larger) {
+            uint32_t from = __builtin_ctzll(larger);
+            *off = sub_split(h, sub_pop(h, from), (from + 1) * SUB_GRAIN, size);
+            return NO_ERROR;
+        }
+    }
+
+    uint32_t limit = h->top / SUB_GRAIN;
+    for (uint32_t *link = &h->large; *link && limit; link = &SUB_CHUNK(h, *link)->next, limit--) {
+        sub_chunk_t *c = SUB_CHUNK(h, *link);
+        if (c->size >= size) {
+            uint32_t chunk = *link;
+            *link = c->next;
+            *off = sub_split(h, chunk, c->size, size);
+            return NO_ERROR;
+        }
+    }
+
+    if (size <= h->size - h->top && (!(h->flags & DOSSUB_SPARSE_OBJ) ||
+        sub_commit((uint8_t*)h, &h->committed, h->top + size) == 0)) {
+        *off = h->top;
+        h->top += size;
+        return NO_ERROR;
+    }
+    if (pass == 0 && sub_coalesce(h) < 0) return ERROR_DOSSUB_CORRUPTED;
+}
+return ERROR_DOSSUB_NOMEM;
+}
+
+static sub_heap_t *sub_heap(PVOID pbBase) {
+sub_heap_t *h = pbBase;
+return h && h->magic == SUB_MAGIC ? h : NULL;
+}
+
+APIRET APIENTRY DosSubSetMem(PVOID pbBase, ULONG flag, ULONG cb) {
+TRACE_ENTER(TRACE_SUBSETMEM, NULL);
+sub_heap_t *h = pbBase;
+uint32_t size = cb & ~(SUB_GRAIN - 1);
+
+if ((flag & ~(DOSSUB_INIT | DOSSUB_GROW | DOSSUB_SPARSE_OBJ | DOSSUB_SERIALIZE)) ||
+    ((flag & DOSSUB_INIT) && (flag & DOSSUB_GROW))) {
+    TRACE_RETURN(ERROR_DOSSUB_BADFLAG, (uintptr_t)pbBase, flag, cb);
+}
+if (!h || ((uintptr_t)h & (SUB_GRAIN - 1)) || size < sizeof(sub_heap_t) + SUB_GRAIN) {
+    TRACE_RETURN(ERROR_INVALID_PARAMETER, (uintptr_t)pbBase, flag, cb);
+}
+
+if (flag & DOSSUB_INIT) {
+    // A sparse heap's header may not be committed yet
+    uint32_t committed = 0;
+    if ((flag & DOSSUB_SPARSE_OBJ) && sub_commit(pbBase, &committed, sizeof(sub_heap_t)) < 0) {
+        TRACE_RETURN(ERROR_DOSSUB_NOMEM, (uintptr_t)pbBase, flag, cb);
+    }
+    memset(h, 0, sizeof(*h));
+    h->flags = flag & (DOSSUB_SPARSE_OBJ | DOSSUB_SERIALIZE);
+    h->size = size;
+    h->top = sizeof(sub_heap_t);
+    h->committed = committed;
+    h->magic = SUB_MAGIC;
+    TRACE_RETURN(NO_ERROR, (uintptr_t)pbBase, flag, cb);
+}
+
+// Without DOSSUB_INIT the heap must exist already (attach, or grow)
+if (!sub_heap(pbBase)) TRACE_RETURN(ERROR_DOSSUB_CORRUPTED, (uintptr_t)pbBase, flag, cb);
+APIRET rc = NO_ERROR;
+if (flag & DOSSUB_GROW) {
+    sub_lock(h);
+    if (size < h->size) rc = ERROR_DOSSUB_SHRINK;
+    else h->size = size;
+    sub_unlock(h);
+}
+TRACE_RETURN(rc, (uintptr_t)pbBase, flag, cb);
+}
+
+APIRET APIENTRY DosSubAllocMem(PVOID pbBase, PVOID *ppb, ULONG cb) {
+TRACE_ENTER(TRACE_SUBALLOCMEM, NULL);
+sub_heap_t *h = sub_heap(pbBase);
+if (!h) TRACE_RETURN(ERROR_DOSSUB_CORRUPTED, (uintptr_t)pbBase, cb, 0);
+if (cb == 0 || cb > h->size) TRACE_RETURN(ERROR_DOSSUB_NOMEM, (uintptr_t)pbBase, cb, 0);
+
+uint32_t size = (cb + SUB_GRAIN - 1) & ~(SUB_GRAIN - 1);
+uint32_t off;
+sub_lock(h);
+APIRET rc = sub_alloc(h, size, &off);
+sub_unlock(h);
+if (rc != NO_ERROR) TRACE_RETURN(rc, (uintptr_t)pbBase, cb, 0);
+
+*ppb = (uint8_t*)h + off;
+TRACE_RETURN(NO_ERROR, (uintptr_t)pbBase, cb, (uintptr_t)*ppb);
+}
+
+APIRET APIENTRY DosSubFreeMem(PVOID pbBase, PVOID pb, ULONG cb) {
+TRACE_ENTER(TRACE_SUBFREEMEM, NULL);
+sub_heap_t *h = sub_heap(pbBase);
+if (!h) TRACE_RETURN(ERROR_DOSSUB_CORRUPTED, (uintptr_t)pbBase, (uintptr_t)pb, cb);
+
+uintptr_t off = (uintptr_t)pb - (uintptr_t)h;
+uint32_t size = (cb + SUB_GRAIN - 1) & ~(SUB_GRAIN - 1);
+sub_lock(h);
+if (cb == 0 || (off & (SUB_GRAIN - 1)) || off < sizeof(sub_heap_t) || off >= h->top ||
+    size > h->top - off) {
+    sub_unlock(h);
+    TRACE_RETURN(ERROR_DOSSUB_OVERLAP, (uintptr_t)pbBase, (uintptr_t)pb, cb);
+}
+if (off + size == h->top) h->top = off;
+else sub_push(h, off, size);
+sub_unlock(h);
+TRACE_RETURN(NO_ERROR, (uintptr_t)pbBase, (uintptr_t)pb, cb);
+}
+
+APIRET APIENTRY DosSubUnsetMem(PVOID pbBase) {
+TRACE_ENTER(TRACE_SUBUNSETMEM, NULL);
+sub_heap_t *h = sub_heap(pbBase);
+if (!h) TRACE_RETURN(ERROR_DOSSUB_CORRUPTED, (uintptr_t)pbBase, 0, 0);
+h->magic = 0;
+TRACE_RETURN(NO_ERROR, (uintptr_t)pbBase, 0, 0);
+}
@@ -0,0 +1,561 @@
+// OS/2 API runtime shared by os2run, os2bench and os2_emulator: file
+// handles, memory, threads, semaphores, queues, tracing. The first part
+// is the OS/2 API itself; Runtime Internals is what the loader, os2bench
+// and the emulator's tests use besides.
+
+#ifndef OS2_RUNTIME_H
+#define OS2_RUNTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// ============================================================================
+// OS/2 API Type Definitions
+// ============================================================================
+
+typedef uint32_t APIRET;
+typedef uint32_t HFILE;
+typedef uint32_t ULONG;
+typedef uint16_t USHORT;
+typedef uint8_t  UCHAR;
+typedef char*    PSZ;
+typedef char*    PCHAR;
+typedef const char* PCSZ;
+typedef void*    PVOID;
+typedef HFILE*   PHFILE;
+typedef ULONG*   PULONG;
+typedef USHORT*  PUSHORT;
+typedef int32_t  LONG;
+
+#define APIENTRY
+
+// OS/2 Error Codes
+#define NO_ERROR                0
+#define ERROR_INVALID_FUNCTION  1
+#define ERROR_FILE_NOT_FOUND    2
+#define ERROR_PATH_NOT_FOUND    3
+#define ERROR_TOO_MANY_OPEN_FILES 4
+#define ERROR_ACCESS_DENIED     5
+#define ERROR_INVALID_HANDLE    6
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_INVALID_DRIVE     15
+#define ERROR_NOT_FROZEN        90
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_TOO_MANY_SEM_REQUESTS 103
+#define ERROR_BROKEN_PIPE       109
+#define ERROR_INVALID_TARGET_HANDLE 114
+#define ERROR_INVALID_NAME      123
+#define ERROR_MAX_THRDS_REACHED 164
+#define ERROR_SEM_NOT_FOUND     187
+#define ERROR_FILENAME_EXCED_RANGE 206
+#define ERROR_TOO_MANY_SEMAPHORES 284
+#define ERROR_DUPLICATE_NAME    285
+#define ERROR_EMPTY_MUXWAIT     286
+#define ERROR_NOT_OWNER         288
+#define ERROR_TOO_MANY_HANDLES  290
+#define ERROR_WRONG_TYPE        292
+#define ERROR_THREAD_NOT_TERMINATED 294
+#define ERROR_TOO_MANY_POSTS    298
+#define ERROR_ALREADY_POSTED    299
+#define ERROR_ALREADY_RESET     300
+#define ERROR_SEM_BUSY          301
+#define ERROR_INVALID_PROCID    303
+#define ERROR_INVALID_PDELTA    304
+#define ERROR_INVALID_PCLASS    307
+#define ERROR_INVALID_SCOPE     308
+#define ERROR_INVALID_THREADID  309
+#define ERROR_DOSSUB_SHRINK     310
+#define ERROR_DOSSUB_NOMEM      311
+#define ERROR_DOSSUB_OVERLAP    312
+#define ERROR_DOSSUB_BADFLAG    314
+#define ERROR_QUE_PROC_NOT_OWNED 330
+#define ERROR_QUE_DUPLICATE     332
+#define ERROR_QUE_ELEMENT_NOT_EXIST 333
+#define ERROR_QUE_NO_MEMORY     334
+#define ERROR_QUE_INVALID_NAME  335
+#define ERROR_QUE_INVALID_PRIORITY 336
+#define ERROR_QUE_INVALID_HANDLE 337
+#define ERROR_QUE_EMPTY         342
+#define ERROR_QUE_NAME_NOT_EXIST 343
+#define ERROR_INVALID_ADDRESS   487
+#define ERROR_DOSSUB_CORRUPTED  532
+#define ERROR_TIMEOUT           640
+
+// DosOpen flags
+#define OPEN_ACTION_FAIL_IF_EXISTS     0x0000
+#define OPEN_ACTION_OPEN_IF_EXISTS     0x0001
+#define OPEN_ACTION_REPLACE_IF_EXISTS  0x0002
+#define OPEN_ACTION_FAIL_IF_NEW        0x0000
+#define OPEN_ACTION_CREATE_IF_NEW      0x0010
+
+#define OPEN_SHARE_DENYREADWRITE       0x0010
+#define OPEN_SHARE_DENYWRITE           0x0020
+#define OPEN_SHARE_DENYREAD            0x0030
+#define OPEN_SHARE_DENYNONE            0x0040
+
+#define OPEN_ACCESS_READONLY           0x0000
+#define OPEN_ACCESS_WRITEONLY          0x0001
+#define OPEN_ACCESS_READWRITE          0x0002
+
+#define OPEN_FLAGS_WRITE_THROUGH       0x4000
+
+#define FILE_NORMAL    0x0000
+#define FILE_READONLY  0x0001
+
+#define FILE_EXISTED   1
+#define FILE_CREATED   2
+#define FILE_TRUNCATED 3
+
+#define FILE_BEGIN   0
+#define FILE_CURRENT 1
+#define FILE_END     2
+
+// DosCopy options
+#define DCPY_EXISTING  0x0001
+#define DCPY_APPEND    0x0002
+#define DCPY_FAILEAS   0x0004
+
+// DosCreatePipe buffer sizes; Linux's own default is 64 KB
+#define PIPE_BUFFER_DEFAULT (64u << 10)
+#define PIPE_BUFFER_MIN     (1u << 20)
+#define PIPE_BUFFER_MAX     (16u << 20)
+
+// Virtual Memory
+
+#define PAG_READ        0x0001
+#define PAG_WRITE       0x0002
+#define PAG_EXECUTE     0x0004
+#define PAG_GUARD       0x0008
+#define PAG_COMMIT      0x0010
+#define PAG_DECOMMIT    0x0020
+#define OBJ_TILE        0x0040
+#define PAG_DEFAULT     0x0400
+#define OBJ_ANY         0x0400              // DosAllocMem: may be above 512 MB (ignored)
+#define PAG_FREE        0x4000
+#define PAG_BASE        0x10000
+
+// Threads
+
+typedef uint32_t TID;
+typedef TID*     PTID;
+typedef void (APIENTRY *PFNTHREAD)(ULONG);
+
+#define CREATE_READY            0
+#define CREATE_SUSPENDED        1
+#define STACK_COMMITTED         2
+
+#define DCWW_WAIT               0
+#define DCWW_NOWAIT             1
+
+#define EXIT_THREAD             0
+#define EXIT_PROCESS            1
+
+#define PRTYS_PROCESS           0
+#define PRTYS_PROCESSTREE       1
+#define PRTYS_THREAD            2
+
+#define PRTYC_NOCHANGE          0
+#define PRTYC_IDLETIME          1
+#define PRTYC_REGULAR           2
+#define PRTYC_TIMECRITICAL      3
+#define PRTYC_FOREGROUNDSERVER  4
+#define PRTYD_MAXIMUM           31
+
+#define THREAD_MAX          4096            // TIDs 1..4095, as on OS/2
+#define THREAD_STACK_MIN    0x10000         // Emulator and libc code run on it too
+#define TLS_WORDS           32              // Thread-local memory per thread
+
+typedef struct {
+ULONG tib2_ultid;
+ULONG tib2_ulpri;       // Class << 8 | level
+ULONG tib2_version;
+USHORT tib2_usMCCount;
+USHORT tib2_fMCForceFlag;
+} TIB2, *PTIB2;
+
+typedef struct {
+PVOID tib_pexchain;     // Exception handler chain
+PVOID tib_pstack;       // Lowest stack address
+PVOID tib_pstacklimit;  // End of the stack
+PTIB2 tib_ptib2;
+ULONG tib_version;
+ULONG tib_ordinal;
+} TIB, *PTIB;
+
+typedef struct {
+ULONG pib_ulpid;
+ULONG pib_ulppid;
+ULONG pib_hmte;
+PCHAR pib_pchcmd;       // Program, NUL, arguments, NUL NUL
+PCHAR pib_pchenv;       // VAR=value strings, each NUL-terminated, then NUL
+ULONG pib_flstatus;
+ULONG pib_ultype;
+} PIB, *PPIB;
+
+// Semaphores
+
+typedef ULONG HEV;
+typedef HEV*  PHEV;
+typedef ULONG HMTX;
+typedef HMTX* PHMTX;
+typedef ULONG HMUX;
+typedef HMUX* PHMUX;
+typedef ULONG HSEM;     // Any of the three (a pointer type on OS/2)
+typedef uint32_t BOOL32;
+
+#define FALSE 0
+#define TRUE  1
+
+typedef struct {
+HSEM hsemCur;
+ULONG ulUser;
+} SEMRECORD, *PSEMRECORD;
+
+#define DC_SEM_SHARED           0x01
+#define DCMW_WAIT_ANY           0x02
+#define DCMW_WAIT_ALL           0x04
+
+#define SEM_INDEFINITE_WAIT     ((ULONG)-1)
+#define SEM_IMMEDIATE_RETURN    0
+
+// Queues
+
+typedef ULONG PID;
+typedef PID*  PPID;
+typedef ULONG HQUEUE;
+typedef HQUEUE* PHQUEUE;
+typedef uint8_t BYTE;
+typedef BYTE* PBYTE;
+typedef PVOID* PPVOID;
+
+typedef struct {
+PID pid;                // Writer
+ULONG ulData;           // DosWriteQueue's request
+} REQUESTDATA, *PREQUESTDATA;
+
+#define QUE_FIFO                0
+#define QUE_LIFO                1
+#define QUE_PRIORITY            2
+#define QUE_CONVERT_ADDRESS     4           // 16-bit addresses; nothing to do here
+
+// Sub-allocated Heaps
+
+#define DOSSUB_INIT         0x01
+#define DOSSUB_GROW         0x02
+#define DOSSUB_SPARSE_OBJ   0x04
+#define DOSSUB_SERIALIZE    0x08
+
+// ============================================================================
+// OS/2 API
+// ============================================================================
+
+APIRET APIENTRY DosCreateThread(PTID ptid, PFNTHREAD pfn, ULONG param, ULONG flag, ULONG cbStack);
+APIRET APIENTRY DosResumeThread(TID tid);
+APIRET APIENTRY DosWaitThread(PTID ptid, ULONG option);
+APIRET APIENTRY DosGetInfoBlocks(PTIB *pptib, PPIB *pppib);
+APIRET APIENTRY DosSetPriority(ULONG scope, ULONG ulClass, LONG delta, ULONG id);
+APIRET APIENTRY DosAllocThreadLocalMemory(ULONG cb, PULONG *p);
+APIRET APIENTRY DosFreeThreadLocalMemory(PULONG p);
+APIRET APIENTRY DosCreateEventSem(PCSZ pszName, PHEV phev, ULONG flAttr, BOOL32 fState);
+APIRET APIENTRY DosOpenEventSem(PCSZ pszName, PHEV phev);
+APIRET APIENTRY DosCloseEventSem(HEV hev);
+APIRET APIENTRY DosPostEventSem(HEV hev);
+APIRET APIENTRY DosWaitEventSem(HEV hev, ULONG ulTimeout);
+APIRET APIENTRY DosResetEventSem(HEV hev, PULONG pulPostCt);
+APIRET APIENTRY DosCreateMutexSem(PCSZ pszName, PHMTX phmtx, ULONG flAttr, BOOL32 fState);
+APIRET APIENTRY DosOpenMutexSem(PCSZ pszName, PHMTX phmtx);
+APIRET APIENTRY DosCloseMutexSem(HMTX hmtx);
+APIRET APIENTRY DosRequestMutexSem(HMTX hmtx, ULONG ulTimeout);
+APIRET APIENTRY DosReleaseMutexSem(HMTX hmtx);
+APIRET APIENTRY DosCreateMuxWaitSem(PCSZ pszName, PHMUX phmux, ULONG cSemRec, PSEMRECORD pSemRec, ULONG flAttr);
+APIRET APIENTRY DosCloseMuxWaitSem(HMUX hmux);
+APIRET APIENTRY DosWaitMuxWaitSem(HMUX hmux, ULONG ulTimeout, PULONG pulUser);
+APIRET APIENTRY DosCreateQueue(PHQUEUE phq, ULONG priority, PCSZ pszName);
+APIRET APIENTRY DosOpenQueue(PPID ppid, PHQUEUE phq, PCSZ pszName);
+APIRET APIENTRY DosCloseQueue(HQUEUE hq);
+APIRET APIENTRY DosWriteQueue(HQUEUE hq, ULONG request, ULONG cbData, PVOID pbData, ULONG priority);
+APIRET APIENTRY DosReadQueue(HQUEUE hq, PREQUESTDATA pRequest, PULONG pcbData, PPVOID ppbuf, ULONG element, BOOL32 wait, PBYTE ppriority, HEV hsem);
+APIRET APIENTRY DosPurgeQueue(HQUEUE hq);
+APIRET APIENTRY DosQueryQueue(HQUEUE hq, PULONG pcbEntries);
+APIRET APIENTRY DosOpen(PCSZ pszFileName, PHFILE pHandle, PULONG pulAction, ULONG ulFileSize, ULONG ulAttribute, ULONG ulOpenFlags, ULONG ulOpenMode, PVOID peaop2);
+APIRET APIENTRY DosRead(HFILE hFile, PVOID pBuffer, ULONG ulLength, PULONG pulBytesRead);
+APIRET APIENTRY DosWrite(HFILE hFile, PVOID pBuffer, ULONG ulLength, PULONG pulBytesWritten);
+APIRET APIENTRY DosClose(HFILE hFile);
+APIRET APIENTRY DosDupHandle(HFILE hFile, PHFILE phfNew);
+APIRET APIENTRY DosSetFilePtr(HFILE hFile, LONG lOffset, ULONG ulOrigin, PULONG pulNewPtr);
+APIRET APIENTRY DosResetBuffer(HFILE hFile);
+APIRET APIENTRY DosDelete(PCSZ pszFileName);
+APIRET APIENTRY DosCreatePipe(PHFILE phfRead, PHFILE phfWrite, ULONG cb);
+APIRET APIENTRY DosCopy(PCSZ pszOld, PCSZ pszNew, ULONG ulOptions);
+void APIENTRY DosExit(ULONG ulAction, ULONG ulResult);
+APIRET APIENTRY DosSleep(ULONG ulMilliseconds);
+APIRET APIENTRY DosAllocMem(PVOID* ppBaseAddress, ULONG ulSize, ULONG ulFlags);
+APIRET APIENTRY DosFreeMem(PVOID pBaseAddress);
+APIRET APIENTRY DosSetMem(PVOID pb, ULONG cb, ULONG flag);
+APIRET APIENTRY DosQueryMem(PVOID pb, PULONG pcb, PULONG pFlag);
+APIRET APIENTRY DosGetMessage(PCHAR *ppStrings, ULONG ulStrings, PCHAR pBuffer, ULONG ulBufferLength, ULONG ulMsgNumber, PCSZ pszMsgFile, PULONG pulMsgLength);
+APIRET APIENTRY DosPutMessage(HFILE hFile, ULONG ulLength, PCHAR pBuffer);
+APIRET APIENTRY DosSubSetMem(PVOID pbBase, ULONG flag, ULONG cb);
+APIRET APIENTRY DosSubAllocMem(PVOID pbBase, PVOID *ppb, ULONG cb);
+APIRET APIENTRY DosSubFreeMem(PVOID pbBase, PVOID pb, ULONG cb);
+APIRET APIENTRY DosSubUnsetMem(PVOID pbBase);
+
+// ============================================================================
+// Runtime Internals
+// ============================================================================
+
+// Handles
+
+#define HANDLE_CHUNK_BITS 8
+#define HANDLE_CHUNK      (1u << HANDLE_CHUNK_BITS)
+#define HANDLE_CHUNKS     4096              // Up to 1M handles
+#define HANDLE_STD        3                 // stdin/stdout/stderr, never reused
+#define HANDLE_NONE       0xFFFFFFFFu
+
+typedef struct io_file io_file_t;
+typedef struct write_buffer write_buffer_t;
+
+typedef struct {
+int linux_fd;           // -1 while free
+uint32_t next_free;     // Next free handle while free
+char *path;             // Only while tracing
+io_file_t *io;          // Regular files under OS2_IO_URING
+write_buffer_t *wb;     // Terminals and regular files, see Write-Behind Buffers
+} handle_entry_t;
+
+extern handle_entry_t *handle_chunks[HANDLE_CHUNKS];
+
+static inline handle_entry_t *handle_entry(HFILE handle) {
+if (handle >= HANDLE_CHUNK * HANDLE_CHUNKS) return NULL;
+handle_entry_t *chunk = __atomic_load_n(&handle_chunks[handle >> HANDLE_CHUNK_BITS],
+                                        __ATOMIC_ACQUIRE);
+return chunk ? &chunk[handle & (HANDLE_CHUNK - 1)] : NULL;
+}
+
+void init_handle_table();
+HFILE allocate_handle(int linux_fd, const char *path);
+int get_linux_fd(HFILE handle);
+int free_handle(HFILE handle);
+APIRET errno_to_os2(int err);
+
+// File I/O
+
+extern int io_wanted;
+
+#define WB_SIZE (16u << 10)
+
+struct write_buffer {
+pthread_mutex_t lock;
+int tty;                // Written out at each newline
+int error;              // errno of a failed write of buffered data
+uint32_t len;
+char data[WB_SIZE];
+};
+
+extern int wb_wanted;
+write_buffer_t *wb_get(HFILE hFile);
+void wb_attach(HFILE hFile, int fd);
+int wb_detach(HFILE hFile);
+void wb_flush_all(void);
+
+int64_t fd_transfer(int in, int out);
+
+APIRET path_translate(const char *name, char *out);
+
+// Tracing
+
+static inline uint64_t now_ns(void) {
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+enum {
+TRACE_OPEN, TRACE_READ, TRACE_WRITE, TRACE_CLOSE, TRACE_SEEK, TRACE_DELETE,
+TRACE_EXIT, TRACE_SLEEP, TRACE_ALLOC, TRACE_FREE, TRACE_GETMESSAGE,
+TRACE_PUTMESSAGE, TRACE_RESOLVE, TRACE_SETMEM, TRACE_QUERYMEM, TRACE_SUBSETMEM,
+TRACE_SUBALLOCMEM, TRACE_SUBFREEMEM, TRACE_SUBUNSETMEM, TRACE_CREATETHREAD,
+TRACE_RESUMETHREAD, TRACE_WAITTHREAD, TRACE_GETINFOBLOCKS, TRACE_SETPRIORITY,
+TRACE_ALLOCTLS, TRACE_FREETLS, TRACE_CREATEEVENTSEM, TRACE_OPENEVENTSEM,
+TRACE_CLOSEEVENTSEM, TRACE_POSTEVENTSEM, TRACE_WAITEVENTSEM, TRACE_RESETEVENTSEM,
+TRACE_CREATEMUTEXSEM, TRACE_OPENMUTEXSEM, TRACE_CLOSEMUTEXSEM, TRACE_REQUESTMUTEXSEM,
+TRACE_RELEASEMUTEXSEM, TRACE_CREATEMUXWAITSEM, TRACE_CLOSEMUXWAITSEM,
+TRACE_WAITMUXWAITSEM, TRACE_CREATEQUEUE, TRACE_OPENQUEUE, TRACE_CLOSEQUEUE,
+TRACE_WRITEQUEUE, TRACE_READQUEUE, TRACE_PURGEQUEUE, TRACE_QUERYQUEUE, TRACE_CREATEPIPE,
+TRACE_DUPHANDLE, TRACE_COPY, TRACE_RESETBUFFER, TRACE_API_COUNT
+};
+
+#define TRACE_FORMAT      1
+#define TRACE_RING_EVENTS 4096              // Per thread, power of two
+#define TRACE_TEXT_TAIL   0x01              // 'text' is the end of a longer string
+
+// Trace file: trace_file_header_t, then event_count trace_event_t
+typedef struct {
+char magic[8];          // "OS2TRACE"
+uint32_t format;
+uint32_t event_size;
+uint64_t event_count;
+uint64_t dropped;       // Overwritten before the rings were written
+double ns_per_tick;     // Event clock to nanoseconds
+} trace_file_header_t;
+
+typedef struct {
+uint64_t start;         // Clock ticks since trace_init
+uint64_t duration;      // Clock ticks
+uint64_t args[3];       // Per call, see trace_print_event
+uint32_t rc;
+uint8_t api;            // TRACE_*
+uint8_t flags;          // TRACE_TEXT_TAIL
+uint16_t thread;        // In order of each thread's first traced call
+char text[16];          // Path or import name
+} trace_event_t;
+
+typedef struct trace_ring {
+struct trace_ring *next;
+uint64_t head;          // Events ever recorded; the last TRACE_RING_EVENTS are kept
+uint16_t thread;
+trace_event_t events[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+typedef struct {
+uint64_t start;         // 0: call not traced
+int api;
+const char *text;
+} trace_call_t;
+
+extern uint64_t g_trace_mask;
+
+// Events are stamped with the TSC where there is one: a clock_gettime at
+// each end of a call would cost more than the rest of the record
+static inline uint64_t trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+return __builtin_ia32_rdtsc();
+#else
+return now_ns();
+#endif
+}
+
+static inline trace_call_t trace_enter(int api, const char *text) {
+trace_call_t call = { 0, api, text };
+if (__builtin_expect(g_trace_mask >> api & 1, 0)) call.start = trace_clock();
+return call;
+}
+
+#ifndef OS2_NO_TRACE
+void trace_record(const trace_call_t *call, uint32_t rc,
+                  uint64_t a0, uint64_t a1, uint64_t a2);
+
+#define TRACE_ENTER(api, text) trace_call_t trace_call = trace_enter((api), (text))
+#define TRACE_POINT(rc, a0, a1, a2) \
+    do { if (trace_call.start) trace_record(&trace_call, (rc), (uint64_t)(a0), \
+                                            (uint64_t)(a1), (uint64_t)(a2)); } while (0)
+#else
+#define TRACE_ENTER(api, text) do { } while (0)
+#define TRACE_POINT(rc, a0, a1, a2) do { } while (0)
+#endif
+
+#define TRACE_RETURN(rc, a0, a1, a2) \
+    do { APIRET trace_rc = (rc); TRACE_POINT(trace_rc, a0, a1, a2); return trace_rc; } while (0)
+
+void trace_init(const char *spec);
+long trace_write(const char *path);
+void trace_flush(void);
+void trace_flush_fatal(void);
+long trace_decode(const char *path);
+extern const char *const trace_calls[TRACE_API_COUNT];
+extern char g_trace_path[PATH_MAX];
+
+// Virtual Memory
+
+#define PAG_ACCESS      (PAG_READ | PAG_WRITE | PAG_EXECUTE)
+#define VM_ALIGN        0x10000             // Allocation granularity
+#define VM_PAGE         4096
+
+// Threads
+
+typedef struct {
+TIB tib;
+TIB2 tib2;
+pid_t linux_tid;        // 0 until the thread runs
+PFNTHREAD fn;
+ULONG arg;
+int suspended;          // CREATE_SUSPENDED, until DosResumeThread
+} os2_thread_t;
+
+extern ULONG tls_area[THREAD_MAX][TLS_WORDS];
+
+os2_thread_t *thread_current(void);
+
+// Semaphores
+
+#define SEM_CHUNK           256
+#define SEM_MAX             65536           // Handles 1..65535
+#define SEM_MUXES           8               // Muxwaits one semaphore can be in
+#define SEM_MUX_RECORDS     64              // Members of one muxwait, as on OS/2
+#define SEM_POSTS           0xFFFF          // Post count bits of an event's word
+#define SEM_MAX_REQUESTS    0xFFFF
+
+enum { SEM_FREE, SEM_EVENT, SEM_MUTEX, SEM_MUX };
+
+typedef struct {
+uint32_t word;          // Futex
+uint32_t waiters;       // Event: threads asleep on word, in any process
+uint32_t owner;         // Mutex: Linux TID of the owner, 0 if none
+uint32_t requests;      // Mutex: requests the owner has not released
+uint32_t type;          // SEM_EVENT or SEM_MUTEX once created
+uint32_t opens;         // Named: processes that have it open
+} sem_state_t;
+
+typedef struct {
+uint32_t type;          // SEM_*
+uint32_t opens;         // Creates and opens not closed yet, in this process
+sem_state_t *state;     // &local, or the shared memory object
+sem_state_t local;
+int shared;             // Named: state is shared with other processes
+char *name;             // Named: the shared memory object
+uint32_t muxes;         // Muxwaits holding this semaphore
+uint32_t mux[SEM_MUXES];    // Their handles, 0 in unused slots
+uint32_t seq;           // Muxwait: bumped when a member is posted or released
+uint32_t sleepers;      // Muxwait: threads asleep on seq
+uint32_t flags;         // Muxwait: DCMW_WAIT_ANY or DCMW_WAIT_ALL
+uint32_t members;       // Muxwait: SEM_EVENT or SEM_MUTEX
+uint32_t count;
+SEMRECORD *records;
+} os2_sem_t;
+
+os2_sem_t *sem_get(ULONG h, uint32_t type);
+
+// Queues
+
+#define QUEUE_MAX           1024            // Handles 1..1023
+#define QUEUE_LEVELS        16
+#define QUEUE_SLOTS         1024            // Elements per priority, power of two
+#define QUEUE_YIELDS        4               // Before a waiting read sleeps
+
+// Sub-allocated Heaps
+
+#define SUB_GRAIN       8
+#define SUB_SMALL       512                 // Largest size with its own class
+#define SUB_CLASSES     (SUB_SMALL / SUB_GRAIN)
+#define SUB_MAGIC       0x48425553          // "SUBH"
+
+typedef struct {
+uint32_t magic;
+uint32_t flags;         // DOSSUB_SPARSE_OBJ | DOSSUB_SERIALIZE
+uint32_t size;          // Bytes managed, header included
+uint32_t top;           // Offset of the space never allocated
+uint32_t committed;     // DOSSUB_SPARSE_OBJ: pages below are committed
+int lock;               // DOSSUB_SERIALIZE
+uint32_t large;         // Chunks above SUB_SMALL, first fit
+uint32_t reserved;
+uint64_t nonempty;      // Bit per class with a free chunk
+uint32_t classes[SUB_CLASSES];  // Heads of the class lists; 0: empty
+} sub_heap_t;
+
+
+
+#endif
@@ -1,70 +1,25 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <dirent.h>
 
-// ============================================================================
-// OS/2 API Type Definitions
-// ============================================================================
-
-typedef uint32_t APIRET;
-typedef uint32_t HFILE;
-typedef uint32_t ULONG;
-typedef uint16_t USHORT;
-typedef uint8_t  UCHAR;
-typedef char*    PSZ;
-typedef char*    PCHAR;
-typedef const char* PCSZ;
-typedef void*    PVOID;
-typedef HFILE*   PHFILE;
-typedef ULONG*   PULONG;
-typedef USHORT*  PUSHORT;
-typedef int32_t  LONG;
-
-#define APIENTRY
-
-// OS/2 Error Codes
-#define NO_ERROR                0
-#define ERROR_INVALID_FUNCTION  1
-#define ERROR_FILE_NOT_FOUND    2
-#define ERROR_PATH_NOT_FOUND    3
-#define ERROR_TOO_MANY_OPEN_FILES 4
-#define ERROR_ACCESS_DENIED     5
-#define ERROR_INVALID_HANDLE    6
-#define ERROR_NOT_ENOUGH_MEMORY 8
-#define ERROR_INVALID_PARAMETER 87
-
-// DosOpen flags
-#define OPEN_ACTION_FAIL_IF_EXISTS     0x0000
-#define OPEN_ACTION_OPEN_IF_EXISTS     0x0001
-#define OPEN_ACTION_REPLACE_IF_EXISTS  0x0002
-#define OPEN_ACTION_FAIL_IF_NEW        0x0000
-#define OPEN_ACTION_CREATE_IF_NEW      0x0010
-
-#define OPEN_SHARE_DENYREADWRITE       0x0010
-#define OPEN_SHARE_DENYWRITE           0x0020
-#define OPEN_SHARE_DENYREAD            0x0030
-#define OPEN_SHARE_DENYNONE            0x0040
-
-#define OPEN_ACCESS_READONLY           0x0000
-#define OPEN_ACCESS_WRITEONLY          0x0001
-#define OPEN_ACCESS_READWRITE          0x0002
-
-#define FILE_NORMAL    0x0000
-#define FILE_READONLY  0x0001
-
-#define FILE_EXISTED   1
-#define FILE_CREATED   2
-#define FILE_TRUNCATED 3
-
-#define FILE_BEGIN   0
-#define FILE_CURRENT 1
-#define FILE_END     2
+#include "os2_runtime.h"
 
 // ============================================================================
 // Binary Format Structures
@@ -130,284 +85,797 @@ uint32_t reserved;
 #define OBJREADABLE   0x0001
 #define OBJWRITEABLE  0x0002
 #define OBJEXECUTABLE 0x0004
+#define OBJPRELOAD    0x0040
+
+// LX object page table entry (LE uses a different, 4-byte layout)
+typedef struct {
+uint32_t page_data_offset;
+uint16_t data_size;
+uint16_t flags;
+} __attribute__((packed)) lx_page_entry_t;
+
+#define LX_PAGE_LEGAL      0x0000
+#define LX_PAGE_ITERATED   0x0001   // EXEPACK1
+#define LX_PAGE_INVALID    0x0002
+#define LX_PAGE_ZEROED     0x0003
+#define LX_PAGE_RANGE      0x0004
+#define LX_PAGE_COMPRESSED 0x0005   // EXEPACK2
+
+#define LOADER_PAGE_SIZE   4096
 
 typedef struct {
 void *base;
 size_t size;
 uint32_t flags;
+uint32_t file_pages;    // Pages mapped straight from the image file
+int prot;
+uint32_t page_count;    // 4 KB pages covering virtual_size
+uint8_t *page_state;    // PAGE_* per page (LX only)
+uint32_t cache_offset;  // Where the contents start in the prelink cache file
 } loaded_object_t;
 
 // ============================================================================
-// Handle Management
+// API Profiling
 // ============================================================================
-
-#define MAX_HANDLES 256
+//
+// With OS2_PROFILE set, API resolution hands out a thunk per API instead
+// of the API itself. The thunk counts calls, their latency (TSC) and the
+// bytes moved by I/O calls into counters private to the calling thread,
+// and a report sorted by total time is printed at exit (DosExit included).
+// Calls that do not go through resolution (loader internals) are not seen.
 
 typedef struct {
-int linux_fd;
-int in_use;
-char path[256];
-} handle_entry_t;
+uint64_t calls;
+uint64_t ticks;
+uint64_t max_ticks;
+uint64_t bytes;
+} profile_counter_t;
 
-static handle_entry_t handle_table[MAX_HANDLES];
-static int handle_table_initialized = 0;
+typedef struct profile_block {
+struct profile_block *next;
+profile_counter_t counters[TRACE_API_COUNT];    // Indexed by TRACE_*
+} profile_block_t;
 
-void init_handle_table() {
-if (handle_table_initialized) return;
+static int g_profile = 0;                   // OS2_PROFILE
+static uint64_t g_profile_epoch = 0;        // trace_clock() when enabled
+static uint64_t g_profile_epoch_ns = 0;
+static profile_block_t *g_profile_blocks = NULL;
+static __thread profile_block_t *t_profile_block = NULL;
 
-for (int i = 0; i < MAX_HANDLES; i++) {
-    handle_table[i].linux_fd = -1;
-    handle_table[i].in_use = 0;
-    handle_table[i].path[0] = '\0';
+static profile_block_t *profile_new_block(void) {
+profile_block_t *block = calloc(1, sizeof(profile_block_t));
+if (!block) return NULL;
+block->next = __atomic_load_n(&g_profile_blocks, __ATOMIC_RELAXED);
+while (!__atomic_compare_exchange_n(&g_profile_blocks, &block->next, block, 1,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) { }
+t_profile_block = block;
+return block;
 }
 
-handle_table[0].linux_fd = 0;
-handle_table[0].in_use = 1;
-handle_table[1].linux_fd = 1;
-handle_table[1].in_use = 1;
-handle_table[2].linux_fd = 2;
-handle_table[2].in_use = 1;
+static inline void profile_record(int api, uint64_t start, uint64_t bytes) {
+uint64_t ticks = trace_clock() - start;
+profile_block_t *block = t_profile_block ? t_profile_block : profile_new_block();
+if (!block) return;
+profile_counter_t *c = &block->counters[api];
+c->calls++;
+c->ticks += ticks;
+if (ticks > c->max_ticks) c->max_ticks = ticks;
+c->bytes += bytes;
+}
+
+#define PROFILE_CALL(api, call, bytes) \
+    uint64_t start = trace_clock(); \
+    APIRET rc = call; \
+    profile_record((api), start, (bytes)); \
+    return rc
 
-handle_table_initialized = 1;
+static APIRET APIENTRY profiled_DosOpen(PCSZ pszFileName, PHFILE pHandle, PULONG pulAction,
+ULONG ulFileSize, ULONG ulAttribute, ULONG ulOpenFlags,
+ULONG ulOpenMode, PVOID peaop2) {
+PROFILE_CALL(TRACE_OPEN, DosOpen(pszFileName, pHandle, pulAction, ulFileSize, ulAttribute,
+                                 ulOpenFlags, ulOpenMode, peaop2), 0);
 }
 
-HFILE allocate_handle(int linux_fd, const char *path) {
-for (int i = 3; i < MAX_HANDLES; i++) {
-if (!handle_table[i].in_use) {
-handle_table[i].linux_fd = linux_fd;
-handle_table[i].in_use = 1;
-strncpy(handle_table[i].path, path ? path : "", sizeof(handle_table[i].path) - 1);
-return i;
+static APIRET APIENTRY profiled_DosRead(HFILE hFile, PVOID pBuffer, ULONG ulLength,
+PULONG pulBytesRead) {
+PROFILE_CALL(TRACE_READ, DosRead(hFile, pBuffer, ulLength, pulBytesRead),
+             rc == NO_ERROR ? *pulBytesRead : 0);
 }
+
+static APIRET APIENTRY profiled_DosWrite(HFILE hFile, PVOID pBuffer, ULONG ulLength,
+PULONG pulBytesWritten) {
+PROFILE_CALL(TRACE_WRITE, DosWrite(hFile, pBuffer, ulLength, pulBytesWritten),
+             rc == NO_ERROR ? *pulBytesWritten : 0);
 }
-return (HFILE)-1;
+
+static APIRET APIENTRY profiled_DosClose(HFILE hFile) {
+PROFILE_CALL(TRACE_CLOSE, DosClose(hFile), 0);
 }
 
-int get_linux_fd(HFILE handle) {
-if (handle >= MAX_HANDLES || !handle_table[handle].in_use) {
-return -1;
+static APIRET APIENTRY profiled_DosSetFilePtr(HFILE hFile, LONG lOffset, ULONG ulOrigin,
+PULONG pulNewPtr) {
+PROFILE_CALL(TRACE_SEEK, DosSetFilePtr(hFile, lOffset, ulOrigin, pulNewPtr), 0);
 }
-return handle_table[handle].linux_fd;
+
+static APIRET APIENTRY profiled_DosDupHandle(HFILE hFile, PHFILE phfNew) {
+PROFILE_CALL(TRACE_DUPHANDLE, DosDupHandle(hFile, phfNew), 0);
 }
 
-void free_handle(HFILE handle) {
-if (handle < MAX_HANDLES && handle_table[handle].in_use) {
-handle_table[handle].in_use = 0;
-handle_table[handle].linux_fd = -1;
+static APIRET APIENTRY profiled_DosCreatePipe(PHFILE phfRead, PHFILE phfWrite, ULONG cb) {
+PROFILE_CALL(TRACE_CREATEPIPE, DosCreatePipe(phfRead, phfWrite, cb), 0);
 }
+
+static APIRET APIENTRY profiled_DosCopy(PCSZ pszOld, PCSZ pszNew, ULONG ulOptions) {
+PROFILE_CALL(TRACE_COPY, DosCopy(pszOld, pszNew, ulOptions), 0);
 }
 
-APIRET errno_to_os2(int err) {
-switch (err) {
-case 0: return NO_ERROR;
-case ENOENT: return ERROR_FILE_NOT_FOUND;
-case EACCES: return ERROR_ACCESS_DENIED;
-case EINVAL: return ERROR_INVALID_PARAMETER;
-case EMFILE: return ERROR_TOO_MANY_OPEN_FILES;
-case ENOMEM: return ERROR_NOT_ENOUGH_MEMORY;
-case EBADF: return ERROR_INVALID_HANDLE;
-default: return ERROR_INVALID_FUNCTION;
+static APIRET APIENTRY profiled_DosResetBuffer(HFILE hFile) {
+PROFILE_CALL(TRACE_RESETBUFFER, DosResetBuffer(hFile), 0);
 }
+
+static APIRET APIENTRY profiled_DosDelete(PCSZ pszFileName) {
+PROFILE_CALL(TRACE_DELETE, DosDelete(pszFileName), 0);
 }
 
-// ============================================================================
-// OS/2 API Implementations
-// ============================================================================
+// Never returns: counted before the report runs from exit()
+static void APIENTRY profiled_DosExit(ULONG ulAction, ULONG ulResult) {
+profile_record(TRACE_EXIT, trace_clock(), 0);
+DosExit(ulAction, ulResult);
+}
 
-APIRET APIENTRY DosOpen(PCSZ pszFileName, PHFILE pHandle, PULONG pulAction,
-ULONG ulFileSize, ULONG ulAttribute, ULONG ulOpenFlags,
-ULONG ulOpenMode, PVOID peaop2) {
-init_handle_table();
-printf("[DosOpen] %s\n", pszFileName);
+static APIRET APIENTRY profiled_DosSleep(ULONG ulMilliseconds) {
+PROFILE_CALL(TRACE_SLEEP, DosSleep(ulMilliseconds), 0);
+}
 
-int flags = 0;
-int mode = 0644;
-int access = ulOpenMode & 0x0003;
+static APIRET APIENTRY profiled_DosAllocMem(PVOID* ppBaseAddress, ULONG ulSize, ULONG ulFlags) {
+PROFILE_CALL(TRACE_ALLOC, DosAllocMem(ppBaseAddress, ulSize, ulFlags), 0);
+}
 
-if (access == OPEN_ACCESS_READONLY) flags = O_RDONLY;
-else if (access == OPEN_ACCESS_WRITEONLY) flags = O_WRONLY;
-else if (access == OPEN_ACCESS_READWRITE) flags = O_RDWR;
+static APIRET APIENTRY profiled_DosFreeMem(PVOID pBaseAddress) {
+PROFILE_CALL(TRACE_FREE, DosFreeMem(pBaseAddress), 0);
+}
 
-int open_action = ulOpenFlags & 0x00FF;
-if (open_action & OPEN_ACTION_CREATE_IF_NEW) {
-    flags |= O_CREAT;
-    if (!(open_action & OPEN_ACTION_OPEN_IF_EXISTS)) {
-        flags |= O_EXCL;
-    }
+static APIRET APIENTRY profiled_DosSetMem(PVOID pb, ULONG cb, ULONG flag) {
+PROFILE_CALL(TRACE_SETMEM, DosSetMem(pb, cb, flag), 0);
 }
-if (open_action & OPEN_ACTION_REPLACE_IF_EXISTS) {
-    flags |= O_TRUNC;
+
+static APIRET APIENTRY profiled_DosQueryMem(PVOID pb, PULONG pcb, PULONG pFlag) {
+PROFILE_CALL(TRACE_QUERYMEM, DosQueryMem(pb, pcb, pFlag), 0);
 }
 
-int fd = open(pszFileName, flags, mode);
-if (fd < 0) return errno_to_os2(errno);
+static APIRET APIENTRY profiled_DosSubSetMem(PVOID pbBase, ULONG flag, ULONG cb) {
+PROFILE_CALL(TRACE_SUBSETMEM, DosSubSetMem(pbBase, flag, cb), 0);
+}
 
-HFILE os2_handle = allocate_handle(fd, pszFileName);
-if (os2_handle == (HFILE)-1) {
-    close(fd);
-    return ERROR_TOO_MANY_OPEN_FILES;
+static APIRET APIENTRY profiled_DosSubAllocMem(PVOID pbBase, PVOID *ppb, ULONG cb) {
+PROFILE_CALL(TRACE_SUBALLOCMEM, DosSubAllocMem(pbBase, ppb, cb), 0);
 }
 
-*pHandle = os2_handle;
-*pulAction = (flags & O_CREAT) ? FILE_CREATED : FILE_EXISTED;
+static APIRET APIENTRY profiled_DosSubFreeMem(PVOID pbBase, PVOID pb, ULONG cb) {
+PROFILE_CALL(TRACE_SUBFREEMEM, DosSubFreeMem(pbBase, pb, cb), 0);
+}
+
+static APIRET APIENTRY profiled_DosSubUnsetMem(PVOID pbBase) {
+PROFILE_CALL(TRACE_SUBUNSETMEM, DosSubUnsetMem(pbBase), 0);
+}
+
+static APIRET APIENTRY profiled_DosCreateThread(PTID ptid, PFNTHREAD pfn, ULONG param, ULONG flag,
+ULONG cbStack) {
+PROFILE_CALL(TRACE_CREATETHREAD, DosCreateThread(ptid, pfn, param, flag, cbStack), 0);
+}
+
+static APIRET APIENTRY profiled_DosResumeThread(TID tid) {
+PROFILE_CALL(TRACE_RESUMETHREAD, DosResumeThread(tid), 0);
+}
+
+static APIRET APIENTRY profiled_DosWaitThread(PTID ptid, ULONG option) {
+PROFILE_CALL(TRACE_WAITTHREAD, DosWaitThread(ptid, option), 0);
+}
+
+static APIRET APIENTRY profiled_DosGetInfoBlocks(PTIB *pptib, PPIB *pppib) {
+PROFILE_CALL(TRACE_GETINFOBLOCKS, DosGetInfoBlocks(pptib, pppib), 0);
+}
+
+static APIRET APIENTRY profiled_DosSetPriority(ULONG scope, ULONG ulClass, LONG delta, ULONG id) {
+PROFILE_CALL(TRACE_SETPRIORITY, DosSetPriority(scope, ulClass, delta, id), 0);
+}
+
+static APIRET APIENTRY profiled_DosAllocThreadLocalMemory(ULONG cb, PULONG *p) {
+PROFILE_CALL(TRACE_ALLOCTLS, DosAllocThreadLocalMemory(cb, p), 0);
+}
+
+static APIRET APIENTRY profiled_DosFreeThreadLocalMemory(PULONG p) {
+PROFILE_CALL(TRACE_FREETLS, DosFreeThreadLocalMemory(p), 0);
+}
+
+static APIRET APIENTRY profiled_DosCreateEventSem(PCSZ pszName, PHEV phev, ULONG flAttr,
+BOOL32 fState) {
+PROFILE_CALL(TRACE_CREATEEVENTSEM, DosCreateEventSem(pszName, phev, flAttr, fState), 0);
+}
+
+static APIRET APIENTRY profiled_DosOpenEventSem(PCSZ pszName, PHEV phev) {
+PROFILE_CALL(TRACE_OPENEVENTSEM, DosOpenEventSem(pszName, phev), 0);
+}
+
+static APIRET APIENTRY profiled_DosCloseEventSem(HEV hev) {
+PROFILE_CALL(TRACE_CLOSEEVENTSEM, DosCloseEventSem(hev), 0);
+}
 
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosPostEventSem(HEV hev) {
+PROFILE_CALL(TRACE_POSTEVENTSEM, DosPostEventSem(hev), 0);
 }
 
-APIRET APIENTRY DosRead(HFILE hFile, PVOID pBuffer, ULONG ulLength, PULONG pulBytesRead) {
-int fd = get_linux_fd(hFile);
-if (fd < 0) return ERROR_INVALID_HANDLE;
+static APIRET APIENTRY profiled_DosWaitEventSem(HEV hev, ULONG ulTimeout) {
+PROFILE_CALL(TRACE_WAITEVENTSEM, DosWaitEventSem(hev, ulTimeout), 0);
+}
 
-ssize_t bytes = read(fd, pBuffer, ulLength);
-if (bytes < 0) {
-    *pulBytesRead = 0;
-    return errno_to_os2(errno);
+static APIRET APIENTRY profiled_DosResetEventSem(HEV hev, PULONG pulPostCt) {
+PROFILE_CALL(TRACE_RESETEVENTSEM, DosResetEventSem(hev, pulPostCt), 0);
 }
 
-*pulBytesRead = bytes;
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosCreateMutexSem(PCSZ pszName, PHMTX phmtx, ULONG flAttr,
+BOOL32 fState) {
+PROFILE_CALL(TRACE_CREATEMUTEXSEM, DosCreateMutexSem(pszName, phmtx, flAttr, fState), 0);
 }
 
-APIRET APIENTRY DosWrite(HFILE hFile, PVOID pBuffer, ULONG ulLength, PULONG pulBytesWritten) {
-int fd = get_linux_fd(hFile);
-if (fd < 0) return ERROR_INVALID_HANDLE;
+static APIRET APIENTRY profiled_DosOpenMutexSem(PCSZ pszName, PHMTX phmtx) {
+PROFILE_CALL(TRACE_OPENMUTEXSEM, DosOpenMutexSem(pszName, phmtx), 0);
+}
 
-ssize_t bytes = write(fd, pBuffer, ulLength);
-if (bytes < 0) {
-    *pulBytesWritten = 0;
-    return errno_to_os2(errno);
+static APIRET APIENTRY profiled_DosCloseMutexSem(HMTX hmtx) {
+PROFILE_CALL(TRACE_CLOSEMUTEXSEM, DosCloseMutexSem(hmtx), 0);
 }
 
-*pulBytesWritten = bytes;
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosRequestMutexSem(HMTX hmtx, ULONG ulTimeout) {
+PROFILE_CALL(TRACE_REQUESTMUTEXSEM, DosRequestMutexSem(hmtx, ulTimeout), 0);
 }
 
-APIRET APIENTRY DosClose(HFILE hFile) {
-int fd = get_linux_fd(hFile);
-if (fd < 0) return ERROR_INVALID_HANDLE;
+static APIRET APIENTRY profiled_DosReleaseMutexSem(HMTX hmtx) {
+PROFILE_CALL(TRACE_RELEASEMUTEXSEM, DosReleaseMutexSem(hmtx), 0);
+}
 
-if (close(fd) < 0) return errno_to_os2(errno);
-free_handle(hFile);
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosCreateMuxWaitSem(PCSZ pszName, PHMUX phmux, ULONG cSemRec,
+PSEMRECORD pSemRec, ULONG flAttr) {
+PROFILE_CALL(TRACE_CREATEMUXWAITSEM, DosCreateMuxWaitSem(pszName, phmux, cSemRec, pSemRec, flAttr), 0);
 }
 
-APIRET APIENTRY DosSetFilePtr(HFILE hFile, LONG lOffset, ULONG ulOrigin, PULONG pulNewPtr) {
-int fd = get_linux_fd(hFile);
-if (fd < 0) return ERROR_INVALID_HANDLE;
+static APIRET APIENTRY profiled_DosCloseMuxWaitSem(HMUX hmux) {
+PROFILE_CALL(TRACE_CLOSEMUXWAITSEM, DosCloseMuxWaitSem(hmux), 0);
+}
 
-int whence;
-switch (ulOrigin) {
-    case FILE_BEGIN:   whence = SEEK_SET; break;
-    case FILE_CURRENT: whence = SEEK_CUR; break;
-    case FILE_END:     whence = SEEK_END; break;
-    default: return ERROR_INVALID_PARAMETER;
+static APIRET APIENTRY profiled_DosWaitMuxWaitSem(HMUX hmux, ULONG ulTimeout, PULONG pulUser) {
+PROFILE_CALL(TRACE_WAITMUXWAITSEM, DosWaitMuxWaitSem(hmux, ulTimeout, pulUser), 0);
 }
 
-off_t new_pos = lseek(fd, lOffset, whence);
-if (new_pos < 0) return errno_to_os2(errno);
+static APIRET APIENTRY profiled_DosCreateQueue(PHQUEUE phq, ULONG priority, PCSZ pszName) {
+PROFILE_CALL(TRACE_CREATEQUEUE, DosCreateQueue(phq, priority, pszName), 0);
+}
 
-if (pulNewPtr) *pulNewPtr = new_pos;
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosOpenQueue(PPID ppid, PHQUEUE phq, PCSZ pszName) {
+PROFILE_CALL(TRACE_OPENQUEUE, DosOpenQueue(ppid, phq, pszName), 0);
 }
 
-APIRET APIENTRY DosDelete(PCSZ pszFileName) {
-if (unlink(pszFileName) < 0) return errno_to_os2(errno);
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosCloseQueue(HQUEUE hq) {
+PROFILE_CALL(TRACE_CLOSEQUEUE, DosCloseQueue(hq), 0);
 }
 
-void APIENTRY DosExit(ULONG ulAction, ULONG ulResult) {
-printf("[DosExit] Code %d\n", ulResult);
-exit(ulResult);
+static APIRET APIENTRY profiled_DosWriteQueue(HQUEUE hq, ULONG request, ULONG cbData, PVOID pbData,
+                                              ULONG priority) {
+PROFILE_CALL(TRACE_WRITEQUEUE, DosWriteQueue(hq, request, cbData, pbData, priority), cbData);
 }
 
-APIRET APIENTRY DosSleep(ULONG ulMilliseconds) {
-usleep(ulMilliseconds * 1000);
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosReadQueue(HQUEUE hq, PREQUESTDATA pRequest, PULONG pcbData, PPVOID ppbuf,
+                                             ULONG element, BOOL32 wait, PBYTE ppriority, HEV hsem) {
+PROFILE_CALL(TRACE_READQUEUE, DosReadQueue(hq, pRequest, pcbData, ppbuf, element, wait, ppriority, hsem), 0);
 }
 
-APIRET APIENTRY DosAllocMem(PVOID* ppBaseAddress, ULONG ulSize, ULONG ulFlags) {
-void *mem = malloc(ulSize);
-if (!mem) return ERROR_NOT_ENOUGH_MEMORY;
-*ppBaseAddress = mem;
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosPurgeQueue(HQUEUE hq) {
+PROFILE_CALL(TRACE_PURGEQUEUE, DosPurgeQueue(hq), 0);
 }
 
-APIRET APIENTRY DosFreeMem(PVOID pBaseAddress) {
-free(pBaseAddress);
-return NO_ERROR;
+static APIRET APIENTRY profiled_DosQueryQueue(HQUEUE hq, PULONG pcbEntries) {
+PROFILE_CALL(TRACE_QUERYQUEUE, DosQueryQueue(hq, pcbEntries), 0);
 }
 
-APIRET APIENTRY DosGetMessage(PCHAR *ppStrings, ULONG ulStrings, PCHAR pBuffer,
+static APIRET APIENTRY profiled_DosGetMessage(PCHAR *ppStrings, ULONG ulStrings, PCHAR pBuffer,
 ULONG ulBufferLength, ULONG ulMsgNumber,
 PCSZ pszMsgFile, PULONG pulMsgLength) {
-// Simplified: just return empty message
-if (pulMsgLength) *pulMsgLength = 0;
-return NO_ERROR;
+PROFILE_CALL(TRACE_GETMESSAGE, DosGetMessage(ppStrings, ulStrings, pBuffer, ulBufferLength,
+                                             ulMsgNumber, pszMsgFile, pulMsgLength), 0);
 }
 
-APIRET APIENTRY DosPutMessage(HFILE hFile, ULONG ulLength, PCHAR pBuffer) {
-ULONG written;
-return DosWrite(hFile, pBuffer, ulLength, &written);
+static APIRET APIENTRY profiled_DosPutMessage(HFILE hFile, ULONG ulLength, PCHAR pBuffer) {
+PROFILE_CALL(TRACE_PUTMESSAGE, DosPutMessage(hFile, ulLength, pBuffer),
+             rc == NO_ERROR ? ulLength : 0);
+}
+
+// Counters of every thread for one API
+static profile_counter_t profile_totals(int api) {
+profile_counter_t total = { 0, 0, 0, 0 };
+for (profile_block_t *b = __atomic_load_n(&g_profile_blocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+    const profile_counter_t *c = &b->counters[api];
+    total.calls += c->calls;
+    total.ticks += c->ticks;
+    total.bytes += c->bytes;
+    if (c->max_ticks > total.max_ticks) total.max_ticks = c->max_ticks;
+}
+return total;
+}
+
+void profile_report(void) {
+if (!g_profile) return;
+
+uint64_t ticks = trace_clock() - g_profile_epoch;
+double ns_per_tick = ticks ? (double)(now_ns() - g_profile_epoch_ns) / ticks : 1.0;
+profile_counter_t totals[TRACE_API_COUNT];
+int order[TRACE_API_COUNT], count = 0;
+uint64_t all_ticks = 0;
+
+// Sorted by total time, most first
+for (int api = 0; api < TRACE_API_COUNT; api++) {
+    totals[api] = profile_totals(api);
+    if (!totals[api].calls) continue;
+    all_ticks += totals[api].ticks;
+    int at = count++;
+    while (at > 0 && totals[order[at - 1]].ticks < totals[api].ticks) {
+        order[at] = order[at - 1];
+        at--;
+    }
+    order[at] = api;
+}
+
+printf("\n=== API Profile ===\n");
+if (!count) {
+    printf("No API calls\n");
+    return;
+}
+printf("%-14s %10s %11s %10s %10s %12s %7s\n", "call", "calls", "total ms", "avg ns",
+       "max us", "bytes", "time");
+for (int i = 0; i < count; i++) {
+    const profile_counter_t *t = &totals[order[i]];
+    printf("%-14s %10llu %11.3f %10.1f %10.3f %12llu %6.1f%%\n", trace_calls[order[i]],
+           (unsigned long long)t->calls, t->ticks * ns_per_tick / 1e6,
+           t->ticks * ns_per_tick / t->calls, t->max_ticks * ns_per_tick / 1000.0,
+           (unsigned long long)t->bytes, all_ticks ? 100.0 * t->ticks / all_ticks : 0.0);
+}
 }
 
 // ============================================================================
 // API Resolution
 // ============================================================================
+//
+// Most LX imports are by ordinal. Each module the emulator knows gets a
+// dispatch array indexed by ordinal, built from api_exports on first use.
+// Imports by name go through a perfect hash of api_exports: the seed is
+// searched once at start-up so every name owns its own slot, and a lookup
+// is one hash, one probe and one compare.
 
 typedef struct {
 const char *name;
 void *function;
+const char *module;     // Exporting DLL
+uint16_t ordinal;       // 0: importable by name only
+void *profiled;         // Thunk handed out instead while profiling
 } api_export_t;
 
 static api_export_t api_exports[] = {
-{ "DOSOPEN", DosOpen },
-{ "DOSREAD", DosRead },
-{ "DOSWRITE", DosWrite },
-{ "DOSCLOSE", DosClose },
-{ "DOSSETFILEPTR", DosSetFilePtr },
-{ "DOSDELETE", DosDelete },
-{ "DOSEXIT", DosExit },
-{ "DOSSLEEP", DosSleep },
-{ "DOSALLOCMEM", DosAllocMem },
-{ "DOSFREEMEM", DosFreeMem },
-{ "DOSGETMESSAGE", DosGetMessage },
-{ "DOSPUTMESSAGE", DosPutMessage },
-{ NULL, NULL }
+{ "DOSOPEN", DosOpen, "DOSCALLS", 273, profiled_DosOpen },
+{ "DOSREAD", DosRead, "DOSCALLS", 281, profiled_DosRead },
+{ "DOSWRITE", DosWrite, "DOSCALLS", 282, profiled_DosWrite },
+{ "DOSCLOSE", DosClose, "DOSCALLS", 257, profiled_DosClose },
+{ "DOSSETFILEPTR", DosSetFilePtr, "DOSCALLS", 256, profiled_DosSetFilePtr },
+{ "DOSDELETE", DosDelete, "DOSCALLS", 259, profiled_DosDelete },
+{ "DOSDUPHANDLE", DosDupHandle, "DOSCALLS", 260, profiled_DosDupHandle },
+{ "DOSCREATEPIPE", DosCreatePipe, "DOSCALLS", 239, profiled_DosCreatePipe },
+{ "DOSCOPY", DosCopy, "DOSCALLS", 258, profiled_DosCopy },
+{ "DOSRESETBUFFER", DosResetBuffer, "DOSCALLS", 254, profiled_DosResetBuffer },
+{ "DOSEXIT", DosExit, "DOSCALLS", 234, profiled_DosExit },
+{ "DOSSLEEP", DosSleep, "DOSCALLS", 229, profiled_DosSleep },
+{ "DOSALLOCMEM", DosAllocMem, "DOSCALLS", 299, profiled_DosAllocMem },
+{ "DOSFREEMEM", DosFreeMem, "DOSCALLS", 304, profiled_DosFreeMem },
+{ "DOSSETMEM", DosSetMem, "DOSCALLS", 305, profiled_DosSetMem },
+{ "DOSQUERYMEM", DosQueryMem, "DOSCALLS", 306, profiled_DosQueryMem },
+{ "DOSSUBSETMEM", DosSubSetMem, "DOSCALLS", 344, profiled_DosSubSetMem },
+{ "DOSSUBALLOCMEM", DosSubAllocMem, "DOSCALLS", 345, profiled_DosSubAllocMem },
+{ "DOSSUBFREEMEM", DosSubFreeMem, "DOSCALLS", 346, profiled_DosSubFreeMem },
+{ "DOSSUBUNSETMEM", DosSubUnsetMem, "DOSCALLS", 347, profiled_DosSubUnsetMem },
+{ "DOSCREATETHREAD", DosCreateThread, "DOSCALLS", 311, profiled_DosCreateThread },
+{ "DOSRESUMETHREAD", DosResumeThread, "DOSCALLS", 237, profiled_DosResumeThread },
+{ "DOSWAITTHREAD", DosWaitThread, "DOSCALLS", 349, profiled_DosWaitThread },
+{ "DOSGETINFOBLOCKS", DosGetInfoBlocks, "DOSCALLS", 312, profiled_DosGetInfoBlocks },
+{ "DOSSETPRIORITY", DosSetPriority, "DOSCALLS", 236, profiled_DosSetPriority },
+{ "DOSALLOCTHREADLOCALMEMORY", DosAllocThreadLocalMemory, "DOSCALLS", 454,
+  profiled_DosAllocThreadLocalMemory },
+{ "DOSFREETHREADLOCALMEMORY", DosFreeThreadLocalMemory, "DOSCALLS", 455,
+  profiled_DosFreeThreadLocalMemory },
+{ "DOSCREATEEVENTSEM", DosCreateEventSem, "DOSCALLS", 324, profiled_DosCreateEventSem },
+{ "DOSOPENEVENTSEM", DosOpenEventSem, "DOSCALLS", 325, profiled_DosOpenEventSem },
+{ "DOSCLOSEEVENTSEM", DosCloseEventSem, "DOSCALLS", 326, profiled_DosCloseEventSem },
+{ "DOSRESETEVENTSEM", DosResetEventSem, "DOSCALLS", 327, profiled_DosResetEventSem },
+{ "DOSPOSTEVENTSEM", DosPostEventSem, "DOSCALLS", 328, profiled_DosPostEventSem },
+{ "DOSWAITEVENTSEM", DosWaitEventSem, "DOSCALLS", 329, profiled_DosWaitEventSem },
+{ "DOSCREATEMUTEXSEM", DosCreateMutexSem, "DOSCALLS", 331, profiled_DosCreateMutexSem },
+{ "DOSOPENMUTEXSEM", DosOpenMutexSem, "DOSCALLS", 332, profiled_DosOpenMutexSem },
+{ "DOSCLOSEMUTEXSEM", DosCloseMutexSem, "DOSCALLS", 333, profiled_DosCloseMutexSem },
+{ "DOSREQUESTMUTEXSEM", DosRequestMutexSem, "DOSCALLS", 334, profiled_DosRequestMutexSem },
+{ "DOSRELEASEMUTEXSEM", DosReleaseMutexSem, "DOSCALLS", 335, profiled_DosReleaseMutexSem },
+{ "DOSCREATEMUXWAITSEM", DosCreateMuxWaitSem, "DOSCALLS", 337, profiled_DosCreateMuxWaitSem },
+{ "DOSCLOSEMUXWAITSEM", DosCloseMuxWaitSem, "DOSCALLS", 339, profiled_DosCloseMuxWaitSem },
+{ "DOSWAITMUXWAITSEM", DosWaitMuxWaitSem, "DOSCALLS", 340, profiled_DosWaitMuxWaitSem },
+{ "DOSREADQUEUE", DosReadQueue, "QUECALLS", 9, profiled_DosReadQueue },
+{ "DOSPURGEQUEUE", DosPurgeQueue, "QUECALLS", 10, profiled_DosPurgeQueue },
+{ "DOSCLOSEQUEUE", DosCloseQueue, "QUECALLS", 11, profiled_DosCloseQueue },
+{ "DOSQUERYQUEUE", DosQueryQueue, "QUECALLS", 12, profiled_DosQueryQueue },
+{ "DOSWRITEQUEUE", DosWriteQueue, "QUECALLS", 14, profiled_DosWriteQueue },
+{ "DOSOPENQUEUE", DosOpenQueue, "QUECALLS", 15, profiled_DosOpenQueue },
+{ "DOSCREATEQUEUE", DosCreateQueue, "QUECALLS", 16, profiled_DosCreateQueue },
+{ "DOSGETMESSAGE", DosGetMessage, "DOSCALLS", 0, profiled_DosGetMessage },  // MSG.6 takes a message segment first
+{ "DOSPUTMESSAGE", DosPutMessage, "MSG", 5, profiled_DosPutMessage },
+{ NULL, NULL, NULL, 0, NULL }
 };
 
-void* resolve_os2_api(const char *name) {
-// Convert to uppercase for comparison
-char upper[256];
-for (int i = 0; name[i] && i < 255; i++) {
-upper[i] = (name[i] >= 'a' && name[i] <= 'z') ? name[i] - 32 : name[i];
+// Modules resolved by ordinal. VIOCALLS, KBDCALLS and PMWIN have no
+// emulated entry points yet; their ordinals come back NULL without a search.
+typedef struct {
+const char *name;
+uint32_t max_ordinal;
+void **by_ordinal;      // max_ordinal + 1 entries
+} api_module_t;
+
+static api_module_t api_modules[] = {
+{ "DOSCALLS", 0, NULL },
+{ "MSG", 0, NULL },
+{ "QUECALLS", 0, NULL },
+{ "VIOCALLS", 0, NULL },
+{ "KBDCALLS", 0, NULL },
+{ "PMWIN", 0, NULL },
+{ NULL, 0, NULL }
+};
+
+static int16_t *api_name_slots = NULL;     // Index into api_exports, -1 empty
+static uint32_t api_name_mask = 0;
+static uint32_t api_name_seed = 0;
+static int api_tables_ready = 0;
+
+// FNV-1a over the upper-cased name
+static inline uint32_t api_name_hash(const char *name, uint32_t seed) {
+uint32_t h = 2166136261u ^ seed;
+for (const uint8_t *p = (const uint8_t*)name; *p; p++) {
+    uint8_t c = *p;
+    if (c >= 'a' && c <= 'z') c -= 32;
+    h = (h ^ c) * 16777619u;
+}
+return h ^ (h >> 16);
 }
-upper[strlen(name)] = '\0';
 
-for (int i = 0; api_exports[i].name != NULL; i++) {
-    if (strcmp(api_exports[i].name, upper) == 0) {
-        printf("[API] Resolved: %s -> %p\n", name, api_exports[i].function);
-        return api_exports[i].function;
+// 'name' against an upper-case export name, ignoring the case of 'name'
+static inline int api_name_equal(const char *upper, const char *name) {
+for (; *upper; upper++, name++) {
+    char c = *name;
+    if (c >= 'a' && c <= 'z') c -= 32;
+    if (c != *upper) return 0;
+}
+return *name == '\0';
+}
+
+static inline void *api_function(const api_export_t *e) {
+return g_profile && e->profiled ? e->profiled : e->function;
+}
+
+static void fill_api_ordinals(void) {
+for (api_module_t *m = api_modules; m->name && m->by_ordinal; m++) {
+    for (api_export_t *e = api_exports; e->name; e++) {
+        if (e->ordinal && strcmp(e->module, m->name) == 0) m->by_ordinal[e->ordinal] = api_function(e);
+    }
+}
+}
+
+static int init_api_tables(void) {
+if (api_tables_ready) return 0;
+
+for (api_module_t *m = api_modules; m->name; m++) {
+    for (api_export_t *e = api_exports; e->name; e++) {
+        if (e->ordinal && strcmp(e->module, m->name) == 0 && e->ordinal > m->max_ordinal) {
+            m->max_ordinal = e->ordinal;
+        }
+    }
+    m->by_ordinal = calloc(m->max_ordinal + 1, sizeof(void*));
+    if (!m->by_ordinal) return -1;
+}
+fill_api_ordinals();
+
+// Twice as many slots as names keeps the seed search to a few tries
+uint32_t count = 0, size = 16;
+while (api_exports[count].name) count++;
+while (size < count * 2) size *= 2;
+api_name_slots = malloc(size * sizeof(int16_t));
+if (!api_name_slots) return -1;
+api_name_mask = size - 1;
+
+for (uint32_t seed = 0; ; seed++) {
+    int collision = 0;
+    memset(api_name_slots, 0xFF, size * sizeof(int16_t));
+    for (uint32_t i = 0; i < count && !collision; i++) {
+        int16_t *slot = &api_name_slots[api_name_hash(api_exports[i].name, seed) & api_name_mask];
+        if (*slot >= 0) collision = 1;
+        *slot = i;
+    }
+    if (!collision) {
+        api_name_seed = seed;
+        break;
     }
 }
 
-printf("[API] Unresolved: %s\n", name);
+api_tables_ready = 1;
+return 0;
+}
+
+static api_module_t *find_api_module(const char *module) {
+if (init_api_tables() < 0) return NULL;
+for (api_module_t *m = api_modules; m->name; m++) {
+    if (strcasecmp(m->name, module) == 0) return m;
+}
 return NULL;
 }
 
+static inline void *lookup_api_ordinal(const api_module_t *m, uint32_t ordinal) {
+return m && ordinal <= m->max_ordinal ? m->by_ordinal[ordinal] : NULL;
+}
+
+static inline void *lookup_api_name(const char *name) {
+if (!api_tables_ready && init_api_tables() < 0) return NULL;
+int16_t i = api_name_slots[api_name_hash(name, api_name_seed) & api_name_mask];
+return i >= 0 && api_name_equal(api_exports[i].name, name) ? api_function(&api_exports[i]) : NULL;
+}
+
+// Resolve APIs to their profiling thunks from now on (or no longer)
+static void profile_enable(int on) {
+g_profile = on;
+g_profile_epoch_ns = now_ns();
+g_profile_epoch = trace_clock();
+if (api_tables_ready) fill_api_ordinals();
+}
+
+void* resolve_os2_api(const char *name) {
+TRACE_ENTER(TRACE_RESOLVE, name);
+void *function = lookup_api_name(name);
+TRACE_POINT(!function, (uintptr_t)function, 0, 0);
+return function;
+}
+
+void* resolve_os2_ordinal(const char *module, uint32_t ordinal) {
+#ifndef OS2_NO_TRACE
+char import[32];
+if (g_trace_mask >> TRACE_RESOLVE & 1) snprintf(import, sizeof(import), "%s.%u", module, ordinal);
+#endif
+TRACE_ENTER(TRACE_RESOLVE, import);
+void *function = lookup_api_ordinal(find_api_module(module), ordinal);
+TRACE_POINT(!function, (uintptr_t)function, ordinal, 0);
+return function;
+}
+
+// ============================================================================
+// EXEPACK Decompression
+// ============================================================================
+//
+// EXEPACK1 (iterated pages) is a list of { USHORT iterations; USHORT length;
+// BYTE data[length]; } records, each expanding to 'data' repeated. EXEPACK2
+// (compressed pages) is a byte-aligned LZ77 stream whose opcodes are picked
+// by the low two bits of the first byte:
+//
+//   00 llllll00             1-63 literal bytes follow
+//   00000000 n b            fill: n copies of byte b (n == 0: end of page)
+//   01 ooooooo mmm ll       ll literals, then m+3 bytes from distance o
+//   10 oooooooooooo ll      l+3 bytes from distance o
+//   11 o(12) m(6) l(4)      l literals, then m bytes from distance o
+//
+// Both decoders write into a zeroed page and return the number of bytes
+// produced, or -1 on a malformed stream. Copies go 8 bytes at a time and
+// may run up to 8 bytes past their end while inside the page; that slop is
+// cleared again before returning.
+
+#define EXEPACK_SLOP 8
+
+static inline void copy8(uint8_t *d, const uint8_t *s) {
+uint64_t v;
+memcpy(&v, s, 8);
+memcpy(d, &v, 8);
+}
+
+// Literal run: 'src' has at least 'len' readable bytes
+static inline void unpack_literal(uint8_t *d, const uint8_t *s, size_t len,
+                                  const uint8_t *d_end, const uint8_t *s_end) {
+if (d + len + EXEPACK_SLOP <= d_end && s + len + EXEPACK_SLOP <= s_end) {
+    for (size_t i = 0; i < len; i += 8) copy8(d + i, s + i);
+} else {
+    memcpy(d, s, len);
+}
+}
+
+// Back-reference: 'len' bytes from 'off' bytes back, 1 <= off <= d - start.
+// Distances under 8 repeat a short pattern; once the first off * (m - 1)
+// bytes are out the pattern can be copied from distance off * m >= 8 in
+// whole words.
+static inline void unpack_match(uint8_t *d, size_t off, size_t len,
+                                const uint8_t *d_end) {
+if (off == 1) {
+    memset(d, d[-1], len);
+    return;
+}
+if (d + len + EXEPACK_SLOP > d_end) {
+    for (size_t i = 0; i < len; i++) d[i] = d[i - off];
+    return;
+}
+
+size_t i = 0;
+if (off < 8) {
+    size_t step = off * ((8 + off - 1) / off);
+    size_t prefix = step - off;
+    if (prefix > len) prefix = len;
+    for (; i < prefix; i++) d[i] = d[i - off];
+    off = step;
+}
+for (; i < len; i += 8) copy8(d + i, d + i - off);
+}
+
+// Repeat 'len' bytes already at 'd' to fill 'total' bytes, doubling each pass
+static inline void replicate(uint8_t *d, size_t len, size_t total) {
+while (len < total) {
+    size_t chunk = len < total - len ? len : total - len;
+    memcpy(d + len, d, chunk);
+    len += chunk;
+}
+}
+
+int exepack1_unpack(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len) {
+const uint8_t *s = src, *s_end = src + src_len;
+uint8_t *d = dst, *d_end = dst + dst_len;
+
+while (s + 4 <= s_end) {
+    uint16_t iterations, length;
+    memcpy(&iterations, s, 2);
+    memcpy(&length, s + 2, 2);
+    s += 4;
+    if (iterations == 0) break;
+
+    size_t total = (size_t)iterations * length;
+    if (s + length > s_end || total > (size_t)(d_end - d)) return -1;
+
+    if (length == 1) {
+        memset(d, *s, total);
+    } else if (length > 0) {
+        memcpy(d, s, length);
+        replicate(d, length, total);
+    }
+    s += length;
+    d += total;
+}
+return d - dst;
+}
+
+int exepack2_unpack(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len) {
+const uint8_t *s = src, *s_end = src + src_len;
+uint8_t *d = dst, *d_end = dst + dst_len;
+
+while (s < s_end) {
+    uint32_t op = s[0];
+    size_t lit, len, off;
+
+    switch (op & 3) {
+        case 0:
+            if (op != 0) {
+                lit = op >> 2;
+                len = 0;
+                off = 0;
+                s += 1;
+                break;
+            }
+            if (s + 2 > s_end) return -1;
+            if (s[1] == 0) goto done;
+            if (s + 3 > s_end || s[1] > (size_t)(d_end - d)) return -1;
+            memset(d, s[2], s[1]);
+            d += s[1];
+            s += 3;
+            continue;
+        case 1:
+            if (s + 2 > s_end) return -1;
+            op |= (uint32_t)s[1] << 8;
+            lit = (op >> 2) & 3;
+            len = ((op >> 4) & 7) + 3;
+            off = op >> 7;
+            s += 2;
+            break;
+        case 2:
+            if (s + 2 > s_end) return -1;
+            op |= (uint32_t)s[1] << 8;
+            lit = 0;
+            len = ((op >> 2) & 3) + 3;
+            off = op >> 4;
+            s += 2;
+            break;
+        default:
+            if (s + 3 > s_end) return -1;
+            op |= (uint32_t)s[1] << 8 | (uint32_t)s[2] << 16;
+            lit = (op >> 2) & 0xF;
+            len = (op >> 6) & 0x3F;
+            off = op >> 12;
+            s += 3;
+            break;
+    }
+
+    if (lit) {
+        if (s + lit > s_end || lit > (size_t)(d_end - d)) return -1;
+        unpack_literal(d, s, lit, d_end, s_end);
+        s += lit;
+        d += lit;
+    }
+    if (len) {
+        if (off == 0 || off > (size_t)(d - dst) || len > (size_t)(d_end - d)) return -1;
+        unpack_match(d, off, len, d_end);
+        d += len;
+    }
+}
+
+done:;
+// Clear what the word copies wrote past the end of the output
+size_t slop = d_end - d < EXEPACK_SLOP ? (size_t)(d_end - d) : EXEPACK_SLOP;
+memset(d, 0, slop);
+return d - dst;
+}
+
 // ============================================================================
 // Loader
 // ============================================================================
 
+// A decoded fixup: where in the page, what to write, and to what
+typedef struct {
+int16_t src_off;        // Offset in the page; negative if it began on the previous one
+uint8_t src_type;       // LX_FIX_* source type
+uint8_t kind;           // FIXUP_*
+uint32_t target;        // Object index or import index
+uint32_t offset;        // Target offset (+ additive); additive only for imports
+} lx_fixup_t;
+
+#define FIXUP_INTERNAL 0
+#define FIXUP_IMPORT   1
+#define FIXUP_CHAIN    2    // Internal chain threaded through the page
+
+typedef struct {
+uint64_t key;           // Module, kind and ordinal/name offset, for dedup
+uint16_t module;        // 1-based imported module ordinal
+uint32_t ordinal;       // 0 when imported by name
+char *name;             // Procedure name for by-name imports
+void *address;          // Resolved target
+} import_entry_t;
+
 typedef struct {
-uint8_t *file_data;
+uint8_t *file_data;     // Read-only mapping of the image (or a heap copy)
 size_t file_size;
+int file_fd;
+int file_mapped;
+int prelink_fd;         // Prelink cache the objects are mapped from, or -1
+struct stat file_stat;  // Identity of the image file; keys the prelink cache
 le_header_t *le_header;
 object_entry_t *objects;
 loaded_object_t *loaded_objects;
 void *entry_point;
 uint32_t le_offset;
+char **module_names;    // Imported modules, by ordinal - 1
+uint32_t module_count;
+import_entry_t *imports;
+uint32_t import_count;
+lx_fixup_t *fixups;     // Decoded fixups grouped by module page
+uint32_t *page_fixups;  // module_pages + 1 indexes into 'fixups'
+uint32_t fixup_count;
+int fixups_ready;       // Imports resolved, pages may be patched
+struct import_stubs *stubs;     // Per-import call stubs (Import Binding)
+int at_preferred_base;  // Every object sits at its link-time base
+uint32_t internal_skipped;  // Internal fixups dropped as already correct
 } os2_exe_t;
 
+// Set by os2bench to measure the old read()+memcpy path against mmap
+static int g_load_by_copy = 0;
+
 uint8_t* read_file(const char *filename, size_t *size) {
 int fd = open(filename, O_RDONLY);
 if (fd < 0) return NULL;
@@ -431,20 +899,64 @@ close(fd);
 return data;
 }
 
+// Map the whole image read-only. Headers and tables are parsed in place
+// and object pages are either mapped from the same file or copied out of
+// this mapping, so the file is never read into a private heap buffer.
+uint8_t* map_file(const char *filename, size_t *size, int *fd_out) {
+int fd = open(filename, O_RDONLY);
+if (fd < 0) return NULL;
+
+struct stat st;
+if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+}
+
+void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+if (data == MAP_FAILED) {
+    close(fd);
+    return NULL;
+}
+
+*size = st.st_size;
+*fd_out = fd;
+return data;
+}
+
+static void release_image(os2_exe_t *exe) {
+if (exe->file_mapped) {
+    munmap(exe->file_data, exe->file_size);
+    close(exe->file_fd);
+} else {
+    free(exe->file_data);
+}
+exe->file_data = NULL;
+}
+
 os2_exe_t* parse_le_exe(const char *filename) {
 os2_exe_t *exe = calloc(1, sizeof(os2_exe_t));
 if (!exe) return NULL;
 
-exe->file_data = read_file(filename, &exe->file_size);
+exe->file_fd = -1;
+exe->prelink_fd = -1;
+if (g_load_by_copy) {
+    exe->file_data = read_file(filename, &exe->file_size);
+} else {
+    exe->file_data = map_file(filename, &exe->file_size, &exe->file_fd);
+    exe->file_mapped = exe->file_data != NULL;
+}
 if (!exe->file_data) {
     free(exe);
     return NULL;
 }
+if ((exe->file_mapped ? fstat(exe->file_fd, &exe->file_stat) : stat(filename, &exe->file_stat)) < 0) {
+    memset(&exe->file_stat, 0, sizeof(exe->file_stat));
+}
 
 mz_header_t *mz = (mz_header_t*)exe->file_data;
-if (mz->e_magic != 0x5A4D) {
+if (exe->file_size < sizeof(mz_header_t) || mz->e_magic != 0x5A4D) {
     fprintf(stderr, "Not a valid DOS executable\n");
-    free(exe->file_data);
+    release_image(exe);
     free(exe);
     return NULL;
 }
@@ -452,9 +964,10 @@ if (mz->e_magic != 0x5A4D) {
 exe->le_offset = mz->e_lfanew;
 exe->le_header = (le_header_t*)(exe->file_data + exe->le_offset);
 
-if (exe->le_header->magic != 0x454C && exe->le_header->magic != 0x584C) {
+if (exe->le_offset + sizeof(le_header_t) > exe->file_size ||
+    (exe->le_header->magic != 0x454C && exe->le_header->magic != 0x584C)) {
     fprintf(stderr, "Not a valid LE/LX executable\n");
-    free(exe->file_data);
+    release_image(exe);
     free(exe);
     return NULL;
 }
@@ -470,265 +983,5561 @@ exe->objects = (object_entry_t*)(exe->file_data + exe->le_offset +
 return exe;
 }
 
-int load_objects(os2_exe_t *exe) {
-exe->loaded_objects = calloc(exe->le_header->object_count, sizeof(loaded_object_t));
-if (!exe->loaded_objects) return -1;
+static int is_lx(os2_exe_t *exe) {
+return exe->le_header->magic == 0x584C;
+}
 
-uint32_t data_offset = exe->le_header->data_pages_offset;
+static lx_page_entry_t *lx_page_table(os2_exe_t *exe) {
+return (lx_page_entry_t*)(exe->file_data + exe->le_offset +
+                          exe->le_header->object_page_table_offset);
+}
 
-printf("\nData pages offset: 0x%x\n", data_offset);
-printf("Page size: 0x%x\n", exe->le_header->page_size);
-printf("File size: 0x%zx\n\n", exe->file_size);
+// File offset of a page's data. Legal and EXEPACK2 pages are relative to
+// the data pages area, iterated pages to the iterated pages area.
+static uint64_t lx_page_file_offset(os2_exe_t *exe, const lx_page_entry_t *pe) {
+le_header_t *le = exe->le_header;
+uint64_t base = le->data_pages_offset;
 
-for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
-    object_entry_t *obj = &exe->objects[i];
-    
-    printf("Object %d:\n", i + 1);
-    printf("  Virtual size: 0x%x\n", obj->virtual_size);
-    printf("  Base address: 0x%x\n", obj->reloc_base_addr);
-    printf("  Flags: 0x%x ", obj->object_flags);
-    if (obj->object_flags & OBJREADABLE) printf("R");
-    if (obj->object_flags & OBJWRITEABLE) printf("W");
-    if (obj->object_flags & OBJEXECUTABLE) printf("X");
-    printf("\n");
-    printf("  Page table index: %d\n", obj->page_table_index);
-    printf("  Page table entries: %d\n", obj->page_table_entries);
-    
-    // Determine protection - objects must be readable
-    int prot = PROT_READ;
-    if (obj->object_flags & OBJWRITEABLE) prot |= PROT_WRITE;
-    if (obj->object_flags & OBJEXECUTABLE) prot |= PROT_EXEC;
-    
-    // Allocate memory
-    size_t alloc_size = (obj->virtual_size + 0xFFF) & ~0xFFF;
-    void *mem = mmap(NULL, alloc_size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    
-    if (mem == MAP_FAILED) {
-        perror("mmap failed");
-        return -1;
-    }
-    
-    printf("  Allocated %zu bytes at %p\n", alloc_size, mem);
-    
-    exe->loaded_objects[i].base = mem;
-    exe->loaded_objects[i].size = alloc_size;
-    exe->loaded_objects[i].flags = obj->object_flags;
-    
-    // Load data from file
-    if (obj->page_table_entries > 0 && obj->page_table_index > 0) {
-        uint32_t page_offset = (obj->page_table_index - 1) * exe->le_header->page_size;
-        uint32_t file_offset = data_offset + page_offset;
-        uint32_t copy_size = obj->virtual_size;
-        
-        printf("  Page offset: 0x%x\n", page_offset);
-        printf("  File offset: 0x%x\n", file_offset);
-        printf("  Copy size: 0x%x\n", copy_size);
-        
-        // Validate file offset
-        if (file_offset >= exe->file_size) {
-            fprintf(stderr, "  WARNING: File offset 0x%x exceeds file size 0x%zx\n", 
-                    file_offset, exe->file_size);
-            continue;
-        }
-        
-        // Adjust copy size if it would exceed file bounds
-        if (file_offset + copy_size > exe->file_size) {
-            copy_size = exe->file_size - file_offset;
-            printf("  Adjusted copy size to 0x%x\n", copy_size);
-        }
-        
-        if (copy_size > 0) {
-            // Make memory writable temporarily if needed
-            if (!(prot & PROT_WRITE)) {
-                mprotect(mem, alloc_size, prot | PROT_WRITE);
-            }
-            
-            memcpy(mem, exe->file_data + file_offset, copy_size);
-            printf("  Copied %d bytes from file\n", copy_size);
-            
-            // Restore original protection
-            if (!(prot & PROT_WRITE)) {
-                mprotect(mem, alloc_size, prot);
-            }
-        }
-    } else {
-        printf("  No pages to load (BSS or empty segment)\n");
-    }
-    printf("\n");
+if (pe->flags == LX_PAGE_ITERATED && le->object_iter_pages_offset) {
+    base = le->object_iter_pages_offset;
+}
+return base + ((uint64_t)pe->page_data_offset << le->page_offset_shift);
 }
 
-if (exe->le_header->eip_object > 0 && 
-    exe->le_header->eip_object <= exe->le_header->object_count) {
-    exe->entry_point = (uint8_t*)exe->loaded_objects[exe->le_header->eip_object - 1].base + 
-                      exe->le_header->eip;
-    printf("Entry point: %p\n", exe->entry_point);
+static const char *lx_page_type_name(uint16_t flags) {
+switch (flags) {
+    case LX_PAGE_LEGAL:      return "legal";
+    case LX_PAGE_ITERATED:   return "iterated";
+    case LX_PAGE_INVALID:    return "invalid";
+    case LX_PAGE_ZEROED:     return "zero-filled";
+    case LX_PAGE_RANGE:      return "range";
+    case LX_PAGE_COMPRESSED: return "compressed";
+    default:                 return "unknown";
+}
 }
 
-return 0;
+// Number of leading pages of an LX object that can be mapped straight
+// from the file: whole, legal, consecutive pages starting at a host page
+// boundary. The kernel then shares them with the page cache and only
+// pages that are written (fixups, data) get a private copy.
+static uint32_t lx_mappable_pages(os2_exe_t *exe, object_entry_t *obj) {
+le_header_t *le = exe->le_header;
+
+if (!exe->file_mapped || !is_lx(exe) || le->page_size != LOADER_PAGE_SIZE) {
+    return 0;
 }
 
-void process_imports(os2_exe_t *exe) {
-if (exe->le_header->imported_modules_count == 0) {
-printf("No imports to process\n");
-return;
+lx_page_entry_t *pages = lx_page_table(exe) + obj->page_table_index - 1;
+uint64_t first = lx_page_file_offset(exe, &pages[0]);
+if (first % LOADER_PAGE_SIZE) return 0;
+
+uint32_t n = 0;
+while (n < obj->page_table_entries) {
+    uint64_t off = lx_page_file_offset(exe, &pages[n]);
+    if (pages[n].flags != LX_PAGE_LEGAL || pages[n].data_size != le->page_size ||
+        off != first + (uint64_t)n * le->page_size ||
+        off + le->page_size > exe->file_size) {
+        break;
+    }
+    n++;
+}
+return n;
 }
 
-printf("\n=== Processing Imports ===\n");
+// Malformed EXEPACK pages, which are left zero-filled
+static uint32_t g_unpack_errors = 0;
 
-uint8_t *import_mod_table = exe->file_data + exe->le_offset + 
-                            exe->le_header->imported_modules_offset;
+// Write the contents of one object page into 'dst', which is writable and
+// already zero. Pages past the object page table are BSS and stay zero;
+// iterated and compressed pages are expanded here, at fault time when the
+// object is demand-loaded.
+static void fill_object_page(os2_exe_t *exe, object_entry_t *obj,
+                             uint32_t page, uint8_t *dst) {
+le_header_t *le = exe->le_header;
 
-// Read module names
-for (uint32_t i = 0; i < exe->le_header->imported_modules_count; i++) {
-    uint8_t name_len = *import_mod_table++;
-    char module_name[256];
-    memcpy(module_name, import_mod_table, name_len);
-    module_name[name_len] = '\0';
-    import_mod_table += name_len;
-    
-    printf("Module %d: %s\n", i + 1, module_name);
-}
+if (page >= obj->page_table_entries) return;
+
+lx_page_entry_t *pe = lx_page_table(exe) + obj->page_table_index - 1 + page;
+uint64_t off = lx_page_file_offset(exe, pe);
+uint32_t size = pe->data_size;
 
-printf("Import processing complete (stub implementation)\n");
+if (size == 0 || off + size > exe->file_size || size > le->page_size) return;
+
+switch (pe->flags) {
+    case LX_PAGE_LEGAL:
+        memcpy(dst, exe->file_data + off, size);
+        break;
+    case LX_PAGE_ITERATED:
+        if (exepack1_unpack(exe->file_data + off, size, dst, le->page_size) < 0) {
+            memset(dst, 0, le->page_size);
+            __atomic_add_fetch(&g_unpack_errors, 1, __ATOMIC_RELAXED);
+        }
+        break;
+    case LX_PAGE_COMPRESSED:
+        if (exepack2_unpack(exe->file_data + off, size, dst, le->page_size) < 0) {
+            memset(dst, 0, le->page_size);
+            __atomic_add_fetch(&g_unpack_errors, 1, __ATOMIC_RELAXED);
+        }
+        break;
+    default:
+        // Zero-filled, invalid and range pages carry no file data
+        break;
+}
 }
 
 // ============================================================================
-// Fixup Processing
+// Demand Paging
 // ============================================================================
+//
+// Pages of non-preload objects start out PROT_NONE. The first access faults
+// into demand_fault_handler, which fills that one page from the image and
+// opens it up with the object's protection, so startup cost follows the
+// pages a program touches rather than the size of the image. Pages covered
+// by the file mapping are mapped PROT_NONE from the file and only need
+// their protection opened.
+//
+// A page that has to be written (filled, or patched by its fixups) is
+// built in a scratch page elsewhere and moved into place with mremap,
+// already at the object's protection: another thread touching it meanwhile
+// faults and waits for it, and never runs or reads it half built.
+//
+// The kernel does not raise SIGSEGV for its own accesses: a read() into an
+// untouched page fails with EFAULT instead. API calls that hand guest
+// buffers to a syscall call loader_prefault() on them first.
+
+#define PAGE_ABSENT   0     // Anonymous, PROT_NONE, not filled yet
+#define PAGE_PRESENT  1
+#define PAGE_FILE     2     // Mapped from the image, PROT_NONE
+#define PAGE_INVALID  3     // LX invalid page; any access is fatal
+
+#define MAX_DEMAND_OBJECTS 64
+#define SCRATCH_PAGES      64   // Mapped at a time for building pages in
+
+static int decode_fixups(os2_exe_t *exe);
+static void drop_internal_fixups(os2_exe_t *exe);
+static int page_has_fixups(os2_exe_t *exe, uint32_t object, uint32_t page);
+static void apply_page_fixups(os2_exe_t *exe, uint32_t object, uint32_t page, uint8_t *dst);
 
 typedef struct {
-uint8_t *fixup_page_table;
-uint8_t *fixup_record_table;
-} fixup_context_t;
+os2_exe_t *exe;
+uint32_t index;
+} demand_object_t;
 
-void apply_fixups(os2_exe_t *exe) {
-if (exe->le_header->fixup_page_table_offset == 0) {
-    printf("\nNo fixup table\n");
+static demand_object_t g_demand_objects[MAX_DEMAND_OBJECTS];
+static int g_demand_count = 0;
+static int g_demand_paging = 1;     // OS2_EAGER_LOAD=1 turns it off
+static int g_fault_lock = 0;
+static uint32_t g_pages_faulted = 0;
+static uint32_t g_pages_prefaulted = 0;
+static struct sigaction g_prev_segv;
+static int g_segv_installed = 0;
+static uint8_t *g_scratch = NULL;   // Unused scratch pages end here
+static uint32_t g_scratch_left = 0;
+
+static void fault_lock(void) {
+while (__atomic_exchange_n(&g_fault_lock, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&g_fault_lock, __ATOMIC_RELAXED)) { }
+}
+}
+
+static void fault_unlock(void) {
+__atomic_store_n(&g_fault_lock, 0, __ATOMIC_RELEASE);
+}
+
+// A zeroed, writable page to build an object page in. Called with
+// g_fault_lock held; NULL if out of memory.
+static uint8_t *scratch_page(void) {
+if (g_scratch_left == 0) {
+    void *mem = mmap(NULL, (size_t)SCRATCH_PAGES * LOADER_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    g_scratch = (uint8_t*)mem + (size_t)SCRATCH_PAGES * LOADER_PAGE_SIZE;
+    g_scratch_left = SCRATCH_PAGES;
+}
+g_scratch_left--;
+g_scratch -= LOADER_PAGE_SIZE;
+return g_scratch;
+}
+
+// Replace the page at 'addr' with the scratch page 'built', at protection
+// 'prot', in one step. The scratch page is gone either way.
+static int install_page(uint8_t *built, uint8_t *addr, int prot) {
+if (mprotect(built, LOADER_PAGE_SIZE, prot) < 0 ||
+    mremap(built, LOADER_PAGE_SIZE, LOADER_PAGE_SIZE, MREMAP_MAYMOVE | MREMAP_FIXED, addr) == MAP_FAILED) {
+    munmap(built, LOADER_PAGE_SIZE);
+    return -1;
+}
+return 0;
+}
+
+// Bring one page of a demand-loaded object in. Called with g_fault_lock
+// held; returns 0 if the page is now accessible.
+static int materialize_page(os2_exe_t *exe, uint32_t index, uint32_t page) {
+loaded_object_t *lo = &exe->loaded_objects[index];
+uint8_t *addr = (uint8_t*)lo->base + (size_t)page * LOADER_PAGE_SIZE;
+
+int patch = exe->fixups_ready && page_has_fixups(exe, index, page);
+int state = lo->page_state[page];
+if (state == PAGE_PRESENT || state == PAGE_INVALID) return -1;
+
+// File-mapped pages only need building (from the same file data) if they
+// carry fixups; the rest just get their protection. Pages mapped from the
+// prelink cache already hold every relocation but the imports, so they
+// are built from the cache rather than from the image.
+if (state == PAGE_ABSENT || patch) {
+    uint8_t *built = scratch_page();
+    if (!built) return -1;
+    if (state == PAGE_FILE && exe->prelink_fd >= 0) {
+        off_t off = lo->cache_offset + (off_t)page * LOADER_PAGE_SIZE;
+        if (pread(exe->prelink_fd, built, LOADER_PAGE_SIZE, off) != LOADER_PAGE_SIZE) {
+            munmap(built, LOADER_PAGE_SIZE);
+            return -1;
+        }
+    } else {
+        fill_object_page(exe, &exe->objects[index], page, built);
+    }
+    if (patch) apply_page_fixups(exe, index, page, built);
+    if (install_page(built, addr, lo->prot) < 0) return -1;
+} else if (mprotect(addr, LOADER_PAGE_SIZE, lo->prot) < 0) {
+    return -1;
+}
+lo->page_state[page] = PAGE_PRESENT;
+return 0;
+}
+
+// Find the demand-loaded object holding 'addr'
+static demand_object_t *find_demand_object(const void *addr, uint32_t *page) {
+for (int i = 0; i < g_demand_count; i++) {
+    demand_object_t *d = &g_demand_objects[i];
+    loaded_object_t *lo = &d->exe->loaded_objects[d->index];
+    uintptr_t base = (uintptr_t)lo->base;
+
+    if ((uintptr_t)addr >= base && (uintptr_t)addr < base + lo->size) {
+        *page = ((uintptr_t)addr - base) / LOADER_PAGE_SIZE;
+        return d;
+    }
+}
+return NULL;
+}
+
+static void demand_fault_handler(int sig, siginfo_t *info, void *context) {
+uint32_t page;
+int handled = 0;
+
+fault_lock();
+demand_object_t *d = find_demand_object(info->si_addr, &page);
+if (d && materialize_page(d->exe, d->index, page) == 0) {
+    __atomic_add_fetch(&g_pages_faulted, 1, __ATOMIC_RELAXED);
+    handled = 1;
+}
+fault_unlock();
+
+if (!handled) {
+    // Not a demand page (or a real protection fault): let the previous
+    // disposition see the access when it is retried
+    trace_flush_fatal();
+    sigaction(SIGSEGV, &g_prev_segv, NULL);
+}
+(void)sig;
+(void)context;
+}
+
+static int install_fault_handler(void) {
+if (g_segv_installed) return 0;
+
+struct sigaction sa;
+memset(&sa, 0, sizeof(sa));
+sa.sa_sigaction = demand_fault_handler;
+sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+sigemptyset(&sa.sa_mask);
+if (sigaction(SIGSEGV, &sa, &g_prev_segv) < 0) return -1;
+
+g_segv_installed = 1;
+return 0;
+}
+
+static int register_demand_object(os2_exe_t *exe, uint32_t index) {
+if (g_demand_count >= MAX_DEMAND_OBJECTS || install_fault_handler() < 0) {
+    return -1;
+}
+fault_lock();
+g_demand_objects[g_demand_count].exe = exe;
+g_demand_objects[g_demand_count].index = index;
+g_demand_count++;
+fault_unlock();
+return 0;
+}
+
+static void unregister_demand_objects(os2_exe_t *exe) {
+fault_lock();
+int kept = 0;
+for (int i = 0; i < g_demand_count; i++) {
+    if (g_demand_objects[i].exe != exe) {
+        g_demand_objects[kept++] = g_demand_objects[i];
+    }
+}
+g_demand_count = kept;
+fault_unlock();
+}
+
+void loader_prefault(const void *addr, size_t len) {
+if (g_demand_count == 0 || len == 0) return;
+
+uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(LOADER_PAGE_SIZE - 1);
+uintptr_t end = (uintptr_t)addr + len;
+
+fault_lock();
+for (uintptr_t p = start; p < end; p += LOADER_PAGE_SIZE) {
+    uint32_t page;
+    demand_object_t *d = find_demand_object((void*)p, &page);
+    if (d && materialize_page(d->exe, d->index, page) == 0) {
+        g_pages_prefaulted++;
+    }
+}
+fault_unlock();
+}
+
+// Pages present vs pages covered by all loaded objects of 'exe'
+static void count_object_pages(os2_exe_t *exe, uint32_t *present, uint32_t *total) {
+*present = 0;
+*total = 0;
+for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    *total += lo->page_count;
+    if (!lo->page_state) {
+        *present += lo->page_count;
+        continue;
+    }
+    for (uint32_t p = 0; p < lo->page_count; p++) {
+        if (lo->page_state[p] == PAGE_PRESENT) (*present)++;
+    }
+}
+}
+
+// ============================================================================
+// Object Loading
+// ============================================================================
+
+// Copy an LE object, whose pages are contiguous from data_pages_offset
+static void copy_le_object(os2_exe_t *exe, object_entry_t *obj, uint8_t *mem) {
+le_header_t *le = exe->le_header;
+uint32_t page_offset = (obj->page_table_index - 1) * le->page_size;
+uint32_t file_offset = le->data_pages_offset + page_offset;
+uint32_t copy_size = obj->virtual_size;
+
+printf("  File offset: 0x%x\n", file_offset);
+if (file_offset >= exe->file_size) {
+    fprintf(stderr, "  WARNING: File offset 0x%x exceeds file size 0x%zx\n",
+            file_offset, exe->file_size);
+    return;
+}
+if (file_offset + copy_size > exe->file_size) {
+    copy_size = exe->file_size - file_offset;
+}
+memcpy(mem, exe->file_data + file_offset, copy_size);
+printf("  Copied %d bytes from file\n", copy_size);
+}
+
+// Walk the object page table: report each page and pick its initial state
+static void scan_object_pages(os2_exe_t *exe, object_entry_t *obj,
+                              loaded_object_t *lo) {
+lx_page_entry_t *pages = lx_page_table(exe) + obj->page_table_index - 1;
+uint32_t counts[6] = { 0 };
+
+for (uint32_t p = 0; p < obj->page_table_entries && p < lo->page_count; p++) {
+    uint16_t type = pages[p].flags;
+    if (type < 6) counts[type]++;
+    if (type == LX_PAGE_INVALID) lo->page_state[p] = PAGE_INVALID;
+    if (type == LX_PAGE_ITERATED || type == LX_PAGE_COMPRESSED) {
+        printf("  Page %d: %s, %d bytes packed\n",
+               p + 1, lx_page_type_name(type), pages[p].data_size);
+    }
+}
+
+printf("  Pages: %d legal, %d iterated, %d compressed, %d zero-filled, %d invalid\n",
+       counts[LX_PAGE_LEGAL], counts[LX_PAGE_ITERATED], counts[LX_PAGE_COMPRESSED],
+       counts[LX_PAGE_ZEROED], counts[LX_PAGE_INVALID]);
+}
+
+// Module flag: the linker stripped internal fixups, so the image only
+// runs at its link-time base
+#define LX_NO_INTERNAL_FIXUPS 0x10
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+// Link-time bases must fall below this to be honoured
+#define PREFERRED_BASE_LIMIT 0x20000000
+
+// Set by OS2_RELOCATE=1 (and os2bench) to always take the relocation path
+static int g_force_relocation = 0;
+
+// Reserve every object at its link-time base. Objects linked without one
+// (base 0, e.g. resources) go anywhere. Either every based object fits or
+// none is placed and the loader relocates as before.
+static int reserve_preferred_bases(os2_exe_t *exe) {
+if (!is_lx(exe) || g_force_relocation) return 0;
+
+uint32_t count = exe->le_header->object_count;
+const char *why = NULL;
+uint32_t failed = 0;
+
+for (uint32_t i = 0; i < count; i++) {
+    object_entry_t *obj = &exe->objects[i];
+    size_t size = (obj->virtual_size + 0xFFF) & ~0xFFF;
+    uintptr_t base = obj->reloc_base_addr;
+
+    if (base == 0) continue;
+    if (size == 0 || (base & 0xFFF) || base + size > PREFERRED_BASE_LIMIT) {
+        why = "is outside the low 512 MB";
+    } else {
+        void *mem = mmap((void*)base, size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        // Kernels before 4.17 treat the flag as a hint and may map elsewhere
+        if (mem != MAP_FAILED && mem != (void*)base) munmap(mem, size);
+        if (mem == (void*)base) {
+            exe->loaded_objects[i].base = mem;
+            exe->loaded_objects[i].size = size;
+            continue;
+        }
+        why = "is occupied";
+    }
+    failed = i;
+    break;
+}
+
+if (why) {
+    for (uint32_t i = 0; i < count; i++) {
+        loaded_object_t *lo = &exe->loaded_objects[i];
+        if (lo->base) munmap(lo->base, lo->size);
+        lo->base = NULL;
+        lo->size = 0;
+    }
+    printf("Placement: relocated (object %d base 0x%x %s)\n",
+           failed + 1, exe->objects[failed].reloc_base_addr, why);
+    if (exe->le_header->module_flags & LX_NO_INTERNAL_FIXUPS) {
+        printf("WARNING: image has no internal fixups and cannot run relocated\n");
+    }
+    return 0;
+}
+
+exe->at_preferred_base = 1;
+printf("Placement: preferred bases\n");
+return 1;
+}
+
+int load_objects(os2_exe_t *exe) {
+exe->loaded_objects = calloc(exe->le_header->object_count, sizeof(loaded_object_t));
+if (!exe->loaded_objects) return -1;
+
+uint32_t data_offset = exe->le_header->data_pages_offset;
+int demand = g_demand_paging && is_lx(exe) &&
+             exe->le_header->page_size == LOADER_PAGE_SIZE &&
+             sysconf(_SC_PAGESIZE) == LOADER_PAGE_SIZE;
+
+if (decode_fixups(exe) < 0) return -1;
+
+printf("\nData pages offset: 0x%x\n", data_offset);
+printf("Page size: 0x%x\n", exe->le_header->page_size);
+printf("File size: 0x%zx\n", exe->file_size);
+printf("Loading: %s\n", demand ? "on demand" : "eager");
+if (reserve_preferred_bases(exe)) drop_internal_fixups(exe);
+printf("\n");
+
+for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+    object_entry_t *obj = &exe->objects[i];
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    
+    printf("Object %d:\n", i + 1);
+    printf("  Virtual size: 0x%x\n", obj->virtual_size);
+    printf("  Base address: 0x%x\n", obj->reloc_base_addr);
+    printf("  Flags: 0x%x ", obj->object_flags);
+    if (obj->object_flags & OBJREADABLE) printf("R");
+    if (obj->object_flags & OBJWRITEABLE) printf("W");
+    if (obj->object_flags & OBJEXECUTABLE) printf("X");
+    if (obj->object_flags & OBJPRELOAD) printf(" preload");
+    printf("\n");
+    printf("  Page table index: %d\n", obj->page_table_index);
+    printf("  Page table entries: %d\n", obj->page_table_entries);
+    
+    // Determine protection - objects must be readable
+    int prot = PROT_READ;
+    if (obj->object_flags & OBJWRITEABLE) prot |= PROT_WRITE;
+    if (obj->object_flags & OBJEXECUTABLE) prot |= PROT_EXEC;
+    
+    size_t alloc_size = (obj->virtual_size + 0xFFF) & ~0xFFF;
+    int has_pages = obj->page_table_entries > 0 && obj->page_table_index > 0;
+    int lazy = demand && !(obj->object_flags & OBJPRELOAD) && alloc_size > 0;
+
+    // Demand-loaded objects start inaccessible; eager ones are filled
+    // writable and sealed to 'prot' afterwards. 32-bit fixups can only
+    // address objects below 4 GB.
+    void *mem = lo->base;
+    if (mem) {
+        if (!lazy) mprotect(mem, alloc_size, PROT_READ | PROT_WRITE);
+    } else {
+        mem = mmap(NULL, alloc_size, lazy ? PROT_NONE : PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    }
+    
+    if (mem == MAP_FAILED) {
+        perror("mmap failed");
+        return -1;
+    }
+    
+    printf("  Allocated %zu bytes at %p\n", alloc_size, mem);
+    
+    lo->base = mem;
+    lo->size = alloc_size;
+    lo->flags = obj->object_flags;
+    lo->prot = prot;
+    lo->page_count = alloc_size / LOADER_PAGE_SIZE;
+
+    if (is_lx(exe)) {
+        lo->page_state = calloc(lo->page_count ? lo->page_count : 1, 1);
+        if (!lo->page_state) return -1;
+        if (has_pages) scan_object_pages(exe, obj, lo);
+    }
+
+    if (!has_pages) {
+        printf("  No pages to load (BSS or empty segment)\n");
+    } else if (!is_lx(exe)) {
+        copy_le_object(exe, obj, mem);
+    } else {
+        uint32_t mapped = g_load_by_copy ? 0 : lx_mappable_pages(exe, obj);
+        if (mapped > lo->page_count) mapped = lo->page_count;
+
+        if (mapped > 0) {
+            lx_page_entry_t *pe = lx_page_table(exe) + obj->page_table_index - 1;
+            off_t off = lx_page_file_offset(exe, pe);
+            if (mmap(mem, (size_t)mapped * LOADER_PAGE_SIZE, lazy ? PROT_NONE : prot,
+                     MAP_PRIVATE | MAP_FIXED, exe->file_fd, off) == MAP_FAILED) {
+                perror("mmap object from file failed");
+                mapped = 0;
+            } else {
+                lo->file_pages = mapped;
+                memset(lo->page_state, lazy ? PAGE_FILE : PAGE_PRESENT, mapped);
+                printf("  Mapped %d pages from file offset 0x%lx\n",
+                       mapped, (long)off);
+            }
+        }
+
+        if (!lazy) {
+            for (uint32_t p = mapped; p < lo->page_count; p++) {
+                fill_object_page(exe, obj, p, (uint8_t*)mem + (size_t)p * LOADER_PAGE_SIZE);
+            }
+        }
+    }
+
+    if (lazy) {
+        if (register_demand_object(exe, i) < 0) {
+            fprintf(stderr, "Too many demand-loaded objects\n");
+            return -1;
+        }
+    } else {
+        if (lo->page_state) {
+            for (uint32_t p = 0; p < lo->page_count; p++) {
+                if (lo->page_state[p] != PAGE_INVALID) lo->page_state[p] = PAGE_PRESENT;
+            }
+        }
+        mprotect(mem, alloc_size, prot);
+    }
+    printf("\n");
+}
+
+if (exe->le_header->eip_object > 0 && 
+    exe->le_header->eip_object <= exe->le_header->object_count) {
+    exe->entry_point = (uint8_t*)exe->loaded_objects[exe->le_header->eip_object - 1].base + 
+                      exe->le_header->eip;
+    printf("Entry point: %p\n", exe->entry_point);
+}
+
+return 0;
+}
+
+// ============================================================================
+// Import Binding
+// ============================================================================
+//
+// Import fixups never point at host functions directly: those live above
+// 4 GB and would not fit. Each import gets a 16-byte stub in low memory
+// that jumps through its own slot, PLT style:
+//
+//   stub:   jmp *slot(%rip)        ; slot starts out pointing at +6
+//   +6:     push $import_index
+//           jmp common
+//   common: movabs $stubs, %r11
+//           jmp *lazy_bind_trampoline
+//
+// The first call lands in lazy_bind_trampoline, which saves the argument
+// registers, resolves the import, stores the target in the slot and jumps
+// there; later calls go straight through the slot. OS2_BIND=eager fills
+// every slot at load time instead (and logs each resolution), for
+// debugging. Unresolved imports keep their slot on the binder, which
+// reports the call and fails it with ERROR_INVALID_FUNCTION.
+
+static const char *module_name(os2_exe_t *exe, uint16_t module);
+
+#define STUB_SIZE       16
+#define STUB_HEADER     32      // common code + trampoline address
+
+struct import_stubs {
+os2_exe_t *exe;
+uint8_t *code;          // Header + one stub per import, read/execute
+uint64_t *slots;        // One jump target per import, read/write
+size_t size;            // Whole mapping
+uint32_t count;
+};
+
+static int g_eager_binding = 0;         // OS2_BIND=eager
+static uint32_t g_imports_stubbed = 0;  // Stubs handed out by this process
+static uint32_t g_imports_bound = 0;    // Bound on first call
+static uint64_t g_bind_ns = 0;          // Time spent binding on first call
+
+#if defined(__x86_64__)
+
+void lazy_bind_trampoline(void);
+
+// Index (pushed by the stub) at 8(%rbp) after the frame is set up, stubs
+// block in %r11. Stack: 8 (stub push) + 8 (rbp) + 7 * 8 + 128 keeps the
+// call 16-byte aligned.
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl lazy_bind_trampoline\n"
+    ".hidden lazy_bind_trampoline\n"
+    "lazy_bind_trampoline:\n"
+    "    push %rbp\n"
+    "    mov %rsp, %rbp\n"
+    "    push %rdi\n"
+    "    push %rsi\n"
+    "    push %rdx\n"
+    "    push %rcx\n"
+    "    push %r8\n"
+    "    push %r9\n"
+    "    push %rax\n"
+    "    sub $128, %rsp\n"
+    "    movdqu %xmm0, 0(%rsp)\n"
+    "    movdqu %xmm1, 16(%rsp)\n"
+    "    movdqu %xmm2, 32(%rsp)\n"
+    "    movdqu %xmm3, 48(%rsp)\n"
+    "    movdqu %xmm4, 64(%rsp)\n"
+    "    movdqu %xmm5, 80(%rsp)\n"
+    "    movdqu %xmm6, 96(%rsp)\n"
+    "    movdqu %xmm7, 112(%rsp)\n"
+    "    mov 8(%rbp), %edi\n"
+    "    mov %r11, %rsi\n"
+    "    call lazy_bind\n"
+    "    mov %rax, %r11\n"
+    "    movdqu 0(%rsp), %xmm0\n"
+    "    movdqu 16(%rsp), %xmm1\n"
+    "    movdqu 32(%rsp), %xmm2\n"
+    "    movdqu 48(%rsp), %xmm3\n"
+    "    movdqu 64(%rsp), %xmm4\n"
+    "    movdqu 80(%rsp), %xmm5\n"
+    "    movdqu 96(%rsp), %xmm6\n"
+    "    movdqu 112(%rsp), %xmm7\n"
+    "    add $128, %rsp\n"
+    "    pop %rax\n"
+    "    pop %r9\n"
+    "    pop %r8\n"
+    "    pop %rcx\n"
+    "    pop %rdx\n"
+    "    pop %rsi\n"
+    "    pop %rdi\n"
+    "    pop %rbp\n"
+    "    add $8, %rsp\n"
+    "    jmp *%r11\n"
+);
+
+static APIRET APIENTRY unresolved_import(void) {
+return ERROR_INVALID_FUNCTION;
+}
+
+// Resolve an import without logging
+static void *lookup_import(os2_exe_t *exe, const import_entry_t *imp) {
+if (imp->name) return lookup_api_name(imp->name);
+return lookup_api_ordinal(find_api_module(module_name(exe, imp->module)), imp->ordinal);
+}
+
+__attribute__((used))
+static void *lazy_bind(uint32_t index, struct import_stubs *stubs) {
+uint64_t start = now_ns();
+os2_exe_t *exe = stubs->exe;
+import_entry_t *imp = &exe->imports[index];
+void *target = lookup_import(exe, imp);
+
+if (!target) {
+    if (imp->name) {
+        fprintf(stderr, "[API] Call to unresolved import %s.%s\n",
+                module_name(exe, imp->module), imp->name);
+    } else {
+        fprintf(stderr, "[API] Call to unresolved import %s.%d\n",
+                module_name(exe, imp->module), imp->ordinal);
+    }
+    return (void*)unresolved_import;
+}
+
+// Racing first calls resolve to the same target; count the one that wins
+uint64_t lazy = (uint64_t)(uintptr_t)(stubs->code + STUB_HEADER + (size_t)index * STUB_SIZE + 6);
+if (__atomic_compare_exchange_n(&stubs->slots[index], &lazy, (uint64_t)(uintptr_t)target,
+                                0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    __atomic_add_fetch(&g_imports_bound, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_bind_ns, now_ns() - start, __ATOMIC_RELAXED);
+}
+return target;
+}
+
+static void put_rel32(uint8_t *at, const uint8_t *next, const void *target) {
+int32_t rel = (int32_t)((intptr_t)target - (intptr_t)next);
+memcpy(at, &rel, 4);
+}
+
+// Build the stubs for every import of 'exe' and point each import at its
+// stub; with eager binding also resolve and fill every slot now
+static int create_import_stubs(os2_exe_t *exe) {
+uint32_t count = exe->import_count;
+if (count == 0) return 0;
+
+size_t code_size = (STUB_HEADER + (size_t)count * STUB_SIZE + LOADER_PAGE_SIZE - 1) &
+                   ~(size_t)(LOADER_PAGE_SIZE - 1);
+size_t slot_size = ((size_t)count * 8 + LOADER_PAGE_SIZE - 1) & ~(size_t)(LOADER_PAGE_SIZE - 1);
+
+struct import_stubs *stubs = calloc(1, sizeof(*stubs));
+if (!stubs) return -1;
+uint8_t *mem = mmap(NULL, code_size + slot_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+if (mem == MAP_FAILED) {
+    free(stubs);
+    return -1;
+}
+
+stubs->exe = exe;
+stubs->code = mem;
+stubs->slots = (uint64_t*)(mem + code_size);
+stubs->size = code_size + slot_size;
+stubs->count = count;
+
+// Header: movabs $stubs, %r11; jmp *trampoline(%rip); .quad trampoline
+uint8_t *p = mem;
+uint64_t self = (uint64_t)(uintptr_t)stubs, tramp = (uint64_t)(uintptr_t)lazy_bind_trampoline;
+p[0] = 0x49; p[1] = 0xBB; memcpy(p + 2, &self, 8);
+p[10] = 0xFF; p[11] = 0x25; put_rel32(p + 12, p + 16, p + 16);
+memcpy(p + 16, &tramp, 8);
+
+for (uint32_t i = 0; i < count; i++) {
+    uint8_t *stub = mem + STUB_HEADER + (size_t)i * STUB_SIZE;
+    stub[0] = 0xFF; stub[1] = 0x25; put_rel32(stub + 2, stub + 6, &stubs->slots[i]);
+    stub[6] = 0x68; memcpy(stub + 7, &i, 4);
+    stub[11] = 0xE9; put_rel32(stub + 12, stub + 16, mem);
+    stubs->slots[i] = (uint64_t)(uintptr_t)(stub + 6);
+    exe->imports[i].address = stub;
+}
+mprotect(mem, code_size, PROT_READ | PROT_EXEC);
+
+exe->stubs = stubs;
+g_imports_stubbed += count;
+return 0;
+}
+
+static void free_import_stubs(os2_exe_t *exe) {
+if (!exe->stubs) return;
+munmap(exe->stubs->code, exe->stubs->size);
+free(exe->stubs);
+exe->stubs = NULL;
+}
+
+#else
+
+// No stubs off x86-64: imports bind straight to the host functions
+static int create_import_stubs(os2_exe_t *exe) {
+(void)exe;
+return -1;
+}
+
+static void free_import_stubs(os2_exe_t *exe) {
+(void)exe;
+}
+
+#endif
+
+
+// ============================================================================
+// Import Processing
+// ============================================================================
+
+// Name from a length-prefixed table entry (resident/imported names)
+static char *dup_pascal_string(const uint8_t *p) {
+char *s = malloc(p[0] + 1);
+if (!s) return NULL;
+memcpy(s, p + 1, p[0]);
+s[p[0]] = '\0';
+return s;
+}
+
+static int read_module_names(os2_exe_t *exe) {
+uint32_t count = exe->le_header->imported_modules_count;
+if (count == 0 || exe->module_names) return 0;
+
+exe->module_names = calloc(count, sizeof(char*));
+if (!exe->module_names) return -1;
+
+const uint8_t *p = exe->file_data + exe->le_offset +
+                   exe->le_header->imported_modules_offset;
+for (uint32_t i = 0; i < count; i++) {
+    exe->module_names[i] = dup_pascal_string(p);
+    if (!exe->module_names[i]) return -1;
+    p += p[0] + 1;
+}
+exe->module_count = count;
+return 0;
+}
+
+static const char *module_name(os2_exe_t *exe, uint16_t module) {
+if (module == 0 || module > exe->module_count) return "?";
+return exe->module_names[module - 1];
+}
+
+void process_imports(os2_exe_t *exe) {
+if (exe->le_header->imported_modules_count == 0) {
+printf("No imports to process\n");
+exe->fixups_ready = 1;
+return;
+}
+
+printf("\n=== Processing Imports ===\n");
+
+if (read_module_names(exe) < 0) {
+    fprintf(stderr, "Out of memory reading module names\n");
     return;
 }
+for (uint32_t i = 0; i < exe->module_count; i++) {
+    printf("Module %d: %s\n", i + 1, exe->module_names[i]);
+}
+
+// Imports point at their stubs; only eager binding resolves them now
+int stubbed = create_import_stubs(exe) == 0;
+uint32_t by_name = 0, resolved = 0;
+for (uint32_t i = 0; i < exe->import_count; i++) {
+    import_entry_t *imp = &exe->imports[i];
+    if (imp->name) by_name++;
+    if (stubbed && !g_eager_binding) continue;
+
+    void *target = imp->name ? resolve_os2_api(imp->name) :
+                   resolve_os2_ordinal(module_name(exe, imp->module), imp->ordinal);
+    if (!target) continue;
+    resolved++;
+    if (stubbed) {
+        exe->stubs->slots[i] = (uint64_t)(uintptr_t)target;
+    } else {
+        imp->address = target;
+    }
+}
+
+printf("Imports: %d (%d by ordinal, %d by name), ",
+       exe->import_count, exe->import_count - by_name, by_name);
+if (stubbed && !g_eager_binding) {
+    printf("bound on first call\n");
+} else {
+    printf("%d resolved%s\n", resolved, stubbed ? " and bound" : "");
+}
+}
+
+// ============================================================================
+// Fixup Processing
+// ============================================================================
+//
+// Fixup records are decoded once, at load time, into one lx_fixup_t array
+// grouped by module page (page_fixups[p] .. page_fixups[p + 1]). Imports
+// are deduplicated into exe->imports so resolving them touches each
+// (module, ordinal/name) pair once. Applying a page's fixups is then a
+// tight loop over fixed-size entries, done when the page is filled: at
+// fault time for demand-loaded objects, in apply_fixups for the rest.
+//
+// A fixup whose bytes straddle two pages is listed under both pages, with
+// a negative source offset on the second; each page writes only its part.
+
+// Source types (low nibble of the source byte)
+#define LX_FIX_BYTE     0x00
+#define LX_FIX_SEL16    0x02
+#define LX_FIX_PTR1616  0x03
+#define LX_FIX_OFF16    0x05
+#define LX_FIX_PTR1632  0x06
+#define LX_FIX_OFF32    0x07
+#define LX_FIX_REL32    0x08
+#define LX_FIX_ALIAS    0x10
+#define LX_FIX_LIST     0x20
+
+// Target flags
+#define LX_TGT_INTERNAL  0x00
+#define LX_TGT_ORDINAL   0x01
+#define LX_TGT_NAME      0x02
+#define LX_TGT_ENTRY     0x03
+#define LX_TGT_ADDITIVE  0x04
+#define LX_TGT_CHAIN     0x08
+#define LX_TGT_OFF32     0x10
+#define LX_TGT_ADD32     0x20
+#define LX_TGT_OBJ16     0x40
+#define LX_TGT_ORD8      0x80
+
+// OS/2 flat selectors; 16-bit objects use tiled LDT selectors instead
+#define FLAT_CS_SELECTOR 0x5B
+#define FLAT_DS_SELECTOR 0x53
+
+#define OBJBIGDEF 0x2000    // 32-bit object
+
+static uint64_t g_fixups_applied = 0;
+static uint64_t g_fixups_truncated = 0;     // Target above 4 GB
+
+static inline uint16_t tiled_selector(uint32_t linear) {
+return (linear >> 13) | 7;
+}
+
+// Resolve an entry table ordinal of this module to object + offset.
+// Forwarders come back as imports (*obj == 0).
+static int lx_entry_target(os2_exe_t *exe, uint32_t ordinal, uint32_t *obj,
+                           uint32_t *offset, uint16_t *fwd_module) {
+const uint8_t *p = exe->file_data + exe->le_offset + exe->le_header->entry_table_offset;
+const uint8_t *end = exe->file_data + exe->file_size;
+uint32_t current = 1;
+
+while (p + 2 <= end && p[0] != 0) {
+    uint8_t count = p[0], type = p[1];
+    static const uint8_t entry_size[] = { 0, 3, 5, 5, 7 };
+    if (type > 4) return -1;
+    p += 2;
+    if (type == 0) {
+        current += count;
+        continue;
+    }
+
+    uint16_t object;
+    memcpy(&object, p, 2);
+    p += 2;
+    if (ordinal < current + count) {
+        const uint8_t *e = p + (ordinal - current) * entry_size[type];
+        if (e + entry_size[type] > end) return -1;
+        uint16_t off16;
+        switch (type) {
+            case 1:
+            case 2:
+                memcpy(&off16, e + 1, 2);
+                *offset = off16;
+                break;
+            case 3:
+                memcpy(offset, e + 1, 4);
+                break;
+            default:
+                memcpy(fwd_module, e + 1, 2);
+                memcpy(offset, e + 3, 4);
+                *obj = 0;
+                return 0;
+        }
+        *obj = object;
+        return 0;
+    }
+    current += count;
+    p += count * entry_size[type];
+}
+return -1;
+}
+
+// Index of an import in exe->imports, adding it on first use. The key
+// packs module, kind and ordinal/name offset; lookups go through an
+// open-addressed hash so decoding stays linear in the record count.
+static int32_t intern_import(os2_exe_t *exe, uint16_t module, int by_name,
+                             uint32_t value, uint32_t **hash, uint32_t *hash_size) {
+uint64_t key = (uint64_t)module << 33 | (uint64_t)by_name << 32 | value;
+
+if (exe->import_count * 2 >= *hash_size) {
+    uint32_t size = *hash_size ? *hash_size * 2 : 256;
+    uint32_t *table = malloc(size * sizeof(uint32_t));
+    if (!table) return -1;
+    memset(table, 0xFF, size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < exe->import_count; i++) {
+        import_entry_t *imp = &exe->imports[i];
+        uint32_t h = (uint32_t)((imp->key * 0x9E3779B97F4A7C15ULL) >> 40) & (size - 1);
+        while (table[h] != 0xFFFFFFFF) h = (h + 1) & (size - 1);
+        table[h] = i;
+    }
+    free(*hash);
+    *hash = table;
+    *hash_size = size;
+
+    import_entry_t *grown = realloc(exe->imports, size / 2 * sizeof(import_entry_t));
+    if (!grown) return -1;
+    exe->imports = grown;
+}
+
+uint32_t h = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 40) & (*hash_size - 1);
+while ((*hash)[h] != 0xFFFFFFFF) {
+    if (exe->imports[(*hash)[h]].key == key) return (*hash)[h];
+    h = (h + 1) & (*hash_size - 1);
+}
+
+import_entry_t *imp = &exe->imports[exe->import_count];
+memset(imp, 0, sizeof(*imp));
+imp->key = key;
+imp->module = module;
+if (by_name) {
+    const uint8_t *name = exe->file_data + exe->le_offset +
+                          exe->le_header->imported_proc_table_offset + value;
+    if (name >= exe->file_data + exe->file_size) return -1;
+    imp->name = dup_pascal_string(name);
+    if (!imp->name) return -1;
+} else {
+    imp->ordinal = value;
+}
+(*hash)[h] = exe->import_count;
+return exe->import_count++;
+}
+
+static int push_fixup(os2_exe_t *exe, uint32_t *capacity, const lx_fixup_t *fx) {
+if (exe->fixup_count == *capacity) {
+    uint32_t grown_cap = *capacity ? *capacity * 2 : 256;
+    lx_fixup_t *grown = realloc(exe->fixups, grown_cap * sizeof(lx_fixup_t));
+    if (!grown) return -1;
+    exe->fixups = grown;
+    *capacity = grown_cap;
+}
+exe->fixups[exe->fixup_count++] = *fx;
+return 0;
+}
+
+#define FIX_RD8(v)  do { if (p + 1 > end) goto bad; (v) = *p; p += 1; } while (0)
+#define FIX_RD16(v) do { uint16_t t_; if (p + 2 > end) goto bad; memcpy(&t_, p, 2); (v) = t_; p += 2; } while (0)
+#define FIX_RD32(v) do { uint32_t t_; if (p + 4 > end) goto bad; memcpy(&t_, p, 4); (v) = t_; p += 4; } while (0)
+
+// Decode the records of one module page
+static int decode_page_fixups(os2_exe_t *exe, const uint8_t *p, const uint8_t *end,
+                              uint32_t *capacity, uint32_t **hash, uint32_t *hash_size) {
+while (p < end) {
+    uint32_t src, flags, count = 1, object = 0, offset = 0, additive = 0;
+    int32_t import = -1;
+    lx_fixup_t fx;
+    int16_t first_off = 0;
+
+    FIX_RD8(src);
+    FIX_RD8(flags);
+    if (src & LX_FIX_LIST) {
+        FIX_RD8(count);
+    } else {
+        uint32_t off;
+        FIX_RD16(off);
+        first_off = (int16_t)off;
+    }
+
+    switch (flags & 3) {
+        case LX_TGT_INTERNAL:
+            if (flags & LX_TGT_OBJ16) FIX_RD16(object); else FIX_RD8(object);
+            if ((src & 0x0F) != LX_FIX_SEL16) {
+                if (flags & LX_TGT_OFF32) FIX_RD32(offset); else FIX_RD16(offset);
+            }
+            break;
+        case LX_TGT_ORDINAL: {
+            uint32_t module, ordinal;
+            if (flags & LX_TGT_OBJ16) FIX_RD16(module); else FIX_RD8(module);
+            if (flags & LX_TGT_ORD8) FIX_RD8(ordinal);
+            else if (flags & LX_TGT_OFF32) FIX_RD32(ordinal);
+            else FIX_RD16(ordinal);
+            import = intern_import(exe, module, 0, ordinal, hash, hash_size);
+            if (import < 0) goto bad;
+            break;
+        }
+        case LX_TGT_NAME: {
+            uint32_t module, name;
+            if (flags & LX_TGT_OBJ16) FIX_RD16(module); else FIX_RD8(module);
+            if (flags & LX_TGT_OFF32) FIX_RD32(name); else FIX_RD16(name);
+            import = intern_import(exe, module, 1, name, hash, hash_size);
+            if (import < 0) goto bad;
+            break;
+        }
+        default: {
+            uint32_t ordinal;
+            uint16_t fwd_module = 0;
+            if (flags & LX_TGT_OBJ16) FIX_RD16(ordinal); else FIX_RD8(ordinal);
+            if (lx_entry_target(exe, ordinal, &object, &offset, &fwd_module) < 0) goto bad;
+            if (object == 0) {
+                import = intern_import(exe, fwd_module, 0, offset, hash, hash_size);
+                if (import < 0) goto bad;
+                offset = 0;
+            }
+            break;
+        }
+    }
+    if (flags & LX_TGT_ADDITIVE) {
+        if (flags & LX_TGT_ADD32) FIX_RD32(additive); else FIX_RD16(additive);
+    }
+
+    if (import < 0 && (object == 0 || object > exe->le_header->object_count)) goto bad;
+
+    fx.src_type = src & 0x0F;
+    if (import >= 0) {
+        fx.kind = FIXUP_IMPORT;
+        fx.target = import;
+        fx.offset = additive;
+    } else {
+        fx.kind = (flags & LX_TGT_CHAIN) ? FIXUP_CHAIN : FIXUP_INTERNAL;
+        fx.target = object - 1;
+        fx.offset = offset + additive;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (src & LX_FIX_LIST) {
+            uint32_t off;
+            FIX_RD16(off);
+            first_off = (int16_t)off;
+        }
+        fx.src_off = first_off;
+        if (push_fixup(exe, capacity, &fx) < 0) return -1;
+    }
+}
+return 0;
+
+bad:
+return -1;
+}
+
+static int decode_fixups(os2_exe_t *exe) {
+le_header_t *le = exe->le_header;
+if (!is_lx(exe) || le->fixup_page_table_offset == 0 || exe->page_fixups) return 0;
+
+uint64_t fpt_off = exe->le_offset + (uint64_t)le->fixup_page_table_offset;
+uint64_t rec_off = exe->le_offset + (uint64_t)le->fixup_record_table_offset;
+if (fpt_off + ((uint64_t)le->module_pages + 1) * 4 > exe->file_size ||
+    rec_off > exe->file_size) {
+    fprintf(stderr, "Fixup tables exceed file bounds\n");
+    return -1;
+}
+
+exe->page_fixups = calloc(le->module_pages + 1, sizeof(uint32_t));
+if (!exe->page_fixups) return -1;
+
+const uint32_t *fpt = (const uint32_t*)(exe->file_data + fpt_off);
+const uint8_t *records = exe->file_data + rec_off;
+uint32_t capacity = 0, *hash = NULL, hash_size = 0;
+int rc = 0;
+
+for (uint32_t page = 0; page < le->module_pages; page++) {
+    exe->page_fixups[page] = exe->fixup_count;
+    if (fpt[page] >= fpt[page + 1]) continue;
+    if (rec_off + fpt[page + 1] > exe->file_size ||
+        decode_page_fixups(exe, records + fpt[page], records + fpt[page + 1],
+                           &capacity, &hash, &hash_size) < 0) {
+        fprintf(stderr, "Bad fixup records for page %d\n", page + 1);
+        rc = -1;
+        break;
+    }
+}
+exe->page_fixups[le->module_pages] = exe->fixup_count;
+free(hash);
+return rc;
+}
+
+static int at_link_base(os2_exe_t *exe, uint32_t object) {
+uintptr_t base = exe->objects[object].reloc_base_addr;
+return base != 0 && (uintptr_t)exe->loaded_objects[object].base == base;
+}
+
+// The image sits at its link-time bases, where the linker already resolved
+// internal references: drop those fixups, keeping ones that target (or, for
+// self-relative ones, sit in) an object placed elsewhere. Pages left with
+// none are never opened for writing.
+static void drop_internal_fixups(os2_exe_t *exe) {
+if (!exe->page_fixups) return;
+
+// Module page -> owning object, for the self-relative check
+uint8_t *source_based = calloc(exe->le_header->module_pages + 1, 1);
+if (!source_based) return;
+for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+    object_entry_t *obj = &exe->objects[i];
+    for (uint32_t p = 0; p < obj->page_table_entries; p++) {
+        uint32_t mp = obj->page_table_index - 1 + p;
+        if (mp < exe->le_header->module_pages) source_based[mp] = at_link_base(exe, i);
+    }
+}
+
+uint32_t kept = 0;
+for (uint32_t page = 0; page < exe->le_header->module_pages; page++) {
+    uint32_t first = exe->page_fixups[page], last = exe->page_fixups[page + 1];
+    exe->page_fixups[page] = kept;
+    for (uint32_t f = first; f < last; f++) {
+        lx_fixup_t *fx = &exe->fixups[f];
+        if (fx->kind == FIXUP_INTERNAL && at_link_base(exe, fx->target) &&
+            (fx->src_type != LX_FIX_REL32 || source_based[page])) continue;
+        exe->fixups[kept++] = *fx;
+    }
+}
+free(source_based);
+exe->page_fixups[exe->le_header->module_pages] = kept;
+exe->internal_skipped = exe->fixup_count - kept;
+exe->fixup_count = kept;
+}
+
+static void free_fixups(os2_exe_t *exe) {
+for (uint32_t i = 0; i < exe->import_count; i++) free(exe->imports[i].name);
+free(exe->imports);
+free(exe->fixups);
+free(exe->page_fixups);
+exe->imports = NULL;
+exe->import_count = 0;
+exe->fixups = NULL;
+exe->page_fixups = NULL;
+exe->fixup_count = 0;
+exe->fixups_ready = 0;
+exe->internal_skipped = 0;
+}
+
+// Store 'size' bytes of 'value' at page offset 'off', keeping only the part
+// that falls inside this page
+static inline void store_clipped(uint8_t *page, int32_t off, const uint8_t *bytes, int size) {
+if (off >= 0 && off + size <= LOADER_PAGE_SIZE) {
+    memcpy(page + off, bytes, size);
+    return;
+}
+for (int i = 0; i < size; i++) {
+    if (off + i >= 0 && off + i < LOADER_PAGE_SIZE) page[off + i] = bytes[i];
+}
+}
+
+static inline uint32_t flat32(const void *addr) {
+if ((uintptr_t)addr > 0xFFFFFFFFULL) g_fixups_truncated++;
+return (uint32_t)(uintptr_t)addr;
+}
+
+// Apply the fixups of one object page to 'dst', a writable copy of it (or
+// the page itself)
+static void apply_page_fixups(os2_exe_t *exe, uint32_t object, uint32_t page, uint8_t *dst) {
+object_entry_t *obj = &exe->objects[object];
+if (!exe->page_fixups || page >= obj->page_table_entries) return;
+
+uint32_t module_page = obj->page_table_index - 1 + page;
+if (module_page >= exe->le_header->module_pages) return;
+
+const lx_fixup_t *fx = exe->fixups + exe->page_fixups[module_page];
+const lx_fixup_t *end = exe->fixups + exe->page_fixups[module_page + 1];
+uint32_t page_linear = flat32((uint8_t*)exe->loaded_objects[object].base + (size_t)page * LOADER_PAGE_SIZE);
+
+for (; fx < end; fx++) {
+    uint32_t target;
+    uint16_t selector;
+
+    if (fx->kind == FIXUP_IMPORT) {
+        target = flat32(exe->imports[fx->target].address) + fx->offset;
+        selector = FLAT_CS_SELECTOR;
+    } else {
+        loaded_object_t *lo = &exe->loaded_objects[fx->target];
+        uint32_t base = flat32(lo->base);
+        if (fx->kind == FIXUP_CHAIN) {
+            // Each 32-bit location holds the next location (12 bits,
+            // 0xFFF ends the chain) and the target offset (20 bits)
+            uint32_t off = fx->src_off;
+            while (off + 4 <= LOADER_PAGE_SIZE) {
+                uint32_t link;
+                memcpy(&link, dst + off, 4);
+                uint32_t value = base + (link & 0xFFFFF) + fx->offset;
+                memcpy(dst + off, &value, 4);
+                g_fixups_applied++;
+                if ((link >> 20) == 0xFFF) break;
+                off = link >> 20;
+            }
+            continue;
+        }
+        target = base + fx->offset;
+        if (lo->flags & OBJBIGDEF) {
+            selector = (lo->flags & OBJEXECUTABLE) ? FLAT_CS_SELECTOR : FLAT_DS_SELECTOR;
+        } else {
+            selector = tiled_selector(target);
+        }
+    }
+
+    uint8_t bytes[6];
+    int size;
+    switch (fx->src_type) {
+        case LX_FIX_BYTE:
+            bytes[0] = target;
+            size = 1;
+            break;
+        case LX_FIX_SEL16:
+            memcpy(bytes, &selector, 2);
+            size = 2;
+            break;
+        case LX_FIX_PTR1616: {
+            uint16_t off16 = target;
+            uint16_t tiled = selector == FLAT_CS_SELECTOR || selector == FLAT_DS_SELECTOR ?
+                             tiled_selector(target) : selector;
+            memcpy(bytes, &off16, 2);
+            memcpy(bytes + 2, &tiled, 2);
+            size = 4;
+            break;
+        }
+        case LX_FIX_OFF16: {
+            uint16_t off16 = target;
+            memcpy(bytes, &off16, 2);
+            size = 2;
+            break;
+        }
+        case LX_FIX_PTR1632:
+            memcpy(bytes, &target, 4);
+            memcpy(bytes + 4, &selector, 2);
+            size = 6;
+            break;
+        case LX_FIX_OFF32:
+            memcpy(bytes, &target, 4);
+            size = 4;
+            break;
+        case LX_FIX_REL32: {
+            uint32_t rel = target - (page_linear + fx->src_off + 4);
+            memcpy(bytes, &rel, 4);
+            size = 4;
+            break;
+        }
+        default:
+            continue;
+    }
+    store_clipped(dst, fx->src_off, bytes, size);
+    g_fixups_applied++;
+}
+}
+
+static int page_has_fixups(os2_exe_t *exe, uint32_t object, uint32_t page) {
+object_entry_t *obj = &exe->objects[object];
+if (!exe->page_fixups || page >= obj->page_table_entries) return 0;
+
+uint32_t module_page = obj->page_table_index - 1 + page;
+return module_page < exe->le_header->module_pages &&
+       exe->page_fixups[module_page] != exe->page_fixups[module_page + 1];
+}
+
+// Imports are resolved: patch every page that is already present, each
+// in a copy put in place when done. Pages of demand-loaded objects that
+// are still absent get theirs at fault time.
+void apply_fixups(os2_exe_t *exe) {
+if (!exe->page_fixups) {
+    printf("\nNo fixup table\n");
+    exe->fixups_ready = 1;
+    return;
+}
+
+printf("\n=== Processing Fixups ===\n");
+
+uint32_t pages_with_fixups = 0, patched_now = 0, unpatched = 0;
+uint64_t applied_before = g_fixups_applied;
+
+fault_lock();
+for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+
+    for (uint32_t p = 0; p < lo->page_count; p++) {
+        if (!page_has_fixups(exe, i, p)) continue;
+        pages_with_fixups++;
+        if (lo->page_state[p] != PAGE_PRESENT) continue;
+        uint8_t *addr = (uint8_t*)lo->base + (size_t)p * LOADER_PAGE_SIZE;
+        uint8_t *built = scratch_page();
+        if (built) {
+            memcpy(built, addr, LOADER_PAGE_SIZE);
+            apply_page_fixups(exe, i, p, built);
+        }
+        if (!built || install_page(built, addr, lo->prot) < 0) {
+            unpatched++;
+            continue;
+        }
+        patched_now++;
+    }
+}
+exe->fixups_ready = 1;
+fault_unlock();
+if (unpatched) fprintf(stderr, "WARNING: %u pages could not be patched\n", unpatched);
+
+printf("Fixup records decoded: %d (%d imports)\n",
+       exe->fixup_count + exe->internal_skipped, exe->import_count);
+if (exe->at_preferred_base) {
+    printf("Loaded at preferred bases: %d internal fixups skipped\n", exe->internal_skipped);
+}
+printf("Pages with fixups: %d, patched now: %d (%llu fixups), rest on first touch\n",
+       pages_with_fixups, patched_now,
+       (unsigned long long)(g_fixups_applied - applied_before));
+if (g_fixups_truncated) {
+    printf("WARNING: %llu fixup targets lie above 4 GB and were truncated\n",
+           (unsigned long long)g_fixups_truncated);
+}
+}
+
+// ============================================================================
+// Prelink Cache
+// ============================================================================
+//
+// After a cold launch the loaded objects (unpacked, with internal fixups
+// applied for the addresses they got) are written to a cache file along
+// with the import fixups still to apply. A warm launch maps the objects
+// straight from that file at the same addresses and only resolves and
+// patches imports, whose host addresses change from run to run.
+//
+// With demand paging the cached objects are registered like file-mapped
+// ones: pages come in from the page cache on first touch and only those
+// carrying import fixups get a private copy, read from the cache file
+// (which stays open for that) and patched.
+//
+// Cache files are named after the image file's identity (device, inode,
+// size and modification time) and a hash of the emulator's API table, so
+// a replaced binary or a changed emulator simply misses without the image
+// being read. Its contents are hashed only when storing. Everything read
+// back is checked against the image before use; anything that does not
+// fit is a miss, as is an address that is already taken.
+//
+//   prelink_header_t
+//   prelink_object_t[object_count]
+//   page state bytes, per object
+//   page_fixups[module_pages + 1], lx_fixup_t[fixup_count] (imports only)
+//   prelink_import_t[import_count], name strings
+//   object contents, each page aligned at its data_offset
+
+#define PRELINK_MAGIC   0x31434C50324F534FULL   // "OSO2PLC1"
+#define PRELINK_FORMAT  2                       // Bump on layout/semantics change
+
+typedef struct {
+uint64_t magic;
+uint32_t format;
+uint32_t object_count;
+uint64_t image_hash;    // Contents when stored; informational
+uint64_t api_hash;
+uint64_t image_size;
+uint64_t image_dev;     // st_dev, st_ino and st_mtim of the image
+uint64_t image_ino;
+int64_t image_mtime_sec;
+uint32_t image_mtime_nsec;
+uint32_t module_pages;
+uint32_t fixup_count;
+uint32_t import_count;
+uint32_t strings_size;
+uint32_t meta_size;     // Everything before the object contents
+} prelink_header_t;
+
+typedef struct {
+uint32_t base;          // Address the contents were relocated for
+uint32_t size;
+uint32_t page_count;
+uint32_t data_offset;
+} prelink_object_t;
+
+typedef struct {
+uint16_t module;
+uint16_t has_name;
+uint32_t ordinal;
+uint32_t name;          // Offset into the string area
+} prelink_import_t;
+
+static int g_prelink = 1;               // OS2_PRELINK=0 turns it off
+static const char *g_prelink_dir = NULL;    // OS2_PRELINK_DIR
+
+// Four independent multiply-xor lanes, 32 bytes per step
+static uint64_t hash_bytes(const uint8_t *p, size_t len, uint64_t seed) {
+const uint64_t k = 0x9E3779B97F4A7C15ULL;
+uint64_t h[4] = { seed, seed ^ 1, seed ^ 2, seed ^ 3 };
+size_t i = 0;
+for (; i + 32 <= len; i += 32) {
+    for (int l = 0; l < 4; l++) {
+        uint64_t w;
+        memcpy(&w, p + i + l * 8, 8);
+        h[l] = (h[l] ^ w) * k;
+        h[l] ^= h[l] >> 29;
+    }
+}
+uint64_t r = len;
+for (int l = 0; l < 4; l++) r = (r ^ h[l]) * k;
+for (; i < len; i++) r = (r ^ p[i]) * k;
+return r ^ (r >> 31);
+}
+
+static uint64_t api_table_hash(void) {
+uint64_t h = PRELINK_FORMAT;
+for (int i = 0; api_exports[i].name != NULL; i++) {
+    h = hash_bytes((const uint8_t*)api_exports[i].name, strlen(api_exports[i].name), h);
+    h = hash_bytes((const uint8_t*)api_exports[i].module, strlen(api_exports[i].module),
+                   h + api_exports[i].ordinal);
+}
+return h;
+}
+
+// Same file, same contents: cheap enough for every launch
+static int image_key(os2_exe_t *exe, uint64_t *key) {
+const struct stat *st = &exe->file_stat;
+if (st->st_ino == 0) return -1;
+uint64_t id[5] = { st->st_dev, st->st_ino, st->st_size,
+                   st->st_mtim.tv_sec, st->st_mtim.tv_nsec };
+*key = hash_bytes((const uint8_t*)id, sizeof(id), 0);
+return 0;
+}
+
+static int prelink_path(char *path, size_t size, os2_exe_t *exe) {
+char dir[PATH_MAX];
+uint64_t key;
+if (image_key(exe, &key) < 0) return -1;
+const char *base = g_prelink_dir ? g_prelink_dir : getenv("OS2_PRELINK_DIR");
+
+if (base && *base) {
+    snprintf(dir, sizeof(dir), "%s", base);
+} else if (getenv("XDG_CACHE_HOME") && *getenv("XDG_CACHE_HOME")) {
+    snprintf(dir, sizeof(dir), "%s/os2run", getenv("XDG_CACHE_HOME"));
+} else if (getenv("HOME")) {
+    snprintf(dir, sizeof(dir), "%s/.cache/os2run", getenv("HOME"));
+} else {
+    return -1;
+}
+
+int n = snprintf(path, size, "%s/%016llx.plc", dir,
+                 (unsigned long long)(key ^ api_table_hash()));
+return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+// Map a cached image for 'exe'. Returns 0 on a hit; on a miss nothing is
+// left mapped and the caller loads normally.
+int prelink_load(os2_exe_t *exe) {
+if (!g_prelink || !is_lx(exe) || exe->loaded_objects) return -1;
+
+char path[PATH_MAX];
+if (prelink_path(path, sizeof(path), exe) < 0) return -1;
+
+int fd = open(path, O_RDONLY);
+if (fd < 0) {
+    printf("Prelink cache: miss (not cached)\n");
+    return -1;
+}
+
+prelink_header_t hdr;
+uint8_t *meta = NULL;
+const char *why = "stale or damaged";
+le_header_t *le = exe->le_header;
+const struct stat *st = &exe->file_stat;
+struct stat cache_st;
+
+if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+    hdr.magic != PRELINK_MAGIC || hdr.format != PRELINK_FORMAT ||
+    hdr.api_hash != api_table_hash() || hdr.image_size != exe->file_size ||
+    hdr.image_dev != (uint64_t)st->st_dev || hdr.image_ino != (uint64_t)st->st_ino ||
+    hdr.image_mtime_sec != st->st_mtim.tv_sec ||
+    hdr.image_mtime_nsec != (uint32_t)st->st_mtim.tv_nsec ||
+    hdr.object_count != le->object_count ||
+    hdr.module_pages != le->module_pages || hdr.meta_size < sizeof(hdr) ||
+    hdr.meta_size > (64u << 20) || fstat(fd, &cache_st) < 0) {
+    goto miss;
+}
+
+meta = malloc(hdr.meta_size);
+if (!meta || pread(fd, meta, hdr.meta_size, 0) != (ssize_t)hdr.meta_size) goto miss;
+
+// Check the layout before pointing into it: objects must be the ones the
+// image describes and lie inside the file, and the sections must add up
+// to exactly what was read
+size_t off = sizeof(hdr) + (size_t)hdr.object_count * sizeof(prelink_object_t);
+if (off > hdr.meta_size) goto miss;
+const prelink_object_t *po = (const prelink_object_t*)(meta + sizeof(hdr));
+size_t state_bytes = 0;
+for (uint32_t i = 0; i < hdr.object_count; i++) {
+    size_t size = ((size_t)exe->objects[i].virtual_size + LOADER_PAGE_SIZE - 1) &
+                  ~(size_t)(LOADER_PAGE_SIZE - 1);
+    if (po[i].size != size || po[i].page_count != size / LOADER_PAGE_SIZE ||
+        po[i].data_offset % LOADER_PAGE_SIZE != 0 || po[i].data_offset < hdr.meta_size ||
+        (uint64_t)po[i].data_offset + size > (uint64_t)cache_st.st_size) {
+        goto miss;
+    }
+    state_bytes += po[i].page_count;
+}
+const uint8_t *states = meta + off;
+off += (state_bytes + 3) & ~(size_t)3;
+const uint32_t *page_fixups = (const uint32_t*)(meta + off);
+off += ((size_t)hdr.module_pages + 1) * sizeof(uint32_t);
+const lx_fixup_t *fixups = (const lx_fixup_t*)(meta + off);
+off += (size_t)hdr.fixup_count * sizeof(lx_fixup_t);
+const prelink_import_t *imports = (const prelink_import_t*)(meta + off);
+off += (size_t)hdr.import_count * sizeof(prelink_import_t);
+const char *strings = (const char*)(meta + off);
+if (off + hdr.strings_size != hdr.meta_size) goto miss;
+
+for (size_t b = 0; b < state_bytes; b++) {
+    if (states[b] != PAGE_PRESENT && states[b] != PAGE_INVALID) goto miss;
+}
+if (page_fixups[0] != 0 || page_fixups[hdr.module_pages] != hdr.fixup_count) goto miss;
+for (uint32_t page = 0; page < hdr.module_pages; page++) {
+    if (page_fixups[page] > page_fixups[page + 1]) goto miss;
+}
+for (uint32_t f = 0; f < hdr.fixup_count; f++) {
+    if (fixups[f].kind != FIXUP_IMPORT || fixups[f].target >= hdr.import_count) goto miss;
+}
+
+exe->loaded_objects = calloc(hdr.object_count, sizeof(loaded_object_t));
+if (!exe->loaded_objects) goto miss;
+
+why = "address range in use";
+for (uint32_t i = 0; i < hdr.object_count; i++) {
+    object_entry_t *obj = &exe->objects[i];
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    int prot = PROT_READ;
+    if (obj->object_flags & OBJWRITEABLE) prot |= PROT_WRITE;
+    if (obj->object_flags & OBJEXECUTABLE) prot |= PROT_EXEC;
+
+    int lazy = g_demand_paging && !(obj->object_flags & OBJPRELOAD);
+    void *want = (void*)(uintptr_t)po[i].base;
+    void *mem = mmap(want, po[i].size, lazy ? PROT_NONE : prot,
+                     MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, po[i].data_offset);
+    if (mem != MAP_FAILED && mem != want) munmap(mem, po[i].size);
+    if (mem != want) goto unmap;
+
+    lo->base = mem;
+    lo->size = po[i].size;
+    lo->flags = obj->object_flags;
+    lo->prot = prot;
+    lo->page_count = po[i].page_count;
+    lo->cache_offset = po[i].data_offset;
+    lo->page_state = malloc(lo->page_count ? lo->page_count : 1);
+    if (!lo->page_state) goto unmap;
+    memcpy(lo->page_state, states, lo->page_count);
+    states += lo->page_count;
+    if (lazy) {
+        lo->file_pages = lo->page_count;
+        for (uint32_t p = 0; p < lo->page_count; p++) {
+            if (lo->page_state[p] != PAGE_INVALID) lo->page_state[p] = PAGE_FILE;
+        }
+        if (register_demand_object(exe, i) < 0) goto unmap;
+    }
+}
+
+why = "out of memory";
+exe->page_fixups = malloc((hdr.module_pages + 1) * sizeof(uint32_t));
+exe->fixups = malloc((hdr.fixup_count ? hdr.fixup_count : 1) * sizeof(lx_fixup_t));
+exe->imports = calloc(hdr.import_count ? hdr.import_count : 1, sizeof(import_entry_t));
+if (!exe->page_fixups || !exe->fixups || !exe->imports) goto unmap;
+memcpy(exe->page_fixups, page_fixups, (hdr.module_pages + 1) * sizeof(uint32_t));
+memcpy(exe->fixups, fixups, hdr.fixup_count * sizeof(lx_fixup_t));
+exe->fixup_count = hdr.fixup_count;
+for (uint32_t i = 0; i < hdr.import_count; i++) {
+    import_entry_t *imp = &exe->imports[i];
+    imp->module = imports[i].module;
+    imp->ordinal = imports[i].ordinal;
+    if (imports[i].has_name) {
+        if (imports[i].name >= hdr.strings_size) goto unmap;
+        imp->name = strndup(strings + imports[i].name, hdr.strings_size - imports[i].name);
+        if (!imp->name) goto unmap;
+    }
+    exe->import_count = i + 1;
+}
+
+if (le->eip_object > 0 && le->eip_object <= hdr.object_count) {
+    exe->entry_point = (uint8_t*)exe->loaded_objects[le->eip_object - 1].base + le->eip;
+}
+
+// Kept open: demand pages with import fixups are built from it
+free(meta);
+exe->prelink_fd = fd;
+printf("Prelink cache: hit %s\n", path);
+return 0;
+
+unmap:
+unregister_demand_objects(exe);
+for (uint32_t i = 0; i < hdr.object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    if (lo->base) munmap(lo->base, lo->size);
+    free(lo->page_state);
+}
+free(exe->loaded_objects);
+exe->loaded_objects = NULL;
+free_fixups(exe);
+miss:
+free(meta);
+close(fd);
+printf("Prelink cache: miss (%s)\n", why);
+return -1;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+const uint8_t *p = buf;
+while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+}
+return 0;
+}
+
+// Write the loaded, fixed-up image to the cache. Must run after
+// apply_fixups and before the program does; every page is faulted in.
+int prelink_store(os2_exe_t *exe) {
+if (!g_prelink || !is_lx(exe) || !exe->loaded_objects || !exe->fixups_ready) return -1;
+
+static const uint8_t zero_page[LOADER_PAGE_SIZE];
+le_header_t *le = exe->le_header;
+char path[PATH_MAX], tmp[PATH_MAX + 32] = "";
+if (prelink_path(path, sizeof(path), exe) < 0) return -1;
+
+// Create the directory (and, for the default location, its parent)
+char dir[PATH_MAX];
+snprintf(dir, sizeof(dir), "%s", path);
+*strrchr(dir, '/') = '\0';
+if (mkdir(dir, 0755) < 0 && errno == ENOENT) {
+    char *slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+        *slash = '/';
+        mkdir(dir, 0755);
+    }
+}
+
+// Import fixups only; everything else is already in the object contents
+uint32_t kept = 0;
+uint32_t *page_fixups = malloc((le->module_pages + 1) * sizeof(uint32_t));
+lx_fixup_t *fixups = malloc((exe->fixup_count ? exe->fixup_count : 1) * sizeof(lx_fixup_t));
+prelink_import_t *imports = calloc(exe->import_count ? exe->import_count : 1,
+                                   sizeof(prelink_import_t));
+size_t strings_size = 0;
+for (uint32_t i = 0; i < exe->import_count; i++) {
+    if (exe->imports[i].name) strings_size += strlen(exe->imports[i].name) + 1;
+}
+char *strings = malloc(strings_size ? strings_size : 1);
+prelink_object_t *po = malloc(le->object_count * sizeof(prelink_object_t));
+int rc = -1, fd = -1;
+
+if (!page_fixups || !fixups || !imports || !strings || !po) goto out;
+
+// Fault in every page first so the stored states are all final
+for (uint32_t i = 0; i < le->object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    loader_prefault(lo->base, lo->size);
+}
+
+if (exe->page_fixups) {
+    for (uint32_t page = 0; page < le->module_pages; page++) {
+        page_fixups[page] = kept;
+        for (uint32_t f = exe->page_fixups[page]; f < exe->page_fixups[page + 1]; f++) {
+            if (exe->fixups[f].kind == FIXUP_IMPORT) fixups[kept++] = exe->fixups[f];
+        }
+    }
+} else {
+    memset(page_fixups, 0, le->module_pages * sizeof(uint32_t));
+}
+page_fixups[le->module_pages] = kept;
+
+size_t used = 0;
+for (uint32_t i = 0; i < exe->import_count; i++) {
+    import_entry_t *imp = &exe->imports[i];
+    imports[i].module = imp->module;
+    imports[i].ordinal = imp->ordinal;
+    if (imp->name) {
+        imports[i].has_name = 1;
+        imports[i].name = used;
+        strcpy(strings + used, imp->name);
+        used += strlen(imp->name) + 1;
+    }
+}
+
+prelink_header_t hdr = {
+    .magic = PRELINK_MAGIC,
+    .format = PRELINK_FORMAT,
+    .object_count = le->object_count,
+    .image_hash = hash_bytes(exe->file_data, exe->file_size, 0),
+    .api_hash = api_table_hash(),
+    .image_size = exe->file_size,
+    .image_dev = exe->file_stat.st_dev,
+    .image_ino = exe->file_stat.st_ino,
+    .image_mtime_sec = exe->file_stat.st_mtim.tv_sec,
+    .image_mtime_nsec = exe->file_stat.st_mtim.tv_nsec,
+    .module_pages = le->module_pages,
+    .fixup_count = kept,
+    .import_count = exe->import_count,
+    .strings_size = strings_size,
+};
+
+size_t state_bytes = 0;
+for (uint32_t i = 0; i < le->object_count; i++) state_bytes += exe->loaded_objects[i].page_count;
+uint8_t pad[4] = { 0 };
+size_t state_pad = ((state_bytes + 3) & ~(size_t)3) - state_bytes;
+hdr.meta_size = sizeof(hdr) + le->object_count * sizeof(prelink_object_t) + state_bytes + state_pad +
+                (le->module_pages + 1) * sizeof(uint32_t) + kept * sizeof(lx_fixup_t) +
+                exe->import_count * sizeof(prelink_import_t) + strings_size;
+
+uint32_t offset = (hdr.meta_size + LOADER_PAGE_SIZE - 1) & ~(LOADER_PAGE_SIZE - 1);
+for (uint32_t i = 0; i < le->object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    if ((uintptr_t)lo->base > 0xFFFFFFFFULL) goto out;
+    po[i] = (prelink_object_t){ (uint32_t)(uintptr_t)lo->base, lo->size, lo->page_count, offset };
+    offset += lo->size;
+}
+
+snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+if (fd < 0) goto out;
+
+if (write_all(fd, &hdr, sizeof(hdr)) < 0 ||
+    write_all(fd, po, le->object_count * sizeof(prelink_object_t)) < 0) {
+    goto out;
+}
+for (uint32_t i = 0; i < le->object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    if (write_all(fd, lo->page_state, lo->page_count) < 0) goto out;
+}
+if (write_all(fd, pad, state_pad) < 0 ||
+    write_all(fd, page_fixups, (le->module_pages + 1) * sizeof(uint32_t)) < 0 ||
+    write_all(fd, fixups, kept * sizeof(lx_fixup_t)) < 0 ||
+    write_all(fd, imports, exe->import_count * sizeof(prelink_import_t)) < 0 ||
+    write_all(fd, strings, strings_size) < 0) {
+    goto out;
+}
+
+for (uint32_t i = 0; i < le->object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    if (lseek(fd, po[i].data_offset, SEEK_SET) < 0) goto out;
+    for (uint32_t p = 0; p < lo->page_count; p++) {
+        const void *src = lo->page_state[p] == PAGE_INVALID ? zero_page :
+                          (uint8_t*)lo->base + (size_t)p * LOADER_PAGE_SIZE;
+        if (write_all(fd, src, LOADER_PAGE_SIZE) < 0) goto out;
+    }
+}
+
+if (close(fd) == 0 && rename(tmp, path) == 0) {
+    printf("Prelink cache: stored %s\n", path);
+    rc = 0;
+}
+fd = -1;
+
+out:
+if (fd >= 0) close(fd);
+if (rc < 0 && tmp[0]) unlink(tmp);
+free(po);
+free(page_fixups);
+free(fixups);
+free(imports);
+free(strings);
+return rc;
+}
+
+static os2_exe_t *g_running_exe = NULL;
+
+// Runs at exit, DosExit included: how much of the image the program used
+static void report_page_usage(void) {
+if (!g_running_exe) return;
+
+uint32_t present, total;
+count_object_pages(g_running_exe, &present, &total);
+printf("[Loader] Pages touched: %d of %d (%d faulted, %d prefaulted by APIs)\n",
+       present, total, g_pages_faulted, g_pages_prefaulted);
+if (g_unpack_errors) {
+    printf("[Loader] %d EXEPACK pages failed to expand\n", g_unpack_errors);
+}
+if (g_running_exe->stubs && !g_eager_binding) {
+    uint32_t bound = g_imports_bound, total = g_imports_stubbed;
+    printf("[Loader] Imports bound: %d of %d on first call (%.1f us)", bound, total,
+           g_bind_ns / 1000.0);
+    if (bound > 0) {
+        printf(", ~%.1f us of binding skipped", g_bind_ns / 1000.0 / bound * (total - bound));
+    }
+    printf("\n");
+}
+}
+
+void execute_os2_program(os2_exe_t *exe) {
+if (!exe->entry_point) {
+fprintf(stderr, "No entry point\n");
+return;
+}
+
+printf("\n=== Executing OS/2 Program ===\n");
+printf("Entry point: %p\n\n", exe->entry_point);
+
+init_handle_table();
+thread_current();           // The program's thread is TID 1
+g_running_exe = exe;
+atexit(report_page_usage);
+
+// Call the entry point
+void (*entry)() = (void(*)())exe->entry_point;
+entry();
+}
+
+void free_os2_exe(os2_exe_t *exe) {
+if (!exe) return;
+
+if (exe->loaded_objects) {
+    unregister_demand_objects(exe);
+    for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+        if (exe->loaded_objects[i].base) {
+            munmap(exe->loaded_objects[i].base, exe->loaded_objects[i].size);
+        }
+        free(exe->loaded_objects[i].page_state);
+    }
+    free(exe->loaded_objects);
+}
+
+for (uint32_t i = 0; i < exe->module_count; i++) free(exe->module_names[i]);
+free(exe->module_names);
+free_fixups(exe);
+free_import_stubs(exe);
+if (exe->prelink_fd >= 0) close(exe->prelink_fd);
+
+release_image(exe);
+free(exe);
+}
+
+// ============================================================================
+// Benchmarks (os2bench, built with -DOS2_BENCH)
+// ============================================================================
+
+#ifdef OS2_BENCH
+
+
+// The loader narrates everything on stdout; park it on /dev/null while
+// a measurement runs so the numbers are not terminal-bound.
+static int g_saved_stdout = -1;
+
+static void quiet_stdout(void) {
+fflush(stdout);
+g_saved_stdout = dup(STDOUT_FILENO);
+int devnull = open("/dev/null", O_WRONLY);
+dup2(devnull, STDOUT_FILENO);
+close(devnull);
+}
+
+static void restore_stdout(void) {
+fflush(stdout);
+dup2(g_saved_stdout, STDOUT_FILENO);
+close(g_saved_stdout);
+}
+
+// Field from /proc/self/status in kB (e.g. "RssAnon:")
+static long proc_status_kb(const char *field) {
+FILE *f = fopen("/proc/self/status", "r");
+if (!f) return -1;
+
+char line[256];
+long kb = -1;
+size_t len = strlen(field);
+while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, field, len) == 0) {
+        kb = strtol(line + len, NULL, 10);
+        break;
+    }
+}
+fclose(f);
+return kb;
+}
+
+static os2_exe_t *bench_load(const char *path) {
+os2_exe_t *exe = parse_le_exe(path);
+if (!exe) return NULL;
+if (load_objects(exe) < 0) {
+    free_os2_exe(exe);
+    return NULL;
+}
+process_imports(exe);
+apply_fixups(exe);
+return exe;
+}
+
+// Launch path (parse, load, imports, fixups) time and resident memory,
+// read()+memcpy against mmap, relocated against preferred-base placement,
+// for every LX image on the command line
+static int bench_launch(int argc, char **argv) {
+static const char *mode_names[] = { "copy", "mmap", "based" };
+const int iters = 200;
+
+printf("%-20s %-5s %10s %9s %9s %9s %9s %7s %7s\n", "image", "mode", "launch us",
+       "anon kB", "file kB", "anon+tch", "file+tch", "mapped", "skipped");
+
+for (int f = 0; f < argc; f++) {
+    for (int mode = 0; mode < 3; mode++) {
+        g_load_by_copy = (mode == 0);
+        g_force_relocation = (mode < 2);
+
+        quiet_stdout();
+        uint64_t start = now_ns();
+        int ok = 1;
+        for (int it = 0; it < iters && ok; it++) {
+            os2_exe_t *exe = bench_load(argv[f]);
+            ok = exe != NULL;
+            free_os2_exe(exe);
+        }
+        uint64_t elapsed = now_ns() - start;
+
+        long anon0 = proc_status_kb("RssAnon:");
+        long file0 = proc_status_kb("RssFile:");
+        os2_exe_t *exe = ok ? bench_load(argv[f]) : NULL;
+        long anon1 = proc_status_kb("RssAnon:");
+        long file1 = proc_status_kb("RssFile:");
+
+        // Touch every object page, as a program run eventually would
+        uint32_t mapped = 0;
+        const char *skipped = "-";
+        char skipped_buf[16];
+        if (exe && exe->at_preferred_base) {
+            snprintf(skipped_buf, sizeof(skipped_buf), "%u", exe->internal_skipped);
+            skipped = skipped_buf;
+        } else if (mode == 2) {
+            skipped = "reloc";
+        }
+        volatile uint8_t sink = 0;
+        for (uint32_t i = 0; exe && i < exe->le_header->object_count; i++) {
+            loaded_object_t *lo = &exe->loaded_objects[i];
+            mapped += lo->file_pages;
+            if (!(lo->flags & OBJREADABLE)) continue;
+            for (size_t off = 0; off < lo->size; off += 4096) {
+                sink += ((uint8_t*)lo->base)[off];
+            }
+        }
+        (void)sink;
+        long anon2 = proc_status_kb("RssAnon:");
+        long file2 = proc_status_kb("RssFile:");
+        free_os2_exe(exe);
+        restore_stdout();
+
+        if (!ok) {
+            fprintf(stderr, "%s: failed to load\n", argv[f]);
+            break;
+        }
+
+        const char *name = strrchr(argv[f], '/');
+        printf("%-20s %-5s %10.1f %9ld %9ld %9ld %9ld %7u %7s\n",
+               name ? name + 1 : argv[f], mode_names[mode],
+               elapsed / 1000.0 / iters,
+               anon1 - anon0, file1 - file0, anon2 - anon0, file2 - file0, mapped, skipped);
+    }
+}
+
+g_load_by_copy = 0;
+g_force_relocation = 0;
+return 0;
+}
+
+// Pages present after load against pages in the image, eager vs on
+// demand, and what a demand fault costs when every page is then touched
+static int bench_pages(int argc, char **argv) {
+const int iters = 200;
+
+printf("%-20s %-6s %10s %8s %8s %12s\n", "image", "mode", "load us",
+       "present", "pages", "fault ns/pg");
+
+for (int f = 0; f < argc; f++) {
+    for (int mode = 0; mode < 2; mode++) {
+        g_demand_paging = mode;
+
+        quiet_stdout();
+        uint64_t start = now_ns();
+        int ok = 1;
+        for (int it = 0; it < iters && ok; it++) {
+            os2_exe_t *exe = parse_le_exe(argv[f]);
+            ok = exe && load_objects(exe) == 0;
+            free_os2_exe(exe);
+        }
+        uint64_t load_ns = now_ns() - start;
+
+        uint32_t present = 0, total = 0;
+        uint64_t touch_ns = 0;
+        os2_exe_t *exe = ok ? parse_le_exe(argv[f]) : NULL;
+        if (exe && load_objects(exe) == 0) {
+            count_object_pages(exe, &present, &total);
+
+            volatile uint8_t sink = 0;
+            start = now_ns();
+            for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+                loaded_object_t *lo = &exe->loaded_objects[i];
+                for (uint32_t pg = 0; pg < lo->page_count; pg++) {
+                    if (lo->page_state && lo->page_state[pg] == PAGE_INVALID) continue;
+                    sink += ((uint8_t*)lo->base)[(size_t)pg * LOADER_PAGE_SIZE];
+                }
+            }
+            touch_ns = now_ns() - start;
+            (void)sink;
+        }
+        free_os2_exe(exe);
+        restore_stdout();
+
+        if (!ok) {
+            fprintf(stderr, "%s: failed to load\n", argv[f]);
+            break;
+        }
+
+        const char *name = strrchr(argv[f], '/');
+        uint32_t faulted = total - present;
+        printf("%-20s %-6s %10.1f %8u %8u %12.0f\n",
+               name ? name + 1 : argv[f], mode ? "demand" : "eager",
+               load_ns / 1000.0 / iters, present, total,
+               faulted ? (double)touch_ns / faulted : 0.0);
+    }
+}
+
+g_demand_paging = 1;
+return 0;
+}
+
+// -------- Prelink cache --------
+
+static os2_exe_t *bench_load_cached(const char *path, int store) {
+os2_exe_t *exe = parse_le_exe(path);
+if (!exe) return NULL;
+int warm = !store && prelink_load(exe) == 0;
+if (!warm && (store ? load_objects(exe) < 0 : 1)) {
+    free_os2_exe(exe);
+    return NULL;
+}
+process_imports(exe);
+apply_fixups(exe);
+if (store && prelink_store(exe) < 0) {
+    free_os2_exe(exe);
+    return NULL;
+}
+return exe;
+}
+
+// Fault in every page, as a program run eventually would
+static void touch_objects(os2_exe_t *exe) {
+for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    loader_prefault(lo->base, lo->size);
+}
+}
+
+// Copy of every object's contents, for comparing two loads
+static uint8_t **snapshot_objects(os2_exe_t *exe, uint32_t *bases) {
+uint32_t count = exe->le_header->object_count;
+uint8_t **copy = calloc(count, sizeof(uint8_t*));
+touch_objects(exe);
+for (uint32_t i = 0; copy && i < count; i++) {
+    loaded_object_t *lo = &exe->loaded_objects[i];
+    copy[i] = calloc(lo->page_count ? lo->page_count : 1, LOADER_PAGE_SIZE);
+    for (uint32_t pg = 0; copy[i] && pg < lo->page_count; pg++) {
+        if (lo->page_state[pg] == PAGE_INVALID) continue;
+        memcpy(copy[i] + (size_t)pg * LOADER_PAGE_SIZE,
+               (uint8_t*)lo->base + (size_t)pg * LOADER_PAGE_SIZE, LOADER_PAGE_SIZE);
+    }
+    bases[i] = (uint32_t)(uintptr_t)lo->base;
+}
+return copy;
+}
+
+// Each load has its own import stubs, so an import target may differ as
+// long as both point at the same stub, absolutely or relative to the site
+static uint32_t stub_offset(const uint8_t *p, uint32_t site, uint32_t stubs, uint32_t size) {
+uint32_t v;
+memcpy(&v, p, 4);
+if (!stubs) return UINT32_MAX;
+if (v - stubs < size) return v - stubs;
+if (v + site + 4 - stubs < size) return (v + site + 4 - stubs) | 0x80000000u;
+return UINT32_MAX;
+}
+
+static int objects_differ(const uint8_t *a, uint32_t a_stubs, const uint8_t *b,
+                          uint32_t b_stubs, uint32_t base, size_t size, uint32_t stub_size) {
+for (size_t k = 0; k < size; k++) {
+    if (a[k] == b[k]) continue;
+    size_t j = k >= 3 ? k - 3 : 0;
+    for (; j <= k && j + 4 <= size; j++) {
+        uint32_t off = stub_offset(a + j, base + j, a_stubs, stub_size);
+        if (off != UINT32_MAX && off == stub_offset(b + j, base + j, b_stubs, stub_size)) break;
+    }
+    if (j > k || j + 4 > size) return 1;
+    k = j + 3;
+}
+return 0;
+}
+
+static uint32_t stub_base(os2_exe_t *exe) {
+return exe->stubs ? (uint32_t)(uintptr_t)exe->stubs->code : 0;
+}
+
+// Warm and normal loads agree on every object both placed at the same
+// address (anywhere objects may land elsewhere and then differ)
+static int compare_warm_load(const char *path) {
+os2_exe_t *exe = bench_load_cached(path, 0);
+if (!exe) return -1;
+uint32_t count = exe->le_header->object_count;
+uint32_t warm_bases[count], cold_bases[count];
+size_t sizes[count];
+uint8_t **warm = snapshot_objects(exe, warm_bases);
+for (uint32_t i = 0; i < count; i++) sizes[i] = exe->loaded_objects[i].size;
+uint32_t warm_stubs = stub_base(exe);
+uint32_t stub_size = exe->stubs ? (uint32_t)exe->stubs->size : 0;
+free_os2_exe(exe);
+
+exe = bench_load(path);
+uint8_t **cold = exe ? snapshot_objects(exe, cold_bases) : NULL;
+uint32_t cold_stubs = exe ? stub_base(exe) : 0;
+int diff = !warm || !cold;
+for (uint32_t i = 0; !diff && i < count; i++) {
+    if (!warm[i] || !cold[i] || exe->loaded_objects[i].size != sizes[i]) diff = 1;
+    else if (warm_bases[i] == cold_bases[i]) {
+        diff = objects_differ(warm[i], warm_stubs, cold[i], cold_stubs, warm_bases[i],
+                              sizes[i], stub_size);
+    }
+}
+free_os2_exe(exe);
+for (uint32_t i = 0; i < count; i++) {
+    if (warm) free(warm[i]);
+    if (cold) free(cold[i]);
+}
+free(warm);
+free(cold);
+return diff;
+}
+
+// Launch latency without the cache, cold (load and store) and warm (map
+// from the cache), also with every page then touched, and whether a warm
+// load matches a normal one
+static int bench_prelink(int argc, char **argv) {
+const int iters = 200;
+char dir[] = "/tmp/os2plcXXXXXX";
+if (!mkdtemp(dir)) return 1;
+g_prelink_dir = dir;
+
+printf("%-20s %9s %9s %9s %9s %11s %11s %6s\n", "image", "plain us", "cold us",
+       "warm us", "speedup", "plain+tch", "warm+tch", "check");
+
+int failures = 0;
+for (int f = 0; f < argc; f++) {
+    char path[PATH_MAX];
+    double us[5] = { 0 };
+    int diff = -1;
+
+    quiet_stdout();
+    os2_exe_t *exe = parse_le_exe(argv[f]);
+    int ok = exe && prelink_path(path, sizeof(path), exe) == 0;
+    free_os2_exe(exe);
+
+    // plain, cold, warm, plain + touch, warm + touch
+    for (int mode = 0; mode < 5 && ok; mode++) {
+        uint64_t start = now_ns();
+        for (int it = 0; it < iters && ok; it++) {
+            if (mode == 1) unlink(path);
+            exe = (mode == 0 || mode == 3) ? bench_load(argv[f]) :
+                  bench_load_cached(argv[f], mode == 1);
+            ok = exe != NULL;
+            if (ok && mode >= 3) touch_objects(exe);
+            free_os2_exe(exe);
+        }
+        us[mode] = (now_ns() - start) / 1000.0 / iters;
+    }
+    if (ok) diff = compare_warm_load(argv[f]);
+    restore_stdout();
+
+    if (!ok) {
+        fprintf(stderr, "%s: failed to load\n", argv[f]);
+        failures++;
+        continue;
+    }
+    if (diff != 0) failures++;
+
+    const char *name = strrchr(argv[f], '/');
+    printf("%-20s %9.1f %9.1f %9.1f %8.2fx %11.1f %11.1f %6s\n", name ? name + 1 : argv[f],
+           us[0], us[1], us[2], us[0] / us[2], us[3], us[4], diff ? "DIFF" : "ok");
+    unlink(path);
+}
+
+rmdir(dir);
+g_prelink_dir = NULL;
+return failures != 0;
+}
+
+// -------- Import resolution --------
+
+// The previous resolver: upper-case copy, then strcmp down the table
+static void *resolve_name_ref(const char *name) {
+char upper[256];
+size_t i = 0;
+for (; name[i] && i < 255; i++) {
+    upper[i] = (name[i] >= 'a' && name[i] <= 'z') ? name[i] - 32 : name[i];
+}
+upper[i] = '\0';
+for (int e = 0; api_exports[e].name != NULL; e++) {
+    if (strcmp(api_exports[e].name, upper) == 0) return api_exports[e].function;
+}
+return NULL;
+}
+
+typedef struct {
+uint16_t module;        // Index into the set's module names
+uint32_t ordinal;       // 0: by name
+char name[32];
+} bench_import_t;
+
+typedef struct {
+const char **modules;
+uint32_t module_count;
+bench_import_t *imports;
+uint32_t count;
+} bench_import_set_t;
+
+// One pass over the set as process_imports makes it. The old resolver
+// skips ordinals, which it cannot resolve.
+static uint32_t resolve_pass(const bench_import_set_t *set, int old) {
+api_module_t *modules[set->module_count ? set->module_count : 1];
+uint32_t found = 0;
+if (!old) {
+    for (uint32_t m = 0; m < set->module_count; m++) modules[m] = find_api_module(set->modules[m]);
+}
+for (uint32_t i = 0; i < set->count; i++) {
+    const bench_import_t *imp = &set->imports[i];
+    void *f;
+    if (imp->ordinal) {
+        if (old) continue;
+        f = lookup_api_ordinal(modules[imp->module], imp->ordinal);
+    } else {
+        f = old ? resolve_name_ref(imp->name) : lookup_api_name(imp->name);
+    }
+    found += f != NULL;
+}
+return found;
+}
+
+// ns per import
+static double time_resolve(const bench_import_set_t *set, int old) {
+if (set->count == 0) return 0;
+const int iters = 1 + 2000000 / set->count;
+volatile uint32_t sink = 0;
+uint64_t start = now_ns();
+for (int it = 0; it < iters; it++) sink += resolve_pass(set, old);
+(void)sink;
+return (double)(now_ns() - start) / ((double)iters * set->count);
+}
+
+// Names and ordinals are timed apart so each column is per import of
+// that kind
+static void report_resolve(const char *label, const bench_import_set_t *set) {
+bench_import_t *names = malloc((set->count + 1) * sizeof(bench_import_t));
+bench_import_t *ordinals = malloc((set->count + 1) * sizeof(bench_import_t));
+if (!names || !ordinals) {
+    free(names);
+    free(ordinals);
+    return;
+}
+bench_import_set_t by_name = *set, by_ordinal = *set;
+by_name.imports = names;
+by_name.count = 0;
+by_ordinal.imports = ordinals;
+by_ordinal.count = 0;
+for (uint32_t i = 0; i < set->count; i++) {
+    if (set->imports[i].ordinal) ordinals[by_ordinal.count++] = set->imports[i];
+    else names[by_name.count++] = set->imports[i];
+}
+
+printf("%-20s %8u %8u %10.1f %10.1f %10.1f %8u %8u\n", label, set->count, by_name.count,
+       time_resolve(&by_name, 1), time_resolve(&by_name, 0), time_resolve(&by_ordinal, 0),
+       resolve_pass(set, 1), resolve_pass(set, 0));
+free(names);
+free(ordinals);
+}
+
+// A large PM program's import set: mostly ordinals into DOSCALLS, PMWIN
+// and friends, the rest by name in mixed case, a third of them unknown
+static void synthetic_import_set(bench_import_set_t *set) {
+static const char *modules[] = { "DOSCALLS", "PMWIN", "PMGPI", "VIOCALLS", "KBDCALLS" };
+uint32_t names = 0;
+while (api_exports[names].name) names++;
+
+set->modules = modules;
+set->module_count = 5;
+uint32_t seed = 12345;
+for (uint32_t i = 0; i < set->count; i++) {
+    seed = seed * 1103515245 + 12345;
+    bench_import_t *imp = &set->imports[i];
+    memset(imp, 0, sizeof(*imp));
+    if ((seed >> 16) % 4 == 0) {
+        uint32_t pick = (seed >> 8) % (names + names / 2);
+        if (pick < names) {
+            snprintf(imp->name, sizeof(imp->name), "%s", api_exports[pick].name);
+            for (char *c = imp->name + 3; *c; c += 2) *c = *c - 'A' + 'a';
+        } else {
+            snprintf(imp->name, sizeof(imp->name), "WinUnknown%u", pick);
+        }
+    } else {
+        imp->module = (seed >> 4) % 5;
+        imp->ordinal = 1 + (seed >> 12) % 960;
+    }
+}
+}
+
+// Import resolution, linear strcmp against ordinal arrays + perfect hash,
+// on a synthetic large import set and on the imports of any images given
+static int bench_resolve(int argc, char **argv) {
+bench_import_t synthetic[8192];
+bench_import_set_t set = { NULL, 0, synthetic, 8192 };
+
+printf("%-20s %8s %8s %10s %10s %10s %8s %8s\n", "imports", "count", "by name",
+       "strcmp ns", "hash ns", "ordinal ns", "old hit", "new hit");
+synthetic_import_set(&set);
+report_resolve("synthetic PM", &set);
+
+// Every export resolves by name in any case, and by ordinal
+int failures = 0;
+for (int e = 0; api_exports[e].name; e++) {
+    char lower[64];
+    snprintf(lower, sizeof(lower), "%s", api_exports[e].name);
+    for (char *c = lower; *c; c++) *c = *c >= 'A' && *c <= 'Z' ? *c + 32 : *c;
+    if (lookup_api_name(lower) != api_exports[e].function) failures++;
+    if (api_exports[e].ordinal &&
+        lookup_api_ordinal(find_api_module(api_exports[e].module), api_exports[e].ordinal) !=
+        api_exports[e].function) {
+        failures++;
+    }
+}
+if (lookup_api_name("DosOpenX") || lookup_api_name("") || lookup_api_name("DOSOPE")) failures++;
+
+for (int f = 0; f < argc; f++) {
+    quiet_stdout();
+    os2_exe_t *exe = parse_le_exe(argv[f]);
+    int ok = exe && load_objects(exe) == 0 && read_module_names(exe) == 0;
+    restore_stdout();
+    bench_import_t *imports = ok ? calloc(exe->import_count + 1, sizeof(bench_import_t)) : NULL;
+    if (!imports) {
+        fprintf(stderr, "%s: failed to load\n", argv[f]);
+        free_os2_exe(exe);
+        failures++;
+        continue;
+    }
+
+    for (uint32_t i = 0; i < exe->import_count; i++) {
+        import_entry_t *imp = &exe->imports[i];
+        imports[i].module = imp->module ? imp->module - 1 : 0;
+        imports[i].ordinal = imp->name ? 0 : imp->ordinal;
+        if (imp->name) snprintf(imports[i].name, sizeof(imports[i].name), "%s", imp->name);
+    }
+    bench_import_set_t image = { (const char**)exe->module_names, exe->module_count,
+                                 imports, exe->import_count };
+    const char *name = strrchr(argv[f], '/');
+    report_resolve(name ? name + 1 : argv[f], &image);
+    free(imports);
+    free_os2_exe(exe);
+}
+
+printf("\nexport table lookups: %s\n", failures ? "FAIL" : "ok");
+return failures != 0;
+}
+
+// -------- Import binding --------
+
+typedef APIRET (*getmessage_fn)(PCHAR*, ULONG, PCHAR, ULONG, ULONG, PCSZ, PULONG);
+typedef APIRET (*write_fn)(HFILE, PVOID, ULONG, PULONG);
+
+// A module with a by-name import taking a stack argument, an ordinal
+// import and an import the emulator does not have
+static os2_exe_t *stub_test_exe(void) {
+static char *modules[] = { "DOSCALLS" };
+static import_entry_t imports[3];
+static os2_exe_t exe;
+memset(&exe, 0, sizeof(exe));
+memset(imports, 0, sizeof(imports));
+imports[0] = (import_entry_t){ 0, 1, 0, "DosGetMessage", NULL };
+imports[1] = (import_entry_t){ 0, 1, 282, NULL, NULL };
+imports[2] = (import_entry_t){ 0, 1, 999, NULL, NULL };
+exe.module_names = modules;
+exe.module_count = 1;
+exe.imports = imports;
+exe.import_count = 3;
+return &exe;
+}
+
+// Call through fresh stubs: arguments (register and stack) arrive intact,
+// the first call binds once, unresolved imports fail cleanly
+static int stub_self_test(void) {
+os2_exe_t *exe = stub_test_exe();
+if (create_import_stubs(exe) < 0) return 1;
+
+int failures = 0;
+uint32_t bound = g_imports_bound;
+getmessage_fn get = (getmessage_fn)exe->imports[0].address;
+write_fn put = (write_fn)exe->imports[1].address;
+write_fn missing = (write_fn)exe->imports[2].address;
+
+init_handle_table();
+for (int call = 0; call < 2; call++) {
+    ULONG length = 99, written = 77;
+    if (get(NULL, 0, NULL, 0, 1, "OSO001.MSG", &length) != NO_ERROR || length != 0) failures++;
+    if (put(1, "", 0, &written) != NO_ERROR || written != 0) failures++;
+    if (g_imports_bound != bound + 2) failures++;
+}
+if (exe->stubs->slots[0] != (uint64_t)(uintptr_t)DosGetMessage ||
+    exe->stubs->slots[1] != (uint64_t)(uintptr_t)DosWrite) {
+    failures++;
+}
+
+int saved_stderr = dup(STDERR_FILENO), devnull = open("/dev/null", O_WRONLY);
+dup2(devnull, STDERR_FILENO);
+ULONG written;
+if (missing(1, "", 0, &written) != ERROR_INVALID_FUNCTION) failures++;
+dup2(saved_stderr, STDERR_FILENO);
+close(saved_stderr);
+close(devnull);
+if (g_imports_bound != bound + 2) failures++;
+
+free_import_stubs(exe);
+return failures;
+}
+
+// Eager against lazy import processing, and what a call costs through a
+// bound stub and on its first, binding, call
+static int bench_bind(int argc, char **argv) {
+int failures = stub_self_test();
+printf("stub self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+printf("%-20s %8s %10s %10s %10s\n", "image", "imports", "eager us", "lazy us", "saved us");
+for (int f = 0; f < argc; f++) {
+    const int iters = 2000;
+    double us[2];
+
+    quiet_stdout();
+    os2_exe_t *exe = parse_le_exe(argv[f]);
+    int ok = exe && load_objects(exe) == 0;
+    for (int eager = 1; eager >= 0 && ok; eager--) {
+        g_eager_binding = eager;
+        uint64_t start = now_ns();
+        for (int it = 0; it < iters; it++) {
+            free_import_stubs(exe);
+            process_imports(exe);
+        }
+        us[eager] = (now_ns() - start) / 1000.0 / iters;
+    }
+    g_eager_binding = 0;
+    restore_stdout();
+
+    if (!ok) {
+        fprintf(stderr, "%s: failed to load\n", argv[f]);
+        free_os2_exe(exe);
+        failures++;
+        continue;
+    }
+    const char *name = strrchr(argv[f], '/');
+    printf("%-20s %8u %10.2f %10.2f %10.2f\n", name ? name + 1 : argv[f],
+           exe->import_count, us[1], us[0], us[1] - us[0]);
+    free_os2_exe(exe);
+}
+
+os2_exe_t *exe = stub_test_exe();
+if (create_import_stubs(exe) < 0) return 1;
+getmessage_fn via_stub = (getmessage_fn)exe->imports[0].address;
+getmessage_fn direct = DosGetMessage;
+uint64_t lazy_slot = exe->stubs->slots[0];
+const int calls = 1000000;
+ULONG length;
+double ns[3];
+
+// The compiler must not see through 'direct'
+__asm__ volatile("" : "+r"(direct));
+uint64_t start = now_ns();
+for (int i = 0; i < calls; i++) direct(NULL, 0, NULL, 0, 1, NULL, &length);
+ns[0] = (double)(now_ns() - start) / calls;
+
+via_stub(NULL, 0, NULL, 0, 1, NULL, &length);
+start = now_ns();
+for (int i = 0; i < calls; i++) via_stub(NULL, 0, NULL, 0, 1, NULL, &length);
+ns[1] = (double)(now_ns() - start) / calls;
+
+start = now_ns();
+for (int i = 0; i < calls / 10; i++) {
+    exe->stubs->slots[0] = lazy_slot;
+    via_stub(NULL, 0, NULL, 0, 1, NULL, &length);
+}
+ns[2] = (double)(now_ns() - start) / (calls / 10);
+free_import_stubs(exe);
+
+printf("\n%-20s %10s\n", "call", "ns/call");
+printf("%-20s %10.1f\n", "direct", ns[0]);
+printf("%-20s %10.1f\n", "stub, bound", ns[1]);
+printf("%-20s %10.1f\n", "stub, first call", ns[2]);
+return failures != 0;
+}
+
+// -------- Handle table --------
+
+// The original table: 256 fixed slots, first-fit scan from handle 3
+#define REF_HANDLES 256
+
+static struct { int linux_fd; int in_use; char path[256]; } ref_handles[REF_HANDLES];
+
+static HFILE ref_allocate_handle(int linux_fd, const char *path) {
+for (int i = 3; i < REF_HANDLES; i++) {
+    if (!ref_handles[i].in_use) {
+        ref_handles[i].linux_fd = linux_fd;
+        ref_handles[i].in_use = 1;
+        strncpy(ref_handles[i].path, path ? path : "", sizeof(ref_handles[i].path) - 1);
+        return i;
+    }
+}
+return (HFILE)-1;
+}
+
+static void ref_free_handle(HFILE handle) {
+if (handle < REF_HANDLES && ref_handles[handle].in_use) {
+    ref_handles[handle].in_use = 0;
+    ref_handles[handle].linux_fd = -1;
+}
+}
+
+typedef struct {
+int base;           // Fake fd range owned by this thread
+int iters;
+int errors;
+} handle_worker_t;
+
+// Open/close churn from several threads; every handle must read back
+// the fd its owner stored, whatever the other threads are doing.
+static void *handle_worker(void *arg) {
+handle_worker_t *w = arg;
+HFILE held[8];
+for (int it = 0; it < w->iters; it++) {
+    for (int i = 0; i < 8; i++) held[i] = allocate_handle(w->base + i, "worker");
+    for (int i = 0; i < 8; i++) {
+        if (held[i] == (HFILE)-1 || get_linux_fd(held[i]) != w->base + i) w->errors++;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (free_handle(held[i]) != w->base + i) w->errors++;
+    }
+}
+return NULL;
+}
+
+static int handle_thread_test(int threads, int iters) {
+pthread_t tid[16];
+handle_worker_t work[16];
+int errors = 0;
+
+for (int t = 0; t < threads; t++) {
+    work[t] = (handle_worker_t){ 1000000 + t * 100, iters, 0 };
+    pthread_create(&tid[t], NULL, handle_worker, &work[t]);
+}
+for (int t = 0; t < threads; t++) {
+    pthread_join(tid[t], NULL);
+    errors += work[t].errors;
+}
+return errors;
+}
+
+static int bench_handles(int argc, char **argv) {
+(void)argc; (void)argv;
+init_handle_table();
+
+int errors = handle_thread_test(4, 50000);
+printf("thread self-test: %s\n\n", errors ? "FAIL" : "ok");
+if (errors) return 1;
+
+// One allocate+free pair with 'held' other handles open
+static HFILE held[100000];
+const int held_counts[] = { 16, 250, 4000, 100000 };
+const int pairs = 1000000;
+
+printf("%-10s %12s %12s\n", "held", "old ns/pair", "new ns/pair");
+for (size_t c = 0; c < sizeof(held_counts) / sizeof(held_counts[0]); c++) {
+    int count = held_counts[c];
+    char old_ns[16] = "-";
+
+    if (count + 3 < REF_HANDLES) {
+        for (int i = 0; i < count; i++) ref_allocate_handle(100 + i, "held");
+        uint64_t start = now_ns();
+        for (int i = 0; i < pairs; i++) {
+            ref_free_handle(ref_allocate_handle(7, "bench"));
+        }
+        snprintf(old_ns, sizeof(old_ns), "%.1f", (double)(now_ns() - start) / pairs);
+        for (int i = 3; i < REF_HANDLES; i++) ref_free_handle(i);
+    }
+
+    for (int i = 0; i < count; i++) held[i] = allocate_handle(100 + i, "held");
+    uint64_t start = now_ns();
+    for (int i = 0; i < pairs; i++) free_handle(allocate_handle(7, "bench"));
+    double new_ns = (double)(now_ns() - start) / pairs;
+    for (int i = 0; i < count; i++) free_handle(held[i]);
+
+    printf("%-10d %12s %12.1f\n", count, old_ns, new_ns);
+}
+
+// The full DosOpen/DosClose path, bounded by the fd limit
+struct rlimit rl;
+int count = 1000;
+if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)count + 64) {
+    count = (int)rl.rlim_cur - 64;
+}
+const int opens = 200000;
+HFILE h;
+ULONG action;
+
+quiet_stdout();
+for (int i = 0; i < count; i++) {
+    DosOpen("/dev/null", &held[i], &action, 0, 0, OPEN_ACTION_OPEN_IF_EXISTS,
+            OPEN_ACCESS_READONLY, NULL);
+}
+uint64_t start = now_ns();
+for (int i = 0; i < opens; i++) {
+    if (DosOpen("/dev/null", &h, &action, 0, 0, OPEN_ACTION_OPEN_IF_EXISTS,
+                OPEN_ACCESS_READONLY, NULL) == NO_ERROR) DosClose(h);
+}
+double open_ns = (double)(now_ns() - start) / opens;
+for (int i = 0; i < count; i++) DosClose(held[i]);
+restore_stdout();
+
+printf("\nDosOpen+DosClose with %d held: %.0f ns/pair (%.0f pairs/s)\n",
+       count, open_ns, 1e9 / open_ns);
+return 0;
+}
+
+// -------- API tracing --------
+
+#ifndef OS2_NO_TRACE
+static void *trace_worker(void *arg) {
+int calls = *(int*)arg;
+ULONG length;
+for (int i = 0; i < calls; i++) DosGetMessage(NULL, 0, NULL, 0, i, NULL, &length);
+return NULL;
+}
+
+// Calls from several threads all come back out of a written trace
+static int trace_self_test(void) {
+char path[] = "/tmp/os2traceXXXXXX";
+int fd = mkstemp(path);
+if (fd < 0) return 1;
+close(fd);
+
+int calls = 1000;
+pthread_t tid[3];
+trace_init("getmessage");
+for (int t = 0; t < 3; t++) pthread_create(&tid[t], NULL, trace_worker, &calls);
+for (int t = 0; t < 3; t++) pthread_join(tid[t], NULL);
+trace_init(NULL);
+
+long written = trace_write(path);
+quiet_stdout();
+long decoded = trace_decode(path);
+restore_stdout();
+unlink(path);
+return written != 3 * calls || decoded != written;
+}
+#endif
+
+// Per-call cost with the call not selected, selected, and with the
+// printf per call that tracing replaces (stdout on /dev/null)
+static int bench_trace(int argc, char **argv) {
+(void)argc; (void)argv;
+#ifndef OS2_NO_TRACE
+int failures = trace_self_test();
+printf("trace self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+#else
+printf("tracing compiled out (OS2_NO_TRACE)\n\n");
+#endif
+
+getmessage_fn getmessage = DosGetMessage;
+__asm__ volatile("" : "+r"(getmessage));
+int devnull = open("/dev/null", O_WRONLY);
+init_handle_table();
+HFILE out = allocate_handle(devnull, "/dev/null");
+static const char line[16] = "0123456789abcde\n";
+ULONG length;
+double ns[2][3];
+
+quiet_stdout();
+for (int mode = 0; mode < 3; mode++) {
+    trace_init(mode == 1 ? "getmessage,write" : NULL);
+    const int calls = 2000000, writes = 200000;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < calls; i++) {
+        if (mode == 2) printf("[DosGetMessage] message %d\n", i);
+        getmessage(NULL, 0, NULL, 0, i, NULL, &length);
+    }
+    ns[0][mode] = (double)(now_ns() - start) / calls;
+
+    start = now_ns();
+    for (int i = 0; i < writes; i++) {
+        if (mode == 2) printf("[DosWrite] handle %u, %zu bytes\n", out, sizeof(line));
+        DosWrite(out, (PVOID)line, sizeof(line), &length);
+    }
+    ns[1][mode] = (double)(now_ns() - start) / writes;
+}
+trace_init(NULL);
+restore_stdout();
+DosClose(out);
+
+printf("%-20s %10s %10s %10s\n", "call", "off ns", "traced ns", "printf ns");
+printf("%-20s %10.1f %10.1f %10.1f\n", "DosGetMessage", ns[0][0], ns[0][1], ns[0][2]);
+printf("%-20s %10.1f %10.1f %10.1f\n", "DosWrite 16 bytes", ns[1][0], ns[1][1], ns[1][2]);
+return 0;
+}
+
+// -------- API profiling --------
+
+// Profiled resolution hands out thunks that count calls and bytes, and
+// plain resolution comes back when profiling is turned off
+static int profile_self_test(void) {
+int failures = 0;
+int devnull = open("/dev/null", O_WRONLY);
+init_handle_table();
+HFILE out = allocate_handle(devnull, "/dev/null");
+static const char line[16] = "0123456789abcde\n";
+ULONG written;
+
+profile_enable(1);
+uint64_t calls = profile_totals(TRACE_WRITE).calls, bytes = profile_totals(TRACE_WRITE).bytes;
+write_fn write = (write_fn)resolve_os2_ordinal("DOSCALLS", 282);
+getmessage_fn get = (getmessage_fn)resolve_os2_api("DosGetMessage");
+if ((void*)write != (void*)profiled_DosWrite || (void*)get != (void*)profiled_DosGetMessage) {
+    failures++;
+}
+for (int i = 0; i < 100; i++) write(out, (PVOID)line, sizeof(line), &written);
+if (profile_totals(TRACE_WRITE).calls != calls + 100 ||
+    profile_totals(TRACE_WRITE).bytes != bytes + 100 * sizeof(line)) {
+    failures++;
+}
+
+profile_enable(0);
+if (resolve_os2_ordinal("DOSCALLS", 282) != (void*)DosWrite ||
+    resolve_os2_api("DosGetMessage") != (void*)DosGetMessage) {
+    failures++;
+}
+DosClose(out);
+return failures;
+}
+
+// Cost of a call direct and through its profiling thunk, and of the two
+// clock reads the thunk has to make (most of the overhead)
+static int bench_profile(int argc, char **argv) {
+(void)argc; (void)argv;
+quiet_stdout();
+int failures = profile_self_test();
+restore_stdout();
+printf("profile self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+getmessage_fn direct = DosGetMessage, thunk = profiled_DosGetMessage;
+__asm__ volatile("" : "+r"(direct), "+r"(thunk));
+const int calls = 5000000;
+ULONG length;
+double ns[3];
+
+profile_enable(1);
+for (int pass = 0; pass < 2; pass++) {
+    getmessage_fn call = pass ? thunk : direct;
+    uint64_t start = now_ns();
+    for (int i = 0; i < calls; i++) call(NULL, 0, NULL, 0, i, NULL, &length);
+    ns[pass] = (double)(now_ns() - start) / calls;
+}
+profile_enable(0);
+
+uint64_t sink = 0, start = now_ns();
+for (int i = 0; i < calls; i++) sink += trace_clock() - trace_clock();
+ns[2] = (double)(now_ns() - start) / calls;
+__asm__ volatile("" : : "r"(sink));
+
+printf("%-20s %10s\n", "call", "ns/call");
+printf("%-20s %10.1f\n", "direct", ns[0]);
+printf("%-20s %10.1f\n", "profiled", ns[1]);
+printf("%-20s %10.1f\n", "overhead", ns[1] - ns[0]);
+printf("%-20s %10.1f\n", "of which clock", ns[2]);
+return 0;
+}
+
+// -------- Virtual memory --------
+
+static int vm_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "vmem: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+// Reserve, commit, query, change access, decommit and free one allocation
+static int vm_self_test(void) {
+int failures = 0;
+uint8_t *p;
+ULONG cb, flags;
+const ULONG rw = PAG_READ | PAG_WRITE;
+
+vm_check(&failures, DosAllocMem((PVOID*)&p, 0x30000, 0) == ERROR_INVALID_PARAMETER,
+         "allocation without access");
+if (!vm_check(&failures, DosAllocMem((PVOID*)&p, 0x30000, rw) == NO_ERROR, "reserve")) {
+    return failures;
+}
+vm_check(&failures, ((uintptr_t)p & (VM_ALIGN - 1)) == 0, "64 KB alignment");
+vm_check(&failures, (uintptr_t)p + 0x30000 <= UINT32_MAX, "below 4 GB");
+
+cb = 0;
+DosQueryMem(p, &cb, &flags);
+vm_check(&failures, cb == 0x30000 && flags == (rw | PAG_BASE), "query reserved");
+
+vm_check(&failures, DosSetMem(p + 0x1800, 0x1000, PAG_COMMIT | PAG_DEFAULT) == NO_ERROR,
+         "commit (unaligned range covers two pages)");
+memset(p + 0x1000, 0xA5, 0x2000);
+vm_check(&failures, DosSetMem(p + 0x2000, 0x1000, PAG_COMMIT | PAG_DEFAULT) == ERROR_ACCESS_DENIED,
+         "commit of committed pages");
+cb = 0x10000;
+DosQueryMem(p + 0x1000, &cb, &flags);
+vm_check(&failures, cb == 0x2000 && flags == (rw | PAG_COMMIT), "query committed");
+cb = 0x10000;
+DosQueryMem(p, &cb, &flags);
+vm_check(&failures, cb == 0x1000 && flags == (rw | PAG_BASE), "query up to committed");
+
+vm_check(&failures, DosSetMem(p + 0x1000, 0x1000, PAG_READ) == NO_ERROR, "make read-only");
+cb = 0;
+DosQueryMem(p + 0x1000, &cb, &flags);
+vm_check(&failures, cb == 0x1000 && flags == (PAG_READ | PAG_COMMIT), "query read-only");
+vm_check(&failures, DosSetMem(p, 0x2000, PAG_READ) == ERROR_ACCESS_DENIED,
+         "access change over uncommitted pages");
+
+vm_check(&failures, DosSetMem(p + 0x1000, 0x2000, PAG_DECOMMIT) == NO_ERROR, "decommit");
+DosSetMem(p + 0x1000, 0x2000, PAG_COMMIT | PAG_READ | PAG_WRITE);
+vm_check(&failures, p[0x1000] == 0 && p[0x2fff] == 0, "recommitted pages are zero");
+
+vm_check(&failures, DosSetMem(p + 0x2f000, 0x2000, PAG_COMMIT | PAG_DEFAULT) == ERROR_INVALID_ADDRESS,
+         "commit past the allocation");
+vm_check(&failures, DosFreeMem(p + 0x1000) == ERROR_INVALID_ADDRESS, "free inside");
+vm_check(&failures, DosFreeMem(p) == NO_ERROR, "free");
+cb = 0x1000;
+DosQueryMem(p, &cb, &flags);
+vm_check(&failures, flags == PAG_FREE, "query freed");
+vm_check(&failures, DosQueryMem(p, NULL, &flags) == ERROR_INVALID_PARAMETER &&
+                    DosQueryMem(p, &cb, NULL) == ERROR_INVALID_PARAMETER, "query without results");
+
+vm_check(&failures, DosAllocMem((PVOID*)&p, 100, rw | PAG_COMMIT) == NO_ERROR, "committed allocation");
+p[99] = 1;
+DosFreeMem(p);
+vm_check(&failures, DosAllocMem((PVOID*)&p, 0x10000, rw | PAG_COMMIT | OBJ_ANY) == NO_ERROR,
+         "OBJ_ANY allocation");
+p[0xffff] = 1;
+DosFreeMem(p);
+return failures;
+}
+
+static long rss_kb(void) {
+return proc_status_kb("VmRSS:");
+}
+
+// Resident memory for a reserve-heavy program (reserve 512 MB, commit and
+// touch 64 MB a megabyte at a time, give half back) with malloc as the
+// old DosAllocMem did and with the reserve/commit manager; then the cost
+// of small allocations and of DosQueryMem among many allocations
+static int bench_vmem(int argc, char **argv) {
+(void)argc; (void)argv;
+int failures = vm_self_test();
+printf("vmem self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+const size_t reserve = 512u << 20, step = 1u << 20, used = 64u << 20;
+long rss[2][4];
+
+// malloc: no commit step, and nothing can be given back
+long base = rss_kb();
+uint8_t *m = malloc(reserve);
+if (!m) return 1;
+rss[0][0] = rss_kb() - base;
+for (size_t off = 0; off < used; off += step) memset(m + off, 1, step);
+rss[0][1] = rss_kb() - base;
+rss[0][2] = rss[0][1];
+free(m);
+rss[0][3] = rss_kb() - base;
+
+base = rss_kb();
+uint8_t *p;
+if (DosAllocMem((PVOID*)&p, reserve, PAG_READ | PAG_WRITE) != NO_ERROR) return 1;
+rss[1][0] = rss_kb() - base;
+for (size_t off = 0; off < used; off += step) {
+    DosSetMem(p + off, step, PAG_COMMIT | PAG_DEFAULT);
+    memset(p + off, 1, step);
+}
+rss[1][1] = rss_kb() - base;
+DosSetMem(p, used / 2, PAG_DECOMMIT);
+rss[1][2] = rss_kb() - base;
+DosFreeMem(p);
+rss[1][3] = rss_kb() - base;
+
+static const char *phase[] = { "reserve 512 MB", "commit 64 MB", "decommit 32 MB", "free" };
+printf("%-18s %12s %12s\n", "RSS growth", "malloc kB", "vm kB");
+for (int i = 0; i < 4; i++) printf("%-18s %12ld %12ld\n", phase[i], rss[0][i], rss[1][i]);
+
+// Small allocations, allocated and freed in bulk
+enum { SMALL = 4096 };
+static PVOID blocks[SMALL];
+double ns[2];
+uint64_t start = now_ns();
+for (int i = 0; i < SMALL; i++) {
+    blocks[i] = malloc(4096);
+    ((uint8_t*)blocks[i])[0] = 1;
+}
+for (int i = 0; i < SMALL; i++) free(blocks[i]);
+ns[0] = (double)(now_ns() - start) / SMALL;
+
+start = now_ns();
+for (int i = 0; i < SMALL; i++) {
+    DosAllocMem(&blocks[i], 4096, PAG_READ | PAG_WRITE | PAG_COMMIT);
+    ((uint8_t*)blocks[i])[0] = 1;
+}
+uint64_t alloc_end = now_ns();
+
+// Lookups among SMALL allocations
+const int queries = 1000000;
+ULONG cb, flags;
+uint64_t qstart = now_ns();
+for (int i = 0; i < queries; i++) {
+    cb = 4096;
+    DosQueryMem((uint8_t*)blocks[(i * 2654435761u) % SMALL] + 100, &cb, &flags);
+}
+double query_ns = (double)(now_ns() - qstart) / queries;
+
+uint64_t free_start = now_ns();
+for (int i = 0; i < SMALL; i++) DosFreeMem(blocks[i]);
+ns[1] = (double)(alloc_end - start + now_ns() - free_start) / SMALL;
+
+printf("\n%-18s %12s %12s\n", "4 KB alloc+free", "malloc ns", "vm ns");
+printf("%-18s %12.1f %12.1f\n", "", ns[0], ns[1]);
+printf("\nDosQueryMem among %d allocations: %.1f ns\n", SMALL, query_ns);
+return 0;
+}
+
+// -------- Sub-allocation --------
+
+// Sizes of the typical small-object mix, 16 to 512 bytes, small ones most
+static const uint32_t sub_mix[16] = {
+16, 16, 24, 24, 32, 32, 40, 48, 64, 64, 96, 128, 160, 256, 384, 512
+};
+
+typedef struct {
+PVOID heap;
+int iters;
+int errors;
+uint8_t tag;
+} sub_worker_t;
+
+// Allocations from several threads at once must never overlap: each block
+// is filled with the thread's tag and checked before it is freed
+static void *sub_worker(void *arg) {
+sub_worker_t *w = arg;
+uint8_t *held[16];
+uint32_t sizes[16];
+uint32_t seed = w->tag * 2654435761u;
+for (int it = 0; it < w->iters; it++) {
+    for (int i = 0; i < 16; i++) {
+        seed = seed * 1103515245 + 12345;
+        sizes[i] = sub_mix[seed >> 28];
+        if (DosSubAllocMem(w->heap, (PVOID*)&held[i], sizes[i]) != NO_ERROR) {
+            w->errors++;
+            held[i] = NULL;
+            continue;
+        }
+        memset(held[i], w->tag, sizes[i]);
+    }
+    for (int i = 0; i < 16; i++) {
+        if (!held[i]) continue;
+        for (uint32_t b = 0; b < sizes[i]; b++) w->errors += held[i][b] != w->tag;
+        DosSubFreeMem(w->heap, held[i], sizes[i]);
+    }
+}
+return NULL;
+}
+
+static int sub_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "suballoc: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+static int sub_self_test(void) {
+int failures = 0;
+const ULONG heap_size = 0x10000;
+uint8_t *heap, *a, *b, *c, *d;
+
+DosAllocMem((PVOID*)&heap, 0x40000, PAG_READ | PAG_WRITE | PAG_COMMIT);
+sub_check(&failures, DosSubSetMem(heap, DOSSUB_INIT | DOSSUB_GROW, heap_size) == ERROR_DOSSUB_BADFLAG,
+          "init and grow together");
+sub_check(&failures, DosSubAllocMem(heap, (PVOID*)&a, 16) == ERROR_DOSSUB_CORRUPTED, "heap not set up");
+sub_check(&failures, DosSubSetMem(heap, DOSSUB_INIT, heap_size) == NO_ERROR, "init");
+
+DosSubAllocMem(heap, (PVOID*)&a, 24);
+DosSubAllocMem(heap, (PVOID*)&b, 100);
+DosSubAllocMem(heap, (PVOID*)&c, 1);
+sub_check(&failures, a >= heap + sizeof(sub_heap_t) && b == a + 24 && c == b + 104 &&
+          ((uintptr_t)c & 7) == 0, "layout");
+memset(a, 1, 24);
+memset(b, 2, 100);
+
+DosSubFreeMem(heap, b, 100);
+DosSubAllocMem(heap, (PVOID*)&d, 97);
+sub_check(&failures, d == b, "freed block reused for the same size");
+DosSubFreeMem(heap, d, 97);
+DosSubAllocMem(heap, (PVOID*)&d, 40);
+DosSubAllocMem(heap, (PVOID*)&b, 64);
+sub_check(&failures, d == c - 104 && b == d + 40, "larger free block split");
+sub_check(&failures, DosSubFreeMem(heap, heap + 8, 16) == ERROR_DOSSUB_OVERLAP, "free of the header");
+sub_check(&failures, DosSubFreeMem(heap, heap + heap_size - 64, 16) == ERROR_DOSSUB_OVERLAP,
+          "free of unallocated space");
+DosSubFreeMem(heap, a, 24);
+DosSubFreeMem(heap, d, 40);
+DosSubFreeMem(heap, b, 64);
+DosSubFreeMem(heap, c, 1);
+
+// Fill the heap with small blocks, free every one, then ask for all of
+// it at once: only coalescing can satisfy that
+static uint8_t *blocks[0x10000 / 64];
+int count = 0;
+while (DosSubAllocMem(heap, (PVOID*)&blocks[count], 64) == NO_ERROR) count++;
+sub_check(&failures, count == (int)((heap_size - sizeof(sub_heap_t)) / 64), "fill");
+for (int i = 0; i < count; i += 2) DosSubFreeMem(heap, blocks[i], 64);
+for (int i = 1; i < count; i += 2) DosSubFreeMem(heap, blocks[i], 64);
+sub_check(&failures, DosSubAllocMem(heap, (PVOID*)&a, heap_size - sizeof(sub_heap_t)) == NO_ERROR &&
+          a == heap + sizeof(sub_heap_t), "whole heap after coalescing");
+DosSubFreeMem(heap, a, heap_size - sizeof(sub_heap_t));
+
+sub_check(&failures, DosSubSetMem(heap, DOSSUB_GROW, heap_size / 2) == ERROR_DOSSUB_SHRINK, "shrink");
+sub_check(&failures, DosSubSetMem(heap, DOSSUB_GROW, heap_size * 2) == NO_ERROR &&
+          DosSubAllocMem(heap, (PVOID*)&a, heap_size) == NO_ERROR, "grow");
+DosSubFreeMem(heap, a, heap_size);
+
+// A block freed twice is found when the free chunks are next merged
+DosSubAllocMem(heap, (PVOID*)&a, 32);
+DosSubAllocMem(heap, (PVOID*)&b, 32);
+DosSubFreeMem(heap, a, 32);
+DosSubFreeMem(heap, a, 32);
+sub_check(&failures, DosSubAllocMem(heap, (PVOID*)&c, heap_size * 2) == ERROR_DOSSUB_CORRUPTED,
+          "double free");
+sub_check(&failures, DosSubUnsetMem(heap) == NO_ERROR &&
+          DosSubAllocMem(heap, (PVOID*)&a, 16) == ERROR_DOSSUB_CORRUPTED, "unset");
+
+// Shared by several threads
+DosSubSetMem(heap, DOSSUB_INIT | DOSSUB_SERIALIZE, 0x40000);
+pthread_t tid[4];
+sub_worker_t work[4];
+for (int t = 0; t < 4; t++) {
+    work[t] = (sub_worker_t){ heap, 20000, 0, (uint8_t)(t + 1) };
+    pthread_create(&tid[t], NULL, sub_worker, &work[t]);
+}
+for (int t = 0; t < 4; t++) {
+    pthread_join(tid[t], NULL);
+    sub_check(&failures, work[t].errors == 0, "serialized heap shared by threads");
+}
+DosFreeMem(heap);
+
+// A sparse heap commits pages only as the heap reaches them
+ULONG cb, flags;
+DosAllocMem((PVOID*)&heap, 0x100000, PAG_READ | PAG_WRITE);
+sub_check(&failures, DosSubSetMem(heap, DOSSUB_INIT | DOSSUB_SPARSE_OBJ, 0x100000) == NO_ERROR,
+          "sparse init");
+DosSubAllocMem(heap, (PVOID*)&a, 5000);
+memset(a, 1, 5000);
+cb = 0;
+DosQueryMem(heap, &cb, &flags);
+sub_check(&failures, (flags & PAG_COMMIT) && cb == 0x2000, "sparse heap commits what it uses");
+DosFreeMem(heap);
+return failures;
+}
+
+// Replace random blocks of a live set with new ones of the mix; returns ns
+// per allocate+free pair. 'heap' NULL: malloc/free.
+static double sub_churn(PVOID heap, int live, int ops) {
+static PVOID held[4096];
+static uint32_t sizes[4096];
+uint32_t seed = 12345;
+for (int i = 0; i < live; i++) {
+    seed = seed * 1103515245 + 12345;
+    sizes[i] = sub_mix[seed >> 28];
+    if (heap) DosSubAllocMem(heap, &held[i], sizes[i]);
+    else held[i] = malloc(sizes[i]);
+}
+
+uint64_t start = now_ns();
+for (int i = 0; i < ops; i++) {
+    seed = seed * 1103515245 + 12345;
+    int slot = (seed >> 8) % live;
+    uint32_t size = sub_mix[seed >> 28];
+    if (heap) {
+        DosSubFreeMem(heap, held[slot], sizes[slot]);
+        DosSubAllocMem(heap, &held[slot], size);
+    } else {
+        free(held[slot]);
+        held[slot] = malloc(size);
+    }
+    *(volatile uint8_t*)held[slot] = 1;
+    sizes[slot] = size;
+}
+double ns = (double)(now_ns() - start) / ops;
+
+for (int i = 0; i < live; i++) {
+    if (heap) DosSubFreeMem(heap, held[i], sizes[i]);
+    else free(held[i]);
+}
+return ns;
+}
+
+// Allocate a burst of blocks, then free them newest first
+static double sub_burst(PVOID heap, int count, int rounds) {
+static PVOID held[4096];
+uint64_t start = now_ns();
+for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < count; i++) {
+        uint32_t size = sub_mix[i & 15];
+        if (heap) DosSubAllocMem(heap, &held[i], size);
+        else held[i] = malloc(size);
+        *(volatile uint8_t*)held[i] = 1;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        if (heap) DosSubFreeMem(heap, held[i], sub_mix[i & 15]);
+        else free(held[i]);
+    }
+}
+return (double)(now_ns() - start) / ((double)count * rounds);
+}
+
+static int bench_suballoc(int argc, char **argv) {
+(void)argc; (void)argv;
+int failures = sub_self_test();
+printf("suballoc self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+const ULONG heap_size = 4u << 20;
+PVOID heap, shared;
+DosAllocMem(&heap, heap_size, PAG_READ | PAG_WRITE | PAG_COMMIT);
+DosAllocMem(&shared, heap_size, PAG_READ | PAG_WRITE | PAG_COMMIT);
+DosSubSetMem(heap, DOSSUB_INIT, heap_size);
+DosSubSetMem(shared, DOSSUB_INIT | DOSSUB_SERIALIZE, heap_size);
+
+const int ops = 2000000;
+printf("%-22s %12s %12s %12s\n", "ns per alloc+free", "malloc", "DosSub", "serialized");
+const int lives[] = { 64, 4096 };
+for (int l = 0; l < 2; l++) {
+    char label[32];
+    snprintf(label, sizeof(label), "churn, %d live", lives[l]);
+    double m = sub_churn(NULL, lives[l], ops);
+    double s = sub_churn(heap, lives[l], ops);
+    double z = sub_churn(shared, lives[l], ops);
+    printf("%-22s %12.1f %12.1f %12.1f\n", label, m, s, z);
+}
+double m = sub_burst(NULL, 1000, ops / 1000);
+double s = sub_burst(heap, 1000, ops / 1000);
+double z = sub_burst(shared, 1000, ops / 1000);
+printf("%-22s %12.1f %12.1f %12.1f\n", "burst of 1000, LIFO", m, s, z);
+
+const sub_heap_t *h = heap;
+printf("\nDosSub heap high-water after the churn: %u KB of %u KB\n",
+       h->top / 1024, heap_size / 1024);
+DosFreeMem(heap);
+DosFreeMem(shared);
+return 0;
+}
+
+// -------- Threads --------
+
+typedef struct {
+TID tid;                // Reported by the thread
+PTIB tib;               // Freed once the thread ends
+PTIB2 tib2;
+PTIB2 gs_tib2;          // Read through the GS base
+ULONG *tls;
+ULONG tls_value;
+ULONG pri;
+} thread_probe_t;
+
+enum { PROBES = 8 };
+static thread_probe_t probes[PROBES];
+static PULONG probe_tls;
+
+static void APIENTRY thread_probe(ULONG arg) {
+thread_probe_t *probe = &probes[arg];
+PPIB pib;
+DosGetInfoBlocks(&probe->tib, &pib);
+probe->tib2 = probe->tib->tib_ptib2;
+probe->tid = probe->tib2->tib2_ultid;
+#if defined(__x86_64__)
+__asm__ volatile("mov %%gs:%c1, %0" : "=r"(probe->gs_tib2) : "i"(offsetof(TIB, tib_ptib2)));
+#endif
+// This thread's copy of the word thread 1 allocated: zero, and its own
+probe->tls = probe_tls - &tls_area[1][0] + &tls_area[probe->tid][0];
+probe->tls_value = *probe->tls;
+*probe->tls = probe->tid;
+DosSetPriority(PRTYS_THREAD, PRTYC_IDLETIME, 5, 0);
+probe->pri = probe->tib2->tib2_ulpri;
+if (probe->tid % 2) DosExit(EXIT_THREAD, 0);
+}
+
+static void APIENTRY thread_nop(ULONG arg) {
+(void)arg;
+}
+
+static void *pthread_nop(void *arg) {
+return arg;
+}
+
+static int thread_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "threads: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+static int thread_self_test(void) {
+int failures = 0;
+PTIB tib;
+PPIB pib;
+DosGetInfoBlocks(&tib, &pib);
+thread_check(&failures, tib->tib_ptib2->tib2_ultid == 1 && pib->pib_ulpid == (ULONG)getpid() &&
+             strcmp(pib->pib_pchcmd + strlen(pib->pib_pchcmd) + 1, "threads") == 0,
+             "thread 1 and process info blocks");
+thread_check(&failures, (uint8_t*)&tib < (uint8_t*)tib->tib_pstacklimit &&
+             (uint8_t*)&tib > (uint8_t*)tib->tib_pstack, "stack bounds");
+thread_check(&failures, DosAllocThreadLocalMemory(1, &probe_tls) == NO_ERROR, "thread-local memory");
+*probe_tls = 1;
+
+TID tids[PROBES];
+for (int i = 0; i < PROBES; i++) {
+    thread_check(&failures, DosCreateThread(&tids[i], thread_probe, i,
+                                            i == 0 ? CREATE_SUSPENDED : CREATE_READY, 8192) == NO_ERROR,
+                 "create");
+}
+TID tid = tids[0];
+thread_check(&failures, DosWaitThread(&tid, DCWW_NOWAIT) == ERROR_THREAD_NOT_TERMINATED,
+             "suspended thread still running");
+thread_check(&failures, DosResumeThread(tids[0]) == NO_ERROR &&
+             DosResumeThread(tids[0]) != NO_ERROR, "resume");
+for (int i = 1; i < PROBES; i++) {
+    tid = tids[i];
+    thread_check(&failures, DosWaitThread(&tid, DCWW_WAIT) == NO_ERROR && tid == tids[i], "wait");
+}
+tid = 0;
+thread_check(&failures, DosWaitThread(&tid, DCWW_WAIT) == NO_ERROR && tid == tids[0], "wait for any");
+tid = 0;
+thread_check(&failures, DosWaitThread(&tid, DCWW_WAIT) == ERROR_INVALID_THREADID, "no threads left");
+tid = tids[1];
+thread_check(&failures, DosWaitThread(&tid, DCWW_WAIT) == ERROR_INVALID_THREADID, "collected twice");
+
+for (int i = 0; i < PROBES; i++) {
+    thread_probe_t *p = &probes[i];
+    thread_check(&failures, p->tid == tids[i] && p->tid > 1 && p->tib != tib, "TIB per thread");
+#if defined(__x86_64__)
+    thread_check(&failures, p->gs_tib2 == p->tib2, "TIB through GS");
+#endif
+    thread_check(&failures, p->tls_value == 0 && *p->tls == p->tid, "thread-local memory per thread");
+    thread_check(&failures, p->pri == (PRTYC_IDLETIME << 8 | 5), "priority");
+}
+thread_check(&failures, *probe_tls == 1 && DosFreeThreadLocalMemory(probe_tls) == NO_ERROR &&
+             DosFreeThreadLocalMemory(probe_tls) == ERROR_INVALID_PARAMETER, "free thread-local memory");
+
+thread_check(&failures, DosSetPriority(PRTYS_THREAD, 7, 0, 0) == ERROR_INVALID_PCLASS &&
+             DosSetPriority(PRTYS_THREAD, PRTYC_REGULAR, 40, 0) == ERROR_INVALID_PDELTA &&
+             DosSetPriority(PRTYS_THREAD, PRTYC_REGULAR, 0, tids[2]) == ERROR_INVALID_THREADID,
+             "priority errors");
+DosSetPriority(PRTYS_THREAD, PRTYC_REGULAR, 3, 0);
+DosSetPriority(PRTYS_THREAD, PRTYC_NOCHANGE, 2, 0);
+thread_check(&failures, tib->tib_ptib2->tib2_ulpri == (PRTYC_REGULAR << 8 | 5), "priority level");
+DosSetPriority(PRTYS_THREAD, PRTYC_REGULAR, -PRTYD_MAXIMUM, 0);
+return failures;
+}
+
+// Create and collect 'count' threads, 'batch' at a time; ns per thread
+static double thread_churn(int native, int count, int batch) {
+TID tids[64];
+pthread_t threads[64];
+pthread_attr_t attr;
+pthread_attr_init(&attr);
+pthread_attr_setstacksize(&attr, THREAD_STACK_MIN);
+
+uint64_t start = now_ns();
+for (int done = 0; done < count; done += batch) {
+    for (int i = 0; i < batch; i++) {
+        if (native) pthread_create(&threads[i], &attr, pthread_nop, NULL);
+        else DosCreateThread(&tids[i], thread_nop, 0, CREATE_READY, THREAD_STACK_MIN);
+    }
+    for (int i = 0; i < batch; i++) {
+        if (native) pthread_join(threads[i], NULL);
+        else DosWaitThread(&tids[i], DCWW_WAIT);
+    }
+}
+pthread_attr_destroy(&attr);
+return (double)(now_ns() - start) / count;
+}
+
+static int bench_threads(int argc, char **argv) {
+(void)argc; (void)argv;
+int failures = thread_self_test();
+printf("thread self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+const int count = 20000;
+printf("%-20s %14s %14s\n", "create + wait", "pthread us", "DosCreate us");
+const int batches[] = { 1, 8, 64 };
+for (int b = 0; b < 3; b++) {
+    char label[32];
+    snprintf(label, sizeof(label), "%d at a time", batches[b]);
+    double native = thread_churn(1, count, batches[b]);
+    double os2 = thread_churn(0, count, batches[b]);
+    printf("%-20s %14.2f %14.2f\n", label, native / 1000, os2 / 1000);
+}
+
+// Per-call cost of finding the current thread's TIB
+const int calls = 10000000;
+PTIB tib;
+uint64_t start = now_ns();
+for (int i = 0; i < calls; i++) {
+    DosGetInfoBlocks(&tib, NULL);
+    __asm__ volatile("" : : "r"(tib) : "memory");
+}
+printf("\nDosGetInfoBlocks: %.1f ns\n", (double)(now_ns() - start) / calls);
+return 0;
+}
+
+// -------- Semaphores --------
+
+static HEV sem_ping, sem_pong;
+static HMTX sem_mutex;
+static HMUX sem_mux;
+static uint64_t sem_counter;
+static int sem_rounds;
+
+static pthread_mutex_t psem_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t psem_cond = PTHREAD_COND_INITIALIZER;
+static int psem_turn;
+
+static int sem_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "sems: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+// Until some thread sleeps on event hev
+static void sem_until_waiting(HEV hev) {
+while (!__atomic_load_n(&sem_get(hev, SEM_EVENT)->state->waiters, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static void APIENTRY sem_relay(ULONG arg) {
+(void)arg;
+DosWaitEventSem(sem_ping, SEM_INDEFINITE_WAIT);
+DosPostEventSem(sem_pong);
+}
+
+static void APIENTRY sem_post_later(ULONG hev) {
+DosSleep(20);
+DosPostEventSem(hev);
+}
+
+// Owns mutex 'hmtx' from the ping to the pong
+static void APIENTRY sem_hold(ULONG hmtx) {
+ULONG posts;
+DosRequestMutexSem(hmtx, SEM_INDEFINITE_WAIT);
+DosPostEventSem(sem_ping);
+DosWaitEventSem(sem_pong, SEM_INDEFINITE_WAIT);
+DosResetEventSem(sem_pong, &posts);
+DosReleaseMutexSem(hmtx);
+}
+
+static void APIENTRY sem_count(ULONG arg) {
+(void)arg;
+for (int i = 0; i < sem_rounds; i++) {
+    DosRequestMutexSem(sem_mutex, SEM_INDEFINITE_WAIT);
+    sem_counter++;
+    DosReleaseMutexSem(sem_mutex);
+}
+}
+
+static void *psem_count(void *arg) {
+for (int i = 0; i < sem_rounds; i++) {
+    pthread_mutex_lock(&psem_lock);
+    sem_counter++;
+    pthread_mutex_unlock(&psem_lock);
+}
+return arg;
+}
+
+// The far end of a ping-pong: through a muxwait if 'arg' is set
+static void APIENTRY sem_pong_thread(ULONG arg) {
+ULONG posts, user;
+for (int i = 0; i < sem_rounds; i++) {
+    if (arg) DosWaitMuxWaitSem(sem_mux, SEM_INDEFINITE_WAIT, &user);
+    else DosWaitEventSem(sem_ping, SEM_INDEFINITE_WAIT);
+    DosResetEventSem(sem_ping, &posts);
+    DosPostEventSem(sem_pong);
+}
+}
+
+static void *psem_pong_thread(void *arg) {
+pthread_mutex_lock(&psem_lock);
+for (int i = 0; i < sem_rounds; i++) {
+    while (psem_turn != 1) pthread_cond_wait(&psem_cond, &psem_lock);
+    psem_turn = 0;
+    pthread_cond_broadcast(&psem_cond);
+}
+pthread_mutex_unlock(&psem_lock);
+return arg;
+}
+
+static int sem_self_test(void) {
+int failures = 0;
+ULONG posts = 0, user = 0;
+TID tid;
+HEV ev;
+sem_check(&failures, DosCreateEventSem(NULL, &ev, 0, FALSE) == NO_ERROR, "create event");
+sem_check(&failures, DosWaitEventSem(ev, SEM_IMMEDIATE_RETURN) == ERROR_TIMEOUT &&
+          DosPostEventSem(ev) == NO_ERROR && DosPostEventSem(ev) == ERROR_ALREADY_POSTED &&
+          DosWaitEventSem(ev, SEM_INDEFINITE_WAIT) == NO_ERROR, "post and wait");
+sem_check(&failures, DosResetEventSem(ev, &posts) == NO_ERROR && posts == 2 &&
+          DosResetEventSem(ev, &posts) == ERROR_ALREADY_RESET && posts == 0, "reset");
+uint64_t start = now_ns();
+sem_check(&failures, DosWaitEventSem(ev, 30) == ERROR_TIMEOUT && now_ns() - start >= 30000000,
+          "timeout");
+
+// A post that is reset at once still releases the waiter
+DosCreateEventSem(NULL, &sem_ping, 0, FALSE);
+DosCreateEventSem(NULL, &sem_pong, 0, FALSE);
+DosCreateThread(&tid, sem_relay, 0, CREATE_READY, THREAD_STACK_MIN);
+sem_until_waiting(sem_ping);
+DosPostEventSem(sem_ping);
+DosResetEventSem(sem_ping, &posts);
+sem_check(&failures, DosWaitEventSem(sem_pong, 5000) == NO_ERROR, "post then reset wakes");
+DosWaitThread(&tid, DCWW_WAIT);
+DosResetEventSem(sem_pong, &posts);
+
+HMTX a, b;
+sem_check(&failures, DosCreateMutexSem(NULL, &a, 0, FALSE) == NO_ERROR &&
+          DosCreateMutexSem(NULL, &b, 0, TRUE) == NO_ERROR, "create mutex");
+sem_check(&failures, DosRequestMutexSem(a, SEM_INDEFINITE_WAIT) == NO_ERROR &&
+          DosRequestMutexSem(a, SEM_IMMEDIATE_RETURN) == NO_ERROR &&
+          DosReleaseMutexSem(a) == NO_ERROR && DosCloseMutexSem(a) == ERROR_SEM_BUSY &&
+          DosReleaseMutexSem(a) == NO_ERROR && DosReleaseMutexSem(a) == ERROR_NOT_OWNER,
+          "nested requests");
+sem_check(&failures, DosReleaseMutexSem(b) == NO_ERROR, "created owned");
+
+sem_rounds = 20000;
+sem_counter = 0;
+sem_mutex = a;
+TID counters[4];
+for (int i = 0; i < 4; i++) DosCreateThread(&counters[i], sem_count, 0, CREATE_READY, THREAD_STACK_MIN);
+for (int i = 0; i < 4; i++) DosWaitThread(&counters[i], DCWW_WAIT);
+sem_check(&failures, sem_counter == 4 * (uint64_t)sem_rounds, "mutual exclusion");
+
+// Muxwaits: any of three events, all of them, all of two mutexes
+HEV evs[3];
+SEMRECORD rec[3];
+for (int i = 0; i < 3; i++) {
+    DosCreateEventSem(NULL, &evs[i], 0, FALSE);
+    rec[i].hsemCur = evs[i];
+    rec[i].ulUser = 10 + i;
+}
+HMUX any, all;
+sem_check(&failures, DosCreateMuxWaitSem(NULL, &any, 3, rec, DCMW_WAIT_ANY) == NO_ERROR &&
+          DosCreateMuxWaitSem(NULL, &all, 3, rec, DCMW_WAIT_ALL) == NO_ERROR, "create muxwait");
+sem_check(&failures, DosWaitMuxWaitSem(any, SEM_IMMEDIATE_RETURN, &user) == ERROR_TIMEOUT,
+          "muxwait with nothing posted");
+DosCreateThread(&tid, sem_post_later, evs[1], CREATE_READY, THREAD_STACK_MIN);
+sem_check(&failures, DosWaitMuxWaitSem(any, 5000, &user) == NO_ERROR && user == 11, "wait for any");
+DosWaitThread(&tid, DCWW_WAIT);
+sem_check(&failures, DosWaitMuxWaitSem(all, 20, &user) == ERROR_TIMEOUT, "wait for all, some posted");
+DosPostEventSem(evs[0]);
+DosCreateThread(&tid, sem_post_later, evs[2], CREATE_READY, THREAD_STACK_MIN);
+sem_check(&failures, DosWaitMuxWaitSem(all, 5000, &user) == NO_ERROR, "wait for all");
+DosWaitThread(&tid, DCWW_WAIT);
+sem_check(&failures, DosCloseEventSem(evs[0]) == ERROR_SEM_BUSY, "member closed");
+
+SEMRECORD mixed[2] = { { evs[0], 0 }, { a, 0 } }, both[2] = { { a, 1 }, { b, 2 } };
+HMUX mux;
+sem_check(&failures, DosCreateMuxWaitSem(NULL, &mux, 2, mixed, DCMW_WAIT_ANY) == ERROR_WRONG_TYPE,
+          "mixed muxwait");
+sem_check(&failures, DosCreateMuxWaitSem(NULL, &mux, 2, both, DCMW_WAIT_ALL) == NO_ERROR, "mutex muxwait");
+DosCreateThread(&tid, sem_hold, b, CREATE_READY, THREAD_STACK_MIN);
+DosWaitEventSem(sem_ping, SEM_INDEFINITE_WAIT);
+DosResetEventSem(sem_ping, &posts);
+sem_check(&failures, DosWaitMuxWaitSem(mux, 20, &user) == ERROR_TIMEOUT &&
+          sem_get(a, SEM_MUTEX)->state->word == 0, "all or none of the mutexes");
+DosPostEventSem(sem_pong);
+sem_check(&failures, DosWaitMuxWaitSem(mux, 5000, &user) == NO_ERROR &&
+          DosReleaseMutexSem(a) == NO_ERROR && DosReleaseMutexSem(b) == NO_ERROR, "both mutexes");
+DosWaitThread(&tid, DCWW_WAIT);
+DosCloseMuxWaitSem(mux);
+
+// A named event posted by another process wakes a muxwait here
+char name[64];
+HEV named, again = 0;
+snprintf(name, sizeof(name), "\\sem32\\os2bench\\%d", (int)getpid());
+sem_check(&failures, DosCreateEventSem(name, &named, 0, FALSE) == NO_ERROR &&
+          DosCreateEventSem(name, &again, 0, FALSE) == ERROR_DUPLICATE_NAME, "named event");
+name[1] = 'S';
+sem_check(&failures, DosOpenEventSem(name, &again) == NO_ERROR && again == named &&
+          DosCloseEventSem(again) == NO_ERROR, "open by name");
+SEMRECORD shared[2] = { { ev, 1 }, { named, 2 } };
+sem_check(&failures, DosCreateMuxWaitSem(NULL, &mux, 2, shared, DCMW_WAIT_ANY) == NO_ERROR,
+          "shared muxwait");
+fflush(NULL);
+pid_t child = fork();
+if (child == 0) {
+    usleep(20000);
+    _exit(DosPostEventSem(named) == NO_ERROR ? 0 : 1);
+}
+int status = 1;
+sem_check(&failures, child > 0 && DosWaitMuxWaitSem(mux, 5000, &user) == NO_ERROR && user == 2,
+          "post from another process");
+if (child > 0) waitpid(child, &status, 0);
+sem_check(&failures, status == 0, "child process");
+sem_check(&failures, DosCloseMuxWaitSem(mux) == NO_ERROR && DosCloseEventSem(named) == NO_ERROR &&
+          DosOpenEventSem(name, &again) == ERROR_SEM_NOT_FOUND, "named event removed");
+
+DosCloseMuxWaitSem(any);
+DosCloseMuxWaitSem(all);
+for (int i = 0; i < 3; i++) DosCloseEventSem(evs[i]);
+sem_check(&failures, DosCloseEventSem(ev) == NO_ERROR && DosCloseMutexSem(a) == NO_ERROR &&
+          DosCloseMutexSem(b) == NO_ERROR && DosCloseMutexSem(b) == ERROR_INVALID_HANDLE, "close");
+return failures;
+}
+
+// ns per round trip between two threads: an event each way, or a
+// condition variable
+static double sem_ping_pong(int native, int through_mux, int rounds) {
+ULONG posts;
+sem_rounds = rounds;
+uint64_t start = now_ns();
+if (native) {
+    pthread_t thread;
+    psem_turn = 0;
+    pthread_create(&thread, NULL, psem_pong_thread, NULL);
+    pthread_mutex_lock(&psem_lock);
+    for (int i = 0; i < rounds; i++) {
+        psem_turn = 1;
+        pthread_cond_broadcast(&psem_cond);
+        while (psem_turn != 0) pthread_cond_wait(&psem_cond, &psem_lock);
+    }
+    pthread_mutex_unlock(&psem_lock);
+    pthread_join(thread, NULL);
+} else {
+    TID tid;
+    DosCreateThread(&tid, sem_pong_thread, through_mux, CREATE_READY, THREAD_STACK_MIN);
+    for (int i = 0; i < rounds; i++) {
+        DosPostEventSem(sem_ping);
+        DosWaitEventSem(sem_pong, SEM_INDEFINITE_WAIT);
+        DosResetEventSem(sem_pong, &posts);
+    }
+    DosWaitThread(&tid, DCWW_WAIT);
+}
+return (double)(now_ns() - start) / rounds;
+}
+
+// ns per request of a mutex 'threads' threads take turns at
+static double sem_contend(int native, int threads, int rounds) {
+TID tids[8];
+pthread_t pthreads[8];
+sem_rounds = rounds;
+uint64_t start = now_ns();
+for (int i = 0; i < threads; i++) {
+    if (native) pthread_create(&pthreads[i], NULL, psem_count, NULL);
+    else DosCreateThread(&tids[i], sem_count, 0, CREATE_READY, THREAD_STACK_MIN);
+}
+for (int i = 0; i < threads; i++) {
+    if (native) pthread_join(pthreads[i], NULL);
+    else DosWaitThread(&tids[i], DCWW_WAIT);
+}
+return (double)(now_ns() - start) / ((uint64_t)threads * rounds);
+}
+
+static int bench_sems(int argc, char **argv) {
+(void)argc; (void)argv;
+int failures = sem_self_test();
+printf("semaphore self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+const int calls = 10000000;
+ULONG posts;
+HEV ev;
+DosCreateEventSem(NULL, &ev, 0, TRUE);
+DosCreateMutexSem(NULL, &sem_mutex, 0, FALSE);
+printf("%-28s %12s %12s\n", "uncontended", "pthread ns", "OS/2 ns");
+
+uint64_t start = now_ns();
+for (int i = 0; i < calls; i++) {
+    pthread_mutex_lock(&psem_lock);
+    pthread_mutex_unlock(&psem_lock);
+}
+double native = (double)(now_ns() - start) / calls;
+start = now_ns();
+for (int i = 0; i < calls; i++) {
+    DosRequestMutexSem(sem_mutex, SEM_INDEFINITE_WAIT);
+    DosReleaseMutexSem(sem_mutex);
+}
+printf("%-28s %12.1f %12.1f\n", "mutex request + release", native, (double)(now_ns() - start) / calls);
+
+// A posted event against a set flag behind a mutex and condition variable
+psem_turn = 1;
+start = now_ns();
+for (int i = 0; i < calls; i++) {
+    pthread_mutex_lock(&psem_lock);
+    while (!psem_turn) pthread_cond_wait(&psem_cond, &psem_lock);
+    pthread_mutex_unlock(&psem_lock);
+}
+native = (double)(now_ns() - start) / calls;
+start = now_ns();
+for (int i = 0; i < calls; i++) DosWaitEventSem(ev, SEM_INDEFINITE_WAIT);
+printf("%-28s %12.1f %12.1f\n", "wait on posted event", native, (double)(now_ns() - start) / calls);
+
+start = now_ns();
+for (int i = 0; i < calls; i++) {
+    pthread_mutex_lock(&psem_lock);
+    psem_turn = 1;
+    pthread_cond_broadcast(&psem_cond);
+    pthread_mutex_unlock(&psem_lock);
+    pthread_mutex_lock(&psem_lock);
+    psem_turn = 0;
+    pthread_mutex_unlock(&psem_lock);
+}
+native = (double)(now_ns() - start) / calls;
+start = now_ns();
+for (int i = 0; i < calls; i++) {
+    DosPostEventSem(ev);
+    DosResetEventSem(ev, &posts);
+}
+printf("%-28s %12.1f %12.1f\n", "post + reset, no waiters", native, (double)(now_ns() - start) / calls);
+
+printf("\n%-28s %12s %12s\n", "contended", "pthread ns", "OS/2 ns");
+const int rounds = 200000;
+DosCreateEventSem(NULL, &sem_ping, 0, FALSE);
+DosCreateEventSem(NULL, &sem_pong, 0, FALSE);
+native = sem_ping_pong(1, 0, rounds);
+printf("%-28s %12.0f %12.0f\n", "ping-pong round trip", native, sem_ping_pong(0, 0, rounds));
+
+HEV idle[3];
+SEMRECORD rec[4] = { { sem_ping, 0 } };
+for (int i = 0; i < 3; i++) {
+    DosCreateEventSem(NULL, &idle[i], 0, FALSE);
+    rec[1 + i].hsemCur = idle[i];
+}
+DosCreateMuxWaitSem(NULL, &sem_mux, 4, rec, DCMW_WAIT_ANY);
+printf("%-28s %12s %12.0f\n", "  through a 4-event muxwait", "-", sem_ping_pong(0, 1, rounds));
+
+const int threads[] = { 2, 4, 8 };
+for (int t = 0; t < 3; t++) {
+    char label[32];
+    snprintf(label, sizeof(label), "mutex, %d threads", threads[t]);
+    native = sem_contend(1, threads[t], rounds);
+    printf("%-28s %12.1f %12.1f\n", label, native, sem_contend(0, threads[t], rounds));
+}
+return 0;
+}
+
+// -------- Queues --------
+
+#define PQUE_SLOTS 1024
+
+static HQUEUE que_queue;
+static int que_messages;                    // Per producer
+
+// The pthread baseline: a bounded ring behind a mutex and two condition
+// variables
+static pthread_mutex_t pque_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pque_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pque_not_full = PTHREAD_COND_INITIALIZER;
+static uint64_t pque_ring[PQUE_SLOTS];
+static uint32_t pque_head, pque_tail;
+
+static int que_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "queues: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+// Writes que_messages elements numbered from 0, as request 'producer'
+static void APIENTRY que_produce(ULONG producer) {
+for (int i = 0; i < que_messages; i++) {
+    while (DosWriteQueue(que_queue, producer, 0, (PVOID)(uintptr_t)i, 0) == ERROR_QUE_NO_MEMORY) {
+        sched_yield();
+    }
+}
+}
+
+static void *pque_produce(void *arg) {
+for (int i = 0; i < que_messages; i++) {
+    pthread_mutex_lock(&pque_lock);
+    while (pque_tail - pque_head == PQUE_SLOTS) pthread_cond_wait(&pque_not_full, &pque_lock);
+    pque_ring[pque_tail++ % PQUE_SLOTS] = (uint64_t)(uintptr_t)arg << 32 | (uint32_t)i;
+    pthread_cond_signal(&pque_not_empty);
+    pthread_mutex_unlock(&pque_lock);
+}
+return NULL;
+}
+
+static void APIENTRY que_write_later(ULONG request) {
+DosSleep(20);
+DosWriteQueue(que_queue, request, 0, NULL, 0);
+}
+
+// Reads 'count' elements, checking each producer's arrive in order and
+// that DosQueryQueue never counts fewer than none left
+static int que_drain(int producers, int count) {
+REQUESTDATA req;
+ULONG cb, left;
+PVOID data;
+BYTE priority;
+int next[16] = { 0 }, ordered = 1;
+for (int i = 0; i < count; i++) {
+    if (DosReadQueue(que_queue, &req, &cb, &data, 0, DCWW_WAIT, &priority, 0) != NO_ERROR) return 0;
+    if (req.ulData >= (ULONG)producers || (uintptr_t)data != (uintptr_t)next[req.ulData]++) ordered = 0;
+    if (DosQueryQueue(que_queue, &left) != NO_ERROR || left > (ULONG)count) ordered = 0;
+}
+return ordered;
+}
+
+static int que_self_test(void) {
+int failures = 0;
+char name[64], other[64];
+REQUESTDATA req;
+ULONG cb, count;
+PVOID data;
+BYTE priority;
+HQUEUE fifo, lifo, prio, again;
+PID owner;
+snprintf(name, sizeof(name), "\\queues\\os2bench\\%d\\fifo", (int)getpid());
+snprintf(other, sizeof(other), "\\QUEUES\\OS2BENCH\\%d\\FIFO", (int)getpid());
+que_check(&failures, DosCreateQueue(&fifo, QUE_FIFO, name) == NO_ERROR &&
+          DosCreateQueue(&again, QUE_FIFO, other) == ERROR_QUE_DUPLICATE, "create");
+que_check(&failures, DosCreateQueue(&again, QUE_FIFO, "\\sem32\\x") == ERROR_QUE_INVALID_NAME &&
+          DosCreateQueue(&again, 7, "\\queues\\x") == ERROR_QUE_INVALID_PRIORITY, "bad create");
+que_check(&failures, DosOpenQueue(&owner, &again, other) == NO_ERROR && again == fifo &&
+          owner == (PID)getpid() && DosCloseQueue(again) == NO_ERROR, "open by name");
+
+// The three orders, one after another
+static const char text[] = "abc";
+for (int i = 0; i < 3; i++) DosWriteQueue(fifo, 100 + i, 1, (PVOID)&text[i], 9);
+int ordered = 1;
+for (int i = 0; i < 3; i++) {
+    ordered &= DosReadQueue(fifo, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == NO_ERROR &&
+               req.ulData == 100u + i && req.pid == (PID)getpid() && cb == 1 &&
+               data == &text[i] && priority == 0;
+}
+que_check(&failures, ordered, "first in, first out");
+snprintf(name, sizeof(name), "\\queues\\os2bench\\%d\\lifo", (int)getpid());
+DosCreateQueue(&lifo, QUE_LIFO | QUE_CONVERT_ADDRESS, name);
+for (int i = 0; i < 3; i++) DosWriteQueue(lifo, i, 0, NULL, 0);
+DosQueryQueue(lifo, &count);
+ordered = count == 3;
+for (int i = 2; i >= 0; i--) {
+    ordered &= DosReadQueue(lifo, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == NO_ERROR &&
+               req.ulData == (ULONG)i;
+}
+que_check(&failures, ordered, "last in, first out");
+snprintf(name, sizeof(name), "\\queues\\os2bench\\%d\\priority", (int)getpid());
+DosCreateQueue(&prio, QUE_PRIORITY, name);
+static const ULONG levels[6] = { 0, 7, 15, 7, 99, 0 };
+for (int i = 0; i < 6; i++) DosWriteQueue(prio, i, 0, NULL, levels[i]);
+static const ULONG expect[6] = { 2, 4, 1, 3, 0, 5 };
+ordered = 1;
+for (int i = 0; i < 6; i++) {
+    ordered &= DosReadQueue(prio, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == NO_ERROR &&
+               req.ulData == expect[i] && priority == (levels[expect[i]] > 15 ? 15 : levels[expect[i]]);
+}
+que_check(&failures, ordered, "priority order");
+que_check(&failures, DosReadQueue(prio, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == ERROR_QUE_EMPTY &&
+          DosReadQueue(prio, &req, &cb, &data, 1, DCWW_NOWAIT, &priority, 0) == ERROR_QUE_ELEMENT_NOT_EXIST,
+          "empty");
+
+// A full queue refuses writes; purging empties it
+int written = 0;
+while (written <= QUEUE_SLOTS && DosWriteQueue(lifo, written, 0, NULL, 0) == NO_ERROR) written++;
+que_check(&failures, written == QUEUE_SLOTS, "full");
+que_check(&failures, DosPurgeQueue(lifo) == NO_ERROR && DosQueryQueue(lifo, &count) == NO_ERROR &&
+          count == 0, "purge");
+
+// A waiting read, and the event a read that did not wait leaves behind
+TID tid;
+que_queue = fifo;
+DosCreateThread(&tid, que_write_later, 7, CREATE_READY, THREAD_STACK_MIN);
+que_check(&failures, DosReadQueue(fifo, &req, &cb, &data, 0, DCWW_WAIT, &priority, 0) == NO_ERROR &&
+          req.ulData == 7, "wait for a write");
+DosWaitThread(&tid, DCWW_WAIT);
+HEV ev;
+ULONG posts;
+snprintf(name, sizeof(name), "\\sem32\\os2bench\\%d\\queue", (int)getpid());
+DosCreateEventSem(name, &ev, 0, FALSE);
+que_check(&failures, DosReadQueue(fifo, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, ev) == ERROR_QUE_EMPTY &&
+          DosWaitEventSem(ev, SEM_IMMEDIATE_RETURN) == ERROR_TIMEOUT, "register event");
+DosWriteQueue(fifo, 8, 0, NULL, 0);
+que_check(&failures, DosWaitEventSem(ev, SEM_IMMEDIATE_RETURN) == NO_ERROR &&
+          DosResetEventSem(ev, &posts) == NO_ERROR, "event posted by a write");
+DosReadQueue(fifo, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0);
+
+// Another process writes, posting the event by name; it may not read
+fflush(NULL);
+pid_t child = fork();
+if (child == 0) {
+    HQUEUE hq;
+    PID pid;
+    usleep(20000);
+    int ok = DosOpenQueue(&pid, &hq, other) == NO_ERROR && pid == (PID)getppid() &&
+             DosReadQueue(hq, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == ERROR_QUE_PROC_NOT_OWNED &&
+             DosWriteQueue(hq, 9, 3, (PVOID)text, 0) == NO_ERROR;
+    _exit(ok ? 0 : 1);
+}
+int status = 1;
+que_check(&failures, child > 0 && DosWaitEventSem(ev, 5000) == NO_ERROR &&
+          DosReadQueue(fifo, &req, &cb, &data, 0, DCWW_NOWAIT, &priority, 0) == NO_ERROR &&
+          req.ulData == 9 && req.pid == (PID)child && cb == 3, "write from another process");
+if (child > 0) waitpid(child, &status, 0);
+que_check(&failures, status == 0, "child process");
+DosCloseEventSem(ev);
+
+// Producers on several threads: nothing lost, each one's in order
+TID tids[4];
+que_messages = 20000;
+for (int i = 0; i < 4; i++) DosCreateThread(&tids[i], que_produce, i, CREATE_READY, THREAD_STACK_MIN);
+que_check(&failures, que_drain(4, 4 * que_messages), "concurrent writers");
+for (int i = 0; i < 4; i++) DosWaitThread(&tids[i], DCWW_WAIT);
+
+que_check(&failures, DosCloseQueue(fifo) == NO_ERROR && DosCloseQueue(lifo) == NO_ERROR &&
+          DosCloseQueue(prio) == NO_ERROR && DosCloseQueue(prio) == ERROR_QUE_INVALID_HANDLE, "close");
+que_check(&failures, DosOpenQueue(&owner, &again, other) == ERROR_QUE_NAME_NOT_EXIST, "removed");
+return failures;
+}
+
+// Messages per second from 'producers' threads to one reader
+static double que_throughput(int native, int producers, int messages) {
+TID tids[16];
+pthread_t threads[16];
+que_messages = messages;
+pque_head = pque_tail = 0;
+uint64_t start = now_ns();
+for (int i = 0; i < producers; i++) {
+    if (native) pthread_create(&threads[i], NULL, pque_produce, (void*)(uintptr_t)i);
+    else DosCreateThread(&tids[i], que_produce, i, CREATE_READY, THREAD_STACK_MIN);
+}
+if (native) {
+    for (int i = 0; i < producers * messages; i++) {
+        pthread_mutex_lock(&pque_lock);
+        while (pque_tail == pque_head) pthread_cond_wait(&pque_not_empty, &pque_lock);
+        pque_head++;
+        pthread_cond_signal(&pque_not_full);
+        pthread_mutex_unlock(&pque_lock);
+    }
+} else {
+    que_drain(producers, producers * messages);
+}
+for (int i = 0; i < producers; i++) {
+    if (native) pthread_join(threads[i], NULL);
+    else DosWaitThread(&tids[i], DCWW_WAIT);
+}
+return (double)producers * messages * 1e9 / (now_ns() - start);
+}
+
+static int bench_queues(int argc, char **argv) {
+(void)argc; (void)argv;
+int failures = que_self_test();
+printf("queue self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+char name[64];
+snprintf(name, sizeof(name), "\\queues\\os2bench\\%d", (int)getpid());
+DosCreateQueue(&que_queue, QUE_FIFO, name);
+printf("%-28s %12s %12s\n", "one reader", "pthread M/s", "OS/2 M/s");
+const int producers[] = { 1, 2, 4, 8, 16 };
+for (int p = 0; p < 5; p++) {
+    char label[32];
+    int messages = 2000000 / producers[p];
+    snprintf(label, sizeof(label), "%d producer%s", producers[p], producers[p] > 1 ? "s" : "");
+    double native = que_throughput(1, producers[p], messages);
+    printf("%-28s %12.2f %12.2f\n", label, native / 1e6, que_throughput(0, producers[p], messages) / 1e6);
+}
+DosCloseQueue(que_queue);
+return 0;
+}
+
+// -------- Pipes --------
+
+#define PIPE_CHUNK (64u << 10)              // Per DosRead and DosWrite, a typical OS/2 buffer
+
+static HFILE pipe_src, pipe_end;
+static uint64_t pipe_bytes;
+
+static int pipe_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "pipes: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+// Bytes from 'in' to 'out' through a buffer of ours
+static uint64_t pipe_bounce(HFILE in, HFILE out) {
+char *buffer = malloc(PIPE_CHUNK);
+uint64_t total = 0;
+ULONG got, written;
+while (buffer && DosRead(in, buffer, PIPE_CHUNK, &got) == NO_ERROR && got) {
+    if (DosWrite(out, buffer, got, &written) != NO_ERROR || written != got) break;
+    total += got;
+}
+free(buffer);
+return total;
+}
+
+// Writes pipe_bytes to pipe_end and closes it
+static void APIENTRY pipe_writer(ULONG arg) {
+(void)arg;
+char *buffer = malloc(PIPE_CHUNK);
+memset(buffer, 'x', PIPE_CHUNK);
+ULONG written;
+for (uint64_t left = pipe_bytes; left; left -= written) {
+    if (DosWrite(pipe_end, buffer, left < PIPE_CHUNK ? left : PIPE_CHUNK, &written) != NO_ERROR) break;
+}
+free(buffer);
+DosClose(pipe_end);
+}
+
+// pipe_src to pipe_end, then closes pipe_end
+static void APIENTRY pipe_feed(ULONG zero_copy) {
+if (zero_copy) fd_transfer(get_linux_fd(pipe_src), get_linux_fd(pipe_end));
+else pipe_bounce(pipe_src, pipe_end);
+DosClose(pipe_end);
+}
+
+// A file of 'bytes' with a pattern that shows misplaced blocks
+static int pipe_make_file(const char *path, uint64_t bytes) {
+uint32_t block[1024];
+int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+if (fd < 0) return -1;
+for (uint64_t done = 0; done < bytes; done += sizeof(block)) {
+    for (int i = 0; i < 1024; i++) block[i] = (uint32_t)(done / sizeof(block)) * 1024 + i;
+    size_t n = bytes - done < sizeof(block) ? bytes - done : sizeof(block);
+    if (write(fd, block, n) != (ssize_t)n) {
+        close(fd);
+        return -1;
+    }
+}
+return close(fd);
+}
+
+static int pipe_same_file(const char *a, const char *b) {
+FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+int same = fa && fb;
+char x[65536], y[65536];
+while (same) {
+    size_t na = fread(x, 1, sizeof(x), fa), nb = fread(y, 1, sizeof(y), fb);
+    same = na == nb && memcmp(x, y, na) == 0;
+    if (!na) break;
+}
+if (fa) fclose(fa);
+if (fb) fclose(fb);
+return same;
+}
+
+static off_t pipe_file_size(const char *path) {
+struct stat st;
+return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+static int pipe_self_test(const char *dir) {
+int failures = 0;
+HFILE r, w, h;
+ULONG n;
+char buffer[16];
+pipe_check(&failures, DosCreatePipe(&r, &w, 4096) == NO_ERROR &&
+           fcntl(get_linux_fd(w), F_GETPIPE_SZ) > (int)PIPE_BUFFER_DEFAULT, "large buffer");
+pipe_check(&failures, DosWrite(w, "hello", 5, &n) == NO_ERROR && n == 5 &&
+           DosRead(r, buffer, sizeof(buffer), &n) == NO_ERROR && n == 5 && memcmp(buffer, "hello", 5) == 0,
+           "write and read");
+
+// Duplicates: a new handle, a given free one, one that was open, stdout
+h = HANDLE_NONE;
+pipe_check(&failures, DosDupHandle(r, &h) == NO_ERROR && h != r && DosWrite(w, "a", 1, &n) == NO_ERROR &&
+           DosRead(h, buffer, 1, &n) == NO_ERROR && n == 1 && buffer[0] == 'a' && DosClose(h) == NO_ERROR,
+           "duplicate");
+h = 1000;
+pipe_check(&failures, DosDupHandle(w, &h) == NO_ERROR && h == 1000 && DosWrite(h, "b", 1, &n) == NO_ERROR &&
+           DosRead(r, buffer, 1, &n) == NO_ERROR && buffer[0] == 'b' && DosClose(h) == NO_ERROR,
+           "duplicate onto a free handle");
+HFILE file;
+ULONG action;
+char path[PATH_MAX], copy[PATH_MAX], fifo[PATH_MAX];
+snprintf(path, sizeof(path), "%s/os2bench.%d.a", dir, (int)getpid());
+snprintf(copy, sizeof(copy), "%s/os2bench.%d.b", dir, (int)getpid());
+snprintf(fifo, sizeof(fifo), "%s/os2bench.%d.fifo", dir, (int)getpid());
+DosOpen(path, &file, &action, 0, FILE_NORMAL, OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS,
+        OPEN_ACCESS_WRITEONLY, NULL);
+h = file;
+pipe_check(&failures, DosDupHandle(w, &h) == NO_ERROR && h == file && DosWrite(file, "c", 1, &n) == NO_ERROR &&
+           DosRead(r, buffer, 1, &n) == NO_ERROR && buffer[0] == 'c' && pipe_file_size(path) == 0 &&
+           DosClose(file) == NO_ERROR, "duplicate onto an open handle");
+HFILE saved = HANDLE_NONE, out = 1;
+fflush(stdout);
+pipe_check(&failures, DosDupHandle(1, &saved) == NO_ERROR && DosDupHandle(w, &out) == NO_ERROR && out == 1 &&
+           write(1, "d", 1) == 1 && DosRead(r, buffer, 1, &n) == NO_ERROR && buffer[0] == 'd' &&
+           DosDupHandle(saved, &out) == NO_ERROR && DosClose(saved) == NO_ERROR, "redirect stdout");
+h = HANDLE_CHUNK * HANDLE_CHUNKS;
+pipe_check(&failures, DosDupHandle(w, &h) == ERROR_INVALID_TARGET_HANDLE &&
+           DosDupHandle(HANDLE_NONE - 1, &h) == ERROR_INVALID_HANDLE, "bad handles");
+pipe_check(&failures, DosClose(r) == NO_ERROR && DosWrite(w, "e", 1, &n) == ERROR_BROKEN_PIPE &&
+           DosClose(w) == NO_ERROR, "broken pipe");
+
+// DosCopy: replace, append, onto itself, and out of a FIFO
+const uint64_t size = 3 << 20;
+pipe_make_file(path, size);
+pipe_check(&failures, DosCopy(path, copy, 0) == NO_ERROR && pipe_same_file(path, copy), "copy");
+pipe_check(&failures, DosCopy(path, copy, 0) == ERROR_ACCESS_DENIED, "copy over a file");
+pipe_check(&failures, DosCopy(path, copy, DCPY_APPEND) == NO_ERROR && pipe_file_size(copy) == 2 * (off_t)size &&
+           DosCopy(path, copy, DCPY_EXISTING) == NO_ERROR && pipe_same_file(path, copy), "append and replace");
+pipe_check(&failures, DosCopy(path, path, DCPY_EXISTING) == ERROR_ACCESS_DENIED &&
+           pipe_file_size(path) == (off_t)size, "copy onto itself");
+pipe_check(&failures, DosCopy(dir, copy, DCPY_EXISTING) == ERROR_ACCESS_DENIED, "copy a directory");
+DosDelete(copy);
+mkfifo(fifo, 0600);
+fflush(NULL);
+pid_t child = fork();
+if (child == 0) {
+    // Opening a FIFO waits for the other end, so the writer is another process
+    HFILE src, end;
+    int ok = DosOpen(path, &src, &action, 0, FILE_NORMAL, OPEN_ACTION_OPEN_IF_EXISTS, OPEN_ACCESS_READONLY,
+                     NULL) == NO_ERROR &&
+             DosOpen(fifo, &end, &action, 0, FILE_NORMAL, OPEN_ACTION_OPEN_IF_EXISTS, OPEN_ACCESS_WRITEONLY,
+                     NULL) == NO_ERROR && pipe_bounce(src, end) == size;
+    _exit(ok ? 0 : 1);
+}
+int status = 1;
+pipe_check(&failures, child > 0 && DosCopy(fifo, copy, 0) == NO_ERROR && pipe_same_file(path, copy),
+           "copy from a FIFO");
+if (child > 0) waitpid(child, &status, 0);
+pipe_check(&failures, status == 0, "child process");
+DosDelete(fifo);
+DosDelete(copy);
+DosDelete(path);
+return failures;
+}
+
+// MB/s through a pipe from a thread writing 64 KB at a time to one
+// reading: Linux's default pipe, or DosCreatePipe's
+static double pipe_throughput(int native, uint64_t bytes) {
+HFILE r, w;
+if (native) {
+    int fds[2];
+    if (pipe(fds) < 0) return 0;
+    r = allocate_handle(fds[0], NULL);
+    w = allocate_handle(fds[1], NULL);
+} else {
+    DosCreatePipe(&r, &w, 0);
+}
+char *buffer = malloc(PIPE_CHUNK);
+uint64_t total = 0;
+ULONG got;
+TID tid;
+pipe_end = w;
+pipe_bytes = bytes;
+uint64_t start = now_ns();
+DosCreateThread(&tid, pipe_writer, 0, CREATE_READY, THREAD_STACK_MIN);
+while (DosRead(r, buffer, PIPE_CHUNK, &got) == NO_ERROR && got) total += got;
+DosWaitThread(&tid, DCWW_WAIT);
+double seconds = (now_ns() - start) / 1e9;
+DosClose(r);
+free(buffer);
+return total == bytes ? total / 1048576.0 / seconds : 0;
+}
+
+// MB/s moving file 'from' to 'to' through a DosCreatePipe pipe, the far
+// side on another thread: DosRead + DosWrite, or splice
+static double pipe_relay(int zero_copy, const char *from, const char *to) {
+HFILE r, dst;
+ULONG action;
+DosOpen(from, &pipe_src, &action, 0, FILE_NORMAL, OPEN_ACTION_OPEN_IF_EXISTS, OPEN_ACCESS_READONLY, NULL);
+DosOpen(to, &dst, &action, 0, FILE_NORMAL, OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS,
+        OPEN_ACCESS_WRITEONLY, NULL);
+DosCreatePipe(&r, &pipe_end, 0);
+TID tid;
+uint64_t start = now_ns();
+DosCreateThread(&tid, pipe_feed, zero_copy, CREATE_READY, THREAD_STACK_MIN);
+int64_t total = zero_copy ? fd_transfer(get_linux_fd(r), get_linux_fd(dst)) : (int64_t)pipe_bounce(r, dst);
+DosWaitThread(&tid, DCWW_WAIT);
+double seconds = (now_ns() - start) / 1e9;
+DosClose(r);
+DosClose(dst);
+DosClose(pipe_src);
+return total == pipe_file_size(from) ? total / 1048576.0 / seconds : 0;
+}
+
+// MB/s copying file 'from' to 'to': DosRead + DosWrite, or DosCopy
+static double pipe_copy(int zero_copy, const char *from, const char *to) {
+uint64_t start = now_ns();
+int ok;
+if (zero_copy) {
+    ok = DosCopy(from, to, DCPY_EXISTING) == NO_ERROR;
+} else {
+    HFILE src, dst;
+    ULONG action;
+    DosOpen(from, &src, &action, 0, FILE_NORMAL, OPEN_ACTION_OPEN_IF_EXISTS, OPEN_ACCESS_READONLY, NULL);
+    DosOpen(to, &dst, &action, 0, FILE_NORMAL, OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS,
+            OPEN_ACCESS_WRITEONLY, NULL);
+    ok = pipe_bounce(src, dst) == (uint64_t)pipe_file_size(from);
+    DosClose(src);
+    DosClose(dst);
+}
+double seconds = (now_ns() - start) / 1e9;
+return ok ? pipe_file_size(from) / 1048576.0 / seconds : 0;
+}
+
+static int bench_pipes(int argc, char **argv) {
+const char *dir = argc > 2 ? argv[2] : "/tmp";
+int failures = pipe_self_test(dir);
+printf("pipe self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+uint64_t piped = (argc > 0 ? strtoull(argv[0], NULL, 0) : 4096) << 20;
+uint64_t filed = (argc > 1 ? strtoull(argv[1], NULL, 0) : 512) << 20;
+char from[PATH_MAX], to[PATH_MAX];
+snprintf(from, sizeof(from), "%s/os2bench.%d.a", dir, (int)getpid());
+snprintf(to, sizeof(to), "%s/os2bench.%d.b", dir, (int)getpid());
+
+char label[64];
+snprintf(label, sizeof(label), "pipe, %llu MB", (unsigned long long)(piped >> 20));
+printf("%-32s %12s\n", label, "MB/s");
+printf("%-32s %12.0f\n", "  pipe(), 64 KB buffer", pipe_throughput(1, piped));
+printf("%-32s %12.0f\n", "  DosCreatePipe", pipe_throughput(0, piped));
+
+if (pipe_make_file(from, filed) < 0) {
+    fprintf(stderr, "pipes: cannot write %s\n", from);
+    return 1;
+}
+snprintf(label, sizeof(label), "file -> pipe -> file, %llu MB", (unsigned long long)(filed >> 20));
+printf("\n%-32s %12s\n", label, "MB/s");
+printf("%-32s %12.0f\n", "  DosRead + DosWrite", pipe_relay(0, from, to));
+printf("%-32s %12.0f\n", "  splice", pipe_relay(1, from, to));
+snprintf(label, sizeof(label), "file copy, %llu MB", (unsigned long long)(filed >> 20));
+printf("\n%-32s %12s\n", label, "MB/s");
+printf("%-32s %12.0f\n", "  DosRead + DosWrite", pipe_copy(0, from, to));
+printf("%-32s %12.0f\n", "  DosCopy", pipe_copy(1, from, to));
+DosDelete(to);
+DosDelete(from);
+return 0;
+}
+
+// -------- File I/O --------
+
+static int files_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "files: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+static HFILE files_open(const char *path, ULONG access, int replace) {
+HFILE h = 0;
+ULONG action;
+ULONG flags = replace ? OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS : OPEN_ACTION_OPEN_IF_EXISTS;
+return DosOpen(path, &h, &action, 0, FILE_NORMAL, flags, access, NULL) == NO_ERROR ? h : HANDLE_NONE;
+}
+
+static ULONG files_seek(HFILE h, LONG offset, ULONG origin) {
+ULONG pos = 0;
+return DosSetFilePtr(h, offset, origin, &pos) == NO_ERROR ? pos : (ULONG)-1;
+}
+
+// Whether 'path' holds exactly 'bytes' of 'expect', read with plain read()
+static int files_holds(const char *path, const uint8_t *expect, size_t bytes) {
+int fd = open(path, O_RDONLY);
+uint8_t *data = malloc(bytes + 1);
+ssize_t got = fd >= 0 && data ? pread(fd, data, bytes + 1, 0) : -1;
+int same = got == (ssize_t)bytes && memcmp(data, expect, bytes) == 0;
+if (fd >= 0) close(fd);
+free(data);
+return same;
+}
 
-printf("\n=== Processing Fixups ===\n");
+// DosRead in records of varying size, 'expect' being what should come back
+static int files_read_back(HFILE h, const uint8_t *expect, size_t bytes) {
+uint8_t *data = malloc(bytes + 1);
+size_t done = 0;
+ULONG got;
+for (uint32_t i = 0; data && done < bytes; i++) {
+    ULONG want = (i * 7919u) % (i % 5 == 4 ? 200000u : 3000u) + 1;
+    if (DosRead(h, data + done, want, &got) != NO_ERROR || !got) break;
+    done += got;
+}
+int same = data && done == bytes && memcmp(data, expect, bytes) == 0 &&
+           DosRead(h, data, 1, &got) == NO_ERROR && got == 0;
+free(data);
+return same;
+}
 
-// Validate offsets are within file
-uint32_t fixup_page_offset = exe->le_offset + exe->le_header->fixup_page_table_offset;
-uint32_t fixup_rec_offset = exe->le_offset + exe->le_header->fixup_record_table_offset;
+static const char *files_dir;
+static int files_thread_ok[4];
 
-if (fixup_page_offset >= exe->file_size || fixup_rec_offset >= exe->file_size) {
-    printf("ERROR: Fixup table offsets exceed file size\n");
-    return;
+// Writes a file of its own through the ring in small records, and reads
+// it back
+static void APIENTRY files_thread(ULONG index) {
+char path[PATH_MAX];
+snprintf(path, sizeof(path), "%s/os2bench.%d.t%u", files_dir, (int)getpid(), (unsigned)index);
+HFILE h = files_open(path, OPEN_ACCESS_READWRITE, 1);
+uint8_t record[333], back[333];
+ULONG n;
+int ok = h != HANDLE_NONE;
+for (int i = 0; ok && i < 3000; i++) {
+    memset(record, (uint8_t)(index * 31 + i), sizeof(record));
+    ok = DosWrite(h, record, sizeof(record), &n) == NO_ERROR && n == sizeof(record);
+}
+ok = ok && files_seek(h, 0, FILE_BEGIN) == 0;
+for (int i = 0; ok && i < 3000; i++) {
+    memset(record, (uint8_t)(index * 31 + i), sizeof(record));
+    ok = DosRead(h, back, sizeof(back), &n) == NO_ERROR && n == sizeof(back) && memcmp(back, record, n) == 0;
+}
+files_thread_ok[index] = ok && DosClose(h) == NO_ERROR && DosDelete(path) == NO_ERROR;
 }
 
-uint32_t *fixup_page_table = (uint32_t*)(exe->file_data + fixup_page_offset);
-uint8_t *fixup_record_base = exe->file_data + fixup_rec_offset;
+static int files_self_test(const char *dir) {
+int failures = 0;
+char path[PATH_MAX], copy[PATH_MAX];
+snprintf(path, sizeof(path), "%s/os2bench.%d.a", dir, (int)getpid());
+snprintf(copy, sizeof(copy), "%s/os2bench.%d.b", dir, (int)getpid());
+const size_t size = 3 << 20;
+uint8_t *expect = calloc(size + 8, 1);
+for (size_t i = 0; i < size; i++) expect[i] = (uint8_t)(i * 2654435761u >> 13);
 
-uint32_t total_pages = 0;
-for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
-    total_pages += exe->objects[i].page_table_entries;
+io_wanted = 1;
+HFILE h = files_open(path, OPEN_ACCESS_READWRITE, 1);
+if (h == HANDLE_NONE || !handle_entry(h)->io) printf("io_uring is not available, checking the plain path\n");
+
+// Records of 1 byte to 200 KB, gathered and written behind
+size_t done = 0;
+ULONG n;
+for (uint32_t i = 0; done < size; i++) {
+    ULONG want = (i * 7919u) % (i % 5 == 4 ? 200000u : 3000u) + 1;
+    if (want > size - done) want = size - done;
+    if (DosWrite(h, expect + done, want, &n) != NO_ERROR || n != want) break;
+    done += n;
+}
+files_check(&failures, done == size && files_seek(h, 0, FILE_CURRENT) == size, "write");
+files_check(&failures, files_seek(h, -10, FILE_END) == size - 10 && files_seek(h, 0, FILE_BEGIN) == 0,
+            "seek from the end");
+files_check(&failures, files_read_back(h, expect, size), "read back");
+
+// Overwrite what has been read ahead, then read it again
+uint8_t patch[100], back[100];
+memset(patch, 0x5A, sizeof(patch));
+memcpy(expect + 70000, patch, sizeof(patch));
+files_check(&failures, files_seek(h, 60000, FILE_BEGIN) == 60000 && DosRead(h, back, 10, &n) == NO_ERROR &&
+            files_seek(h, 70000, FILE_BEGIN) == 70000 && DosWrite(h, patch, sizeof(patch), &n) == NO_ERROR &&
+            files_seek(h, -(LONG)sizeof(patch), FILE_CURRENT) == 70000 &&
+            DosRead(h, back, sizeof(back), &n) == NO_ERROR && n == sizeof(back) &&
+            memcmp(back, patch, sizeof(back)) == 0, "read after write");
+
+// Writing past the end leaves a hole, and the end moves with it
+memcpy(expect + size + 5, "\1\2\3", 3);
+files_check(&failures, files_seek(h, 5, FILE_END) == size + 5 && DosWrite(h, "\1\2\3", 3, &n) == NO_ERROR &&
+            files_seek(h, 0, FILE_END) == size + 8 && files_seek(h, size, FILE_BEGIN) == size &&
+            DosRead(h, back, sizeof(back), &n) == NO_ERROR && n == 8 &&
+            memcmp(back, expect + size, 8) == 0, "write past the end");
+files_check(&failures, files_seek(h, -1, FILE_BEGIN) == (ULONG)-1, "seek before the start");
+
+// DosCopy sees what is still being written behind
+memcpy(expect, "copy", 4);
+files_check(&failures, files_seek(h, 0, FILE_BEGIN) == 0 && DosWrite(h, "copy", 4, &n) == NO_ERROR &&
+            DosCopy(path, copy, DCPY_EXISTING) == NO_ERROR && files_holds(copy, expect, size + 8),
+            "copy while writing");
+
+// A duplicate shares the file pointer, so both leave the ring
+HFILE dup = HANDLE_NONE;
+memcpy(expect + 1000, "dup", 3);
+files_check(&failures, files_seek(h, 1000, FILE_BEGIN) == 1000 && DosDupHandle(h, &dup) == NO_ERROR &&
+            !handle_entry(h)->io && files_seek(dup, 0, FILE_CURRENT) == 1000 &&
+            DosWrite(dup, "dup", 3, &n) == NO_ERROR && files_seek(h, 0, FILE_CURRENT) == 1003 &&
+            DosClose(dup) == NO_ERROR, "duplicate");
+files_check(&failures, DosClose(h) == NO_ERROR && files_holds(path, expect, size + 8), "close");
+
+h = files_open(path, OPEN_ACCESS_READONLY, 0);
+files_check(&failures, h != HANDLE_NONE && DosWrite(h, "x", 1, &n) != NO_ERROR &&
+            files_read_back(h, expect, size + 8) && DosClose(h) == NO_ERROR, "read only");
+h = files_open(path, OPEN_ACCESS_WRITEONLY, 0);
+files_check(&failures, h != HANDLE_NONE && DosRead(h, back, 1, &n) != NO_ERROR && DosClose(h) == NO_ERROR,
+            "write only");
+
+// Threads with a file each, waiting on the ring together
+TID tids[4];
+int together = 1;
+files_dir = dir;
+for (ULONG i = 0; i < 4; i++) DosCreateThread(&tids[i], files_thread, i, CREATE_READY, THREAD_STACK_MIN);
+for (int i = 0; i < 4; i++) together &= DosWaitThread(&tids[i], DCWW_WAIT) == NO_ERROR && files_thread_ok[i];
+files_check(&failures, together, "threads");
+io_wanted = 0;
+free(expect);
+DosDelete(copy);
+DosDelete(path);
+return failures;
+}
+
+// MB/s writing a file of 'bytes' in records of 'record' bytes, then
+// reading it back, with or without the ring
+static void files_throughput(const char *path, int ring, size_t record, uint64_t bytes,
+                             double *write_rate, double *read_rate) {
+uint8_t *buffer = malloc(record);
+memset(buffer, 0xA5, record);
+io_wanted = ring;
+HFILE h = files_open(path, OPEN_ACCESS_WRITEONLY, 1);
+uint64_t total = 0;
+ULONG n;
+uint64_t start = now_ns();
+while (h != HANDLE_NONE && total < bytes && DosWrite(h, buffer, record, &n) == NO_ERROR && n) total += n;
+if (h != HANDLE_NONE) DosClose(h);
+*write_rate = total == bytes ? total / 1048576.0 / ((now_ns() - start) / 1e9) : 0;
+
+h = files_open(path, OPEN_ACCESS_READONLY, 0);
+total = 0;
+start = now_ns();
+while (h != HANDLE_NONE && DosRead(h, buffer, record, &n) == NO_ERROR && n) total += n;
+if (h != HANDLE_NONE) DosClose(h);
+*read_rate = total == bytes ? total / 1048576.0 / ((now_ns() - start) / 1e9) : 0;
+io_wanted = 0;
+free(buffer);
+}
+
+static int bench_files(int argc, char **argv) {
+const char *dir = argc > 1 ? argv[1] : "/tmp";
+int failures = files_self_test(dir);
+printf("file I/O self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+uint64_t bytes = (argc > 0 ? strtoull(argv[0], NULL, 0) : 256) << 20;
+char path[PATH_MAX];
+snprintf(path, sizeof(path), "%s/os2bench.%d.a", dir, (int)getpid());
+static const size_t records[] = { 64, 512, 4096, 65536, 1 << 20 };
+
+char label[64];
+snprintf(label, sizeof(label), "MB/s, %llu MB file", (unsigned long long)(bytes >> 20));
+printf("%-20s %12s %12s %12s %12s\n", label, "write", "write", "read", "read");
+printf("%-20s %12s %12s %12s %12s\n", "record", "plain", "io_uring", "plain", "io_uring");
+for (size_t i = 0; i < sizeof(records) / sizeof(records[0]); i++) {
+    double write_plain, read_plain, write_ring, read_ring;
+    files_throughput(path, 0, records[i], bytes, &write_plain, &read_plain);
+    files_throughput(path, 1, records[i], bytes, &write_ring, &read_ring);
+    if (records[i] >= 1024) snprintf(label, sizeof(label), "  %zu KB", records[i] >> 10);
+    else snprintf(label, sizeof(label), "  %zu B", records[i]);
+    printf("%-20s %12.0f %12.0f %12.0f %12.0f\n", label, write_plain, write_ring, read_plain, read_ring);
+}
+DosDelete(path);
+return 0;
+}
+
+// -------- Write-behind --------
+
+static int writes_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "writes: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+// A pseudo-terminal: *slave is the terminal, read back through the master
+static int writes_open_pty(int *slave) {
+int master = posix_openpt(O_RDWR | O_NOCTTY);
+if (master < 0) return -1;
+if (grantpt(master) < 0 || unlockpt(master) < 0 || (*slave = open(ptsname(master), O_RDWR | O_NOCTTY)) < 0) {
+    close(master);
+    return -1;
+}
+return master;
+}
+
+static int writes_read_pty(int master, const char *expect) {
+char got[64];
+size_t want = strlen(expect), done = 0;
+while (done < want) {
+    ssize_t n = read(master, got + done, want - done);
+    if (n <= 0) return 0;
+    done += n;
+}
+return memcmp(got, expect, want) == 0;
+}
+
+static uint64_t writes_syscalls(void) {
+FILE *f = fopen("/proc/self/io", "r");
+char line[64];
+unsigned long long count = 0;
+while (f && fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "syscw: %llu", &count) == 1) break;
+}
+if (f) fclose(f);
+return count;
+}
+
+static int writes_self_test(const char *dir) {
+int failures = 0;
+char path[PATH_MAX];
+snprintf(path, sizeof(path), "%s/os2bench.%d.a", dir, (int)getpid());
+ULONG n;
+char buffer[1000];
+memset(buffer, 'w', sizeof(buffer));
+
+// Gathered until a seek, WB_SIZE bytes, DosResetBuffer, a read or DosClose
+HFILE h = files_open(path, OPEN_ACCESS_READWRITE, 1);
+writes_check(&failures, h != HANDLE_NONE && wb_get(h) && DosWrite(h, "abc", 3, &n) == NO_ERROR && n == 3 &&
+             pipe_file_size(path) == 0, "buffered");
+writes_check(&failures, files_seek(h, 0, FILE_CURRENT) == 3 && pipe_file_size(path) == 3, "seek");
+for (ULONG left = WB_SIZE - 1; left; left -= n) {
+    if (DosWrite(h, buffer, left < sizeof(buffer) ? left : sizeof(buffer), &n) != NO_ERROR) break;
+}
+writes_check(&failures, pipe_file_size(path) == 3 && DosWrite(h, "w", 1, &n) == NO_ERROR &&
+             pipe_file_size(path) == 3 + WB_SIZE, "size threshold");
+writes_check(&failures, DosWrite(h, "xyz", 3, &n) == NO_ERROR && DosResetBuffer(h) == NO_ERROR &&
+             pipe_file_size(path) == 6 + WB_SIZE, "DosResetBuffer");
+writes_check(&failures, DosWrite(h, "uvw", 3, &n) == NO_ERROR && files_seek(h, 0, FILE_BEGIN) == 0 &&
+             DosRead(h, buffer, 3, &n) == NO_ERROR && n == 3 && memcmp(buffer, "abc", 3) == 0, "read");
+writes_check(&failures, files_seek(h, 0, FILE_END) == 9 + WB_SIZE && DosWrite(h, "end", 3, &n) == NO_ERROR &&
+             DosClose(h) == NO_ERROR && pipe_file_size(path) == 12 + WB_SIZE, "close");
+
+// Not buffered: write-through files, duplicates, pipes
+h = files_open(path, OPEN_ACCESS_WRITEONLY | OPEN_FLAGS_WRITE_THROUGH, 1);
+writes_check(&failures, h != HANDLE_NONE && !wb_get(h) && (fcntl(get_linux_fd(h), F_GETFL) & O_DSYNC) &&
+             DosWrite(h, "abc", 3, &n) == NO_ERROR && pipe_file_size(path) == 3 && DosClose(h) == NO_ERROR,
+             "write-through");
+HFILE copy = HANDLE_NONE;
+h = files_open(path, OPEN_ACCESS_WRITEONLY, 1);
+writes_check(&failures, h != HANDLE_NONE && DosWrite(h, "ab", 2, &n) == NO_ERROR &&
+             DosDupHandle(h, &copy) == NO_ERROR && pipe_file_size(path) == 2 && !wb_get(h) && !wb_get(copy) &&
+             DosClose(copy) == NO_ERROR && DosClose(h) == NO_ERROR, "duplicate");
+HFILE r, w;
+writes_check(&failures, DosCreatePipe(&r, &w, 0) == NO_ERROR && !wb_get(w), "pipe");
+
+// A terminal gets each line as it ends
+int slave, master = writes_open_pty(&slave);
+if (master < 0) printf("no pseudo-terminals, not checking terminals\n");
+if (master >= 0) {
+    h = allocate_handle(slave, NULL);
+    wb_attach(h, slave);
+    writes_check(&failures, wb_get(h) && wb_get(h)->tty && DosWrite(h, "hello", 5, &n) == NO_ERROR &&
+                 wb_get(h)->len == 5 && DosPutMessage(h, 1, "\n") == NO_ERROR && wb_get(h)->len == 0 &&
+                 writes_read_pty(master, "hello\r\n"), "terminal");
+    DosClose(h);
+
+    // The console is written out before the program reads or sleeps
+    fflush(stdout);
+    int saved = dup(1);
+    wb_detach(1);
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    dup2(slave, 1);
+    close(slave);
+    wb_attach(1, 1);
+    writes_check(&failures, wb_get(1) && DosWrite(1, "name? ", 6, &n) == NO_ERROR && wb_get(1)->len == 6 &&
+                 DosWrite(w, "x", 1, &n) == NO_ERROR && DosRead(r, buffer, 1, &n) == NO_ERROR &&
+                 wb_get(1)->len == 0 && writes_read_pty(master, "name? "), "prompt before a read");
+    writes_check(&failures, DosWrite(1, "...", 3, &n) == NO_ERROR && DosSleep(0) == NO_ERROR &&
+                 writes_read_pty(master, "..."), "before a sleep");
+    wb_detach(1);
+    dup2(saved, 1);
+    close(saved);
+    wb_attach(1, 1);
+    close(master);
+}
+DosClose(r);
+DosClose(w);
+
+// And at exit
+wb_flush_all();
+fflush(NULL);
+pid_t child = fork();
+if (child == 0) {
+    h = files_open(path, OPEN_ACCESS_WRITEONLY, 1);
+    DosWrite(h, "exit", 4, &n);
+    DosExit(EXIT_PROCESS, 0);
+}
+int status = 1;
+if (child > 0) waitpid(child, &status, 0);
+writes_check(&failures, status == 0 && pipe_file_size(path) == 4, "exit");
+DosDelete(path);
+return failures;
+}
+
+static void APIENTRY writes_drain(ULONG master) {
+char buffer[4096];
+while (read(master, buffer, sizeof(buffer)) > 0) { }
+}
+
+// A log line at a time, in four writes, to 'h': returns lines/s and
+// write system calls per line
+static double writes_log(HFILE h, uint32_t lines, double *syscalls) {
+char stamp[32], message[64];
+ULONG n;
+uint64_t calls = writes_syscalls();
+uint64_t start = now_ns();
+for (uint32_t i = 0; i < lines; i++) {
+    int len = snprintf(stamp, sizeof(stamp), "%02u:%02u:%02u.%03u ", i / 3600000 % 24, i / 60000 % 60,
+                       i / 1000 % 60, i % 1000);
+    DosWrite(h, stamp, len, &n);
+    DosWrite(h, "INFO  ", 6, &n);
+    len = snprintf(message, sizeof(message), "request %u served in %u us", i, i * 7919 % 1000);
+    DosPutMessage(h, len, message);
+    DosWrite(h, "\n", 1, &n);
+}
+DosResetBuffer(h);
+double seconds = (now_ns() - start) / 1e9;
+*syscalls = (double)(writes_syscalls() - calls) / lines;
+return lines / seconds;
+}
+
+static int bench_writes(int argc, char **argv) {
+const char *dir = argc > 1 ? argv[1] : "/tmp";
+int failures = writes_self_test(dir);
+printf("write-behind self-test: %s\n\n", failures ? "FAIL" : "ok");
+if (failures) return 1;
+
+uint32_t lines = argc > 0 ? strtoul(argv[0], NULL, 0) : 200000;
+char path[PATH_MAX];
+snprintf(path, sizeof(path), "%s/os2bench.%d.a", dir, (int)getpid());
+
+char label[64];
+snprintf(label, sizeof(label), "logging, %u lines", lines);
+printf("%-32s %12s %12s\n", label, "lines/s", "writes/line");
+for (int tty = 0; tty < 2; tty++) {
+    for (int buffered = 0; buffered < 2; buffered++) {
+        HFILE h = HANDLE_NONE;
+        int master = -1;
+        TID tid = 0;
+        wb_wanted = buffered;
+        if (!tty) {
+            h = files_open(path, OPEN_ACCESS_WRITEONLY, 1);
+        } else {
+            int slave;
+            master = writes_open_pty(&slave);
+            if (master >= 0) {
+                h = allocate_handle(slave, NULL);
+                wb_attach(h, slave);
+                DosCreateThread(&tid, writes_drain, master, CREATE_READY, THREAD_STACK_MIN);
+            }
+        }
+        wb_wanted = 1;
+        if (h == HANDLE_NONE) continue;
+
+        double syscalls, rate = writes_log(h, lines, &syscalls);
+        DosClose(h);
+        if (tid) DosWaitThread(&tid, DCWW_WAIT);
+        if (master >= 0) close(master);
+        snprintf(label, sizeof(label), "  %s, %s", tty ? "terminal" : "file", buffered ? "write-behind" : "unbuffered");
+        printf("%-32s %12.0f %12.3f\n", label, rate, syscalls);
+    }
+}
+DosDelete(path);
+return 0;
+}
+
+// -------- Path translation --------
+
+static int paths_check(int *failures, int ok, const char *what) {
+if (!ok) {
+    fprintf(stderr, "paths: %s\n", what);
+    (*failures)++;
+}
+return ok;
+}
+
+static int paths_make(const char *path) {
+int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+if (fd >= 0) close(fd);
+return fd >= 0;
 }
 
-printf("Total pages: %d\n", total_pages);
-printf("Fixup page table at: 0x%x (file offset 0x%x)\n", 
-       exe->le_header->fixup_page_table_offset, fixup_page_offset);
-printf("Fixup record table at: 0x%x (file offset 0x%x)\n", 
-       exe->le_header->fixup_record_table_offset, fixup_rec_offset);
-printf("Fixup size: 0x%x\n", exe->le_header->fixup_size);
+// root followed by 'rest', in 'out' (PATH_MAX bytes); root is short
+static void paths_at(char *out, const char *root, const char *rest) {
+size_t len = strlen(root);
+memcpy(out, root, len);
+strcpy(out + len, rest);
+}
+
+// Whether the OS/2 name 'name' translates to root followed by 'expect'
+static int paths_is(const char *root, const char *name, const char *expect) {
+char out[PATH_MAX];
+size_t len = strlen(root);
+return path_translate(name, out) == NO_ERROR && strncmp(out, root, len) == 0 && strcmp(out + len, expect) == 0;
+}
 
-// Check if we have enough space for the page table
-if (fixup_page_offset + (total_pages + 1) * 4 > exe->file_size) {
-    printf("ERROR: Fixup page table exceeds file bounds\n");
+static void paths_remove(const char *path) {
+DIR *d = opendir(path);
+if (!d) {
+    unlink(path);
     return;
 }
+char child[PATH_MAX];
+for (struct dirent *de; (de = readdir(d)); ) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+    snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+    paths_remove(child);
+}
+closedir(d);
+rmdir(path);
+}
+
+// Runs with C: at 'root'
+static int paths_self_test(const char *root) {
+int failures = 0;
+char path[PATH_MAX];
+
+// Drives, backslashes, . and ..
+paths_check(&failures, paths_is(root, "C:\\a\\.\\b\\..\\c", "/a/c") && paths_is(root, "c:/a", "/a") &&
+            paths_is(root, "\\a", "/a") && paths_is(root, "C:\\..\\..\\a", "/a") && paths_is(root, "C:", ""),
+            "translation");
+paths_check(&failures, path_translate("Q:\\A", path) == ERROR_INVALID_DRIVE, "unknown drive");
+
+// Any case finds the file; the same spelling wins over others
+paths_at(path, root, "/MixedCase.Txt");
+paths_make(path);
+paths_at(path, root, "/dup.txt");
+paths_make(path);
+paths_at(path, root, "/DUP.txt");
+paths_make(path);
+HFILE h = files_open("C:\\MIXEDCASE.TXT", OPEN_ACCESS_READONLY, 0);
+paths_check(&failures, h != HANDLE_NONE && DosClose(h) == NO_ERROR, "any case");
+paths_check(&failures, paths_is(root, "C:\\dup.txt", "/dup.txt") && paths_is(root, "C:\\DUP.txt", "/DUP.txt"),
+            "same spelling first");
+
+// New names are used as given, and changes on disk are seen at once
+h = files_open("C:\\NewFile.TXT", OPEN_ACCESS_WRITEONLY, 1);
+paths_at(path, root, "/NewFile.TXT");
+paths_check(&failures, h != HANDLE_NONE && DosClose(h) == NO_ERROR && access(path, F_OK) == 0, "create");
+char moved[PATH_MAX];
+paths_at(moved, root, "/Renamed.txt");
+rename(path, moved);
+paths_check(&failures, paths_is(root, "C:\\RENAMED.TXT", "/Renamed.txt") &&
+            paths_is(root, "C:\\NEWFILE.TXT", "/NEWFILE.TXT"), "file renamed");
+
+paths_at(path, root, "/Sub");
+mkdir(path, 0755);
+paths_at(path, root, "/Sub/In.txt");
+paths_make(path);
+paths_check(&failures, paths_is(root, "C:\\SUB\\IN.TXT", "/Sub/In.txt"), "subdirectory");
+paths_at(path, root, "/Sub");
+paths_at(moved, root, "/Other");
+rename(path, moved);
+paths_at(path, root, "/sub");
+mkdir(path, 0755);
+paths_check(&failures, paths_is(root, "C:\\OTHER\\IN.TXT", "/Other/In.txt") &&
+            paths_is(root, "C:\\SUB\\IN.TXT", "/sub/IN.TXT"), "directory renamed");
+
+// Relative names start at the current directory
+int cwd = open(".", O_RDONLY | O_DIRECTORY);
+paths_check(&failures, cwd >= 0 && chdir(root) == 0 && paths_is(root, "other\\..\\OTHER\\in.TXT", "/Other/In.txt"),
+            "relative");
+if (cwd >= 0 && fchdir(cwd) == 0) close(cwd);
+
+// DosDelete and DosCopy translate too
+paths_at(path, root, "/Other/COPY.TXT");
+paths_check(&failures, DosCopy("C:\\mixedcase.txt", "C:\\other\\COPY.TXT", 0) == NO_ERROR &&
+            access(path, F_OK) == 0, "DosCopy");
+paths_at(moved, root, "/Renamed.txt");
+paths_check(&failures, DosDelete("C:\\renamed.TXT") == NO_ERROR && access(moved, F_OK) < 0 &&
+            DosDelete("C:\\RENAMED.TXT") == ERROR_FILE_NOT_FOUND, "DosDelete");
+return failures;
+}
+
+// The deep tree's file i, as an OS/2 name under C: (upper case) or as on disk
+static void paths_name(char *out, size_t size, const char *root, uint32_t i, uint32_t levels, int os2) {
+size_t len = snprintf(out, size, "%s", os2 ? "C:" : root);
+for (uint32_t l = 0, at = i; l < levels; l++, at /= 4) {
+    len += snprintf(out + len, size - len, os2 ? "\\BRANCH%u" : "/Branch%u", at % 4);
+}
+snprintf(out + len, size - len, os2 ? "\\FILE%06u.DAT" : "/File%06u.Dat", i);
+}
+
+// Case-insensitive lookup without an index: a readdir per component
+static int paths_scan_open(const char *name, const char *root) {
+char path[PATH_MAX];
+size_t len = strlen(root);
+memcpy(path, root, len + 1);
+for (const char *c = name + 2; *c; ) {
+    const char *end = c + 1;
+    while (*end && *end != '\\') end++;
+    size_t n = end - c - 1;
+    DIR *d = opendir(path);
+    struct dirent *de = NULL;
+    while (d && (de = readdir(d)) && (strncasecmp(de->d_name, c + 1, n) != 0 || de->d_name[n])) {}
+    path[len++] = '/';
+    memcpy(path + len, de ? de->d_name : c + 1, n);
+    len += n;
+    path[len] = 0;
+    if (d) closedir(d);
+    c = end;
+}
+return open(path, O_RDONLY);
+}
+
+static int bench_paths(int argc, char **argv) {
+const char *dir = argc > 1 ? argv[1] : "/tmp";
+char made[PATH_MAX], root[PATH_MAX];
+snprintf(made, sizeof(made), "%s/os2bench.%d.p", dir, (int)getpid());
+if (mkdir(made, 0755) < 0 || !realpath(made, root) || strlen(root) > PATH_MAX / 2) {
+    perror(made);
+    return 1;
+}
+setenv("OS2_DRIVE_C", root, 1);
+unsetenv("OS2_DRIVE_Q");
+unsetenv("OS2_FOLD_CASE");
 
-// Dump first few page table entries
-printf("\nFirst few fixup page table entries:\n");
-for (uint32_t i = 0; i < (total_pages < 5 ? total_pages + 1 : 5); i++) {
-    printf("  Page %d: 0x%08x\n", i, fixup_page_table[i]);
+int failures = paths_self_test(root);
+printf("path translation self-test: %s\n\n", failures ? "FAIL" : "ok");
+paths_remove(root);
+if (failures) return 1;
+
+// Four directories to a level, about a hundred files to a directory
+uint32_t files = argc > 0 ? strtoul(argv[0], NULL, 0) : 100000, levels = 1;
+while (levels < 12 && (files >> (2 * levels)) > 100) levels++;
+char path[PATH_MAX], name[PATH_MAX];
+mkdir(root, 0755);
+for (uint32_t i = 0; i < files; i++) {
+    paths_name(path, sizeof(path), root, i, levels, 0);
+    for (char *slash = path + strlen(root); (slash = strchr(slash + 1, '/')); ) {
+        *slash = 0;
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+    if (!paths_make(path)) {
+        perror(path);
+        paths_remove(root);
+        return 1;
+    }
 }
 
-// Dump first 64 bytes of fixup records
-printf("\nFirst 64 bytes of fixup records:\n");
-for (int i = 0; i < 64 && i < (int)exe->le_header->fixup_size; i += 16) {
-    printf("  %04x: ", i);
-    for (int j = 0; j < 16 && i + j < (int)exe->le_header->fixup_size; j++) {
-        printf("%02x ", fixup_record_base[i + j]);
+char label[64];
+snprintf(label, sizeof(label), "open, %u files %u deep", files, levels + 1);
+printf("%-32s %12s %12s\n", label, "opens/s", "us/open");
+for (int way = 0; way < 4; way++) {
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < files; i++) {
+        paths_name(name, sizeof(name), root, i, levels, way > 0);
+        if (way < 2) {
+            int fd = way ? paths_scan_open(name, root) : open(name, O_RDONLY);
+            if (fd >= 0) close(fd);
+        } else {
+            HFILE h = files_open(name, OPEN_ACCESS_READONLY, 0);
+            if (h != HANDLE_NONE) DosClose(h);
+        }
     }
-    printf("\n");
+    double seconds = (now_ns() - start) / 1e9;
+    static const char *const ways[] = { "open(), name on disk", "readdir per component",
+                                        "DosOpen, reading dirs", "DosOpen, indexed" };
+    printf("  %-30s %12.0f %12.2f\n", ways[way], files / seconds, seconds * 1e6 / files);
+}
+paths_remove(root);
+return 0;
 }
 
-printf("\nNote: LE fixup format is complex and may vary by compiler.\n");
-printf("This program requires GUI APIs that aren't implemented.\n");
-printf("Skipping full fixup processing to avoid crashes.\n");
+// -------- EXEPACK decompression --------
 
-// For GUI apps like this, fixups won't help - it needs PM APIs
-// Let's just report what we found
-int import_count = 0;
-for (uint32_t page = 0; page < total_pages; page++) {
-    uint32_t fixup_start = fixup_page_table[page];
-    uint32_t fixup_end = fixup_page_table[page + 1];
-    if (fixup_start < fixup_end) {
-        import_count++;
+// Byte-at-a-time decoders, the obvious transcription of the formats
+static int exepack1_unpack_ref(const uint8_t *src, size_t src_len,
+                               uint8_t *dst, size_t dst_len) {
+size_t s = 0, d = 0;
+while (s + 4 <= src_len) {
+    uint16_t iterations = src[s] | src[s + 1] << 8;
+    uint16_t length = src[s + 2] | src[s + 3] << 8;
+    s += 4;
+    if (iterations == 0) break;
+    if (s + length > src_len || d + (size_t)iterations * length > dst_len) return -1;
+    for (uint32_t it = 0; it < iterations; it++) {
+        for (uint32_t i = 0; i < length; i++) dst[d++] = src[s + i];
     }
+    s += length;
+}
+return d;
 }
 
-printf("\nPages with fixups: %d\n", import_count);
-printf("This is a Presentation Manager GUI application.\n");
-printf("It requires:\n");
-printf("  - PMWIN (Window Manager)\n");
-printf("  - PMSHAPI (Shell APIs)\n");
-printf("  - NLS (National Language Support)\n");
-printf("  - MSG (Message handling)\n");
-printf("\nThese are not implemented. The program will crash immediately.\n");
+static int exepack2_unpack_ref(const uint8_t *src, size_t src_len,
+                               uint8_t *dst, size_t dst_len) {
+size_t s = 0, d = 0;
+while (s < src_len) {
+    uint32_t op = src[s];
+    size_t lit = 0, len = 0, off = 0;
+    if ((op & 3) == 0 && op == 0) {
+        if (s + 2 > src_len) return -1;
+        if (src[s + 1] == 0) break;
+        if (s + 3 > src_len || d + src[s + 1] > dst_len) return -1;
+        for (uint32_t i = 0; i < src[s + 1]; i++) dst[d++] = src[s + 2];
+        s += 3;
+        continue;
+    }
+    if ((op & 3) == 0) {
+        lit = op >> 2;
+        s += 1;
+    } else if ((op & 3) == 1) {
+        if (s + 2 > src_len) return -1;
+        op |= src[s + 1] << 8;
+        lit = (op >> 2) & 3; len = ((op >> 4) & 7) + 3; off = op >> 7;
+        s += 2;
+    } else if ((op & 3) == 2) {
+        if (s + 2 > src_len) return -1;
+        op |= src[s + 1] << 8;
+        len = ((op >> 2) & 3) + 3; off = op >> 4;
+        s += 2;
+    } else {
+        if (s + 3 > src_len) return -1;
+        op |= src[s + 1] << 8 | src[s + 2] << 16;
+        lit = (op >> 2) & 0xF; len = (op >> 6) & 0x3F; off = op >> 12;
+        s += 3;
+    }
+    if (s + lit > src_len || d + lit + len > dst_len) return -1;
+    for (size_t i = 0; i < lit; i++) dst[d++] = src[s++];
+    if (len && (off == 0 || off > d)) return -1;
+    for (size_t i = 0; i < len; i++, d++) dst[d] = dst[d - off];
+}
+return d;
 }
 
-void execute_os2_program(os2_exe_t *exe) {
-if (!exe->entry_point) {
-fprintf(stderr, "No entry point\n");
-return;
+// Encoders for the synthetic corpus: runs of a repeated 1/2/4/8-byte unit
+// become EXEPACK1 records, everything else single-iteration records
+static size_t exepack1_pack(const uint8_t *src, size_t n, uint8_t *out) {
+size_t s = 0, o = 0, lit_start = 0;
+
+while (s <= n) {
+    size_t best_unit = 0, best_reps = 0;
+    for (size_t unit = 1; s < n && unit <= 8; unit *= 2) {
+        size_t reps = 1;
+        while (s + (reps + 1) * unit <= n &&
+               memcmp(src + s, src + s + reps * unit, unit) == 0 && reps < 0xFFFF) {
+            reps++;
+        }
+        if (reps >= 4 && reps * unit > best_reps * best_unit) {
+            best_unit = unit;
+            best_reps = reps;
+        }
+    }
+    if (best_reps == 0 && s < n) {
+        s++;
+        continue;
+    }
+    // Flush pending literals, then the run
+    if (s > lit_start) {
+        uint16_t hdr[2] = { 1, (uint16_t)(s - lit_start) };
+        memcpy(out + o, hdr, 4);
+        memcpy(out + o + 4, src + lit_start, s - lit_start);
+        o += 4 + (s - lit_start);
+    }
+    if (s == n) break;
+    uint16_t hdr[2] = { (uint16_t)best_reps, (uint16_t)best_unit };
+    memcpy(out + o, hdr, 4);
+    memcpy(out + o + 4, src + s, best_unit);
+    o += 4 + best_unit;
+    s += best_reps * best_unit;
+    lit_start = s;
+}
+return o;
 }
 
-printf("\n=== Executing OS/2 Program ===\n");
-printf("Entry point: %p\n\n", exe->entry_point);
+static size_t exepack2_flush(const uint8_t *lit, size_t count, uint8_t *out) {
+size_t o = 0;
+while (count > 0) {
+    size_t chunk = count > 63 ? 63 : count;
+    out[o++] = chunk << 2;
+    memcpy(out + o, lit, chunk);
+    o += chunk;
+    lit += chunk;
+    count -= chunk;
+}
+return o;
+}
 
-init_handle_table();
+// Greedy LZ77 over a 4 KB window, using every opcode form
+static size_t exepack2_pack(const uint8_t *src, size_t n, uint8_t *out) {
+size_t s = 0, o = 0, lit_start = 0;
 
-// Call the entry point
-void (*entry)() = (void(*)())exe->entry_point;
-entry();
+while (s < n) {
+    // Long single-byte runs with nothing before them use the fill opcode
+    size_t run = 1;
+    while (s + run < n && run < 255 && src[s + run] == src[s]) run++;
+    if (run >= 16) {
+        o += exepack2_flush(src + lit_start, s - lit_start, out + o);
+        out[o++] = 0;
+        out[o++] = run;
+        out[o++] = src[s];
+        s += run;
+        lit_start = s;
+        continue;
+    }
+
+    size_t best_len = 0, best_off = 0;
+    size_t window = s < 4095 ? s : 4095;
+    for (size_t off = 1; off <= window; off++) {
+        size_t len = 0;
+        while (s + len < n && len < 63 && src[s + len] == src[s + len - off]) len++;
+        if (len > best_len) {
+            best_len = len;
+            best_off = off;
+            if (len == 63) break;
+        }
+    }
+    if (best_len < 3) {
+        s++;
+        continue;
+    }
+
+    size_t pending = s - lit_start;
+    if (pending > 15) {
+        size_t keep = pending % 16;
+        o += exepack2_flush(src + lit_start, pending - keep, out + o);
+        lit_start += pending - keep;
+        pending = keep;
+    }
+
+    uint32_t op;
+    if (best_off < 512 && best_len <= 10 && pending <= 3) {
+        op = 1 | pending << 2 | (best_len - 3) << 4 | best_off << 7;
+        out[o++] = op;
+        out[o++] = op >> 8;
+    } else if (pending == 0 && best_len <= 6) {
+        op = 2 | (best_len - 3) << 2 | best_off << 4;
+        out[o++] = op;
+        out[o++] = op >> 8;
+    } else {
+        op = 3 | pending << 2 | best_len << 6 | best_off << 12;
+        out[o++] = op;
+        out[o++] = op >> 8;
+        out[o++] = op >> 16;
+    }
+    memcpy(out + o, src + lit_start, pending);
+    o += pending;
+    s += best_len;
+    lit_start = s;
+}
+o += exepack2_flush(src + lit_start, n - lit_start, out + o);
+out[o++] = 0;
+out[o++] = 0;
+return o;
 }
 
-void free_os2_exe(os2_exe_t *exe) {
-if (!exe) return;
+// Pages that look like a 32-bit image: code-like bytes with repeats,
+// zero-padded tables, text, and fill patterns
+static void make_corpus_page(uint8_t *page, uint32_t seed) {
+uint32_t x = seed * 2654435761u + 1;
+size_t p = 0;
 
-if (exe->loaded_objects) {
+while (p < LOADER_PAGE_SIZE) {
+    x = x * 1103515245 + 12345;
+    size_t len = 16 + (x >> 16) % 240;
+    if (len > LOADER_PAGE_SIZE - p) len = LOADER_PAGE_SIZE - p;
+
+    switch ((x >> 8) % 5) {
+        case 0:     // zero padding
+            memset(page + p, 0, len);
+            break;
+        case 1:     // repeated struct
+            for (size_t i = 0; i < len; i++) page[p + i] = "\x10\x00\x02\x00\xff\xff\x00\x00"[i % 8];
+            break;
+        case 2:     // text
+            for (size_t i = 0; i < len; i++) page[p + i] = "Presentation Manager window "[(i + seed) % 28];
+            break;
+        case 3:     // earlier bytes again (code idioms)
+            for (size_t i = 0; i < len; i++) {
+                page[p + i] = p > 64 ? page[p - 64 + (i % 64)] : (uint8_t)(x >> (i % 24));
+            }
+            break;
+        default:    // noise
+            for (size_t i = 0; i < len; i++) {
+                x = x * 1103515245 + 12345;
+                page[p + i] = x >> 16;
+            }
+            break;
+    }
+    p += len;
+}
+}
+
+typedef int (*unpack_fn_t)(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len);
+
+typedef struct {
+uint8_t *data;
+uint32_t size;
+} packed_page_t;
+
+// Decode every page 'rounds' times; returns output MB/s, -1 on mismatch
+static double time_unpack(unpack_fn_t fn, packed_page_t *pages, int count,
+                          const uint8_t *expect, int rounds) {
+static uint8_t out[LOADER_PAGE_SIZE];
+uint64_t start = now_ns();
+size_t produced = 0;
+
+for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < count; i++) {
+        memset(out, 0, sizeof(out));
+        int n = fn(pages[i].data, pages[i].size, out, sizeof(out));
+        if (n < 0) return -1;
+        if (r == 0 && expect && memcmp(out, expect + (size_t)i * LOADER_PAGE_SIZE,
+                                       LOADER_PAGE_SIZE) != 0) {
+            return -1;
+        }
+        produced += LOADER_PAGE_SIZE;
+    }
+}
+double secs = (now_ns() - start) / 1e9;
+return produced / secs / (1024 * 1024);
+}
+
+static void report_unpack(const char *what, unpack_fn_t ref, unpack_fn_t fast,
+                          packed_page_t *pages, int count, const uint8_t *expect) {
+size_t packed = 0;
+for (int i = 0; i < count; i++) packed += pages[i].size;
+
+int rounds = count ? 1 + 20000 / count : 0;
+double ref_rate = time_unpack(ref, pages, count, expect, rounds);
+double fast_rate = time_unpack(fast, pages, count, expect, rounds);
+
+printf("%-22s %6d %7.1f%% %10.0f %10.0f %7.2fx%s\n", what, count,
+       100.0 * packed / ((size_t)count * LOADER_PAGE_SIZE), ref_rate, fast_rate,
+       ref_rate > 0 ? fast_rate / ref_rate : 0.0,
+       ref_rate < 0 || fast_rate < 0 ? "  MISMATCH" : "");
+}
+
+// Reference vs optimised EXEPACK1/2 decoding on a synthetic corpus and on
+// the packed pages of any images given
+static int bench_unpack(int argc, char **argv) {
+const int corpus = 256;
+uint8_t *plain = malloc((size_t)corpus * LOADER_PAGE_SIZE);
+uint8_t *packed = malloc((size_t)corpus * LOADER_PAGE_SIZE * 2);
+packed_page_t pages1[256], pages2[256];
+if (!plain || !packed) return 1;
+
+size_t o = 0;
+for (int i = 0; i < corpus; i++) {
+    uint8_t *page = plain + (size_t)i * LOADER_PAGE_SIZE;
+    make_corpus_page(page, i);
+    pages1[i].data = packed + o;
+    pages1[i].size = exepack1_pack(page, LOADER_PAGE_SIZE, packed + o);
+    o += pages1[i].size;
+    pages2[i].data = packed + o;
+    pages2[i].size = exepack2_pack(page, LOADER_PAGE_SIZE, packed + o);
+    o += pages2[i].size;
+}
+
+printf("%-22s %6s %8s %10s %10s %8s\n", "pages", "count", "packed",
+       "ref MB/s", "fast MB/s", "speedup");
+report_unpack("synthetic EXEPACK1", exepack1_unpack_ref, exepack1_unpack,
+              pages1, corpus, plain);
+report_unpack("synthetic EXEPACK2", exepack2_unpack_ref, exepack2_unpack,
+              pages2, corpus, plain);
+
+for (int f = 0; f < argc; f++) {
+    quiet_stdout();
+    os2_exe_t *exe = parse_le_exe(argv[f]);
+    restore_stdout();
+    if (!exe || !is_lx(exe)) {
+        fprintf(stderr, "%s: not an LX image\n", argv[f]);
+        free_os2_exe(exe);
+        continue;
+    }
+
+    packed_page_t real[2][256];
+    int counts[2] = { 0, 0 };
+    lx_page_entry_t *pt = lx_page_table(exe);
+    for (uint32_t p = 0; p < exe->le_header->module_pages; p++) {
+        int kind = pt[p].flags == LX_PAGE_ITERATED ? 0 :
+                   pt[p].flags == LX_PAGE_COMPRESSED ? 1 : -1;
+        uint64_t off = lx_page_file_offset(exe, &pt[p]);
+        if (kind < 0 || counts[kind] >= 256 || off + pt[p].data_size > exe->file_size) continue;
+        real[kind][counts[kind]].data = exe->file_data + off;
+        real[kind][counts[kind]].size = pt[p].data_size;
+        counts[kind]++;
+    }
+
+    // The reference decoder's output is the expected result
+    for (int kind = 0; kind < 2; kind++) {
+        if (counts[kind] == 0) continue;
+        unpack_fn_t ref = kind ? exepack2_unpack_ref : exepack1_unpack_ref;
+        unpack_fn_t fast = kind ? exepack2_unpack : exepack1_unpack;
+        uint8_t *expect = calloc(counts[kind], LOADER_PAGE_SIZE);
+        for (int i = 0; i < counts[kind]; i++) {
+            ref(real[kind][i].data, real[kind][i].size,
+                expect + (size_t)i * LOADER_PAGE_SIZE, LOADER_PAGE_SIZE);
+        }
+        char what[64];
+        const char *name = strrchr(argv[f], '/');
+        snprintf(what, sizeof(what), "%.13s EXEPACK%d", name ? name + 1 : argv[f], kind + 1);
+        report_unpack(what, ref, fast, real[kind], counts[kind], expect);
+        free(expect);
+    }
+    free_os2_exe(exe);
+}
+
+free(plain);
+free(packed);
+return 0;
+}
+
+// -------- Fixups --------
+
+static uint8_t *put8(uint8_t *p, uint32_t v) { *p = v; return p + 1; }
+static uint8_t *put16(uint8_t *p, uint32_t v) { uint16_t t = v; memcpy(p, &t, 2); return p + 2; }
+static uint8_t *put32(uint8_t *p, uint32_t v) { memcpy(p, &v, 4); return p + 4; }
+
+// A small LX image with one fixup of every source type and target kind:
+// object 1 (32-bit code, 2 pages), object 2 (16-bit data, 1 page)
+static size_t build_fixup_image(uint8_t *img) {
+const uint32_t lx = 0x80;
+memset(img, 0, 0x4000);
+img[0] = 'M';
+img[1] = 'Z';
+put32(img + 0x3C, lx);
+
+le_header_t *le = (le_header_t*)(img + lx);
+le->magic = 0x584C;
+le->cpu_type = 2;
+le->target_os = 1;
+le->module_pages = 3;
+le->eip_object = 1;
+le->page_size = LOADER_PAGE_SIZE;
+le->object_table_offset = 0xC4;
+le->object_count = 2;
+le->object_page_table_offset = 0xF4;
+le->entry_table_offset = 0x10C;
+le->imported_modules_offset = 0x120;
+le->imported_modules_count = 1;
+le->imported_proc_table_offset = 0x130;
+le->fixup_page_table_offset = 0x140;
+le->fixup_record_table_offset = 0x150;
+le->data_pages_offset = 0x1000;
+
+object_entry_t *obj = (object_entry_t*)(img + lx + 0xC4);
+obj[0] = (object_entry_t){ 0x2000, 0x10000, OBJREADABLE | OBJEXECUTABLE | OBJBIGDEF, 1, 2, 0 };
+obj[1] = (object_entry_t){ 0x1000, 0x20000, OBJREADABLE | OBJWRITEABLE, 3, 1, 0 };
+
+lx_page_entry_t *pages = (lx_page_entry_t*)(img + lx + 0xF4);
+for (int i = 0; i < 3; i++) {
+    pages[i] = (lx_page_entry_t){ (uint32_t)i * LOADER_PAGE_SIZE, LOADER_PAGE_SIZE, LX_PAGE_LEGAL };
+}
+
+// Entry 1: 32-bit entry, object 1 offset 0x500
+uint8_t *p = img + lx + 0x10C;
+p = put8(p, 1); p = put8(p, 3); p = put16(p, 1); p = put8(p, 1); p = put32(p, 0x500);
+memcpy(img + lx + 0x120, "\x08" "DOSCALLS", 9);
+memcpy(img + lx + 0x130, "\x08" "DosWrite", 9);
+
+uint32_t *fpt = (uint32_t*)(img + lx + 0x140);
+uint8_t *rec = img + lx + 0x150;
+p = rec;
+
+// Module page 1 (object 1, page 1)
+p = put8(p, LX_FIX_OFF32);   p = put8(p, LX_TGT_OFF32);   p = put16(p, 0x000); p = put8(p, 2); p = put32(p, 0x10);
+p = put8(p, LX_FIX_REL32);   p = put8(p, LX_TGT_OFF32);   p = put16(p, 0x010); p = put8(p, 1); p = put32(p, 0x200);
+p = put8(p, LX_FIX_PTR1632); p = put8(p, LX_TGT_OFF32);   p = put16(p, 0x020); p = put8(p, 1); p = put32(p, 0x300);
+p = put8(p, LX_FIX_PTR1616); p = put8(p, 0);              p = put16(p, 0x030); p = put8(p, 2); p = put16(p, 0x40);
+p = put8(p, LX_FIX_SEL16);   p = put8(p, 0);              p = put16(p, 0x040); p = put8(p, 2);
+p = put8(p, LX_FIX_OFF16);   p = put8(p, 0);              p = put16(p, 0x048); p = put8(p, 2); p = put16(p, 0x234);
+p = put8(p, LX_FIX_BYTE);    p = put8(p, 0);              p = put16(p, 0x050); p = put8(p, 2); p = put16(p, 0x7);
+p = put8(p, LX_FIX_OFF32 | LX_FIX_LIST); p = put8(p, LX_TGT_ORDINAL | LX_TGT_ADDITIVE);
+p = put8(p, 2); p = put8(p, 1); p = put16(p, 283); p = put16(p, 8); p = put16(p, 0x060); p = put16(p, 0x064);
+p = put8(p, LX_FIX_OFF32);   p = put8(p, LX_TGT_NAME);    p = put16(p, 0x070); p = put8(p, 1); p = put16(p, 0);
+p = put8(p, LX_FIX_OFF32);   p = put8(p, LX_TGT_ENTRY);   p = put16(p, 0x080); p = put8(p, 1);
+p = put8(p, LX_FIX_OFF32);   p = put8(p, LX_TGT_CHAIN | LX_TGT_OFF32); p = put16(p, 0x100); p = put8(p, 2); p = put32(p, 0);
+p = put8(p, LX_FIX_OFF32);   p = put8(p, LX_TGT_OFF32);   p = put16(p, 0xFFE); p = put8(p, 2); p = put32(p, 0x20);
+fpt[1] = p - rec;
+
+// Module page 2: the tail of the fixup straddling pages 1 and 2
+p = put8(p, LX_FIX_OFF32);   p = put8(p, LX_TGT_OFF32);   p = put16(p, 0xFFFE); p = put8(p, 2); p = put32(p, 0x20);
+fpt[2] = p - rec;
+
+// Module page 3 (object 2): self-relative call to an 8-bit import ordinal
+p = put8(p, LX_FIX_REL32);   p = put8(p, LX_TGT_ORDINAL | LX_TGT_ORD8); p = put16(p, 0x010); p = put8(p, 1); p = put8(p, 5);
+fpt[3] = p - rec;
+
+// Chain threaded through page 1: 0x100 -> 0x110 -> end
+put32(img + 0x1000 + 0x100, 0x110u << 20 | 0x30);
+put32(img + 0x1000 + 0x110, 0xFFFu << 20 | 0x44);
+
+// Internal targets pre-resolved for the link-time bases, as a linker does
+uint8_t *code = img + 0x1000;
+put32(code + 0x00, 0x20010);
+put32(code + 0x10, 0x10200 - 0x10014);
+put32(code + 0x20, 0x10300);
+put16(code + 0x24, FLAT_CS_SELECTOR);
+put16(code + 0x30, 0x0040);
+put16(code + 0x32, tiled_selector(0x20040));
+put16(code + 0x40, tiled_selector(0x20000));
+put16(code + 0x48, 0x0234);
+put8(code + 0x50, 0x07);
+put32(code + 0x80, 0x10500);
+put32(code + 0xFFE, 0x20020);
+return 0x4000;
+}
+
+static void *find_import(os2_exe_t *exe, uint32_t ordinal, const char *name) {
+for (uint32_t i = 0; i < exe->import_count; i++) {
+    import_entry_t *imp = &exe->imports[i];
+    if (name ? (imp->name && strcmp(imp->name, name) == 0) : imp->ordinal == ordinal) {
+        return imp->address;
+    }
+}
+return (void*)-1;
+}
+
+static int check_value(const char *what, const uint8_t *at, uint32_t expect, int size) {
+uint32_t got = 0;
+memcpy(&got, at, size);
+if (size < 4) expect &= (1u << (size * 8)) - 1;
+if (got == expect) return 0;
+fprintf(stderr, "  %s: got 0x%x, expected 0x%x\n", what, got, expect);
+return 1;
+}
+
+// Load the synthetic image eagerly and on demand, relocated and at its
+// preferred bases, each also warm from the prelink cache after a cold
+// load stored it, and check every location
+static int fixup_self_test(void) {
+char path[] = "/tmp/os2fixXXXXXX";
+char dir[] = "/tmp/os2plcXXXXXX";
+int fd = mkstemp(path);
+if (fd < 0) return 1;
+if (!mkdtemp(dir)) {
+    close(fd);
+    unlink(path);
+    return 1;
+}
+g_prelink_dir = dir;
+
+uint8_t *img = malloc(0x4000);
+size_t size = build_fixup_image(img);
+int wrote = write(fd, img, size) == (ssize_t)size;
+close(fd);
+free(img);
+int failures = !wrote;
+for (int mode = 0; mode < 8 && wrote; mode++) {
+    int warm = mode & 4;
+    g_demand_paging = mode & 1;
+    g_force_relocation = !(mode & 2);
+    quiet_stdout();
+    os2_exe_t *exe;
+    if (warm) {
+        char cached[PATH_MAX];
+        exe = parse_le_exe(path);
+        if (exe && prelink_path(cached, sizeof(cached), exe) == 0) unlink(cached);
+        free_os2_exe(exe);
+        exe = bench_load_cached(path, 1);
+        free_os2_exe(exe);
+        exe = exe ? bench_load_cached(path, 0) : NULL;
+    } else {
+        exe = bench_load(path);
+    }
+    restore_stdout();
+    if (!exe) {
+        fprintf(stderr, "  synthetic image failed to load (mode %d)\n", mode);
+        failures++;
+        continue;
+    }
+    if ((mode & 2) && !warm && (!exe->at_preferred_base || exe->internal_skipped == 0)) {
+        fprintf(stderr, "  synthetic image was not placed at its preferred bases\n");
+        failures++;
+    }
+
+    uint8_t *code = exe->loaded_objects[0].base;
+    uint8_t *data = exe->loaded_objects[1].base;
+    uint32_t base1 = (uint32_t)(uintptr_t)code, base2 = (uint32_t)(uintptr_t)data;
+    uint32_t ord283 = (uint32_t)(uintptr_t)find_import(exe, 283, NULL);
+    uint32_t ord5 = (uint32_t)(uintptr_t)find_import(exe, 5, NULL);
+    uint32_t named = (uint32_t)(uintptr_t)find_import(exe, 0, "DosWrite");
+
+    failures += check_value("internal off32", code + 0x00, base2 + 0x10, 4);
+    failures += check_value("internal rel32", code + 0x10, base1 + 0x200 - (base1 + 0x14), 4);
+    failures += check_value("16:32 offset", code + 0x20, base1 + 0x300, 4);
+    failures += check_value("16:32 selector", code + 0x24, FLAT_CS_SELECTOR, 2);
+    failures += check_value("16:16 offset", code + 0x30, base2 + 0x40, 2);
+    failures += check_value("16:16 selector", code + 0x32, tiled_selector(base2 + 0x40), 2);
+    failures += check_value("selector", code + 0x40, tiled_selector(base2), 2);
+    failures += check_value("off16", code + 0x48, base2 + 0x234, 2);
+    failures += check_value("byte", code + 0x50, base2 + 7, 1);
+    failures += check_value("ordinal list 1", code + 0x60, ord283 + 8, 4);
+    failures += check_value("ordinal list 2", code + 0x64, ord283 + 8, 4);
+    failures += check_value("import by name", code + 0x70, named, 4);
+    failures += check_value("entry table", code + 0x80, base1 + 0x500, 4);
+    failures += check_value("chain 1", code + 0x100, base2 + 0x30, 4);
+    failures += check_value("chain 2", code + 0x110, base2 + 0x44, 4);
+    failures += check_value("page straddle", code + 0xFFE, base2 + 0x20, 4);
+    failures += check_value("ord8 rel32", data + 0x10, ord5 - (base2 + 0x14), 4);
+    free_os2_exe(exe);
+}
+
+g_demand_paging = 1;
+g_force_relocation = 0;
+g_prelink_dir = NULL;
+DIR *d = opendir(dir);
+for (struct dirent *e; d && (e = readdir(d)) != NULL; ) {
+    if (e->d_name[0] != '.') unlinkat(dirfd(d), e->d_name, 0);
+}
+if (d) closedir(d);
+rmdir(dir);
+unlink(path);
+return failures;
+}
+
+// Check the 32-bit fixups that lie wholly inside their page
+static int verify_image_fixups(os2_exe_t *exe) {
+int bad = 0;
+for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+    object_entry_t *obj = &exe->objects[i];
+    uint8_t *base = exe->loaded_objects[i].base;
+    for (uint32_t pg = 0; pg < obj->page_table_entries; pg++) {
+        uint32_t mp = obj->page_table_index - 1 + pg;
+        uint8_t *page = base + (size_t)pg * LOADER_PAGE_SIZE;
+        for (uint32_t f = exe->page_fixups[mp]; f < exe->page_fixups[mp + 1]; f++) {
+            lx_fixup_t *fx = &exe->fixups[f];
+            if (fx->src_off < 0 || fx->src_off + 4 > LOADER_PAGE_SIZE || fx->kind == FIXUP_CHAIN) continue;
+            uint32_t target = fx->kind == FIXUP_IMPORT ?
+                (uint32_t)(uintptr_t)exe->imports[fx->target].address + fx->offset :
+                (uint32_t)(uintptr_t)exe->loaded_objects[fx->target].base + fx->offset;
+            if (fx->src_type == LX_FIX_OFF32) {
+                bad += check_value("off32", page + fx->src_off, target, 4);
+            } else if (fx->src_type == LX_FIX_REL32) {
+                uint32_t from = (uint32_t)(uintptr_t)page + fx->src_off + 4;
+                bad += check_value("rel32", page + fx->src_off, target - from, 4);
+            }
+        }
+    }
+}
+return bad;
+}
+
+// Synthetic all-forms test, then decode and apply rates on real images
+static int bench_fixups(int argc, char **argv) {
+int failures = fixup_self_test();
+printf("synthetic image: %s\n\n", failures ? "FAIL" : "ok");
+
+printf("%-20s %8s %8s %14s %14s %7s\n", "image", "records", "imports",
+       "decode fix/s", "apply fix/s", "check");
+
+// Relocate so internal fixups are part of the measurement
+g_force_relocation = 1;
+for (int f = 0; f < argc; f++) {
+    g_demand_paging = 0;
+    quiet_stdout();
+    os2_exe_t *exe = bench_load(argv[f]);
+    restore_stdout();
+    if (!exe || !exe->page_fixups || exe->fixup_count == 0) {
+        fprintf(stderr, "%s: no LX fixups\n", argv[f]);
+        free_os2_exe(exe);
+        failures++;
+        continue;
+    }
+
+    // Stand-in targets below 4 GB for imports the emulator cannot resolve
+    for (uint32_t i = 0; i < exe->import_count; i++) {
+        if (!exe->imports[i].address) exe->imports[i].address = (void*)(uintptr_t)(0x7F000000 + i * 16);
+    }
     for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
-        if (exe->loaded_objects[i].base) {
-            munmap(exe->loaded_objects[i].base, exe->loaded_objects[i].size);
+        loaded_object_t *lo = &exe->loaded_objects[i];
+        mprotect(lo->base, lo->size, lo->prot | PROT_WRITE);
+    }
+
+    // Apply every page's fixups repeatedly (idempotent without chains)
+    const int rounds = 20000;
+    uint64_t applied = g_fixups_applied;
+    uint64_t start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < exe->le_header->object_count; i++) {
+            loaded_object_t *lo = &exe->loaded_objects[i];
+            for (uint32_t pg = 0; pg < lo->page_count; pg++) {
+                apply_page_fixups(exe, i, pg, (uint8_t*)lo->base + (size_t)pg * LOADER_PAGE_SIZE);
+            }
         }
     }
-    free(exe->loaded_objects);
+    double apply_rate = (g_fixups_applied - applied) / ((now_ns() - start) / 1e9);
+    int bad = verify_image_fixups(exe);
+    failures += bad;
+
+    // Re-decode from the records (decode only; imports are not resolved)
+    uint32_t records = exe->fixup_count, imports = exe->import_count;
+    start = now_ns();
+    for (int r = 0; r < rounds / 10; r++) {
+        free_fixups(exe);
+        decode_fixups(exe);
+    }
+    double decode_rate = (double)records * (rounds / 10) / ((now_ns() - start) / 1e9);
+
+    const char *name = strrchr(argv[f], '/');
+    printf("%-20s %8u %8u %14.0f %14.0f %7s\n", name ? name + 1 : argv[f],
+           records, imports, decode_rate, apply_rate, bad ? "FAIL" : "ok");
+    free_os2_exe(exe);
 }
 
-free(exe->file_data);
-free(exe);
+g_demand_paging = 1;
+g_force_relocation = 0;
+return failures != 0;
+}
+
+typedef struct {
+const char *name;
+int (*run)(int argc, char **argv);
+const char *usage;
+} bench_suite_t;
+
+static bench_suite_t bench_suites[] = {
+{ "launch", bench_launch, "launch <image.exe>..." },
+{ "pages",  bench_pages,  "pages <image.exe>..." },
+{ "unpack", bench_unpack, "unpack [image.exe]..." },
+{ "fixups", bench_fixups, "fixups [image.exe]..." },
+{ "prelink", bench_prelink, "prelink image.exe..." },
+{ "resolve", bench_resolve, "resolve [image.exe]..." },
+{ "bind", bench_bind, "bind [image.exe]..." },
+{ "handles", bench_handles, "handles" },
+{ "trace", bench_trace, "trace" },
+{ "profile", bench_profile, "profile" },
+{ "vmem", bench_vmem, "vmem" },
+{ "suballoc", bench_suballoc, "suballoc" },
+{ "threads", bench_threads, "threads" },
+{ "sems", bench_sems, "sems" },
+{ "queues", bench_queues, "queues" },
+{ "pipes", bench_pipes, "pipes [MB piped [MB copied [dir]]]" },
+{ "files", bench_files, "files [MB [dir]]" },
+{ "writes", bench_writes, "writes [lines [dir]]" },
+{ "paths", bench_paths, "paths [files [dir]]" },
+{ NULL, NULL, NULL }
+};
+
+int main(int argc, char **argv) {
+if (argc >= 2) {
+    for (int i = 0; bench_suites[i].name != NULL; i++) {
+        if (strcmp(bench_suites[i].name, argv[1]) == 0) {
+            return bench_suites[i].run(argc - 2, argv + 2);
+        }
+    }
+}
+
+fprintf(stderr, "Usage:\n");
+for (int i = 0; bench_suites[i].name != NULL; i++) {
+    fprintf(stderr, "  %s %s\n", argv[0], bench_suites[i].usage);
+}
+return 1;
 }
 
+#else
+
 // ============================================================================
 // Main
 // ============================================================================
 
 int main(int argc, char **argv) {
+if (argc == 3 && strcmp(argv[1], "--trace") == 0) {
+    return trace_decode(argv[2]) < 0;
+}
 if (argc < 2) {
 fprintf(stderr, "Usage: %s <os2_executable.exe>\n", argv[0]);
+fprintf(stderr, "       %s --trace <trace file>\n", argv[0]);
 return 1;
 }
 
 printf("OS/2 Loader with API Emulation\n");
 printf("===============================\n\n");
 
+const char *eager = getenv("OS2_EAGER_LOAD");
+if (eager && *eager && *eager != '0') g_demand_paging = 0;
+const char *bind = getenv("OS2_BIND");
+if (bind && strcmp(bind, "eager") == 0) g_eager_binding = 1;
+const char *relocate = getenv("OS2_RELOCATE");
+if (relocate && *relocate && *relocate != '0') g_force_relocation = 1;
+
+const char *prelink = getenv("OS2_PRELINK");
+if (prelink && *prelink == '0') g_prelink = 0;
+const char *profile = getenv("OS2_PROFILE");
+if (profile && *profile && *profile != '0') {
+    profile_enable(1);
+    atexit(profile_report);
+}
+trace_init(getenv("OS2_TRACE"));
+if (g_trace_mask) {
+    atexit(trace_flush);
+    install_fault_handler();    // Also saves the trace on a crash
+}
+
 os2_exe_t *exe = parse_le_exe(argv[1]);
 if (!exe) return 1;
 
-if (load_objects(exe) < 0) {
+// A prelink cache hit maps the objects already unpacked and relocated
+int warm = prelink_load(exe) == 0;
+if (!warm && load_objects(exe) < 0) {
     fprintf(stderr, "Failed to load objects\n");
     free_os2_exe(exe);
     return 1;
@@ -738,6 +6547,7 @@ process_imports(exe);
 
 // Apply fixups/relocations
 apply_fixups(exe);
+if (!warm) prelink_store(exe);
 
 printf("\n=== Ready to Execute ===\n");
 execute_os2_program(exe);
@@ -745,3 +6555,5 @@ execute_os2_program(exe);
 free_os2_exe(exe);
 return 0;
 }
+
+#endif
@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdatomic.h>
 
 /* ============================================
  * CPU Feature Detection
@@ -36,9 +37,13 @@ typedef struct cpu_features {
     bool avx;
     bool avx2;
     bool avx512f;
+    bool xsave;         /* XSAVE/XGETBV */
+    bool erms;          /* Enhanced REP MOVSB/STOSB */
+    bool fsrm;          /* Fast short REP MOVSB */
     
     /* Advanced features */
     bool x2apic;        /* Extended APIC */
+    bool tsc_deadline;  /* APIC timer TSC-deadline mode */
     bool pcid;          /* Process Context Identifiers */
     bool invpcid;       /* INVPCID instruction */
     bool smep;          /* Supervisor Mode Execution Prevention */
@@ -98,6 +103,8 @@ void hal_detect_cpu_features(cpu_features_t *features) {
     features->sse4_1 = (ecx & (1 << 19)) != 0;
     features->sse4_2 = (ecx & (1 << 20)) != 0;
     features->x2apic = (ecx & (1 << 21)) != 0;
+    features->tsc_deadline = (ecx & (1 << 24)) != 0;
+    features->xsave = (ecx & (1 << 26)) != 0;
     features->avx = (ecx & (1 << 28)) != 0;
     features->hypervisor = (ecx & (1 << 31)) != 0;
     
@@ -109,6 +116,8 @@ void hal_detect_cpu_features(cpu_features_t *features) {
         features->avx512f = (ebx & (1 << 16)) != 0;
         features->smap = (ebx & (1 << 20)) != 0;
         features->invpcid = (ebx & (1 << 10)) != 0;
+        features->erms = (ebx & (1 << 9)) != 0;
+        features->fsrm = (edx & (1 << 4)) != 0;
     }
     
     /* Extended features (leaf 0x80000001) */
@@ -197,6 +206,24 @@ void hal_detect_cpu_topology(cpu_topology_t *topo) {
 #define APIC_TIMER_INITIAL      0x380
 #define APIC_TIMER_CURRENT      0x390
 #define APIC_TIMER_DIVIDE       0x3E0
+#define APIC_LDR                0xD0
+#define APIC_DFR                0xE0
+
+/* ICR fields */
+#define ICR_DELIVERY_FIXED      (0 << 8)
+#define ICR_DELIVERY_INIT       (5 << 8)
+#define ICR_DELIVERY_STARTUP    (6 << 8)
+#define ICR_DEST_LOGICAL        (1 << 11)
+#define ICR_DELIVERY_PENDING    (1 << 12)  /* xAPIC only */
+#define ICR_LEVEL_ASSERT        (1 << 14)
+#define ICR_SHORTHAND_NONE      (0 << 18)
+#define ICR_SHORTHAND_SELF      (1 << 18)
+#define ICR_SHORTHAND_ALL       (2 << 18)  /* Including self */
+#define ICR_SHORTHAND_OTHERS    (3 << 18)  /* Excluding self */
+
+#define X2APIC_MSR_ID           0x802
+#define X2APIC_MSR_LDR          0x80D
+#define X2APIC_MSR_ICR          0x830
 
 static uint64_t apic_base_phys;
 static void *apic_base_virt;
@@ -255,7 +282,7 @@ void hal_apic_init(cpu_features_t *features) {
 
 uint32_t hal_apic_get_id(void) {
     if (x2apic_mode) {
-        return rdmsr(0x802);  /* x2APIC ID MSR */
+        return rdmsr(X2APIC_MSR_ID);
     } else {
         return apic_read(APIC_ID) >> 24;
     }
@@ -265,12 +292,327 @@ void hal_apic_send_eoi(void) {
     apic_write(APIC_EOI, 0);
 }
 
-void hal_apic_send_ipi(uint32_t dest_apic_id, uint32_t vector) {
+/* Spin until the previous xAPIC ICR write has been accepted.
+ * x2APIC ICR writes are serialised by the MSR itself and have no
+ * delivery-status bit. */
+static inline void apic_wait_icr_idle(void) {
+    if (x2apic_mode) return;
+    while (apic_read(APIC_ICR_LOW) & ICR_DELIVERY_PENDING) {
+        __asm__ volatile("pause" ::: "memory");
+    }
+}
+
+/* Raw ICR write: 'low' carries vector, delivery mode, destination
+ * mode and shorthand; 'dest' is a physical APIC ID or a logical
+ * destination depending on ICR_DEST_LOGICAL. */
+static void apic_write_icr(uint32_t dest, uint32_t low) {
     if (x2apic_mode) {
-        wrmsr(0x830, ((uint64_t)dest_apic_id << 32) | vector);
+        wrmsr(X2APIC_MSR_ICR, ((uint64_t)dest << 32) | low);
     } else {
-        apic_write(APIC_ICR_HIGH, dest_apic_id << 24);
-        apic_write(APIC_ICR_LOW, vector);
+        apic_wait_icr_idle();
+        apic_write(APIC_ICR_HIGH, dest << 24);
+        apic_write(APIC_ICR_LOW, low);
+        apic_wait_icr_idle();
+    }
+}
+
+void hal_apic_send_ipi(uint32_t dest_apic_id, uint32_t vector) {
+    apic_write_icr(dest_apic_id, vector);
+}
+
+/* ============================================
+ * IPI Layer (shorthands, multicast, coalescing)
+ * ============================================ */
+
+#define HAL_MAX_CPUS            256
+#define IPI_VECTOR              0xF0     /* Coalesced message IPI */
+#define IPI_CALL_QUEUE_SIZE     16       /* Per-CPU function-call slots */
+
+typedef struct cpumask {
+    uint64_t bits[HAL_MAX_CPUS / 64];
+} cpumask_t;
+
+static inline void cpumask_clear(cpumask_t *mask) {
+    for (int i = 0; i < HAL_MAX_CPUS / 64; i++) mask->bits[i] = 0;
+}
+
+static inline void cpumask_set(cpumask_t *mask, uint32_t cpu) {
+    mask->bits[cpu / 64] |= 1ULL << (cpu % 64);
+}
+
+static inline bool cpumask_test(const cpumask_t *mask, uint32_t cpu) {
+    return (mask->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+static inline uint32_t cpumask_weight(const cpumask_t *mask) {
+    uint32_t n = 0;
+    for (int i = 0; i < HAL_MAX_CPUS / 64; i++) {
+        /* No libgcc in the kernel link, so no __builtin_popcountll */
+        for (uint64_t w = mask->bits[i]; w; w &= w - 1) n++;
+    }
+    return n;
+}
+
+/* Message types; each is one bit in the per-CPU pending word so that
+ * repeated requests of the same type collapse into a single IPI. */
+typedef enum {
+    IPI_MSG_RESCHEDULE = 0,
+    IPI_MSG_TLB_SHOOTDOWN,
+    IPI_MSG_CALL_FUNCTION,
+    IPI_MSG_TIMER,
+    IPI_MSG_STOP,
+    IPI_MSG_COUNT
+} ipi_msg_t;
+
+typedef void (*ipi_handler_t)(uint32_t cpu);
+typedef void (*ipi_call_fn_t)(void *arg);
+
+typedef struct ipi_call {
+    ipi_call_fn_t fn;
+    void *arg;
+} ipi_call_t;
+
+typedef struct ipi_cpu {
+    atomic_uint_fast32_t pending;        /* Bitmask of ipi_msg_t */
+    atomic_bool call_lock;
+    uint32_t call_head;
+    uint32_t call_tail;
+    ipi_call_t calls[IPI_CALL_QUEUE_SIZE];
+
+    /* Statistics */
+    atomic_uint_fast64_t sent;           /* Interrupts actually raised */
+    atomic_uint_fast64_t coalesced;      /* Requests folded into a pending IPI */
+    atomic_uint_fast64_t received;
+} __attribute__((aligned(64))) ipi_cpu_t;
+
+static struct {
+    uint32_t num_cpus;
+    uint32_t apic_id[HAL_MAX_CPUS];      /* CPU index -> APIC ID */
+    uint32_t logical_id[HAL_MAX_CPUS];   /* CPU index -> logical destination */
+    bool logical_ok;                     /* Logical addressing usable */
+    atomic_uint_fast32_t ldr_ready;      /* xAPIC: CPUs 0-7 whose LDR is programmed */
+    ipi_handler_t handlers[IPI_MSG_COUNT];
+    ipi_cpu_t cpu[HAL_MAX_CPUS];
+} g_ipi;
+
+/* Map the running CPU's APIC ID back to a CPU index */
+uint32_t hal_cpu_index(void) {
+    uint32_t apic_id = hal_apic_get_id();
+    for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+        if (g_ipi.apic_id[i] == apic_id) return i;
+    }
+    return 0;
+}
+
+/* Set up logical addressing for every CPU in the topology.
+ *
+ * x2APIC: the LDR is read-only and fixed to cluster mode, with the
+ *   cluster in bits 31:16 and a one-hot member bit in 15:0, derived
+ *   from the x2APIC ID, so it can be computed for remote CPUs.
+ * xAPIC: flat model, one bit per CPU in LDR[31:24]; only the first
+ *   eight CPUs get a logical ID, the rest are reached by unicast. The
+ *   LDR is written by each CPU itself in hal_ipi_init_local() (APs
+ *   from hal_ap_start()), and a CPU is only addressed logically once
+ *   it has done so. */
+void hal_ipi_init(const cpu_topology_t *topo) {
+    g_ipi.num_cpus = topo->num_threads;
+    atomic_store(&g_ipi.ldr_ready, 0);
+    if (g_ipi.num_cpus > HAL_MAX_CPUS) g_ipi.num_cpus = HAL_MAX_CPUS;
+
+    for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+        uint32_t id = topo->cpus[i].apic_id;
+        g_ipi.apic_id[i] = id;
+
+        if (x2apic_mode) {
+            g_ipi.logical_id[i] = ((id >> 4) << 16) | (1U << (id & 0xF));
+        } else {
+            g_ipi.logical_id[i] = (i < 8) ? (1U << i) : 0;
+        }
+    }
+    g_ipi.logical_ok = true;
+}
+
+/* Per-CPU part of init, run by the BSP and by every AP as it starts:
+ * program this CPU's xAPIC logical ID, or take its x2APIC one from
+ * the read-only LDR. */
+void hal_ipi_init_local(void) {
+    uint32_t cpu = hal_cpu_index();
+    if (x2apic_mode) {
+        g_ipi.logical_id[cpu] = (uint32_t)rdmsr(X2APIC_MSR_LDR);
+        return;
+    }
+    if (!g_ipi.logical_id[cpu]) return;
+
+    apic_write(APIC_DFR, 0xFFFFFFFF);                   /* Flat model */
+    apic_write(APIC_LDR, g_ipi.logical_id[cpu] << 24);
+    atomic_fetch_or(&g_ipi.ldr_ready, 1U << cpu);
+}
+
+void hal_ipi_register_handler(ipi_msg_t msg, ipi_handler_t handler) {
+    if (msg < IPI_MSG_COUNT) g_ipi.handlers[msg] = handler;
+}
+
+/* Raise IPI_VECTOR on every CPU in 'targets' with as few ICR writes
+ * as the addressing mode allows. */
+static void ipi_raise(const cpumask_t *targets) {
+    uint32_t self = hal_cpu_index();
+    uint32_t weight = cpumask_weight(targets);
+    if (weight == 0) return;
+
+    /* Whole machine: one shorthand write */
+    if (weight == g_ipi.num_cpus) {
+        apic_write_icr(0, ICR_SHORTHAND_ALL | ICR_DELIVERY_FIXED | IPI_VECTOR);
+        return;
+    }
+    if (weight == g_ipi.num_cpus - 1 && !cpumask_test(targets, self)) {
+        apic_write_icr(0, ICR_SHORTHAND_OTHERS | ICR_DELIVERY_FIXED | IPI_VECTOR);
+        return;
+    }
+    if (weight == 1 && cpumask_test(targets, self)) {
+        apic_write_icr(0, ICR_SHORTHAND_SELF | ICR_DELIVERY_FIXED | IPI_VECTOR);
+        return;
+    }
+
+    if (x2apic_mode && g_ipi.logical_ok) {
+        /* Cluster mode: merge members of the same cluster into one write.
+         * Clusters are visited in CPU order; 'done' tracks CPUs already
+         * covered by an earlier cluster write. */
+        cpumask_t done;
+        cpumask_clear(&done);
+
+        for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+            if (!cpumask_test(targets, i) || cpumask_test(&done, i)) continue;
+
+            uint32_t cluster = g_ipi.logical_id[i] >> 16;
+            uint32_t members = 0;
+            for (uint32_t j = i; j < g_ipi.num_cpus; j++) {
+                if (cpumask_test(targets, j) &&
+                    (g_ipi.logical_id[j] >> 16) == cluster) {
+                    members |= g_ipi.logical_id[j] & 0xFFFF;
+                    cpumask_set(&done, j);
+                }
+            }
+            apic_write_icr((cluster << 16) | members,
+                           ICR_DEST_LOGICAL | ICR_DELIVERY_FIXED | IPI_VECTOR);
+        }
+        return;
+    }
+
+    /* xAPIC flat logical: CPUs 0-7 that have programmed their LDR in
+     * one write, the rest unicast */
+    uint32_t ready = atomic_load(&g_ipi.ldr_ready);
+    uint32_t flat = 0;
+    for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+        if (!cpumask_test(targets, i)) continue;
+
+        if (g_ipi.logical_ok && i < 8 && (ready & (1U << i))) {
+            flat |= g_ipi.logical_id[i];
+        } else {
+            apic_write_icr(g_ipi.apic_id[i], ICR_DELIVERY_FIXED | IPI_VECTOR);
+        }
+    }
+    if (flat) {
+        apic_write_icr(flat, ICR_DEST_LOGICAL | ICR_DELIVERY_FIXED | IPI_VECTOR);
+    }
+}
+
+/* Post 'msg' to every CPU in 'targets'. A CPU that already has any
+ * message pending is not interrupted again; its handler will observe
+ * the new bit when it drains the pending word. */
+void hal_ipi_send_mask(const cpumask_t *targets, ipi_msg_t msg) {
+    cpumask_t raise;
+    cpumask_clear(&raise);
+
+    for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+        if (!cpumask_test(targets, i)) continue;
+
+        ipi_cpu_t *c = &g_ipi.cpu[i];
+        uint32_t old = atomic_fetch_or(&c->pending, 1U << msg);
+        if (old == 0) {
+            cpumask_set(&raise, i);
+            atomic_fetch_add(&c->sent, 1);
+        } else {
+            atomic_fetch_add(&c->coalesced, 1);
+        }
+    }
+
+    ipi_raise(&raise);
+}
+
+void hal_ipi_send(uint32_t cpu, ipi_msg_t msg) {
+    cpumask_t mask;
+    cpumask_clear(&mask);
+    cpumask_set(&mask, cpu);
+    hal_ipi_send_mask(&mask, msg);
+}
+
+static void ipi_call_lock(ipi_cpu_t *c) {
+    bool expected = false;
+    while (!atomic_compare_exchange_weak(&c->call_lock, &expected, true)) {
+        expected = false;
+        __asm__ volatile("pause" ::: "memory");
+    }
+}
+
+static void ipi_call_unlock(ipi_cpu_t *c) {
+    atomic_store(&c->call_lock, false);
+}
+
+/* Queue fn(arg) to run on each CPU in 'targets'. Returns false if any
+ * target's call queue was full (that CPU is skipped). */
+bool hal_ipi_call_mask(const cpumask_t *targets, ipi_call_fn_t fn, void *arg) {
+    bool ok = true;
+
+    for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+        if (!cpumask_test(targets, i)) continue;
+
+        ipi_cpu_t *c = &g_ipi.cpu[i];
+        ipi_call_lock(c);
+        if (c->call_head - c->call_tail < IPI_CALL_QUEUE_SIZE) {
+            ipi_call_t *slot = &c->calls[c->call_head % IPI_CALL_QUEUE_SIZE];
+            slot->fn = fn;
+            slot->arg = arg;
+            c->call_head++;
+        } else {
+            ok = false;
+        }
+        ipi_call_unlock(c);
+    }
+
+    hal_ipi_send_mask(targets, IPI_MSG_CALL_FUNCTION);
+    return ok;
+}
+
+/* IPI_VECTOR interrupt handler */
+void hal_ipi_interrupt(void) {
+    uint32_t cpu = hal_cpu_index();
+    ipi_cpu_t *c = &g_ipi.cpu[cpu];
+
+    /* EOI first so a message posted while we run raises a new IPI */
+    hal_apic_send_eoi();
+    atomic_fetch_add(&c->received, 1);
+
+    uint32_t pending = atomic_exchange(&c->pending, 0);
+
+    if (pending & (1U << IPI_MSG_CALL_FUNCTION)) {
+        for (;;) {
+            ipi_call_lock(c);
+            if (c->call_tail == c->call_head) {
+                ipi_call_unlock(c);
+                break;
+            }
+            ipi_call_t call = c->calls[c->call_tail % IPI_CALL_QUEUE_SIZE];
+            c->call_tail++;
+            ipi_call_unlock(c);
+
+            call.fn(call.arg);
+        }
+    }
+
+    for (uint32_t msg = 0; msg < IPI_MSG_COUNT; msg++) {
+        if ((pending & (1U << msg)) && g_ipi.handlers[msg]) {
+            g_ipi.handlers[msg](cpu);
+        }
     }
 }
 
@@ -337,12 +679,200 @@ typedef struct acpi_srat_lapic {
     uint32_t clock_domain;
 } __attribute__((packed)) acpi_srat_lapic_t;
 
+typedef struct acpi_madt_x2apic {
+    uint8_t type;           /* 9 = Local x2APIC */
+    uint8_t length;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t processor_uid;
+} __attribute__((packed)) acpi_madt_x2apic_t;
+
+typedef struct acpi_srat_mem {
+    uint8_t type;           /* 1 = Memory affinity */
+    uint8_t length;
+    uint32_t proximity_domain;
+    uint16_t reserved1;
+    uint64_t base_address;
+    uint64_t length_bytes;
+    uint32_t reserved2;
+    uint32_t flags;         /* Bit 0 enabled, bit 1 hot-pluggable */
+    uint64_t reserved3;
+} __attribute__((packed)) acpi_srat_mem_t;
+
+typedef struct acpi_srat_x2apic {
+    uint8_t type;           /* 2 = x2APIC affinity */
+    uint8_t length;
+    uint16_t reserved1;
+    uint32_t proximity_domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed)) acpi_srat_x2apic_t;
+
+typedef struct acpi_slit {
+    acpi_header_t header;
+    uint64_t localities;
+    uint8_t matrix[];       /* localities x localities, row-major */
+} __attribute__((packed)) acpi_slit_t;
+
+typedef struct acpi_sdt {
+    acpi_header_t header;
+    uint8_t entries[];      /* uint32_t (RSDT) or uint64_t (XSDT) */
+} __attribute__((packed)) acpi_sdt_t;
+
+/* Signature -> table index, built once by hal_acpi_init().
+ * Open addressing; a system has a few dozen tables at most. When a
+ * signature repeats (SSDT), the first table wins. */
+#define ACPI_INDEX_BITS     6
+#define ACPI_INDEX_SIZE     (1U << ACPI_INDEX_BITS)
+
+typedef struct acpi_index_entry {
+    uint32_t signature;     /* 0 = empty slot */
+    acpi_header_t *table;
+} acpi_index_entry_t;
+
+static acpi_index_entry_t acpi_index[ACPI_INDEX_SIZE];
+static uint32_t acpi_table_count = 0;
+static uint64_t acpi_boot_rsdp = 0;     /* From multiboot2/UEFI, if any */
+static uintptr_t acpi_phys_offset = 0;  /* Kernel direct-map base */
+
+static inline void *acpi_phys_to_virt(uint64_t phys) {
+    return (void *)(uintptr_t)(phys + acpi_phys_offset);
+}
+
+static inline uint32_t acpi_sig32(const char *sig) {
+    return (uint32_t)(uint8_t)sig[0] | ((uint32_t)(uint8_t)sig[1] << 8) |
+           ((uint32_t)(uint8_t)sig[2] << 16) | ((uint32_t)(uint8_t)sig[3] << 24);
+}
+
+static inline uint32_t acpi_index_slot(uint32_t sig) {
+    return (sig * 0x9E3779B1U) >> (32 - ACPI_INDEX_BITS);
+}
+
+static bool acpi_checksum_ok(const void *data, size_t length) {
+    const uint8_t *p = data;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) sum += p[i];
+    return sum == 0;
+}
+
+/* Add a table to the index after validating its checksum */
+bool hal_acpi_register_table(acpi_header_t *table) {
+    if (!table || table->length < sizeof(acpi_header_t)) return false;
+    if (!acpi_checksum_ok(table, table->length)) return false;
+
+    uint32_t sig = acpi_sig32(table->signature);
+    uint32_t slot = acpi_index_slot(sig);
+
+    for (uint32_t probe = 0; probe < ACPI_INDEX_SIZE; probe++) {
+        acpi_index_entry_t *e = &acpi_index[(slot + probe) & (ACPI_INDEX_SIZE - 1)];
+        if (e->signature == sig) return true;   /* Keep the first one */
+        if (e->signature == 0) {
+            e->signature = sig;
+            e->table = table;
+            acpi_table_count++;
+            return true;
+        }
+    }
+    return false;   /* Index full */
+}
+
+static acpi_rsdp_t *acpi_check_rsdp(void *p) {
+    acpi_rsdp_t *rsdp = p;
+    if (rsdp->signature[0] != 'R' || rsdp->signature[1] != 'S' ||
+        rsdp->signature[2] != 'D' || rsdp->signature[3] != ' ' ||
+        rsdp->signature[4] != 'P' || rsdp->signature[5] != 'T' ||
+        rsdp->signature[6] != 'R' || rsdp->signature[7] != ' ') {
+        return NULL;
+    }
+
+    /* ACPI 1.0 checksum covers the first 20 bytes */
+    if (!acpi_checksum_ok(rsdp, 20)) return NULL;
+    if (rsdp->revision >= 2 && !acpi_checksum_ok(rsdp, rsdp->length)) return NULL;
+    return rsdp;
+}
+
+static acpi_rsdp_t *acpi_scan_rsdp(uint64_t phys, size_t length) {
+    uint8_t *base = acpi_phys_to_virt(phys);
+    for (size_t off = 0; off + sizeof(acpi_rsdp_t) <= length; off += 16) {
+        acpi_rsdp_t *rsdp = acpi_check_rsdp(base + off);
+        if (rsdp) return rsdp;
+    }
+    return NULL;
+}
+
+/* Legacy BIOS search: first 1 KB of the EBDA, then 0xE0000-0xFFFFF */
+static acpi_rsdp_t *acpi_find_rsdp(void) {
+    if (acpi_boot_rsdp) {
+        return acpi_check_rsdp(acpi_phys_to_virt(acpi_boot_rsdp));
+    }
+
+    uint16_t ebda_seg = *(volatile uint16_t *)acpi_phys_to_virt(0x40E);
+    uint64_t ebda = (uint64_t)ebda_seg << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        acpi_rsdp_t *rsdp = acpi_scan_rsdp(ebda, 1024);
+        if (rsdp) return rsdp;
+    }
+
+    return acpi_scan_rsdp(0xE0000, 0x20000);
+}
+
+/* Multiboot2 (tag 14/15) or UEFI configuration table RSDP */
+void hal_acpi_set_rsdp(uint64_t rsdp_phys) {
+    acpi_boot_rsdp = rsdp_phys;
+}
+
 void *hal_acpi_find_table(const char *signature) {
-    /* This would search for ACPI tables in memory */
-    /* Implementation depends on UEFI providing tables */
-    return NULL;  /* Placeholder */
+    uint32_t sig = acpi_sig32(signature);
+    uint32_t slot = acpi_index_slot(sig);
+
+    for (uint32_t probe = 0; probe < ACPI_INDEX_SIZE; probe++) {
+        acpi_index_entry_t *e = &acpi_index[(slot + probe) & (ACPI_INDEX_SIZE - 1)];
+        if (e->signature == sig) return e->table;
+        if (e->signature == 0) return NULL;
+    }
+    return NULL;
+}
+
+/* Locate the RSDP, walk the XSDT (or RSDT on ACPI 1.0) and index
+ * every valid table. Returns the number of tables indexed. */
+uint32_t hal_acpi_init(uintptr_t phys_offset) {
+    acpi_phys_offset = phys_offset;
+
+    acpi_rsdp_t *rsdp = acpi_find_rsdp();
+    if (!rsdp) return 0;
+
+    bool xsdt = rsdp->revision >= 2 && rsdp->xsdt_address != 0;
+    acpi_sdt_t *sdt = xsdt ? acpi_phys_to_virt(rsdp->xsdt_address)
+                           : acpi_phys_to_virt(rsdp->rsdt_address);
+    if (!acpi_checksum_ok(sdt, sdt->header.length)) return 0;
+
+    size_t entry_size = xsdt ? 8 : 4;
+    size_t count = (sdt->header.length - sizeof(acpi_header_t)) / entry_size;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t phys;
+        if (xsdt) {
+            phys = ((uint64_t *)sdt->entries)[i];  /* Packed: unaligned read */
+        } else {
+            phys = ((uint32_t *)sdt->entries)[i];
+        }
+        hal_acpi_register_table(acpi_phys_to_virt(phys));
+    }
+
+    /* The DSDT is only reachable through the FADT */
+    acpi_header_t *fadt = hal_acpi_find_table("FACP");
+    if (fadt && fadt->length >= 44) {
+        uint32_t dsdt = *(uint32_t *)((uint8_t *)fadt + 40);
+        if (dsdt) hal_acpi_register_table(acpi_phys_to_virt(dsdt));
+    }
+
+    return acpi_table_count;
 }
 
+
 void hal_parse_madt(cpu_topology_t *topo) {
     acpi_madt_t *madt = hal_acpi_find_table("APIC");
     if (!madt) return;
@@ -355,14 +885,22 @@ void hal_parse_madt(cpu_topology_t *topo) {
     while (ptr < end) {
         uint8_t type = ptr[0];
         uint8_t length = ptr[1];
+        if (length < 2) break;  /* Malformed entry */
         
-        if (type == 0) {  /* Local APIC */
+        if (type == 0 && cpu_count < HAL_MAX_CPUS) {  /* Local APIC */
             acpi_madt_lapic_t *lapic = (acpi_madt_lapic_t *)ptr;
             
             if (lapic->flags & 1) {  /* Enabled */
                 topo->cpus[cpu_count].apic_id = lapic->apic_id;
                 cpu_count++;
             }
+        } else if (type == 9 && cpu_count < HAL_MAX_CPUS) {  /* Local x2APIC */
+            acpi_madt_x2apic_t *x2apic = (acpi_madt_x2apic_t *)ptr;
+            
+            if (x2apic->flags & 1) {
+                topo->cpus[cpu_count].apic_id = x2apic->x2apic_id;
+                cpu_count++;
+            }
         }
         
         ptr += length;
@@ -371,6 +909,90 @@ void hal_parse_madt(cpu_topology_t *topo) {
     topo->num_threads = cpu_count;
 }
 
+/* ============================================
+ * NUMA Topology (SRAT / SLIT)
+ * ============================================ */
+
+#define NUMA_MAX_NODES          64
+#define NUMA_MAX_MEM_RANGES     128
+#define NUMA_LOCAL_DISTANCE     10
+#define NUMA_REMOTE_DISTANCE    20      /* Default when there is no SLIT */
+#define SLIT_MAX_LOCALITIES     256     /* Larger SLITs are taken as corrupt */
+
+typedef struct numa_mem_range {
+    uint64_t base;
+    uint64_t length;
+    uint32_t node;
+    bool hotplug;
+} numa_mem_range_t;
+
+/* Nodes are dense indices 0..num_nodes-1; 'domain' keeps the sparse
+ * ACPI proximity domain each one was created from. */
+typedef struct numa_topology {
+    uint32_t num_nodes;
+    uint32_t domain[NUMA_MAX_NODES];
+    uint64_t node_memory[NUMA_MAX_NODES];        /* Bytes per node */
+    cpumask_t node_cpus[NUMA_MAX_NODES];
+
+    uint32_t num_ranges;
+    numa_mem_range_t ranges[NUMA_MAX_MEM_RANGES]; /* Sorted by base */
+
+    uint8_t distance[NUMA_MAX_NODES][NUMA_MAX_NODES];
+    uint8_t fallback[NUMA_MAX_NODES][NUMA_MAX_NODES]; /* Nearest first */
+
+    uint32_t cpu_node[HAL_MAX_CPUS];             /* CPU index -> node */
+} numa_topology_t;
+
+static numa_topology_t g_numa;
+
+/* Dense node for a proximity domain, creating it on first sight */
+static uint32_t numa_node_for_domain(uint32_t domain) {
+    for (uint32_t n = 0; n < g_numa.num_nodes; n++) {
+        if (g_numa.domain[n] == domain) return n;
+    }
+    if (g_numa.num_nodes == NUMA_MAX_NODES) return 0;
+
+    g_numa.domain[g_numa.num_nodes] = domain;
+    return g_numa.num_nodes++;
+}
+
+static bool numa_lookup_domain(uint32_t domain, uint32_t *node) {
+    for (uint32_t n = 0; n < g_numa.num_nodes; n++) {
+        if (g_numa.domain[n] == domain) {
+            *node = n;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void numa_assign_cpu(cpu_topology_t *topo, uint32_t apic_id, uint32_t node) {
+    for (uint32_t i = 0; i < topo->num_threads && i < HAL_MAX_CPUS; i++) {
+        if (topo->cpus[i].apic_id == apic_id) {
+            topo->cpus[i].numa_node = node;
+            g_numa.cpu_node[i] = node;
+            cpumask_set(&g_numa.node_cpus[node], i);
+            return;
+        }
+    }
+}
+
+static void numa_add_range(uint64_t base, uint64_t length, uint32_t node, bool hotplug) {
+    if (length == 0 || g_numa.num_ranges == NUMA_MAX_MEM_RANGES) return;
+
+    /* Insertion keeps the array sorted for hal_numa_node_of_addr() */
+    uint32_t i = g_numa.num_ranges++;
+    while (i > 0 && g_numa.ranges[i - 1].base > base) {
+        g_numa.ranges[i] = g_numa.ranges[i - 1];
+        i--;
+    }
+    g_numa.ranges[i].base = base;
+    g_numa.ranges[i].length = length;
+    g_numa.ranges[i].node = node;
+    g_numa.ranges[i].hotplug = hotplug;
+    g_numa.node_memory[node] += length;
+}
+
 void hal_parse_srat(cpu_topology_t *topo) {
     acpi_srat_t *srat = hal_acpi_find_table("SRAT");
     if (!srat) return;
@@ -381,6 +1003,7 @@ void hal_parse_srat(cpu_topology_t *topo) {
     while (ptr < end) {
         uint8_t type = ptr[0];
         uint8_t length = ptr[1];
+        if (length < 2) break;  /* Malformed entry */
         
         if (type == 0) {  /* Local APIC affinity */
             acpi_srat_lapic_t *affinity = (acpi_srat_lapic_t *)ptr;
@@ -390,12 +1013,23 @@ void hal_parse_srat(cpu_topology_t *topo) {
                              (affinity->proximity_domain_high[1] << 16) |
                              (affinity->proximity_domain_high[2] << 24);
             
-            /* Find CPU with this APIC ID and set NUMA node */
-            for (uint32_t i = 0; i < topo->num_threads; i++) {
-                if (topo->cpus[i].apic_id == affinity->apic_id) {
-                    topo->cpus[i].numa_node = domain;
-                    break;
-                }
+            if (affinity->flags & 1) {
+                numa_assign_cpu(topo, affinity->apic_id, numa_node_for_domain(domain));
+            }
+        } else if (type == 1) {  /* Memory affinity */
+            acpi_srat_mem_t *mem = (acpi_srat_mem_t *)ptr;
+            
+            if (mem->flags & 1) {
+                numa_add_range(mem->base_address, mem->length_bytes,
+                               numa_node_for_domain(mem->proximity_domain),
+                               (mem->flags & 2) != 0);
+            }
+        } else if (type == 2) {  /* x2APIC affinity */
+            acpi_srat_x2apic_t *affinity = (acpi_srat_x2apic_t *)ptr;
+            
+            if (affinity->flags & 1) {
+                numa_assign_cpu(topo, affinity->x2apic_id,
+                                numa_node_for_domain(affinity->proximity_domain));
             }
         }
         
@@ -403,33 +1037,158 @@ void hal_parse_srat(cpu_topology_t *topo) {
     }
 }
 
+/* Fill the node distance matrix from the SLIT, or with the ACPI
+ * defaults when the firmware provides none, then derive each node's
+ * allocation fallback order. Must run after hal_parse_srat(). */
+void hal_parse_slit(void) {
+    if (g_numa.num_nodes == 0) g_numa.num_nodes = 1;
+
+    for (uint32_t a = 0; a < g_numa.num_nodes; a++) {
+        for (uint32_t b = 0; b < g_numa.num_nodes; b++) {
+            g_numa.distance[a][b] = (a == b) ? NUMA_LOCAL_DISTANCE
+                                             : NUMA_REMOTE_DISTANCE;
+        }
+    }
+
+    /* Bound n before squaring it: a 64-bit count would wrap n * n */
+    acpi_slit_t *slit = hal_acpi_find_table("SLIT");
+    if (slit && slit->header.length >= sizeof(acpi_slit_t)) {
+        uint64_t n = slit->localities;
+        if (n <= SLIT_MAX_LOCALITIES && n * n <= slit->header.length - sizeof(acpi_slit_t)) {
+            /* SLIT rows/columns are indexed by proximity domain */
+            for (uint64_t i = 0; i < n; i++) {
+                uint32_t a;
+                if (!numa_lookup_domain((uint32_t)i, &a)) continue;
+                for (uint64_t j = 0; j < n; j++) {
+                    uint32_t b;
+                    if (!numa_lookup_domain((uint32_t)j, &b)) continue;
+                    g_numa.distance[a][b] = slit->matrix[i * n + j];
+                }
+            }
+        }
+    }
+
+    for (uint32_t a = 0; a < g_numa.num_nodes; a++) {
+        uint8_t *order = g_numa.fallback[a];
+        for (uint32_t b = 0; b < g_numa.num_nodes; b++) {
+            uint32_t k = b;
+            while (k > 0 && g_numa.distance[a][order[k - 1]] > g_numa.distance[a][b]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = (uint8_t)b;
+        }
+    }
+}
+
+const numa_topology_t *hal_numa_get(void) {
+    return &g_numa;
+}
+
+uint32_t hal_numa_distance(uint32_t a, uint32_t b) {
+    if (a >= g_numa.num_nodes || b >= g_numa.num_nodes) {
+        return (a == b) ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+    }
+    return g_numa.distance[a][b];
+}
+
+uint32_t hal_numa_node_of_cpu(uint32_t cpu) {
+    return (cpu < HAL_MAX_CPUS) ? g_numa.cpu_node[cpu] : 0;
+}
+
+/* Per-CPU node array in the form sched_init() takes */
+const uint32_t *hal_numa_cpu_nodes(void) {
+    return g_numa.cpu_node;
+}
+
+/* Node owning a physical address; addresses outside every SRAT range
+ * (or systems without an SRAT) belong to node 0. */
+uint32_t hal_numa_node_of_addr(uint64_t phys) {
+    uint32_t lo = 0, hi = g_numa.num_ranges;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        const numa_mem_range_t *r = &g_numa.ranges[mid];
+        if (phys < r->base) {
+            hi = mid;
+        } else if (phys - r->base >= r->length) {
+            lo = mid + 1;
+        } else {
+            return r->node;
+        }
+    }
+    return 0;
+}
+
+/* Nodes ordered by distance from 'node', nearest (itself) first. The
+ * physical page allocator walks this list when the local node is out
+ * of pages. Returns the list length. */
+uint32_t hal_numa_fallback_order(uint32_t node, const uint8_t **order) {
+    if (node >= g_numa.num_nodes) node = 0;
+    *order = g_numa.fallback[node];
+    return g_numa.num_nodes;
+}
+
 /* ============================================
  * Time Stamp Counter (TSC)
  * ============================================ */
 
 static uint64_t tsc_frequency = 0;  /* Hz */
 
+/* Fixed-point TSC <-> ns conversion, set by hal_calibrate_tsc().
+ * A plain (tsc * 1e9) / freq overflows after a few seconds of uptime. */
+#define TSC_NS_SHIFT    32
+#define NS_TSC_SHIFT    24
+static uint64_t tsc_to_ns_mult;
+static uint64_t ns_to_tsc_mult;
+
 static inline uint64_t rdtsc(void) {
     uint32_t low, high;
     __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
     return ((uint64_t)high << 32) | low;
 }
 
+static inline uint64_t mul_shift(uint64_t a, uint64_t mult, uint32_t shift) {
+    return (uint64_t)(((unsigned __int128)a * mult) >> shift);
+}
+
+uint64_t hal_tsc_to_ns(uint64_t tsc) {
+    return mul_shift(tsc, tsc_to_ns_mult, TSC_NS_SHIFT);
+}
+
+uint64_t hal_ns_to_tsc(uint64_t ns) {
+    return mul_shift(ns, ns_to_tsc_mult, NS_TSC_SHIFT);
+}
+
 void hal_calibrate_tsc(void) {
     /* Calibrate TSC against a known timer source (HPET or PIT) */
     /* This is simplified - real implementation would use HPET */
     
     /* For now, try to get from CPUID if available */
     uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+    
+    uint32_t base_mhz = 0;
+    if (max_leaf >= 0x16) {
+        cpuid(0x16, 0, &eax, &ebx, &ecx, &edx);
+        base_mhz = eax;
+    }
+    
     cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
     
-    if (eax && ebx && ecx) {
+    if (max_leaf >= 0x15 && eax && ebx && ecx) {
         /* TSC frequency = ECX * EBX / EAX */
         tsc_frequency = ((uint64_t)ecx * ebx) / eax;
+    } else if (base_mhz) {
+        /* Processor base frequency tracks the TSC rate */
+        tsc_frequency = (uint64_t)base_mhz * 1000000ULL;
     } else {
         /* Fallback: calibrate manually using PIT or assume 2.4 GHz */
         tsc_frequency = 2400000000ULL;
     }
+    
+    tsc_to_ns_mult = (1000000000ULL << TSC_NS_SHIFT) / tsc_frequency;
+    ns_to_tsc_mult = (tsc_frequency << NS_TSC_SHIFT) / 1000000000ULL;
 }
 
 uint64_t hal_get_tsc_frequency(void) {
@@ -437,19 +1196,945 @@ uint64_t hal_get_tsc_frequency(void) {
 }
 
 uint64_t hal_get_nanoseconds(void) {
-    uint64_t tsc = rdtsc();
-    return (tsc * 1000000000ULL) / tsc_frequency;
+    return hal_tsc_to_ns(rdtsc());
+}
+
+/* ============================================
+ * Local APIC Timer (one-shot / TSC-deadline)
+ * ============================================ */
+
+#define IA32_TSC_DEADLINE_MSR   0x6E0
+
+#define LVT_MASKED              (1 << 16)
+#define LVT_TIMER_ONESHOT       (0 << 17)
+#define LVT_TIMER_TSC_DEADLINE  (2 << 17)
+
+#define LOCAL_TIMER_VECTOR      0xEF
+#define APIC_DIVIDE_BY_16       0x3
+#define APIC_CALIBRATE_NS       10000000ULL  /* 10 ms */
+#define APIC_NS_SHIFT           24
+
+typedef void (*timer_handler_t)(uint32_t cpu, uint64_t now_ns);
+
+typedef struct local_timer {
+    bool tsc_deadline;          /* Else one-shot with initial count */
+    uint8_t vector;
+    uint64_t apic_hz;           /* One-shot mode: ticks/s after divide */
+    uint64_t ns_to_apic_mult;
+    uint64_t deadline_tsc;      /* 0 = disarmed */
+
+    /* Lateness statistics, reset by hal_timer_measure_jitter() */
+    uint64_t fired;
+    uint64_t late_min_tsc;
+    uint64_t late_max_tsc;
+    uint64_t late_sum_tsc;
+} __attribute__((aligned(64))) local_timer_t;
+
+static local_timer_t g_local_timer[HAL_MAX_CPUS];
+static timer_handler_t g_timer_handler;
+
+/* Measure the APIC timer rate against the (already calibrated) TSC */
+static uint64_t apic_timer_calibrate(uint8_t vector) {
+    apic_write(APIC_TIMER_DIVIDE, APIC_DIVIDE_BY_16);
+    apic_write(APIC_TIMER_LVT, LVT_MASKED | LVT_TIMER_ONESHOT | vector);
+
+    uint64_t span = hal_ns_to_tsc(APIC_CALIBRATE_NS);
+    uint64_t start = rdtsc();
+    apic_write(APIC_TIMER_INITIAL, 0xFFFFFFFF);
+    while (rdtsc() - start < span) {
+        __asm__ volatile("pause");
+    }
+    uint32_t remaining = apic_read(APIC_TIMER_CURRENT);
+    uint64_t elapsed_tsc = rdtsc() - start;
+    apic_write(APIC_TIMER_INITIAL, 0);
+
+    uint64_t ticks = 0xFFFFFFFFULL - remaining;
+    return (ticks * tsc_frequency) / elapsed_tsc;
+}
+
+void hal_timer_set_handler(timer_handler_t handler) {
+    g_timer_handler = handler;
+}
+
+/* Per-CPU: pick TSC-deadline mode when CPUID advertises it (and the
+ * TSC is invariant, so deadlines survive C-states), otherwise
+ * calibrate the APIC one-shot counter. Leaves the timer disarmed. */
+void hal_timer_init_local(const cpu_features_t *features, uint8_t vector) {
+    local_timer_t *t = &g_local_timer[hal_cpu_index()];
+    t->vector = vector;
+    t->deadline_tsc = 0;
+
+    if (features->tsc_deadline && (features->invariant_tsc || features->hypervisor)) {
+        t->tsc_deadline = true;
+        apic_write(APIC_TIMER_LVT, LVT_TIMER_TSC_DEADLINE | vector);
+        /* LVT write must be ordered before the first deadline MSR write */
+        __asm__ volatile("mfence" ::: "memory");
+        wrmsr(IA32_TSC_DEADLINE_MSR, 0);
+        return;
+    }
+
+    t->tsc_deadline = false;
+    t->apic_hz = apic_timer_calibrate(vector);
+    t->ns_to_apic_mult = (t->apic_hz << APIC_NS_SHIFT) / 1000000000ULL;
+    apic_write(APIC_TIMER_DIVIDE, APIC_DIVIDE_BY_16);
+    apic_write(APIC_TIMER_LVT, LVT_TIMER_ONESHOT | vector);
+}
+
+/* Fire once at absolute time 'deadline_ns' (hal_get_nanoseconds()
+ * timebase) on the calling CPU. Re-arming replaces the previous
+ * deadline; a deadline in the past fires immediately. */
+void hal_timer_arm_at(uint64_t deadline_ns) {
+    local_timer_t *t = &g_local_timer[hal_cpu_index()];
+    uint64_t deadline_tsc = hal_ns_to_tsc(deadline_ns);
+    t->deadline_tsc = deadline_tsc;
+
+    if (t->tsc_deadline) {
+        wrmsr(IA32_TSC_DEADLINE_MSR, deadline_tsc);
+        return;
+    }
+
+    uint64_t now = rdtsc();
+    uint64_t delta_ns = (deadline_tsc > now) ? hal_tsc_to_ns(deadline_tsc - now) : 0;
+    uint64_t ticks = mul_shift(delta_ns, t->ns_to_apic_mult, APIC_NS_SHIFT);
+    if (ticks == 0) ticks = 1;
+    if (ticks > 0xFFFFFFFF) ticks = 0xFFFFFFFF;  /* Re-armed by the handler */
+    apic_write(APIC_TIMER_INITIAL, (uint32_t)ticks);
+}
+
+void hal_timer_cancel(void) {
+    local_timer_t *t = &g_local_timer[hal_cpu_index()];
+    t->deadline_tsc = 0;
+
+    if (t->tsc_deadline) {
+        wrmsr(IA32_TSC_DEADLINE_MSR, 0);
+    } else {
+        apic_write(APIC_TIMER_INITIAL, 0);
+    }
+}
+
+/* Local timer interrupt handler */
+void hal_timer_interrupt(void) {
+    uint32_t cpu = hal_cpu_index();
+    local_timer_t *t = &g_local_timer[cpu];
+    uint64_t now = rdtsc();
+
+    hal_apic_send_eoi();
+    if (t->deadline_tsc == 0) return;  /* Cancelled while in flight */
+
+    /* One-shot counts are capped at 32 bits; keep going if early */
+    if (now < t->deadline_tsc) {
+        hal_timer_arm_at(hal_tsc_to_ns(t->deadline_tsc));
+        return;
+    }
+
+    uint64_t late = now - t->deadline_tsc;
+    t->deadline_tsc = 0;
+    if (t->fired == 0 || late < t->late_min_tsc) t->late_min_tsc = late;
+    if (late > t->late_max_tsc) t->late_max_tsc = late;
+    t->late_sum_tsc += late;
+    t->fired++;
+
+    if (g_timer_handler) g_timer_handler(cpu, hal_tsc_to_ns(now));
+}
+
+typedef struct timer_jitter_result {
+    bool tsc_deadline;
+    uint64_t samples;
+    uint64_t late_min_ns;
+    uint64_t late_max_ns;
+    uint64_t late_avg_ns;
+} timer_jitter_result_t;
+
+/* Arm 'samples' consecutive one-shots 'period_ns' apart on the calling
+ * CPU and report how late each interrupt arrived. Interrupts must be
+ * enabled. Meant to be run at boot under QEMU/KVM and on hardware. */
+void hal_timer_measure_jitter(uint32_t samples, uint64_t period_ns,
+                              timer_jitter_result_t *result) {
+    local_timer_t *t = &g_local_timer[hal_cpu_index()];
+    t->fired = 0;
+    t->late_min_tsc = 0;
+    t->late_max_tsc = 0;
+    t->late_sum_tsc = 0;
+
+    for (uint32_t i = 0; i < samples; i++) {
+        uint64_t before = t->fired;
+        hal_timer_arm_at(hal_get_nanoseconds() + period_ns);
+        while (__atomic_load_n(&t->fired, __ATOMIC_RELAXED) == before) {
+            __asm__ volatile("hlt");
+        }
+    }
+
+    result->tsc_deadline = t->tsc_deadline;
+    result->samples = t->fired;
+    result->late_min_ns = hal_tsc_to_ns(t->late_min_tsc);
+    result->late_max_ns = hal_tsc_to_ns(t->late_max_tsc);
+    result->late_avg_ns = t->fired ? hal_tsc_to_ns(t->late_sum_tsc / t->fired) : 0;
+}
+
+/* ============================================
+ * IPI Microbenchmark
+ * ============================================ */
+
+typedef struct ipi_bench_result {
+    uint32_t targets;                /* CPUs interrupted per round */
+    uint32_t rounds;
+    uint64_t unicast_ipis_per_sec;   /* One ICR write per target */
+    uint64_t multicast_ipis_per_sec; /* ipi_raise() over the whole mask */
+} ipi_bench_result_t;
+
+static uint64_t ipi_bench_received(const cpumask_t *targets) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+        if (cpumask_test(targets, i)) total += atomic_load(&g_ipi.cpu[i].received);
+    }
+    return total;
+}
+
+static uint64_t ipi_bench_rate(uint64_t ipis, uint64_t cycles) {
+    if (cycles == 0) return 0;
+    return (ipis * tsc_frequency) / cycles;
+}
+
+/* Round-trip IPI throughput from the calling CPU to every other online
+ * CPU. Each round waits until all targets have taken the interrupt, so
+ * the figures include delivery, not just ICR write cost. */
+void hal_ipi_benchmark(uint32_t rounds, ipi_bench_result_t *result) {
+    uint32_t self = hal_cpu_index();
+    cpumask_t targets;
+    cpumask_clear(&targets);
+    for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+        if (i != self) cpumask_set(&targets, i);
+    }
+
+    uint32_t weight = cpumask_weight(&targets);
+    result->targets = weight;
+    result->rounds = rounds;
+    result->unicast_ipis_per_sec = 0;
+    result->multicast_ipis_per_sec = 0;
+    if (weight == 0 || rounds == 0) return;
+
+    /* Unicast: N separate ICR writes per round */
+    uint64_t expect = ipi_bench_received(&targets);
+    uint64_t start = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < g_ipi.num_cpus; i++) {
+            if (!cpumask_test(&targets, i)) continue;
+            apic_write_icr(g_ipi.apic_id[i], ICR_DELIVERY_FIXED | IPI_VECTOR);
+        }
+        expect += weight;
+        while (ipi_bench_received(&targets) < expect) {
+            __asm__ volatile("pause" ::: "memory");
+        }
+    }
+    result->unicast_ipis_per_sec =
+        ipi_bench_rate((uint64_t)rounds * weight, rdtsc() - start);
+
+    /* Multicast: shorthand / logical cluster writes */
+    start = rdtsc();
+    for (uint32_t r = 0; r < rounds; r++) {
+        ipi_raise(&targets);
+        expect += weight;
+        while (ipi_bench_received(&targets) < expect) {
+            __asm__ volatile("pause" ::: "memory");
+        }
+    }
+    result->multicast_ipis_per_sec =
+        ipi_bench_rate((uint64_t)rounds * weight, rdtsc() - start);
+}
+
+/* ============================================
+ * Feature-Dispatched Memory Primitives
+ * ============================================
+ *
+ * The kernel is built with -mno-sse, so the compiler never touches
+ * vector registers and nothing saves them on kernel entry. The SIMD
+ * routines below are therefore written as single asm blocks that
+ * spill and reload exactly the registers they use; sizes too small
+ * to amortise that spill go to plain register moves, which need no
+ * FPU state at all.
+ *
+ * The spilled registers belong to whatever task this CPU was running,
+ * so nothing may switch tasks between spill and reload: each block
+ * runs with interrupts off (mem_simd_begin/end), which also keeps the
+ * caller from migrating. The host test build runs in user space,
+ * where the kernel already saves vector state, and skips that.
+ */
+
+#define MEM_SIMD_MIN        64           /* Below this, GPR moves */
+#define MEM_ERMS_MIN        2048         /* ERMS rep movsb considered from here */
+#define MEM_NT_MIN          (1024 * 1024) /* Non-temporal stores from here */
+#define PAGE_SIZE_4K        4096
+
+typedef void *(*memcpy_fn_t)(void *dst, const void *src, size_t n);
+typedef void *(*memset_fn_t)(void *dst, int c, size_t n);
+typedef int (*memcmp_fn_t)(const void *a, const void *b, size_t n);
+typedef void (*page_zero_fn_t)(void *page);
+
+/* -------- General-purpose register implementations -------- */
+
+/* Short copies: a pair of possibly-overlapping loads/stores per size
+ * band instead of a byte loop or a rep-string startup */
+static void *memcpy_small(void *dst, const void *src, size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if (n >= 16) {
+        uint64_t t0, t1;
+        while (n > 16) {
+            __builtin_memcpy(&t0, s, 8);
+            __builtin_memcpy(&t1, s + 8, 8);
+            __builtin_memcpy(d, &t0, 8);
+            __builtin_memcpy(d + 8, &t1, 8);
+            d += 16; s += 16; n -= 16;
+        }
+        __builtin_memcpy(&t0, s + n - 16, 8);
+        __builtin_memcpy(&t1, s + n - 8, 8);
+        __builtin_memcpy(d + n - 16, &t0, 8);
+        __builtin_memcpy(d + n - 8, &t1, 8);
+    } else if (n >= 8) {
+        uint64_t t0, t1;
+        __builtin_memcpy(&t0, s, 8);
+        __builtin_memcpy(&t1, s + n - 8, 8);
+        __builtin_memcpy(d, &t0, 8);
+        __builtin_memcpy(d + n - 8, &t1, 8);
+    } else if (n >= 4) {
+        uint32_t t0, t1;
+        __builtin_memcpy(&t0, s, 4);
+        __builtin_memcpy(&t1, s + n - 4, 4);
+        __builtin_memcpy(d, &t0, 4);
+        __builtin_memcpy(d + n - 4, &t1, 4);
+    } else if (n) {
+        uint8_t t0 = s[0], t1 = s[n / 2], t2 = s[n - 1];
+        d[0] = t0; d[n / 2] = t1; d[n - 1] = t2;
+    }
+    return dst;
+}
+
+static void *memset_small(void *dst, int c, size_t n) {
+    uint8_t *d = dst;
+    uint64_t v = (uint8_t)c * 0x0101010101010101ULL;
+
+    if (n >= 8) {
+        while (n > 8) {
+            __builtin_memcpy(d, &v, 8);
+            d += 8; n -= 8;
+        }
+        __builtin_memcpy(d + n - 8, &v, 8);
+    } else if (n >= 4) {
+        uint32_t v32 = (uint32_t)v;
+        __builtin_memcpy(d, &v32, 4);
+        __builtin_memcpy(d + n - 4, &v32, 4);
+    } else if (n) {
+        d[0] = (uint8_t)c; d[n / 2] = (uint8_t)c; d[n - 1] = (uint8_t)c;
+    }
+    return dst;
+}
+
+static int memcmp_scalar(const void *a, const void *b, size_t n) {
+    const uint8_t *pa = a, *pb = b;
+
+    /* Skip equal 8-byte words, then locate the differing byte */
+    while (n >= 8) {
+        uint64_t wa, wb;
+        __builtin_memcpy(&wa, pa, 8);
+        __builtin_memcpy(&wb, pb, 8);
+        if (wa != wb) break;
+        pa += 8; pb += 8; n -= 8;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (pa[i] != pb[i]) return pa[i] - pb[i];
+    }
+    return 0;
+}
+
+/* -------- String-instruction implementations -------- */
+
+static void *memcpy_movsb(void *dst, const void *src, size_t n) {
+    void *d = dst;
+    __asm__ volatile("rep movsb"
+        : "+D"(d), "+S"(src), "+c"(n) :: "memory");
+    return dst;
+}
+
+static void *memcpy_movsq(void *dst, const void *src, size_t n) {
+    if (n < MEM_SIMD_MIN) return memcpy_small(dst, src, n);
+
+    const uint8_t *s = src;
+    void *d = dst;
+    size_t words = n / 8;
+    __asm__ volatile("rep movsq"
+        : "+D"(d), "+S"(s), "+c"(words) :: "memory");
+
+    /* Tail: last 8 bytes, overlapping what rep movsq already wrote */
+    if (n % 8) memcpy_small((uint8_t *)dst + n - 8, (const uint8_t *)src + n - 8, 8);
+    return dst;
+}
+
+static void *memset_stosb(void *dst, int c, size_t n) {
+    void *d = dst;
+    __asm__ volatile("rep stosb"
+        : "+D"(d), "+c"(n) : "a"(c) : "memory");
+    return dst;
+}
+
+static void *memset_stosq(void *dst, int c, size_t n) {
+    if (n < MEM_SIMD_MIN) return memset_small(dst, c, n);
+
+    void *d = dst;
+    uint64_t pattern = (uint8_t)c * 0x0101010101010101ULL;
+    size_t words = n / 8;
+    __asm__ volatile("rep stosq"
+        : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+
+    if (n % 8) memset_small((uint8_t *)dst + n - 8, c, 8);
+    return dst;
+}
+
+static void page_zero_stosq(void *page) {
+    size_t words = PAGE_SIZE_4K / 8;
+    __asm__ volatile("rep stosq"
+        : "+D"(page), "+c"(words) : "a"(0ULL) : "memory");
+}
+
+static void page_zero_stosb(void *page) {
+    size_t n = PAGE_SIZE_4K;
+    __asm__ volatile("rep stosb"
+        : "+D"(page), "+c"(n) : "a"(0) : "memory");
+}
+
+/* -------- Vector register bracketing -------- */
+
+static inline uint64_t mem_simd_begin(void) {
+#ifdef HAL_HOST_TEST
+    return 0;
+#else
+    uint64_t flags;
+    __asm__ volatile("pushfq\n\tpopq %0\n\tcli" : "=r"(flags) :: "memory");
+    return flags;
+#endif
+}
+
+static inline void mem_simd_end(uint64_t flags) {
+#ifdef HAL_HOST_TEST
+    (void)flags;
+#else
+    if (flags & (1ULL << 9)) __asm__ volatile("sti" ::: "memory");  /* IF */
+#endif
+}
+
+/* -------- SSE2 implementations (xmm0-xmm3) -------- */
+
+/* n >= 64. The first 16 bytes are stored unaligned, the loop then runs
+ * on a 16-byte aligned destination, and the last 64 bytes are stored
+ * unaligned over whatever the loop left. */
+static void *memcpy_sse2(void *dst, const void *src, size_t n) {
+    if (n < MEM_SIMD_MIN) return memcpy_small(dst, src, n);
+
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    const uint8_t *tail_s = s + n - 64;
+    uint8_t *tail_d = d + n - 64;
+    uint8_t save[64] __attribute__((aligned(16)));
+
+    size_t skew = 16 - ((uintptr_t)d & 15);
+    d += skew; s += skew; n -= skew;
+    size_t blocks = n / 64;
+    uint64_t nt = n >= MEM_NT_MIN;
+
+    uint64_t flags = mem_simd_begin();
+    __asm__ volatile(
+        "movdqa %%xmm0, 0(%[save])\n\t"
+        "movdqa %%xmm1, 16(%[save])\n\t"
+        "movdqa %%xmm2, 32(%[save])\n\t"
+        "movdqa %%xmm3, 48(%[save])\n\t"
+        "movdqu (%[head_s]), %%xmm0\n\t"
+        "movdqu %%xmm0, (%[head_d])\n\t"
+        "test %[blocks], %[blocks]\n\t"
+        "jz 3f\n\t"
+        "test %[nt], %[nt]\n\t"
+        "jnz 2f\n"
+        "1:\n\t"
+        "movdqu 0(%[s]), %%xmm0\n\t"
+        "movdqu 16(%[s]), %%xmm1\n\t"
+        "movdqu 32(%[s]), %%xmm2\n\t"
+        "movdqu 48(%[s]), %%xmm3\n\t"
+        "movdqa %%xmm0, 0(%[d])\n\t"
+        "movdqa %%xmm1, 16(%[d])\n\t"
+        "movdqa %%xmm2, 32(%[d])\n\t"
+        "movdqa %%xmm3, 48(%[d])\n\t"
+        "add $64, %[s]\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[blocks]\n\t"
+        "jnz 1b\n\t"
+        "jmp 3f\n"
+        "2:\n\t"
+        "movdqu 0(%[s]), %%xmm0\n\t"
+        "movdqu 16(%[s]), %%xmm1\n\t"
+        "movdqu 32(%[s]), %%xmm2\n\t"
+        "movdqu 48(%[s]), %%xmm3\n\t"
+        "movntdq %%xmm0, 0(%[d])\n\t"
+        "movntdq %%xmm1, 16(%[d])\n\t"
+        "movntdq %%xmm2, 32(%[d])\n\t"
+        "movntdq %%xmm3, 48(%[d])\n\t"
+        "add $64, %[s]\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[blocks]\n\t"
+        "jnz 2b\n\t"
+        "sfence\n"
+        "3:\n\t"
+        "movdqu 0(%[tail_s]), %%xmm0\n\t"
+        "movdqu 16(%[tail_s]), %%xmm1\n\t"
+        "movdqu 32(%[tail_s]), %%xmm2\n\t"
+        "movdqu 48(%[tail_s]), %%xmm3\n\t"
+        "movdqu %%xmm0, 0(%[tail_d])\n\t"
+        "movdqu %%xmm1, 16(%[tail_d])\n\t"
+        "movdqu %%xmm2, 32(%[tail_d])\n\t"
+        "movdqu %%xmm3, 48(%[tail_d])\n\t"
+        "movdqa 0(%[save]), %%xmm0\n\t"
+        "movdqa 16(%[save]), %%xmm1\n\t"
+        "movdqa 32(%[save]), %%xmm2\n\t"
+        "movdqa 48(%[save]), %%xmm3"
+        : [d]"+r"(d), [s]"+r"(s), [blocks]"+r"(blocks)
+        : [save]"r"(save), [nt]"r"(nt),
+          [head_s]"r"(src), [head_d]"r"(dst),
+          [tail_s]"r"(tail_s), [tail_d]"r"(tail_d)
+        : "memory", "cc");
+    mem_simd_end(flags);
+
+    return dst;
+}
+
+static void *memset_sse2(void *dst, int c, size_t n) {
+    if (n < MEM_SIMD_MIN) return memset_small(dst, c, n);
+
+    uint8_t *d = dst;
+    uint8_t *tail_d = d + n - 64;
+    uint8_t save[16] __attribute__((aligned(16)));
+    uint64_t pattern = (uint8_t)c * 0x0101010101010101ULL;
+
+    size_t skew = 16 - ((uintptr_t)d & 15);
+    d += skew; n -= skew;
+    size_t blocks = n / 64;
+
+    uint64_t flags = mem_simd_begin();
+    __asm__ volatile(
+        "movdqa %%xmm0, (%[save])\n\t"
+        "movq %[pattern], %%xmm0\n\t"
+        "punpcklqdq %%xmm0, %%xmm0\n\t"
+        "movdqu %%xmm0, (%[head_d])\n\t"
+        "test %[blocks], %[blocks]\n\t"
+        "jz 2f\n"
+        "1:\n\t"
+        "movdqa %%xmm0, 0(%[d])\n\t"
+        "movdqa %%xmm0, 16(%[d])\n\t"
+        "movdqa %%xmm0, 32(%[d])\n\t"
+        "movdqa %%xmm0, 48(%[d])\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[blocks]\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "movdqu %%xmm0, 0(%[tail_d])\n\t"
+        "movdqu %%xmm0, 16(%[tail_d])\n\t"
+        "movdqu %%xmm0, 32(%[tail_d])\n\t"
+        "movdqu %%xmm0, 48(%[tail_d])\n\t"
+        "movdqa (%[save]), %%xmm0"
+        : [d]"+r"(d), [blocks]"+r"(blocks)
+        : [save]"r"(save), [pattern]"r"(pattern),
+          [head_d]"r"(dst), [tail_d]"r"(tail_d)
+        : "memory", "cc");
+    mem_simd_end(flags);
+
+    return dst;
+}
+
+static int memcmp_sse2(const void *a, const void *b, size_t n) {
+    if (n < MEM_SIMD_MIN) return memcmp_scalar(a, b, n);
+
+    const uint8_t *pa = a, *pb = b;
+    uint8_t save[32] __attribute__((aligned(16)));
+    size_t blocks = n / 16;
+    size_t left = blocks;
+
+    uint64_t flags = mem_simd_begin();
+    /* Leaves 'left' at the number of 16-byte blocks not proven equal */
+    __asm__ volatile(
+        "movdqa %%xmm0, 0(%[save])\n\t"
+        "movdqa %%xmm1, 16(%[save])\n"
+        "1:\n\t"
+        "movdqu (%[a]), %%xmm0\n\t"
+        "movdqu (%[b]), %%xmm1\n\t"
+        "pcmpeqb %%xmm1, %%xmm0\n\t"
+        "pmovmskb %%xmm0, %%eax\n\t"
+        "cmp $0xFFFF, %%eax\n\t"
+        "jne 2f\n\t"
+        "add $16, %[a]\n\t"
+        "add $16, %[b]\n\t"
+        "dec %[left]\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "movdqa 0(%[save]), %%xmm0\n\t"
+        "movdqa 16(%[save]), %%xmm1"
+        : [a]"+r"(pa), [b]"+r"(pb), [left]"+r"(left)
+        : [save]"r"(save)
+        : "rax", "memory", "cc");
+    mem_simd_end(flags);
+
+    return memcmp_scalar(pa, pb, n - (blocks - left) * 16);
+}
+
+/* -------- AVX2 implementations (ymm0-ymm1) -------- */
+
+static void *memcpy_avx2(void *dst, const void *src, size_t n) {
+    if (n < MEM_SIMD_MIN) return memcpy_small(dst, src, n);
+
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    const uint8_t *tail_s = s + n - 64;
+    uint8_t *tail_d = d + n - 64;
+    uint8_t save[64] __attribute__((aligned(32)));
+
+    size_t skew = 32 - ((uintptr_t)d & 31);
+    d += skew; s += skew; n -= skew;
+    size_t blocks = n / 64;
+    uint64_t nt = n >= MEM_NT_MIN;
+
+    uint64_t flags = mem_simd_begin();
+    __asm__ volatile(
+        "vmovdqa %%ymm0, 0(%[save])\n\t"
+        "vmovdqa %%ymm1, 32(%[save])\n\t"
+        "vmovdqu (%[head_s]), %%ymm0\n\t"
+        "vmovdqu %%ymm0, (%[head_d])\n\t"
+        "test %[blocks], %[blocks]\n\t"
+        "jz 3f\n\t"
+        "test %[nt], %[nt]\n\t"
+        "jnz 2f\n"
+        "1:\n\t"
+        "vmovdqu 0(%[s]), %%ymm0\n\t"
+        "vmovdqu 32(%[s]), %%ymm1\n\t"
+        "vmovdqa %%ymm0, 0(%[d])\n\t"
+        "vmovdqa %%ymm1, 32(%[d])\n\t"
+        "add $64, %[s]\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[blocks]\n\t"
+        "jnz 1b\n\t"
+        "jmp 3f\n"
+        "2:\n\t"
+        "vmovdqu 0(%[s]), %%ymm0\n\t"
+        "vmovdqu 32(%[s]), %%ymm1\n\t"
+        "vmovntdq %%ymm0, 0(%[d])\n\t"
+        "vmovntdq %%ymm1, 32(%[d])\n\t"
+        "add $64, %[s]\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[blocks]\n\t"
+        "jnz 2b\n\t"
+        "sfence\n"
+        "3:\n\t"
+        "vmovdqu 0(%[tail_s]), %%ymm0\n\t"
+        "vmovdqu 32(%[tail_s]), %%ymm1\n\t"
+        "vmovdqu %%ymm0, 0(%[tail_d])\n\t"
+        "vmovdqu %%ymm1, 32(%[tail_d])\n\t"
+        "vmovdqa 0(%[save]), %%ymm0\n\t"
+        "vmovdqa 32(%[save]), %%ymm1"
+        : [d]"+r"(d), [s]"+r"(s), [blocks]"+r"(blocks)
+        : [save]"r"(save), [nt]"r"(nt),
+          [head_s]"r"(src), [head_d]"r"(dst),
+          [tail_s]"r"(tail_s), [tail_d]"r"(tail_d)
+        : "memory", "cc");
+    mem_simd_end(flags);
+
+    return dst;
+}
+
+static void *memset_avx2(void *dst, int c, size_t n) {
+    if (n < MEM_SIMD_MIN) return memset_small(dst, c, n);
+
+    uint8_t *d = dst;
+    uint8_t *tail_d = d + n - 64;
+    uint8_t save[32] __attribute__((aligned(32)));
+
+    size_t skew = 32 - ((uintptr_t)d & 31);
+    d += skew; n -= skew;
+    size_t blocks = n / 64;
+
+    uint64_t flags = mem_simd_begin();
+    __asm__ volatile(
+        "vmovdqa %%ymm0, (%[save])\n\t"
+        "vmovd %k[c], %%xmm0\n\t"
+        "vpbroadcastb %%xmm0, %%ymm0\n\t"
+        "vmovdqu %%ymm0, (%[head_d])\n\t"
+        "test %[blocks], %[blocks]\n\t"
+        "jz 2f\n"
+        "1:\n\t"
+        "vmovdqa %%ymm0, 0(%[d])\n\t"
+        "vmovdqa %%ymm0, 32(%[d])\n\t"
+        "add $64, %[d]\n\t"
+        "dec %[blocks]\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "vmovdqu %%ymm0, 0(%[tail_d])\n\t"
+        "vmovdqu %%ymm0, 32(%[tail_d])\n\t"
+        "vmovdqa (%[save]), %%ymm0"
+        : [d]"+r"(d), [blocks]"+r"(blocks)
+        : [save]"r"(save), [c]"r"(c),
+          [head_d]"r"(dst), [tail_d]"r"(tail_d)
+        : "memory", "cc");
+    mem_simd_end(flags);
+
+    return dst;
+}
+
+static int memcmp_avx2(const void *a, const void *b, size_t n) {
+    if (n < MEM_SIMD_MIN) return memcmp_scalar(a, b, n);
+
+    const uint8_t *pa = a, *pb = b;
+    uint8_t save[64] __attribute__((aligned(32)));
+    size_t blocks = n / 32;
+    size_t left = blocks;
+
+    uint64_t flags = mem_simd_begin();
+    __asm__ volatile(
+        "vmovdqa %%ymm0, 0(%[save])\n\t"
+        "vmovdqa %%ymm1, 32(%[save])\n"
+        "1:\n\t"
+        "vmovdqu (%[a]), %%ymm0\n\t"
+        "vpcmpeqb (%[b]), %%ymm0, %%ymm1\n\t"
+        "vpmovmskb %%ymm1, %%eax\n\t"
+        "cmp $-1, %%eax\n\t"
+        "jne 2f\n\t"
+        "add $32, %[a]\n\t"
+        "add $32, %[b]\n\t"
+        "dec %[left]\n\t"
+        "jnz 1b\n"
+        "2:\n\t"
+        "vmovdqa 0(%[save]), %%ymm0\n\t"
+        "vmovdqa 32(%[save]), %%ymm1"
+        : [a]"+r"(pa), [b]"+r"(pb), [left]"+r"(left)
+        : [save]"r"(save)
+        : "rax", "memory", "cc");
+    mem_simd_end(flags);
+
+    return memcmp_scalar(pa, pb, n - (blocks - left) * 32);
+}
+
+static void page_zero_avx2(void *page) {
+    uint8_t save[32] __attribute__((aligned(32)));
+    size_t blocks = PAGE_SIZE_4K / 128;
+    uint64_t flags = mem_simd_begin();
+    __asm__ volatile(
+        "vmovdqa %%ymm0, (%[save])\n\t"
+        "vpxor %%ymm0, %%ymm0, %%ymm0\n"
+        "1:\n\t"
+        "vmovdqa %%ymm0, 0(%[p])\n\t"
+        "vmovdqa %%ymm0, 32(%[p])\n\t"
+        "vmovdqa %%ymm0, 64(%[p])\n\t"
+        "vmovdqa %%ymm0, 96(%[p])\n\t"
+        "add $128, %[p]\n\t"
+        "dec %[blocks]\n\t"
+        "jnz 1b\n\t"
+        "vmovdqa (%[save]), %%ymm0"
+        : [p]"+r"(page), [blocks]"+r"(blocks)
+        : [save]"r"(save)
+        : "memory", "cc");
+    mem_simd_end(flags);
+}
+
+/* -------- Boot-time selection -------- */
+
+typedef struct mem_ops {
+    const char *name;
+    memcpy_fn_t copy;           /* n >= MEM_SIMD_MIN, below ERMS/NT range */
+    memcpy_fn_t copy_small;
+    memcpy_fn_t copy_large;     /* MEM_ERMS_MIN <= n < MEM_NT_MIN */
+    memset_fn_t set;
+    memset_fn_t set_small;
+    memset_fn_t set_large;      /* MEM_ERMS_MIN <= n */
+    memcmp_fn_t cmp;
+    page_zero_fn_t page_zero;
+} mem_ops_t;
+
+static mem_ops_t g_mem_ops = {
+    "movsq", memcpy_movsq, memcpy_small, memcpy_movsq,
+    memset_stosq, memset_small, memset_stosq, memcmp_scalar, page_zero_stosq
+};
+
+/* Set CR0/CR4 (and XCR0) so SSE and, when present, AVX instructions do
+ * not fault. Ring 0 only; the host test build skips it. */
+void hal_fpu_enable(const cpu_features_t *features) {
+    uint64_t cr0, cr4;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~(1ULL << 2);                    /* EM */
+    cr0 |= (1ULL << 1);                     /* MP */
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0));
+
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= (1ULL << 9) | (1ULL << 10);      /* OSFXSR, OSXMMEXCPT */
+    if (features->xsave) cr4 |= (1ULL << 18); /* OSXSAVE */
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
+
+    if (features->xsave) {
+        uint64_t xcr0 = 0x3;                /* x87 + SSE */
+        if (features->avx) xcr0 |= 0x4;     /* AVX (upper ymm) */
+        __asm__ volatile("xsetbv" :: "c"(0), "a"((uint32_t)xcr0),
+                         "d"((uint32_t)(xcr0 >> 32)));
+    }
+}
+
+/* AVX state must be enabled by the OS, not merely present in CPUID */
+static bool avx_state_enabled(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & (1 << 27))) return false;   /* OSXSAVE */
+
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (lo & 0x6) == 0x6;
+}
+
+void hal_mem_init(const cpu_features_t *features) {
+    mem_ops_t ops = g_mem_ops;
+
+    if (features->fsrm) ops.copy_small = memcpy_movsb;
+    if (features->erms) {
+        ops.name = "erms";
+        ops.copy = memcpy_movsb;
+        ops.copy_large = memcpy_movsb;
+        ops.set = memset_stosb;
+        ops.set_large = memset_stosb;
+        ops.page_zero = page_zero_stosb;
+    }
+    if (features->sse2) {
+        ops.name = features->erms ? "sse2+erms" : "sse2";
+        ops.copy = memcpy_sse2;
+        if (!features->erms) ops.copy_large = memcpy_sse2;
+        ops.set = memset_sse2;
+        if (!features->erms) ops.set_large = memset_sse2;
+        ops.cmp = memcmp_sse2;
+    }
+    if (features->avx2 && avx_state_enabled()) {
+        ops.name = features->erms ? "avx2+erms" : "avx2";
+        ops.copy = memcpy_avx2;
+        if (!features->erms) ops.copy_large = memcpy_avx2;
+        ops.set = memset_avx2;
+        if (!features->erms) ops.set_large = memset_avx2;
+        ops.cmp = memcmp_avx2;
+        ops.page_zero = page_zero_avx2;
+    }
+
+    g_mem_ops = ops;
+}
+
+const char *hal_mem_impl_name(void) {
+    return g_mem_ops.name;
+}
+
+void *hal_memcpy(void *dst, const void *src, size_t n) {
+    if (n < MEM_SIMD_MIN) return g_mem_ops.copy_small(dst, src, n);
+    if (n >= MEM_NT_MIN) return g_mem_ops.copy(dst, src, n);
+    if (n >= MEM_ERMS_MIN) return g_mem_ops.copy_large(dst, src, n);
+    return g_mem_ops.copy(dst, src, n);
+}
+
+void *hal_memset(void *dst, int c, size_t n) {
+    if (n < MEM_SIMD_MIN) return g_mem_ops.set_small(dst, c, n);
+    if (n >= MEM_ERMS_MIN) return g_mem_ops.set_large(dst, c, n);
+    return g_mem_ops.set(dst, c, n);
+}
+
+int hal_memcmp(const void *a, const void *b, size_t n) {
+    return g_mem_ops.cmp(a, b, n);
+}
+
+void hal_page_zero(void *page) {
+    g_mem_ops.page_zero(page);
+}
+
+/* ============================================
+ * Memory Primitive Benchmark
+ * ============================================ */
+
+typedef struct mem_bench_impl {
+    const char *name;
+    memcpy_fn_t copy;
+    memset_fn_t set;
+    memcmp_fn_t cmp;
+    bool usable;
+} mem_bench_impl_t;
+
+typedef void (*mem_bench_report_t)(const char *op, const char *impl,
+                                   size_t size, uint64_t mb_per_sec);
+
+static uint64_t mem_bench_rate(size_t bytes, uint64_t cycles) {
+    if (cycles == 0) return 0;
+    return (((uint64_t)bytes >> 10) * tsc_frequency / cycles) >> 10;
+}
+
+/* Throughput of every usable implementation for sizes 16 B..4 MB, in
+ * powers of four, plus the dispatched hal_* entry points. 'a' and 'b'
+ * must each hold at least 4 MB. Each measurement moves ~64 MB. */
+void hal_mem_benchmark(const cpu_features_t *features, void *a, void *b,
+                       mem_bench_report_t report) {
+    bool avx2 = features->avx2 && avx_state_enabled();
+    mem_bench_impl_t impls[] = {
+        { "movsq",    memcpy_movsq, memset_stosq, memcmp_scalar, true },
+        { "movsb",    memcpy_movsb, memset_stosb, memcmp_scalar, features->erms },
+        { "sse2",     memcpy_sse2,  memset_sse2,  memcmp_sse2,   features->sse2 },
+        { "avx2",     memcpy_avx2,  memset_avx2,  memcmp_avx2,   avx2 },
+        { "dispatch", hal_memcpy,   hal_memset,   hal_memcmp,    true },
+    };
+    const size_t total = 64ULL << 20;
+
+    for (size_t size = 16; size <= (4ULL << 20); size *= 4) {
+        size_t iters = total / size;
+
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            mem_bench_impl_t *impl = &impls[i];
+            if (!impl->usable) continue;
+
+            uint64_t start = rdtsc();
+            for (size_t it = 0; it < iters; it++) impl->copy(b, a, size);
+            report("memcpy", impl->name, size, mem_bench_rate(total, rdtsc() - start));
+
+            start = rdtsc();
+            for (size_t it = 0; it < iters; it++) impl->set(b, (int)it, size);
+            report("memset", impl->name, size, mem_bench_rate(total, rdtsc() - start));
+
+            impl->copy(b, a, size);
+            int sink = 0;
+            start = rdtsc();
+            for (size_t it = 0; it < iters; it++) sink |= impl->cmp(a, b, size);
+            report(sink ? "memcmp!" : "memcmp", impl->name, size,
+                   mem_bench_rate(total, rdtsc() - start));
+        }
+    }
+
+    page_zero_fn_t zero[] = { page_zero_stosq, page_zero_stosb, page_zero_avx2 };
+    const char *zero_name[] = { "stosq", "stosb", "avx2" };
+    bool zero_ok[] = { true, features->erms, avx2 };
+    for (size_t i = 0; i < 3; i++) {
+        if (!zero_ok[i]) continue;
+        uint64_t start = rdtsc();
+        for (size_t off = 0; off < total; off += PAGE_SIZE_4K) {
+            zero[i]((uint8_t *)a + (off & ((4ULL << 20) - 1)));
+        }
+        report("page_zero", zero_name[i], PAGE_SIZE_4K,
+               mem_bench_rate(total, rdtsc() - start));
+    }
 }
 
 /* ============================================
  * SMP Initialization
  * ============================================ */
 
+/* The trampoline is entered by SIPI in real mode, switches to long
+ * mode and jumps through ap_startup_entry. */
 extern void ap_startup_code(void);  /* Assembly trampoline */
+void (*volatile ap_startup_entry)(void);
 
 void hal_start_ap(uint32_t apic_id, void (*entry_point)(void)) {
+    __atomic_store_n(&ap_startup_entry, entry_point, __ATOMIC_RELEASE);
+
     /* Send INIT IPI */
-    hal_apic_send_ipi(apic_id, 0x4500);  /* INIT, level assert */
+    hal_apic_send_ipi(apic_id, ICR_SHORTHAND_NONE | ICR_LEVEL_ASSERT | ICR_DELIVERY_INIT);
     
     /* Wait 10ms */
     uint64_t start = hal_get_nanoseconds();
@@ -457,22 +2142,46 @@ void hal_start_ap(uint32_t apic_id, void (*entry_point)(void)) {
     
     /* Send STARTUP IPI */
     uint32_t vector = ((uintptr_t)ap_startup_code >> 12) & 0xFF;
-    hal_apic_send_ipi(apic_id, 0x4600 | vector);  /* STARTUP */
+    hal_apic_send_ipi(apic_id, ICR_SHORTHAND_NONE | ICR_LEVEL_ASSERT | ICR_DELIVERY_STARTUP | vector);
     
     /* Wait 200us */
     start = hal_get_nanoseconds();
     while (hal_get_nanoseconds() - start < 200000);
     
     /* Send second STARTUP IPI (per Intel spec) */
-    hal_apic_send_ipi(apic_id, 0x4600 | vector);
+    hal_apic_send_ipi(apic_id, ICR_SHORTHAND_NONE | ICR_LEVEL_ASSERT | ICR_DELIVERY_STARTUP | vector);
+}
+
+typedef struct hal_info {
+    cpu_features_t features;
+    cpu_topology_t topology;
+    const numa_topology_t *numa;
+    uint64_t tsc_frequency;
+    bool x2apic_enabled;
+} hal_info_t;
+
+static hal_info_t g_hal_info = {0};
+static void (*g_ap_entry)(void);
+
+/* Where the trampoline lands on every AP: the per-CPU half of
+ * hal_initialize() (SSE/AVX state for the hal_mem_init() choice,
+ * local APIC in the BSP's mode, logical ID, one-shot timer), then the
+ * caller's entry point */
+static void hal_ap_start(void) {
+    hal_fpu_enable(&g_hal_info.features);
+    hal_apic_init(&g_hal_info.features);
+    hal_ipi_init_local();
+    hal_timer_init_local(&g_hal_info.features, LOCAL_TIMER_VECTOR);
+    g_ap_entry();
 }
 
 void hal_smp_init(cpu_topology_t *topo, void (*ap_entry)(void)) {
     uint32_t bsp_apic_id = hal_apic_get_id();
+    g_ap_entry = ap_entry;
     
     for (uint32_t i = 0; i < topo->num_threads; i++) {
         if (topo->cpus[i].apic_id != bsp_apic_id) {
-            hal_start_ap(topo->cpus[i].apic_id, ap_entry);
+            hal_start_ap(topo->cpus[i].apic_id, hal_ap_start);
         }
     }
 }
@@ -481,18 +2190,11 @@ void hal_smp_init(cpu_topology_t *topo, void (*ap_entry)(void)) {
  * HAL Initialization
  * ============================================ */
 
-typedef struct hal_info {
-    cpu_features_t features;
-    cpu_topology_t topology;
-    uint64_t tsc_frequency;
-    bool x2apic_enabled;
-} hal_info_t;
-
-static hal_info_t g_hal_info = {0};
-
 hal_info_t *hal_initialize(void) {
     /* 1. Detect CPU features */
     hal_detect_cpu_features(&g_hal_info.features);
+    hal_fpu_enable(&g_hal_info.features);
+    hal_mem_init(&g_hal_info.features);
     
     /* 2. Initialize APIC */
     hal_apic_init(&g_hal_info.features);
@@ -502,16 +2204,290 @@ hal_info_t *hal_initialize(void) {
     hal_detect_cpu_topology(&g_hal_info.topology);
     
     /* 4. Parse ACPI tables for detailed topology and NUMA */
+    hal_acpi_init(0);
     hal_parse_madt(&g_hal_info.topology);
     hal_parse_srat(&g_hal_info.topology);
+    hal_parse_slit();
+    g_hal_info.numa = hal_numa_get();
     
     /* 5. Calibrate TSC */
     hal_calibrate_tsc();
     g_hal_info.tsc_frequency = tsc_frequency;
     
+    /* 6. IPI addressing for the discovered CPUs */
+    hal_ipi_init(&g_hal_info.topology);
+    hal_ipi_init_local();
+    
+    /* 7. Per-CPU one-shot timer (APs: hal_ap_start) */
+    hal_timer_init_local(&g_hal_info.features, LOCAL_TIMER_VECTOR);
+    
     return &g_hal_info;
 }
 
 hal_info_t *hal_get_info(void) {
     return &g_hal_info;
-}
\ No newline at end of file
+}
+
+/* ============================================
+ * Host Test Mode
+ * ============================================
+ *
+ * Build on the host to exercise the ACPI parsers against raw table
+ * dumps (acpixtract *.dat, or /sys/firmware/acpi/tables/<SIG>):
+ *
+ *   gcc -x c -std=gnu11 -DHAL_HOST_TEST -o hal_host_test AbstractLayer.cpp
+ *   ./hal_host_test /sys/firmware/acpi/tables/APIC srat.dat ...
+ *
+ * and to benchmark the memory primitives in user space:
+ *
+ *   ./hal_host_test --mem-bench
+ *
+ * --numa-test parses the multi-node tables under acpi_tables/ and
+ * checks the node map and distance matrix each must produce:
+ *
+ *   ./hal_host_test --numa-test acpi_tables
+ */
+
+#ifdef HAL_HOST_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Never executed on the host; satisfies hal_start_ap()'s reference */
+void ap_startup_code(void) {}
+
+static acpi_header_t *host_load_table(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+
+    acpi_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.length < sizeof(hdr)) {
+        fprintf(stderr, "%s: truncated ACPI header\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    acpi_header_t *table = malloc(hdr.length);
+    if (!table) {
+        fclose(f);
+        return NULL;
+    }
+
+    rewind(f);
+    if (fread(table, 1, hdr.length, f) != hdr.length) {
+        fprintf(stderr, "%s: short read (%u bytes expected)\n", path, hdr.length);
+        free(table);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    return table;
+}
+
+/* CPUID leaf 0x15/0x16 is often absent under hypervisors; measure
+ * the TSC against CLOCK_MONOTONIC instead */
+static void host_calibrate_tsc(void) {
+    struct timespec ts0, ts1;
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    uint64_t start = rdtsc();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &ts1);
+    } while ((ts1.tv_sec - ts0.tv_sec) * 1000000000LL +
+             (ts1.tv_nsec - ts0.tv_nsec) < 100000000LL);
+    uint64_t cycles = rdtsc() - start;
+    uint64_t ns = (ts1.tv_sec - ts0.tv_sec) * 1000000000ULL +
+                  (ts1.tv_nsec - ts0.tv_nsec);
+
+    tsc_frequency = cycles * 1000000000ULL / ns;
+    tsc_to_ns_mult = (1000000000ULL << TSC_NS_SHIFT) / tsc_frequency;
+    ns_to_tsc_mult = (tsc_frequency << NS_TSC_SHIFT) / 1000000000ULL;
+}
+
+static void host_mem_report(const char *op, const char *impl,
+                            size_t size, uint64_t mb_per_sec) {
+    printf("%-10s %-9s %8zu B  %8llu MB/s\n", op, impl, size,
+           (unsigned long long)mb_per_sec);
+}
+
+static int host_mem_bench(void) {
+    static cpu_features_t features;
+    hal_detect_cpu_features(&features);
+    host_calibrate_tsc();
+    hal_mem_init(&features);
+
+    printf("CPU: %s  erms=%d fsrm=%d sse2=%d avx2=%d  TSC %llu MHz  dispatch=%s\n\n",
+           features.vendor, features.erms, features.fsrm, features.sse2,
+           features.avx2, (unsigned long long)(tsc_frequency / 1000000),
+           hal_mem_impl_name());
+
+    size_t size = 4ULL << 20;
+    uint8_t *a = aligned_alloc(4096, size);
+    uint8_t *b = aligned_alloc(4096, size);
+    if (!a || !b) return 1;
+    memset(a, 0x5A, size);
+    memset(b, 0, size);
+
+    hal_mem_benchmark(&features, a, b, host_mem_report);
+    free(a);
+    free(b);
+    return 0;
+}
+
+/* One fixture set: the tables to load and what hal_parse_madt/srat/slit
+ * must make of them. CPUs are in MADT order. */
+typedef struct host_numa_case {
+    const char *tables[3];
+    uint32_t num_cpus;
+    uint32_t cpu_node[8];
+    uint32_t num_nodes;
+    uint32_t domain[4];
+    uint8_t distance[4][4];
+    uint8_t fallback0[4];           /* Node 0's allocation order */
+} host_numa_case_t;
+
+static const host_numa_case_t host_numa_cases[] = {
+    /* Two sockets, xAPIC; MADT interleaves the sockets */
+    { { "two_socket/apic.dat", "two_socket/srat.dat", "two_socket/slit.dat" },
+      8, { 0, 1, 0, 1, 0, 1, 0, 1 },
+      2, { 0, 1 }, { { 10, 21 }, { 21, 10 } }, { 0, 1 } },
+    /* Four nodes, two per socket, x2APIC; SRAT introduces the domains
+     * out of order, so nodes and SLIT rows differ */
+    { { "four_node/apic.dat", "four_node/srat.dat", "four_node/slit.dat" },
+      8, { 1, 1, 3, 3, 0, 0, 2, 2 },
+      4, { 2, 0, 3, 1 },
+      { { 10, 32, 12, 32 }, { 32, 10, 32, 11 }, { 12, 32, 10, 32 }, { 32, 11, 32, 10 } },
+      { 0, 2, 1, 3 } },
+    /* 2^32 localities: rejected, defaults kept */
+    { { "two_socket/apic.dat", "two_socket/srat.dat", "bad_slit/slit.dat" },
+      8, { 0, 1, 0, 1, 0, 1, 0, 1 },
+      2, { 0, 1 }, { { 10, 20 }, { 20, 10 } }, { 0, 1 } },
+};
+
+static int host_numa_check(const char *what, uint32_t got, uint32_t expect) {
+    if (got == expect) return 0;
+    fprintf(stderr, "  %s: got %u, expected %u\n", what, got, expect);
+    return 1;
+}
+
+static int host_numa_test(const char *dir) {
+    int failures = 0;
+
+    for (size_t c = 0; c < sizeof(host_numa_cases) / sizeof(host_numa_cases[0]); c++) {
+        const host_numa_case_t *t = &host_numa_cases[c];
+        acpi_header_t *tables[3] = { NULL };
+        static cpu_topology_t topo;
+        int bad = 0;
+
+        memset(acpi_index, 0, sizeof(acpi_index));
+        acpi_table_count = 0;
+        memset(&g_numa, 0, sizeof(g_numa));
+        memset(&topo, 0, sizeof(topo));
+
+        for (int i = 0; i < 3; i++) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dir, t->tables[i]);
+            tables[i] = host_load_table(path);
+            if (!tables[i] || !hal_acpi_register_table(tables[i])) bad++;
+        }
+        if (!bad) {
+            hal_parse_madt(&topo);
+            hal_parse_srat(&topo);
+            hal_parse_slit();
+
+            const numa_topology_t *numa = hal_numa_get();
+            char what[64];
+            bad += host_numa_check("cpus", topo.num_threads, t->num_cpus);
+            for (uint32_t i = 0; i < t->num_cpus && i < topo.num_threads; i++) {
+                snprintf(what, sizeof(what), "cpu %u node", i);
+                bad += host_numa_check(what, topo.cpus[i].numa_node, t->cpu_node[i]);
+            }
+            bad += host_numa_check("nodes", numa->num_nodes, t->num_nodes);
+            for (uint32_t a = 0; a < t->num_nodes && a < numa->num_nodes; a++) {
+                snprintf(what, sizeof(what), "node %u domain", a);
+                bad += host_numa_check(what, numa->domain[a], t->domain[a]);
+                snprintf(what, sizeof(what), "fallback[0][%u]", a);
+                bad += host_numa_check(what, numa->fallback[0][a], t->fallback0[a]);
+                for (uint32_t b = 0; b < t->num_nodes && b < numa->num_nodes; b++) {
+                    snprintf(what, sizeof(what), "distance[%u][%u]", a, b);
+                    bad += host_numa_check(what, numa->distance[a][b], t->distance[a][b]);
+                }
+            }
+        }
+
+        printf("%-20s %-20s %s\n", t->tables[0], t->tables[2], bad ? "FAIL" : "ok");
+        failures += bad;
+        for (int i = 0; i < 3; i++) free(tables[i]);
+    }
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <table.dat>... | --mem-bench | --numa-test <dir>\n", argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[1], "--mem-bench") == 0) return host_mem_bench();
+    if (strcmp(argv[1], "--numa-test") == 0) {
+        return host_numa_test(argc > 2 ? argv[2] : "acpi_tables");
+    }
+
+    int failures = 0;
+    for (int i = 1; i < argc; i++) {
+        acpi_header_t *table = host_load_table(argv[i]);
+        if (!table) {
+            failures++;
+            continue;
+        }
+        if (!hal_acpi_register_table(table)) {
+            fprintf(stderr, "%s: bad checksum or index full\n", argv[i]);
+            free(table);
+            failures++;
+            continue;
+        }
+        printf("%.4s  len=%-6u rev=%u  oem=%.6s  %s\n", table->signature,
+               table->length, table->revision, table->oem_id, argv[i]);
+    }
+    printf("Indexed %u table(s)\n\n", acpi_table_count);
+
+    static cpu_topology_t topo;
+    hal_parse_madt(&topo);
+    hal_parse_srat(&topo);
+    hal_parse_slit();
+
+    printf("MADT: %u enabled CPU(s)\n", topo.num_threads);
+    for (uint32_t i = 0; i < topo.num_threads; i++) {
+        printf("  cpu %-3u apic_id=%-4u node=%u\n",
+               i, topo.cpus[i].apic_id, topo.cpus[i].numa_node);
+    }
+
+    const numa_topology_t *numa = hal_numa_get();
+    printf("\nNUMA: %u node(s)\n", numa->num_nodes);
+    for (uint32_t n = 0; n < numa->num_nodes; n++) {
+        printf("  node %-2u domain=%-3u cpus=%-3u memory=%llu MB  distances:",
+               n, numa->domain[n], cpumask_weight(&numa->node_cpus[n]),
+               (unsigned long long)(numa->node_memory[n] >> 20));
+        for (uint32_t m = 0; m < numa->num_nodes; m++) {
+            printf(" %3u", numa->distance[n][m]);
+        }
+        printf("\n");
+    }
+    for (uint32_t r = 0; r < numa->num_ranges; r++) {
+        const numa_mem_range_t *range = &numa->ranges[r];
+        uint64_t probe = range->base + range->length / 2;
+        printf("  range %016llx-%016llx node=%u%s  lookup(mid)=%u\n",
+               (unsigned long long)range->base,
+               (unsigned long long)(range->base + range->length - 1),
+               range->node, range->hotplug ? " hotplug" : "",
+               hal_numa_node_of_addr(probe));
+    }
+
+    return failures ? 1 : 0;
+}
+
+#endif /* HAL_HOST_TEST */
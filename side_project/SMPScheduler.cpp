@@ -116,6 +116,14 @@ typedef struct scheduler {
 
 static scheduler_t g_scheduler = {0};
 
+/* NUMA model from the HAL (SRAT/SLIT) */
+extern uint32_t hal_numa_distance(uint32_t a, uint32_t b);
+
+/* Per-CPU one-shot timer from the HAL */
+extern uint64_t hal_get_nanoseconds(void);
+extern void hal_timer_arm_at(uint64_t deadline_ns);
+extern void hal_timer_cancel(void);
+
 /* ============================================
  * Priority Calculation - OS/2 Compatible
  * ============================================ */
@@ -283,11 +291,14 @@ static thread_t *dequeue_highest_priority(cpu_runqueue_t *rq) {
  * Core Scheduler Functions
  * ============================================ */
 
-/* Initialize scheduler subsystem */
-void sched_init(uint32_t num_cpus, uint32_t *numa_topology) {
+/* Initialize scheduler subsystem.
+ * numa_topology is the per-CPU node array from hal_numa_cpu_nodes(),
+ * or NULL to treat the machine as a single node. */
+void sched_init(uint32_t num_cpus, const uint32_t *numa_topology) {
     if (atomic_load(&g_scheduler.initialized)) return;
     
     atomic_store(&g_scheduler.num_cpus, num_cpus);
+    g_scheduler.num_numa_nodes = 1;
     
     for (uint32_t i = 0; i < num_cpus; i++) {
         cpu_runqueue_t *rq = &g_scheduler.runqueues[i];
@@ -298,6 +309,13 @@ void sched_init(uint32_t num_cpus, uint32_t *numa_topology) {
         rq->numa_node = numa_topology ? numa_topology[i] : 0;
         rq->current = NULL;
         
+        if (rq->numa_node < MAX_CPUS / 8) {
+            g_scheduler.cpus_per_node[rq->numa_node]++;
+            if (rq->numa_node >= g_scheduler.num_numa_nodes) {
+                g_scheduler.num_numa_nodes = rq->numa_node + 1;
+            }
+        }
+        
         for (int j = 0; j <= MAX_PRIORITY; j++) {
             rq->queues[j] = NULL;
         }
@@ -395,9 +413,14 @@ thread_t *sched_schedule(uint32_t cpu_id) {
         next->last_scheduled = __rdtsc();  /* Read CPU timestamp counter */
         rq->current = next;
         rq->total_switches++;
+        
+        /* Program the exact end of this slice instead of waiting for
+         * a periodic tick */
+        hal_timer_arm_at(hal_get_nanoseconds() + next->time_slice_remaining);
     } else {
-        /* No ready threads - idle */
+        /* No ready threads - idle, no timer needed until woken */
         rq->current = NULL;
+        hal_timer_cancel();
     }
     
     return next;
@@ -438,11 +461,27 @@ static thread_t *steal_thread(cpu_runqueue_t *thief_rq) {
     uint32_t num_cpus = atomic_load(&g_scheduler.num_cpus);
     uint32_t thief_load = atomic_load(&thief_rq->num_threads);
     
-    /* Look for CPU with significantly more threads */
+    /* Visit victims nearest NUMA node first, so stolen threads stay
+     * close to the memory they were using when a near victim exists */
+    uint16_t order[MAX_CPUS];
+    uint32_t count = 0;
     for (uint32_t i = 0; i < num_cpus; i++) {
         if (i == thief_rq->cpu_id) continue;
         
-        cpu_runqueue_t *victim_rq = &g_scheduler.runqueues[i];
+        uint32_t d = hal_numa_distance(thief_rq->numa_node,
+                                       g_scheduler.runqueues[i].numa_node);
+        uint32_t k = count++;
+        while (k > 0 && hal_numa_distance(thief_rq->numa_node,
+                            g_scheduler.runqueues[order[k - 1]].numa_node) > d) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = (uint16_t)i;
+    }
+    
+    /* Look for CPU with significantly more threads */
+    for (uint32_t n = 0; n < count; n++) {
+        cpu_runqueue_t *victim_rq = &g_scheduler.runqueues[order[n]];
         uint32_t victim_load = atomic_load(&victim_rq->num_threads);
         
         /* Only steal if victim has at least 2 more threads */